@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Timing helpers for the benchmark programs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "mdm-bench.h"
+
+double
+mdm_bench_now (void)
+{
+	return g_get_monotonic_time () / 1000000.0;
+}
+
+static int
+compare_double (gconstpointer a, gconstpointer b)
+{
+	double da = *(const double *) a;
+	double db = *(const double *) b;
+
+	return (da > db) - (da < db);
+}
+
+gboolean
+mdm_bench_percentiles (GArray              *samples,
+		       MdmBenchPercentiles *percentiles)
+{
+	const double *s;
+	guint         n;
+
+	n = samples->len;
+	if (n == 0)
+		return FALSE;
+
+	g_array_sort (samples, compare_double);
+	s = (const double *) samples->data;
+
+	percentiles->min = s[0];
+	percentiles->median = s[n / 2];
+	percentiles->p99 = s[(n * 99) / 100];
+	percentiles->max = s[n - 1];
+
+	return TRUE;
+}
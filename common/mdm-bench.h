@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Timing helpers for the benchmark programs
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MDM_BENCH_H
+#define _MDM_BENCH_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Only linked into the test programs, never into mdm itself */
+
+typedef struct {
+	double min;
+	double median;
+	double p99;
+	double max;
+} MdmBenchPercentiles;
+
+/* Seconds on the monotonic clock */
+double   mdm_bench_now          (void);
+
+/* Sorts samples, an array of doubles, and picks the percentiles out
+ * of it.  FALSE if there are no samples. */
+gboolean mdm_bench_percentiles  (GArray              *samples,
+				 MdmBenchPercentiles *percentiles);
+
+G_END_DECLS
+
+#endif /* _MDM_BENCH_H */
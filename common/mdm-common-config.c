@@ -25,8 +25,11 @@
 #include <stdlib.h>
 #include <locale.h>
 #include <syslog.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include "mdm-common-config.h"
 
@@ -486,3 +489,164 @@ mdm_common_config_remove_key (GKeyFile   *config,
 	g_free (group);
 	g_free (default_value);
 }
+
+/*
+ * Keeps parsed key files around, each under a name of the caller's
+ * choosing, and parses a file again only when a stat shows that it
+ * was replaced or changed.  Files that do not exist are remembered as
+ * such too, so asking for them again costs a stat and nothing else.
+ */
+typedef struct {
+	char     *filename;
+	GKeyFile *config;	/* NULL if the file did not exist */
+	gboolean  exists;
+	dev_t     dev;
+	ino_t     ino;
+	off_t     size;
+	time_t    mtime;
+	glong     mtime_nsec;
+} MdmCommonConfigCacheEntry;
+
+struct _MdmCommonConfigCache {
+	GHashTable *entries;
+	guint       parse_count;
+};
+
+static void
+cache_entry_free (MdmCommonConfigCacheEntry *entry)
+{
+	g_free (entry->filename);
+	if (entry->config != NULL)
+		g_key_file_free (entry->config);
+	g_free (entry);
+}
+
+static glong
+stat_mtime_nsec (const struct stat *s)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+	return s->st_mtim.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+static gboolean
+cache_entry_is_current (MdmCommonConfigCacheEntry *entry,
+			const char                *filename,
+			gboolean                   exists,
+			const struct stat         *s)
+{
+	if (strcmp (entry->filename, filename) != 0 || entry->exists != exists)
+		return FALSE;
+
+	if (! exists)
+		return TRUE;
+
+	return entry->dev == s->st_dev &&
+	       entry->ino == s->st_ino &&
+	       entry->size == s->st_size &&
+	       entry->mtime == s->st_mtime &&
+	       entry->mtime_nsec == stat_mtime_nsec (s);
+}
+
+MdmCommonConfigCache *
+mdm_common_config_cache_new (void)
+{
+	MdmCommonConfigCache *cache;
+
+	cache = g_new0 (MdmCommonConfigCache, 1);
+	cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+						(GDestroyNotify) cache_entry_free);
+
+	return cache;
+}
+
+void
+mdm_common_config_cache_free (MdmCommonConfigCache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	g_hash_table_destroy (cache->entries);
+	g_free (cache);
+}
+
+/**
+ * mdm_common_config_cache_lookup
+ *
+ * Returns the parsed contents of filename, cached under name, or NULL
+ * if the file does not exist or cannot be parsed.  The key file is
+ * owned by the cache and stays valid until the next lookup or
+ * invalidation of the same name.
+ */
+GKeyFile *
+mdm_common_config_cache_lookup (MdmCommonConfigCache *cache,
+				const char           *name,
+				const char           *filename)
+{
+	MdmCommonConfigCacheEntry *entry;
+	struct stat                s;
+	gboolean                   exists;
+
+	exists = (g_stat (filename, &s) == 0);
+
+	entry = g_hash_table_lookup (cache->entries, name);
+	if (entry != NULL && cache_entry_is_current (entry, filename, exists, &s))
+		return entry->config;
+
+	entry = g_new0 (MdmCommonConfigCacheEntry, 1);
+	entry->filename = g_strdup (filename);
+	entry->exists = exists;
+	if (exists) {
+		entry->dev = s.st_dev;
+		entry->ino = s.st_ino;
+		entry->size = s.st_size;
+		entry->mtime = s.st_mtime;
+		entry->mtime_nsec = stat_mtime_nsec (&s);
+		entry->config = mdm_common_config_load (filename, NULL);
+		cache->parse_count++;
+	}
+	g_hash_table_replace (cache->entries, g_strdup (name), entry);
+
+	return entry->config;
+}
+
+/* Returns what is cached under name without checking the file, so
+ * that callers can compare it with what the file says now */
+GKeyFile *
+mdm_common_config_cache_peek (MdmCommonConfigCache *cache,
+			      const char           *name)
+{
+	MdmCommonConfigCacheEntry *entry;
+
+	entry = g_hash_table_lookup (cache->entries, name);
+
+	return entry != NULL ? entry->config : NULL;
+}
+
+/* Whether anything, even a missing file, is cached under name */
+gboolean
+mdm_common_config_cache_contains (MdmCommonConfigCache *cache,
+				  const char           *name)
+{
+	return g_hash_table_lookup (cache->entries, name) != NULL;
+}
+
+/* Forgets what is cached under name, or everything if name is NULL */
+void
+mdm_common_config_cache_invalidate (MdmCommonConfigCache *cache,
+				    const char           *name)
+{
+	if (name == NULL)
+		g_hash_table_remove_all (cache->entries);
+	else
+		g_hash_table_remove (cache->entries, name);
+}
+
+/* How many times a file was actually parsed, for the tests */
+guint
+mdm_common_config_cache_get_parse_count (MdmCommonConfigCache *cache)
+{
+	return cache->parse_count;
+}
@@ -70,6 +70,21 @@ void       mdm_common_config_remove_key       (GKeyFile   *config,
 					       const char *keystring,
 					       GError    **error);
 
+typedef struct _MdmCommonConfigCache MdmCommonConfigCache;
+
+MdmCommonConfigCache * mdm_common_config_cache_new     (void);
+void       mdm_common_config_cache_free       (MdmCommonConfigCache *cache);
+GKeyFile * mdm_common_config_cache_lookup     (MdmCommonConfigCache *cache,
+					       const char           *name,
+					       const char           *filename);
+GKeyFile * mdm_common_config_cache_peek       (MdmCommonConfigCache *cache,
+					       const char           *name);
+gboolean   mdm_common_config_cache_contains   (MdmCommonConfigCache *cache,
+					       const char           *name);
+void       mdm_common_config_cache_invalidate (MdmCommonConfigCache *cache,
+					       const char           *name);
+guint      mdm_common_config_cache_get_parse_count (MdmCommonConfigCache *cache);
+
 G_END_DECLS
 
 #endif /* _MDM_COMMON_CONFIG_H */
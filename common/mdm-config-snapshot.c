@@ -0,0 +1,285 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Binary configuration snapshot shared by the daemon and the greeters
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * The daemon publishes its resolved configuration as one immutable
+ * file which the greeters mmap, so that reading a key is a binary
+ * search instead of a socket round trip.  A new snapshot is written
+ * next to the old one and renamed over it.  Processes that still have
+ * the old one mapped notice through its superseded flag, which is the
+ * only thing that is ever written to a published file.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include "mdm-common.h"
+#include "mdm-log.h"
+#include "mdm-publish.h"
+#include "mdm-config-snapshot.h"
+
+struct _MdmConfigSnapshot {
+	const char                    *data;
+	gsize                          size;
+	const MdmConfigSnapshotHeader *header;
+	const MdmConfigSnapshotEntry  *entries;
+};
+
+static int
+compare_keys (gconstpointer a, gconstpointer b, gpointer data)
+{
+	GPtrArray *keys = data;
+
+	return strcmp (g_ptr_array_index (keys, *(const guint *) a),
+		       g_ptr_array_index (keys, *(const guint *) b));
+}
+
+static guint32
+append_string (GString *buf, const char *str)
+{
+	guint32 offset = buf->len;
+
+	g_string_append_len (buf, ve_sure_string (str), strlen (ve_sure_string (str)) + 1);
+	return offset;
+}
+
+gboolean
+mdm_config_snapshot_write (const char *path,
+			   guint64     generation,
+			   const char *custom_file,
+			   GPtrArray  *keys,
+			   GPtrArray  *values)
+{
+	MdmConfigSnapshotHeader *header;
+	MdmConfigSnapshotEntry  *entries;
+	GString *buf;
+	guint   *order;
+	guint32  custom_offset;
+	char    *tmp;
+	guint    i;
+
+	g_return_val_if_fail (keys->len == values->len, FALSE);
+
+	order = g_new (guint, keys->len);
+	for (i = 0; i < keys->len; i++)
+		order[i] = i;
+	g_qsort_with_data (order, keys->len, sizeof (guint), compare_keys, keys);
+
+	/* header and entry table first, filled in once the string
+	 * offsets are known */
+	buf = g_string_sized_new (sizeof (MdmConfigSnapshotHeader) +
+				  keys->len * sizeof (MdmConfigSnapshotEntry) +
+				  keys->len * 64);
+	g_string_set_size (buf, sizeof (MdmConfigSnapshotHeader) +
+			   keys->len * sizeof (MdmConfigSnapshotEntry));
+	memset (buf->str, 0, buf->len);
+
+	custom_offset = append_string (buf, custom_file);
+	for (i = 0; i < keys->len; i++) {
+		guint32 key, value;
+
+		key = append_string (buf, g_ptr_array_index (keys, order[i]));
+		value = append_string (buf, g_ptr_array_index (values, order[i]));
+
+		entries = (MdmConfigSnapshotEntry *) (buf->str + sizeof (MdmConfigSnapshotHeader));
+		entries[i].key = key;
+		entries[i].value = value;
+	}
+	g_free (order);
+
+	header = (MdmConfigSnapshotHeader *) buf->str;
+	memcpy (header->magic, MDM_CONFIG_SNAPSHOT_MAGIC, sizeof (header->magic));
+	header->version = MDM_CONFIG_SNAPSHOT_VERSION;
+	header->header_size = sizeof (MdmConfigSnapshotHeader);
+	header->size = buf->len;
+	header->superseded = 0;
+	header->generation = generation;
+	header->n_entries = keys->len;
+	header->custom_file = custom_offset;
+
+	tmp = g_strconcat (path, ".new", NULL);
+	if ( ! mdm_publish_file (path, tmp, buf->str, buf->len,
+				 MDM_CONFIG_SNAPSHOT_MAGIC, sizeof (((MdmConfigSnapshotHeader *) NULL)->magic),
+				 offsetof (MdmConfigSnapshotHeader, superseded),
+				 "configuration snapshot"))
+		goto fail;
+
+	g_free (tmp);
+	g_string_free (buf, TRUE);
+	return TRUE;
+
+ fail:
+	g_free (tmp);
+	g_string_free (buf, TRUE);
+	return FALSE;
+}
+
+static gboolean
+snapshot_is_valid (const char *data, gsize size)
+{
+	const MdmConfigSnapshotHeader *header;
+	const MdmConfigSnapshotEntry  *entries;
+	guint32 i;
+
+	if (size < sizeof (MdmConfigSnapshotHeader))
+		return FALSE;
+
+	header = (const MdmConfigSnapshotHeader *) data;
+	if (memcmp (header->magic, MDM_CONFIG_SNAPSHOT_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->version != MDM_CONFIG_SNAPSHOT_VERSION ||
+	    header->header_size != sizeof (MdmConfigSnapshotHeader) ||
+	    header->size != size)
+		return FALSE;
+
+	/* every string is terminated if the file is */
+	if (data[size - 1] != '\0')
+		return FALSE;
+
+	if (header->n_entries > (size - header->header_size) / sizeof (MdmConfigSnapshotEntry) ||
+	    header->custom_file >= size)
+		return FALSE;
+
+	entries = (const MdmConfigSnapshotEntry *) (data + header->header_size);
+	for (i = 0; i < header->n_entries; i++) {
+		if (entries[i].key >= size || entries[i].value >= size)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * mdm_config_snapshot_open
+ *
+ * Maps the snapshot at path.  Returns NULL if there is none or it is
+ * not one this code understands, the caller then has to ask the daemon.
+ */
+MdmConfigSnapshot *
+mdm_config_snapshot_open (const char *path)
+{
+	MdmConfigSnapshot *snapshot;
+	struct stat        s;
+	void              *data;
+	int                fd;
+
+	VE_IGNORE_EINTR (fd = open (path, O_RDONLY));
+	if (fd < 0)
+		return NULL;
+
+	if (fstat (fd, &s) < 0 || s.st_size < (off_t) sizeof (MdmConfigSnapshotHeader)) {
+		VE_IGNORE_EINTR (close (fd));
+		return NULL;
+	}
+
+	data = mmap (NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	VE_IGNORE_EINTR (close (fd));
+	if (data == MAP_FAILED)
+		return NULL;
+
+	if ( ! snapshot_is_valid (data, s.st_size)) {
+		munmap (data, s.st_size);
+		return NULL;
+	}
+
+	snapshot = g_new0 (MdmConfigSnapshot, 1);
+	snapshot->data = data;
+	snapshot->size = s.st_size;
+	snapshot->header = data;
+	snapshot->entries = (const MdmConfigSnapshotEntry *)
+		(snapshot->data + snapshot->header->header_size);
+
+	return snapshot;
+}
+
+void
+mdm_config_snapshot_close (MdmConfigSnapshot *snapshot)
+{
+	if (snapshot == NULL)
+		return;
+
+	munmap ((void *) snapshot->data, snapshot->size);
+	g_free (snapshot);
+}
+
+/**
+ * mdm_config_snapshot_is_current
+ *
+ * Returns FALSE once the daemon has published a newer snapshot, the
+ * values in this one must not be used any more then.
+ */
+gboolean
+mdm_config_snapshot_is_current (MdmConfigSnapshot *snapshot)
+{
+	return g_atomic_int_get ((volatile gint *) &snapshot->header->superseded) == 0;
+}
+
+guint64
+mdm_config_snapshot_get_generation (MdmConfigSnapshot *snapshot)
+{
+	return snapshot->header->generation;
+}
+
+const char *
+mdm_config_snapshot_get_custom_file (MdmConfigSnapshot *snapshot)
+{
+	return snapshot->data + snapshot->header->custom_file;
+}
+
+/**
+ * mdm_config_snapshot_lookup
+ *
+ * Returns the value for a "group/Key" key, without a default value
+ * appended, or NULL if the snapshot does not hold the key.  The
+ * string points into the mapping.
+ */
+const char *
+mdm_config_snapshot_lookup (MdmConfigSnapshot *snapshot,
+			    const char        *key)
+{
+	guint32 low, high;
+
+	low = 0;
+	high = snapshot->header->n_entries;
+	while (low < high) {
+		guint32 mid = low + (high - low) / 2;
+		int     cmp;
+
+		cmp = strcmp (key, snapshot->data + snapshot->entries[mid].key);
+		if (cmp == 0)
+			return snapshot->data + snapshot->entries[mid].value;
+		else if (cmp < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return NULL;
+}
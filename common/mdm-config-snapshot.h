@@ -0,0 +1,74 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Binary configuration snapshot shared by the daemon and the greeters
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MDM_CONFIG_SNAPSHOT_H
+#define _MDM_CONFIG_SNAPSHOT_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define MDM_CONFIG_SNAPSHOT_MAGIC   "MDMSNAP"
+#define MDM_CONFIG_SNAPSHOT_VERSION 1
+
+/*
+ * File layout: the header, n_entries entries sorted by key and then
+ * the NUL terminated strings the entries point at.  All offsets are
+ * from the start of the file.  Only the superseded field ever changes
+ * after the file has been published.
+ */
+typedef struct {
+	char    magic[8];
+	guint32 version;
+	guint32 header_size;
+	guint32 size;		/* of the whole file */
+	guint32 superseded;	/* set once a newer snapshot replaced this one */
+	guint64 generation;
+	guint32 n_entries;
+	guint32 custom_file;	/* offset of the custom config file name */
+} MdmConfigSnapshotHeader;
+
+typedef struct {
+	guint32 key;		/* offset of "group/Key" */
+	guint32 value;		/* offset of the value as GET_CONFIG returns it */
+} MdmConfigSnapshotEntry;
+
+typedef struct _MdmConfigSnapshot MdmConfigSnapshot;
+
+/* Daemon side: atomically replaces path with a new snapshot holding
+ * the given keys and values and marks the previous one superseded */
+gboolean             mdm_config_snapshot_write          (const char        *path,
+							 guint64            generation,
+							 const char        *custom_file,
+							 GPtrArray         *keys,
+							 GPtrArray         *values);
+
+/* Client side */
+MdmConfigSnapshot *  mdm_config_snapshot_open           (const char        *path);
+void                 mdm_config_snapshot_close          (MdmConfigSnapshot *snapshot);
+gboolean             mdm_config_snapshot_is_current     (MdmConfigSnapshot *snapshot);
+guint64              mdm_config_snapshot_get_generation (MdmConfigSnapshot *snapshot);
+const char *         mdm_config_snapshot_get_custom_file (MdmConfigSnapshot *snapshot);
+const char *         mdm_config_snapshot_lookup         (MdmConfigSnapshot *snapshot,
+							 const char        *key);
+
+G_END_DECLS
+
+#endif /* _MDM_CONFIG_SNAPSHOT_H */
@@ -53,8 +53,18 @@ struct _MdmConfig
 	time_t           custom_mtime;
 
 	GPtrArray       *entries;
+	/* indexes into entries, by id and by group and key */
+	GPtrArray       *entries_by_id;
+	GHashTable      *entry_hash;
 
 	GHashTable      *value_hash;
+	/* the value in value_hash for each entry id, so that it can be
+	 * peeked at without building the group/key path */
+	GPtrArray       *values_by_id;
+	/* values that were replaced, kept because the peek functions
+	 * hand out pointers into them, until the owner of the config
+	 * says nobody holds one any more */
+	GSList          *superseded;
 
 	MdmConfigFunc    validate_func;
 	gpointer         validate_func_data;
@@ -566,14 +576,37 @@ mdm_config_value_to_string (const MdmConfigValue *value)
 	return ret;
 }
 
+static guint
+entry_hash (gconstpointer data)
+{
+	const MdmConfigEntry *entry = data;
+
+	return g_str_hash (entry->group) * 31 + g_str_hash (entry->key);
+}
+
+static gboolean
+entry_equal (gconstpointer a,
+	     gconstpointer b)
+{
+	const MdmConfigEntry *entry_a = a;
+	const MdmConfigEntry *entry_b = b;
+
+	return strcmp (entry_a->key, entry_b->key) == 0
+		&& strcmp (entry_a->group, entry_b->group) == 0;
+}
+
 static void
 mdm_config_init (MdmConfig *config)
 {
 	config->entries = g_ptr_array_new ();
+	config->entries_by_id = g_ptr_array_new ();
+	/* the entries are owned by the entries array */
+	config->entry_hash = g_hash_table_new (entry_hash, entry_equal);
 	config->value_hash = g_hash_table_new_full (g_str_hash,
 						    g_str_equal,
 						    (GDestroyNotify)g_free,
 						    (GDestroyNotify)mdm_config_value_free);
+	config->values_by_id = g_ptr_array_new ();
 }
 
 MdmConfig *
@@ -602,6 +635,10 @@ mdm_config_free (MdmConfig *config)
 	MdmConfigEntry *e;
 	GKeyFile       *mkf, *dkf, *ckf;
 	GHashTable     *hash;
+	GPtrArray      *values;
+	GSList         *superseded;
+	GPtrArray      *by_id;
+	GHashTable     *entry_index;
 
 	g_return_if_fail (config != NULL);
 
@@ -616,12 +653,20 @@ mdm_config_free (MdmConfig *config)
 	mkf  = config->distro_key_file;
 	ckf  = config->custom_key_file;
 	hash = config->value_hash;
+	values = config->values_by_id;
+	superseded = config->superseded;
+	by_id = config->entries_by_id;
+	entry_index = config->entry_hash;
 
 	config->entries            = NULL;	
+	config->entries_by_id      = NULL;
+	config->entry_hash         = NULL;
 	config->default_key_file   = NULL;
 	config->distro_key_file    = NULL;
 	config->custom_key_file    = NULL;
 	config->value_hash         = NULL;
+	config->values_by_id       = NULL;
+	config->superseded         = NULL;
 	
 	g_free (config->default_filename);
 	g_free (config->distro_filename);
@@ -629,6 +674,10 @@ mdm_config_free (MdmConfig *config)
 
 	g_slice_free (MdmConfig, config);
 
+	if (entry_index != NULL)
+		g_hash_table_destroy (entry_index);
+	if (by_id != NULL)
+		g_ptr_array_free (by_id, TRUE);
 	if (e != NULL) {
 		g_ptr_array_foreach (e, (GFunc)mdm_config_entry_free, NULL);
 		g_ptr_array_free (e, TRUE);
@@ -641,6 +690,10 @@ mdm_config_free (MdmConfig *config)
 		g_key_file_free (ckf);
 	if (hash != NULL)
 		g_hash_table_destroy (hash);
+	if (values != NULL)
+		g_ptr_array_free (values, TRUE);
+	g_slist_foreach (superseded, (GFunc)mdm_config_value_free, NULL);
+	g_slist_free (superseded);
 }
 
 static void
@@ -713,49 +766,29 @@ mdm_config_lookup_entry (MdmConfig  *config,
 			 const char *group,
 			 const char *key)
 {
-	int                   i;
-	const MdmConfigEntry *entry;
+	MdmConfigEntry template;
 
 	g_return_val_if_fail (config != NULL, NULL);
 	g_return_val_if_fail (group != NULL, NULL);
 	g_return_val_if_fail (key != NULL, NULL);
 
-	entry = NULL;
+	template.group = (char *)group;
+	template.key = (char *)key;
 
-	for (i = 0; i < config->entries->len; i++) {
-		MdmConfigEntry *this;
-		this = g_ptr_array_index (config->entries, i);
-		if (strcmp (this->group, group) == 0
-		    && strcmp (this->key, key) == 0) {
-			entry = (const MdmConfigEntry *)this;
-			break;
-		}
-	}
-
-	return entry;
+	return g_hash_table_lookup (config->entry_hash, &template);
 }
 
 const MdmConfigEntry *
 mdm_config_lookup_entry_for_id (MdmConfig  *config,
 				int         id)
 {
-	int                   i;
-	const MdmConfigEntry *entry;
-
 	g_return_val_if_fail (config != NULL, NULL);
 
-	entry = NULL;
-
-	for (i = 0; i < config->entries->len; i++) {
-		MdmConfigEntry *this;
-		this = g_ptr_array_index (config->entries, i);
-		if (this->id == id) {
-			entry = (const MdmConfigEntry *)this;
-			break;
-		}
+	if (id < 0 || id >= config->entries_by_id->len) {
+		return NULL;
 	}
 
-	return entry;
+	return g_ptr_array_index (config->entries_by_id, id);
 }
 
 void
@@ -769,6 +802,19 @@ mdm_config_add_entry (MdmConfig            *config,
 
 	new_entry = mdm_config_entry_copy (entry);
 	g_ptr_array_add (config->entries, new_entry);
+
+	/* like the linear search that this replaces, the first entry
+	 * added for a key or an id is the one that is found */
+	if (g_hash_table_lookup (config->entry_hash, new_entry) == NULL) {
+		g_hash_table_insert (config->entry_hash, new_entry, new_entry);
+	}
+
+	if (new_entry->id >= 0) {
+		if (new_entry->id >= config->entries_by_id->len)
+			g_ptr_array_set_size (config->entries_by_id, new_entry->id + 1);
+		if (g_ptr_array_index (config->entries_by_id, new_entry->id) == NULL)
+			g_ptr_array_index (config->entries_by_id, new_entry->id) = new_entry;
+	}
 }
 
 void
@@ -776,10 +822,20 @@ mdm_config_add_static_entries (MdmConfig            *config,
 			       const MdmConfigEntry *entries)
 {
 	int i;
+	int max_id;
 
 	g_return_if_fail (config != NULL);
 	g_return_if_fail (entries != NULL);
 
+	/* size the id index once rather than growing it entry by entry */
+	max_id = -1;
+	for (i = 0; entries[i].group != NULL; i++) {
+		max_id = MAX (max_id, entries[i].id);
+	}
+	if (max_id >= (int)config->entries_by_id->len) {
+		g_ptr_array_set_size (config->entries_by_id, max_id + 1);
+	}
+
 	for (i = 0; entries[i].group != NULL; i++) {
 		mdm_config_add_entry (config, &entries[i]);
 	}
@@ -1025,11 +1081,13 @@ internal_set_value (MdmConfig          *config,
 		    MdmConfigSourceType source,
 		    const char         *group,
 		    const char         *key,
+		    int                 id,
 		    MdmConfigValue     *value)
 {
 	char           *key_path;
-	int             id;
+	char           *old_key_path;
 	MdmConfigValue *v;
+	MdmConfigValue *new_value;
 	gboolean        res;
 
 	g_return_if_fail (config != NULL);
@@ -1037,9 +1095,10 @@ internal_set_value (MdmConfig          *config,
 	key_path = g_strdup_printf ("%s/%s", group, key);
 
 	v = NULL;
+	old_key_path = NULL;
 	res = g_hash_table_lookup_extended (config->value_hash,
 					    key_path,
-					    NULL,
+					    (gpointer *)&old_key_path,
 					    (gpointer *)&v);
 
 	if (res) {
@@ -1047,13 +1106,24 @@ internal_set_value (MdmConfig          *config,
 			/* value is the same - don't update */
 			goto out;
 		}
+
+		/* somebody may still hold a string peeked from it */
+		g_hash_table_steal (config->value_hash, key_path);
+		g_free (old_key_path);
+		if (v != NULL)
+			config->superseded = g_slist_prepend (config->superseded, v);
 	}
 
+	new_value = mdm_config_value_copy (value);
 	g_hash_table_insert (config->value_hash,
 			     g_strdup (key_path),
-			     mdm_config_value_copy (value));
+			     new_value);
 
-	id = lookup_id_for_key (config, group, key);
+	if (id >= 0) {
+		if (id >= config->values_by_id->len)
+			g_ptr_array_set_size (config->values_by_id, id + 1);
+		g_ptr_array_index (config->values_by_id, id) = new_value;
+	}
 
 	if (config->notify_func) {
 		(* config->notify_func) (config, source, group, key, value, id, config->notify_func_data);
@@ -1068,7 +1138,17 @@ store_entry_value (MdmConfig            *config,
 		   MdmConfigSourceType   source,
 		   MdmConfigValue       *value)
 {
-	internal_set_value (config, source, entry->group, entry->key, value);
+	int id;
+
+	/* entries that come from our own table know their id, anything
+	 * else (server entries, duplicates) is looked up like a key */
+	if (mdm_config_lookup_entry_for_id (config, entry->id) == entry) {
+		id = entry->id;
+	} else {
+		id = lookup_id_for_key (config, entry->group, entry->key);
+	}
+
+	internal_set_value (config, source, entry->group, entry->key, id, value);
 }
 
 static gboolean
@@ -1269,6 +1349,56 @@ mdm_config_load (MdmConfig *config,
 	return TRUE;
 }
 
+/*
+ * Reparses the file for one source even if its mtime did not change,
+ * for callers that know it was rewritten (mtime only has a resolution
+ * of a second).  The values are only updated by processing entries.
+ */
+gboolean
+mdm_config_load_source (MdmConfig          *config,
+			MdmConfigSourceType source,
+			GError            **error)
+{
+	GKeyFile *kf;
+
+	g_return_val_if_fail (config != NULL, FALSE);
+
+	switch (source) {
+	case MDM_CONFIG_SOURCE_DEFAULT:
+		kf = config->default_key_file;
+		config->default_key_file = NULL;
+		if (kf != NULL)
+			g_key_file_free (kf);
+		config->default_loaded = load_backend (config,
+						       config->default_filename,
+						       &config->default_key_file,
+						       &config->default_mtime);
+		return config->default_loaded;
+	case MDM_CONFIG_SOURCE_DISTRO:
+		kf = config->distro_key_file;
+		config->distro_key_file = NULL;
+		if (kf != NULL)
+			g_key_file_free (kf);
+		config->distro_loaded = load_backend (config,
+						      config->distro_filename,
+						      &config->distro_key_file,
+						      &config->distro_mtime);
+		return config->distro_loaded;
+	case MDM_CONFIG_SOURCE_CUSTOM:
+		kf = config->custom_key_file;
+		config->custom_key_file = NULL;
+		if (kf != NULL)
+			g_key_file_free (kf);
+		config->custom_loaded = load_backend (config,
+						      config->custom_filename,
+						      &config->custom_key_file,
+						      &config->custom_mtime);
+		return config->custom_loaded;
+	default:
+		return FALSE;
+	}
+}
+
 static gboolean
 process_entries (MdmConfig             *config,
 		 const MdmConfigEntry **entries,
@@ -1394,12 +1524,46 @@ mdm_config_set_value (MdmConfig       *config,
 	g_return_val_if_fail (key != NULL, FALSE);
 	g_return_val_if_fail (value != NULL, FALSE);
 
-	internal_set_value (config, MDM_CONFIG_SOURCE_RUNTIME_USER, group, key, value);
+	internal_set_value (config,
+			    MDM_CONFIG_SOURCE_RUNTIME_USER,
+			    group,
+			    key,
+			    lookup_id_for_key (config, group, key),
+			    value);
 
 	return TRUE;
 }
 
-static gboolean
+/*
+ * Frees the values replaced since the last call.  Only to be called
+ * where no pointer from the peek functions can be held any more, such
+ * as between two messages of the main loop.
+ */
+void
+mdm_config_release_superseded (MdmConfig *config)
+{
+	g_return_if_fail (config != NULL);
+
+	g_slist_foreach (config->superseded, (GFunc)mdm_config_value_free, NULL);
+	g_slist_free (config->superseded);
+	config->superseded = NULL;
+}
+
+guint
+mdm_config_get_n_superseded (MdmConfig *config)
+{
+	g_return_val_if_fail (config != NULL, 0);
+
+	return g_slist_length (config->superseded);
+}
+
+/*
+ * Returns the stored value without copying it.  A value that is
+ * replaced is kept until mdm_config_release_superseded, so what this
+ * returns stays valid across later sets of the key until then.
+ * Nothing is allocated for keys that have been set before.
+ */
+gboolean
 mdm_config_peek_value_for_id (MdmConfig             *config,
 			      int                    id,
 			      const MdmConfigValue **valuep)
@@ -1408,6 +1572,14 @@ mdm_config_peek_value_for_id (MdmConfig             *config,
 
 	g_return_val_if_fail (config != NULL, FALSE);
 
+	if (id >= 0 && id < config->values_by_id->len &&
+	    g_ptr_array_index (config->values_by_id, id) != NULL) {
+		if (valuep != NULL) {
+			*valuep = g_ptr_array_index (config->values_by_id, id);
+		}
+		return TRUE;
+	}
+
 	entry = mdm_config_lookup_entry_for_id (config, id);
 	if (entry == NULL) {
 		return FALSE;
@@ -1495,13 +1667,13 @@ mdm_config_get_bool_for_id (MdmConfig       *config,
 			    int              id,
 			    gboolean        *boolp)
 {
-	MdmConfigValue *value;
-	gboolean        bool;
-	gboolean        res;
+	const MdmConfigValue *value;
+	gboolean              bool;
+	gboolean              res;
 
 	g_return_val_if_fail (config != NULL, FALSE);
 
-	res = mdm_config_get_value_for_id (config, id, &value);
+	res = mdm_config_peek_value_for_id (config, id, &value);
 	if (! res) {
 		return FALSE;
 	}
@@ -1511,8 +1683,6 @@ mdm_config_get_bool_for_id (MdmConfig       *config,
 		*boolp = bool;
 	}
 
-	mdm_config_value_free (value);
-
 	return res;
 }
 
@@ -1521,13 +1691,13 @@ mdm_config_get_int_for_id (MdmConfig       *config,
 			   int              id,
 			   int             *integerp)
 {
-	MdmConfigValue *value;
-	gboolean        integer;
-	gboolean        res;
+	const MdmConfigValue *value;
+	int                   integer;
+	gboolean              res;
 
 	g_return_val_if_fail (config != NULL, FALSE);
 
-	res = mdm_config_get_value_for_id (config, id, &value);
+	res = mdm_config_peek_value_for_id (config, id, &value);
 	if (! res) {
 		return FALSE;
 	}
@@ -1537,8 +1707,6 @@ mdm_config_get_int_for_id (MdmConfig       *config,
 		*integerp = integer;
 	}
 
-	mdm_config_value_free (value);
-
 	return res;
 }
 
@@ -110,6 +110,9 @@ const MdmConfigEntry * mdm_config_lookup_entry_for_id    (MdmConfig            *
 
 gboolean               mdm_config_load                   (MdmConfig             *config,
 							  GError               **error);
+gboolean               mdm_config_load_source            (MdmConfig             *config,
+							  MdmConfigSourceType    source,
+							  GError               **error);
 gboolean               mdm_config_process_all            (MdmConfig             *config,
 							  GError               **error);
 gboolean               mdm_config_process_entry          (MdmConfig             *config,
@@ -142,6 +145,9 @@ gboolean               mdm_config_set_value              (MdmConfig       *confi
 							  MdmConfigValue  *value);
 
 /* convenience functions */
+gboolean               mdm_config_peek_value_for_id      (MdmConfig             *config,
+							  int                    id,
+							  const MdmConfigValue **value);
 gboolean               mdm_config_get_value_for_id       (MdmConfig       *config,
 							  int              id,
 							  MdmConfigValue **value);
@@ -171,6 +177,12 @@ gboolean               mdm_config_set_int_for_id         (MdmConfig       *confi
 							  int              id,
 							  int              integer);
 
+/* Values replaced by a set are kept for the peek functions until this,
+ * to be called where nobody can hold a peeked pointer any more */
+void                   mdm_config_release_superseded     (MdmConfig       *config);
+/* How many are kept, for the tests */
+guint                  mdm_config_get_n_superseded       (MdmConfig       *config);
+
 /* Config Values */
 
 MdmConfigValue *     mdm_config_value_new              (MdmConfigValueType    type);
@@ -0,0 +1,319 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Pack of pre-scaled face thumbnails shared by the slaves and the greeters
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Decoding and scaling every user's picture is most of what a greeter
+ * does before it can show the user list.  The slaves keep the results
+ * in one file which every greeter on every seat maps; an entry is only
+ * used while the picture it was made from still has the same path,
+ * mtime and size.  The file is replaced the same way as the
+ * configuration snapshot: written next to the old one, renamed over
+ * it, and the old one flagged as superseded.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include "mdm-common.h"
+#include "mdm-log.h"
+#include "mdm-publish.h"
+#include "mdm-face-cache.h"
+
+#define PIXELS_ALIGN 16
+
+struct _MdmFaceCache {
+	const char               *data;
+	gsize                     size;
+	const MdmFaceCacheHeader *header;
+	const MdmFaceCacheEntry  *entries;
+};
+
+static int
+compare_thumbs (gconstpointer a, gconstpointer b, gpointer data)
+{
+	const MdmFaceCacheThumb *thumbs = data;
+	guint ia = *(const guint *) a;
+	guint ib = *(const guint *) b;
+
+	if (thumbs[ia].uid != thumbs[ib].uid)
+		return (thumbs[ia].uid > thumbs[ib].uid) ? 1 : -1;
+	/* the later one first, so it is the one that is kept */
+	return (ia < ib) ? 1 : (ia > ib) ? -1 : 0;
+}
+
+gboolean
+mdm_face_cache_write (const char *path,
+		      GArray     *thumbs)
+{
+	MdmFaceCacheHeader *header;
+	MdmFaceCacheEntry  *entries;
+	MdmFaceCacheThumb  *thumb;
+	GString *buf;
+	guint   *order;
+	guint    i, n;
+	gsize    pixels;
+	char    *tmp;
+
+	/* sorted by uid, duplicates dropped */
+	order = g_new (guint, MAX (thumbs->len, 1));
+	for (i = 0; i < thumbs->len; i++)
+		order[i] = i;
+	g_qsort_with_data (order, thumbs->len, sizeof (guint),
+			   compare_thumbs, thumbs->data);
+	for (i = 0, n = 0; i < thumbs->len; i++) {
+		if (n > 0 &&
+		    g_array_index (thumbs, MdmFaceCacheThumb, order[n - 1]).uid ==
+		    g_array_index (thumbs, MdmFaceCacheThumb, order[i]).uid)
+			continue;
+		order[n++] = order[i];
+	}
+
+	pixels = sizeof (MdmFaceCacheHeader) + n * sizeof (MdmFaceCacheEntry);
+	pixels = (pixels + PIXELS_ALIGN - 1) & ~(gsize) (PIXELS_ALIGN - 1);
+
+	buf = g_string_sized_new (pixels + n * (MDM_FACE_CACHE_THUMB_BYTES + 64));
+	g_string_set_size (buf, pixels + n * MDM_FACE_CACHE_THUMB_BYTES);
+	memset (buf->str, 0, pixels);
+
+	for (i = 0; i < n; i++) {
+		guint32 path_offset;
+
+		thumb = &g_array_index (thumbs, MdmFaceCacheThumb, order[i]);
+		memcpy (buf->str + pixels + i * MDM_FACE_CACHE_THUMB_BYTES,
+			thumb->pixels, MDM_FACE_CACHE_THUMB_BYTES);
+
+		path_offset = buf->len;
+		g_string_append_len (buf, ve_sure_string (thumb->path),
+				     strlen (ve_sure_string (thumb->path)) + 1);
+
+		entries = (MdmFaceCacheEntry *) (buf->str + sizeof (MdmFaceCacheHeader));
+		entries[i].uid = thumb->uid;
+		entries[i].path = path_offset;
+		entries[i].mtime = thumb->mtime;
+		entries[i].size = thumb->size;
+		entries[i].pixels = pixels + i * MDM_FACE_CACHE_THUMB_BYTES;
+	}
+	g_free (order);
+
+	/* so that the last path is terminated even with no entries */
+	if (n == 0)
+		g_string_append_c (buf, '\0');
+
+	header = (MdmFaceCacheHeader *) buf->str;
+	memcpy (header->magic, MDM_FACE_CACHE_MAGIC, sizeof (header->magic));
+	header->version = MDM_FACE_CACHE_VERSION;
+	header->header_size = sizeof (MdmFaceCacheHeader);
+	header->size = buf->len;
+	header->superseded = 0;
+	header->thumb_size = MDM_FACE_CACHE_THUMB_SIZE;
+	header->n_entries = n;
+
+	/* mdm_face_thumb_update keeps two slaves from merging at
+	 * once, the pid is for anybody else writing the pack */
+	tmp = g_strdup_printf ("%s.%d", path, (int) getpid ());
+	if ( ! mdm_publish_file (path, tmp, buf->str, buf->len,
+				 MDM_FACE_CACHE_MAGIC, sizeof (((MdmFaceCacheHeader *) NULL)->magic),
+				 offsetof (MdmFaceCacheHeader, superseded),
+				 "face cache"))
+		goto fail;
+
+	g_free (tmp);
+	g_string_free (buf, TRUE);
+	return TRUE;
+
+ fail:
+	g_free (tmp);
+	g_string_free (buf, TRUE);
+	return FALSE;
+}
+
+static gboolean
+cache_is_valid (const char *data, gsize size)
+{
+	const MdmFaceCacheHeader *header;
+	const MdmFaceCacheEntry  *entries;
+	guint32 i;
+
+	if (size < sizeof (MdmFaceCacheHeader))
+		return FALSE;
+
+	header = (const MdmFaceCacheHeader *) data;
+	if (memcmp (header->magic, MDM_FACE_CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->version != MDM_FACE_CACHE_VERSION ||
+	    header->header_size != sizeof (MdmFaceCacheHeader) ||
+	    header->thumb_size != MDM_FACE_CACHE_THUMB_SIZE ||
+	    header->size != size)
+		return FALSE;
+
+	if (data[size - 1] != '\0')
+		return FALSE;
+
+	if (header->n_entries > (size - header->header_size) / sizeof (MdmFaceCacheEntry))
+		return FALSE;
+
+	entries = (const MdmFaceCacheEntry *) (data + header->header_size);
+	for (i = 0; i < header->n_entries; i++) {
+		if (entries[i].path >= size ||
+		    entries[i].pixels > size - MDM_FACE_CACHE_THUMB_BYTES)
+			return FALSE;
+		if (i > 0 && entries[i - 1].uid >= entries[i].uid)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * mdm_face_cache_open
+ *
+ * Maps the pack at path.  Returns NULL if there is none or it is not
+ * one this code understands, every picture is a miss then.
+ */
+MdmFaceCache *
+mdm_face_cache_open (const char *path)
+{
+	MdmFaceCache *cache;
+	struct stat   s;
+	void         *data;
+	int           fd;
+
+	if (ve_string_empty (path))
+		return NULL;
+
+	VE_IGNORE_EINTR (fd = open (path, O_RDONLY));
+	if (fd < 0)
+		return NULL;
+
+	if (fstat (fd, &s) < 0 || s.st_size < (off_t) sizeof (MdmFaceCacheHeader)) {
+		VE_IGNORE_EINTR (close (fd));
+		return NULL;
+	}
+
+	data = mmap (NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	VE_IGNORE_EINTR (close (fd));
+	if (data == MAP_FAILED)
+		return NULL;
+
+	if ( ! cache_is_valid (data, s.st_size)) {
+		munmap (data, s.st_size);
+		return NULL;
+	}
+
+	cache = g_new0 (MdmFaceCache, 1);
+	cache->data = data;
+	cache->size = s.st_size;
+	cache->header = data;
+	cache->entries = (const MdmFaceCacheEntry *)
+		(cache->data + cache->header->header_size);
+
+	return cache;
+}
+
+void
+mdm_face_cache_close (MdmFaceCache *cache)
+{
+	if (cache == NULL)
+		return;
+
+	munmap ((void *) cache->data, cache->size);
+	g_free (cache);
+}
+
+/**
+ * mdm_face_cache_is_current
+ *
+ * Returns FALSE once a slave has published a newer pack.  The
+ * thumbnails in this one are still right for what they say they are
+ * of, but the pack should be reopened to pick up the new ones.
+ */
+gboolean
+mdm_face_cache_is_current (MdmFaceCache *cache)
+{
+	return g_atomic_int_get ((volatile gint *) &cache->header->superseded) == 0;
+}
+
+guint
+mdm_face_cache_get_n_thumbs (MdmFaceCache *cache)
+{
+	return cache->header->n_entries;
+}
+
+void
+mdm_face_cache_get_thumb (MdmFaceCache      *cache,
+			  guint              n,
+			  MdmFaceCacheThumb *thumb)
+{
+	const MdmFaceCacheEntry *entry = &cache->entries[n];
+
+	thumb->uid = entry->uid;
+	thumb->path = cache->data + entry->path;
+	thumb->mtime = entry->mtime;
+	thumb->size = entry->size;
+	thumb->pixels = (const guchar *) cache->data + entry->pixels;
+}
+
+/**
+ * mdm_face_cache_lookup
+ *
+ * Returns the thumbnail of uid's picture if it was made from a file
+ * with this mtime and size, and, unless path is NULL, this path.  The
+ * pixels point into the mapping.
+ */
+const guchar *
+mdm_face_cache_lookup (MdmFaceCache *cache,
+		       guint32       uid,
+		       const char   *path,
+		       gint64        mtime,
+		       guint64       size)
+{
+	guint32 low, high;
+
+	low = 0;
+	high = cache->header->n_entries;
+	while (low < high) {
+		guint32 mid = low + (high - low) / 2;
+		const MdmFaceCacheEntry *entry = &cache->entries[mid];
+
+		if (uid == entry->uid) {
+			if (entry->mtime != mtime ||
+			    entry->size != size ||
+			    (path != NULL && strcmp (path, cache->data + entry->path) != 0))
+				return NULL;
+			return (const guchar *) cache->data + entry->pixels;
+		} else if (uid < entry->uid) {
+			high = mid;
+		} else {
+			low = mid + 1;
+		}
+	}
+
+	return NULL;
+}
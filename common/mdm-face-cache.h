@@ -0,0 +1,92 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Pack of pre-scaled face thumbnails shared by the slaves and the greeters
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MDM_FACE_CACHE_H
+#define _MDM_FACE_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define MDM_FACE_CACHE_MAGIC       "MDMFACE"
+#define MDM_FACE_CACHE_VERSION     1
+
+/* Thumbnails are square, RGBA with 8 bits per sample, not
+ * premultiplied, rows MDM_FACE_CACHE_THUMB_SIZE * 4 bytes apart */
+#define MDM_FACE_CACHE_THUMB_SIZE  48
+#define MDM_FACE_CACHE_THUMB_BYTES (MDM_FACE_CACHE_THUMB_SIZE * MDM_FACE_CACHE_THUMB_SIZE * 4)
+
+/*
+ * File layout: the header, n_entries entries sorted by uid, the
+ * thumbnails (each aligned to 16 bytes) and then the NUL terminated
+ * source paths.  All offsets are from the start of the file.  Only the
+ * superseded field ever changes after the file has been published.
+ */
+typedef struct {
+	char    magic[8];
+	guint32 version;
+	guint32 header_size;
+	guint32 size;		/* of the whole file */
+	guint32 superseded;	/* set once a newer pack replaced this one */
+	guint32 thumb_size;	/* MDM_FACE_CACHE_THUMB_SIZE when written */
+	guint32 n_entries;
+} MdmFaceCacheHeader;
+
+typedef struct {
+	guint32 uid;
+	guint32 path;		/* offset of the picture the thumbnail is of */
+	gint64  mtime;		/* of that picture when it was scaled */
+	guint64 size;		/* likewise */
+	guint32 pixels;		/* offset of MDM_FACE_CACHE_THUMB_BYTES */
+	guint32 reserved;
+} MdmFaceCacheEntry;
+
+typedef struct {
+	guint32       uid;
+	const char   *path;
+	gint64        mtime;
+	guint64       size;
+	const guchar *pixels;
+} MdmFaceCacheThumb;
+
+typedef struct _MdmFaceCache MdmFaceCache;
+
+/* Slave side: atomically replaces path with a pack holding thumbs (an
+ * array of MdmFaceCacheThumb, a later thumbnail for the same uid wins)
+ * and marks the previous pack superseded */
+gboolean       mdm_face_cache_write        (const char         *path,
+					    GArray             *thumbs);
+
+MdmFaceCache * mdm_face_cache_open         (const char         *path);
+void           mdm_face_cache_close        (MdmFaceCache       *cache);
+gboolean       mdm_face_cache_is_current   (MdmFaceCache       *cache);
+guint          mdm_face_cache_get_n_thumbs (MdmFaceCache       *cache);
+void           mdm_face_cache_get_thumb    (MdmFaceCache       *cache,
+					    guint               n,
+					    MdmFaceCacheThumb  *thumb);
+const guchar * mdm_face_cache_lookup       (MdmFaceCache       *cache,
+					    guint32             uid,
+					    const char         *path,
+					    gint64              mtime,
+					    guint64             size);
+
+G_END_DECLS
+
+#endif /* _MDM_FACE_CACHE_H */
@@ -0,0 +1,137 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Line framing for the daemon protocol
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Data is read straight into one flat buffer per connection and lines
+ * are found with memchr.  Complete lines are terminated in place and
+ * handed out as pointers into the buffer, so nothing is copied on the
+ * common path.  Only a partial line left over at the end of a read is
+ * ever moved, and only when it is in the way of the next read.
+ *
+ * Lines are cut short the same way the old per-byte reader did it: a
+ * line that has grown past MDM_LINE_BUFFER_MAX_LINE bytes is handed
+ * out when the next byte arrives and that byte is dropped.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "mdm-line-buffer.h"
+
+/* The longest partial line we may have to keep around is
+ * MAX_LINE + 1 bytes, leave a full chunk of room after that */
+#define LINE_BUFFER_SIZE (MDM_LINE_BUFFER_MAX_LINE + 1 + MDM_LINE_BUFFER_CHUNK)
+
+void
+mdm_line_buffer_init (MdmLineBuffer *lb)
+{
+	lb->data = NULL;
+	lb->start = 0;
+	lb->scan = 0;
+	lb->end = 0;
+}
+
+void
+mdm_line_buffer_clear (MdmLineBuffer *lb)
+{
+	g_free (lb->data);
+	mdm_line_buffer_init (lb);
+}
+
+char *
+mdm_line_buffer_reserve (MdmLineBuffer *lb,
+			 gsize         *avail)
+{
+	if (lb->data == NULL)
+		lb->data = g_malloc (LINE_BUFFER_SIZE);
+
+	if (lb->start == lb->end) {
+		/* Everything was consumed, the usual case */
+		lb->start = lb->scan = lb->end = 0;
+	} else if (LINE_BUFFER_SIZE - lb->end < MDM_LINE_BUFFER_CHUNK) {
+		gsize len = lb->end - lb->start;
+
+		memmove (lb->data, lb->data + lb->start, len);
+		lb->scan -= lb->start;
+		lb->start = 0;
+		lb->end = len;
+	}
+
+	*avail = LINE_BUFFER_SIZE - lb->end;
+	return lb->data + lb->end;
+}
+
+void
+mdm_line_buffer_commit (MdmLineBuffer *lb,
+			gsize          len)
+{
+	char *p, *q, *stop;
+
+	g_assert (lb->end + len <= LINE_BUFFER_SIZE);
+
+	p = memchr (lb->data + lb->end, '\r', len);
+	if G_UNLIKELY (p != NULL) {
+		/* carriage returns are ignored, squeeze them out */
+		stop = lb->data + lb->end + len;
+		for (q = p; p < stop; p++) {
+			if (*p != '\r')
+				*q++ = *p;
+		}
+		len = q - (lb->data + lb->end);
+	}
+
+	lb->end += len;
+}
+
+gboolean
+mdm_line_buffer_next (MdmLineBuffer *lb,
+		      char         **line)
+{
+	char *first, *nl;
+
+	while (lb->start < lb->end) {
+		first = lb->data + lb->start;
+		nl = memchr (lb->data + lb->scan, '\n', lb->end - lb->scan);
+
+		if (nl == NULL || nl - first > MDM_LINE_BUFFER_MAX_LINE + 1) {
+			if (lb->end - lb->start <= MDM_LINE_BUFFER_MAX_LINE + 1) {
+				/* incomplete, wait for more */
+				lb->scan = lb->end;
+				return FALSE;
+			}
+			/* cut lines short to prevent DoS attacks */
+			nl = first + MDM_LINE_BUFFER_MAX_LINE + 1;
+		}
+
+		*nl = '\0';
+		lb->start = lb->scan = nl - lb->data + 1;
+
+		/* ignore empty lines */
+		if (nl != first) {
+			*line = first;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,58 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Line framing for the daemon protocol
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MDM_LINE_BUFFER_H
+#define _MDM_LINE_BUFFER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Lines longer than this are cut short to prevent DoS attacks */
+#define MDM_LINE_BUFFER_MAX_LINE 4096
+/* At least this much room is available for every read */
+#define MDM_LINE_BUFFER_CHUNK 4096
+
+typedef struct {
+	char  *data;
+	gsize  start;	/* first byte not yet handed out */
+	gsize  scan;	/* bytes before this are known to hold no newline */
+	gsize  end;	/* end of the data read so far */
+} MdmLineBuffer;
+
+void     mdm_line_buffer_init     (MdmLineBuffer *lb);
+void     mdm_line_buffer_clear    (MdmLineBuffer *lb);
+
+/* Returns where the next read should go, *avail is set to how many
+ * bytes may be read there.  Call mdm_line_buffer_commit afterwards. */
+char    *mdm_line_buffer_reserve  (MdmLineBuffer *lb,
+				   gsize         *avail);
+void     mdm_line_buffer_commit   (MdmLineBuffer *lb,
+				   gsize          len);
+
+/* Hands out the next complete line, newline stripped, as a pointer
+ * into the buffer.  It stays valid until the next reserve or clear.
+ * Carriage returns and empty lines are skipped. */
+gboolean mdm_line_buffer_next     (MdmLineBuffer *lb,
+				   char         **line);
+
+G_END_DECLS
+
+#endif /* _MDM_LINE_BUFFER_H */
@@ -0,0 +1,122 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Replacing files that other processes have mapped
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "mdm-common.h"
+#include "mdm-log.h"
+#include "mdm-publish.h"
+
+gboolean
+mdm_write_all (int fd, const char *data, gsize len)
+{
+	while (len > 0) {
+		ssize_t n;
+
+		VE_IGNORE_EINTR (n = write (fd, data, len));
+		if (n < 0)
+			return FALSE;
+		if (n == 0) {
+			errno = ENOSPC;
+			return FALSE;
+		}
+		data += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+static void
+mark_superseded (int         fd,
+		 const char *magic,
+		 gsize       magic_len,
+		 goffset     superseded_offset)
+{
+	char    buf[16];
+	guint32 superseded = 1;
+	ssize_t n;
+
+	g_return_if_fail (magic_len <= sizeof (buf));
+
+	VE_IGNORE_EINTR (n = pread (fd, buf, magic_len, 0));
+	if (n != (ssize_t) magic_len ||
+	    memcmp (buf, magic, magic_len) != 0)
+		return;
+
+	VE_IGNORE_EINTR (n = pwrite (fd, &superseded, sizeof (superseded),
+				     superseded_offset));
+}
+
+gboolean
+mdm_publish_file (const char *path,
+		  const char *tmp_path,
+		  const char *data,
+		  gsize       len,
+		  const char *magic,
+		  gsize       magic_len,
+		  goffset     superseded_offset,
+		  const char *what)
+{
+	int fd, old_fd;
+
+	VE_IGNORE_EINTR (unlink (tmp_path));
+	VE_IGNORE_EINTR (fd = open (tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0644));
+	if (fd < 0) {
+		mdm_error ("Cannot create %s %s: %s",
+			   what, tmp_path, strerror (errno));
+		return FALSE;
+	}
+	/* readable by the greeters whatever the umask */
+	fchmod (fd, 0644);
+
+	if ( ! mdm_write_all (fd, data, len)) {
+		mdm_error ("Cannot write %s %s: %s",
+			   what, tmp_path, strerror (errno));
+		VE_IGNORE_EINTR (close (fd));
+		VE_IGNORE_EINTR (unlink (tmp_path));
+		return FALSE;
+	}
+	VE_IGNORE_EINTR (close (fd));
+
+	VE_IGNORE_EINTR (old_fd = open (path, O_RDWR));
+	if (rename (tmp_path, path) < 0) {
+		mdm_error ("Cannot publish %s %s: %s",
+			   what, path, strerror (errno));
+		if (old_fd >= 0)
+			VE_IGNORE_EINTR (close (old_fd));
+		VE_IGNORE_EINTR (unlink (tmp_path));
+		return FALSE;
+	}
+	if (old_fd >= 0) {
+		mark_superseded (old_fd, magic, magic_len, superseded_offset);
+		VE_IGNORE_EINTR (close (old_fd));
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Replacing files that other processes have mapped
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MDM_PUBLISH_H
+#define _MDM_PUBLISH_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Writes all of data, FALSE with errno set if that fails */
+gboolean mdm_write_all    (int         fd,
+			   const char *data,
+			   gsize       len);
+
+/*
+ * Replaces path with a file holding data, readable by everybody.  It
+ * is written to tmp_path and renamed over path, so that readers see
+ * either the old or the new file.  If the old file starts with magic,
+ * the guint32 at superseded_offset in it is then set to 1, which tells
+ * the processes that have it mapped to open the new one.  what names
+ * the file in the error messages.
+ */
+gboolean mdm_publish_file (const char *path,
+			   const char *tmp_path,
+			   const char *data,
+			   gsize       len,
+			   const char *magic,
+			   gsize       magic_len,
+			   goffset     superseded_offset,
+			   const char *what);
+
+G_END_DECLS
+
+#endif /* _MDM_PUBLISH_H */
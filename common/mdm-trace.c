@@ -0,0 +1,237 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Boot to session timeline, in the Chrome trace format
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "mdm-common.h"
+#include "mdm-log.h"
+#include "mdm-publish.h"
+#include "mdm-trace.h"
+
+/* The oldest events get overwritten when more than this many are
+ * recorded between two dumps */
+#define TRACE_EVENTS 256
+
+typedef struct {
+	const char *name;
+	gint64      ts;	/* usec, CLOCK_MONOTONIC */
+	char        ph;	/* B, E or i */
+} TraceEvent;
+
+static gboolean   trace_enabled = FALSE;
+static char      *trace_file = NULL;
+static char      *trace_process = NULL;
+static char      *trace_display = NULL;
+
+static TraceEvent trace_events[TRACE_EVENTS];
+static guint      trace_head = 0;	/* where the next one goes */
+static guint      trace_n_events = 0;
+
+void
+mdm_trace_init (const char *file,
+		const char *process,
+		const char *display)
+{
+	char *old_file = trace_file;
+
+	/* file may be what mdm_trace_get_file returned */
+	trace_enabled = ! ve_string_empty (file);
+	trace_file = trace_enabled ? g_strdup (file) : NULL;
+	g_free (old_file);
+
+	g_free (trace_process);
+	trace_process = g_strdup (process);
+	g_free (trace_display);
+	trace_display = g_strdup (display);
+
+	trace_head = 0;
+	trace_n_events = 0;
+}
+
+gboolean
+mdm_trace_enabled (void)
+{
+	return trace_enabled;
+}
+
+const char *
+mdm_trace_get_file (void)
+{
+	return trace_file;
+}
+
+static void
+trace_add (const char *name, char ph)
+{
+	TraceEvent *event;
+
+	if G_LIKELY ( ! trace_enabled)
+		return;
+
+	event = &trace_events[trace_head];
+	event->name = name;
+	event->ts = g_get_monotonic_time ();
+	event->ph = ph;
+
+	trace_head = (trace_head + 1) % TRACE_EVENTS;
+	if (trace_n_events < TRACE_EVENTS)
+		trace_n_events++;
+}
+
+void
+mdm_trace_begin (const char *name)
+{
+	trace_add (name, 'B');
+}
+
+void
+mdm_trace_end (const char *name)
+{
+	trace_add (name, 'E');
+}
+
+void
+mdm_trace_mark (const char *name)
+{
+	trace_add (name, 'i');
+}
+
+void
+mdm_trace_new_file (uid_t owner, gid_t group)
+{
+	int fd;
+
+	if ( ! trace_enabled)
+		return;
+
+	VE_IGNORE_EINTR (fd = open (trace_file,
+				    O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_NOCTTY,
+				    0644));
+	if (fd < 0) {
+		mdm_error ("Cannot create trace file %s: %s",
+			   trace_file, g_strerror (errno));
+		return;
+	}
+
+	mdm_write_all (fd, "[\n", 2);
+	if (fchown (fd, owner, group) < 0)
+		mdm_error ("Cannot change owner of trace file %s: %s",
+			   trace_file, g_strerror (errno));
+	VE_IGNORE_EINTR (close (fd));
+}
+
+static void
+append_json_string (GString *str, const char *s)
+{
+	g_string_append_c (str, '"');
+	for (; s != NULL && *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			g_string_append_c (str, '\\');
+		if ((guchar) *s < 0x20)
+			g_string_append_printf (str, "\\u%04x", (guchar) *s);
+		else
+			g_string_append_c (str, *s);
+	}
+	g_string_append_c (str, '"');
+}
+
+void
+mdm_trace_dump (void)
+{
+	GString *str;
+	long     pid;
+	guint    i;
+	int      fd;
+
+	if ( ! trace_enabled || trace_n_events == 0)
+		return;
+
+	pid = (long) getpid ();
+	str = g_string_sized_new (trace_n_events * 100);
+
+	/* names the row in the viewer */
+	g_string_append_printf (str,
+				"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,"
+				"\"args\":{\"name\":",
+				pid, pid);
+	if (trace_display != NULL) {
+		char *name = g_strdup_printf ("%s %s", ve_sure_string (trace_process),
+					      trace_display);
+		append_json_string (str, name);
+		g_free (name);
+	} else {
+		append_json_string (str, trace_process);
+	}
+	g_string_append (str, "}},\n");
+
+	for (i = 0; i < trace_n_events; i++) {
+		const TraceEvent *event;
+
+		event = &trace_events[(trace_head + TRACE_EVENTS - trace_n_events + i) % TRACE_EVENTS];
+
+		g_string_append (str, "{\"name\":");
+		append_json_string (str, event->name);
+		g_string_append_printf (str, ",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT
+					",\"pid\":%ld,\"tid\":%ld",
+					event->ph, event->ts, pid, pid);
+		if (event->ph == 'i')
+			g_string_append (str, ",\"s\":\"p\"");
+		if (trace_display != NULL) {
+			g_string_append (str, ",\"args\":{\"display\":");
+			append_json_string (str, trace_display);
+			g_string_append_c (str, '}');
+		}
+		g_string_append (str, "},\n");
+	}
+	trace_n_events = 0;
+
+	/* one write so that the processes do not get mixed up, the file
+	 * is only created here if nobody started it */
+	VE_IGNORE_EINTR (fd = open (trace_file,
+				    O_WRONLY | O_APPEND | O_NOFOLLOW | O_NOCTTY));
+	if (fd < 0 && errno == ENOENT) {
+		VE_IGNORE_EINTR (fd = open (trace_file,
+					    O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_NOFOLLOW | O_NOCTTY,
+					    0644));
+		if (fd >= 0)
+			g_string_prepend (str, "[\n");
+	}
+
+	if (fd < 0) {
+		mdm_error ("Cannot open trace file %s: %s",
+			   trace_file, g_strerror (errno));
+	} else {
+		if ( ! mdm_write_all (fd, str->str, str->len))
+			mdm_error ("Cannot write trace file %s: %s",
+				   trace_file, g_strerror (errno));
+		VE_IGNORE_EINTR (close (fd));
+	}
+
+	g_string_free (str, TRUE);
+}
@@ -0,0 +1,69 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Boot to session timeline, in the Chrome trace format
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MDM_TRACE_H
+#define _MDM_TRACE_H
+
+#include <sys/types.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * The daemon, the slaves and the greeters each keep their events in a
+ * ring buffer of their own and append it to one trace file when they
+ * dump it, so the file holds the whole timeline with the processes
+ * apart.  Timestamps are CLOCK_MONOTONIC, which all of them share.
+ * The file is a JSON array that is never closed, which chrome://tracing
+ * and Perfetto accept as it is.
+ *
+ * Nothing is recorded until mdm_trace_init is called with a file, and
+ * recording an event is a clock read and a store.  The names must be
+ * string constants, only the pointer is kept.
+ */
+
+/* The environment variable the slave hands the trace file to the
+ * greeter in */
+#define MDM_TRACE_FILE_ENV "MDM_TRACE_FILE"
+
+/* Also forgets the events recorded so far, call it again after a fork
+ * so that they do not get dumped twice.  An empty or NULL file turns
+ * tracing off. */
+void     mdm_trace_init       (const char *file,
+			       const char *process,
+			       const char *display);
+gboolean mdm_trace_enabled    (void);
+const char * mdm_trace_get_file (void);
+
+/* Starts a new trace file, owned by owner and group so that the
+ * greeters can append to it too */
+void     mdm_trace_new_file   (uid_t       owner,
+			       gid_t       group);
+
+void     mdm_trace_begin      (const char *name);
+void     mdm_trace_end        (const char *name);
+void     mdm_trace_mark       (const char *name);
+
+/* Appends the events recorded since the last dump to the file */
+void     mdm_trace_dump       (void);
+
+G_END_DECLS
+
+#endif /* _MDM_TRACE_H */
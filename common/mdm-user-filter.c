@@ -0,0 +1,144 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Which passwd entries the greeters list
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+
+#include <glib.h>
+
+#include "mdm-user-filter.h"
+
+struct _MdmUserFilter {
+	GHashTable *shells;	/* valid login shells */
+	GHashTable *excludes;	/* excluded logins, case folded */
+	gboolean    allow_root;
+	uid_t       minimal_uid;
+};
+
+MdmUserFilter *
+mdm_user_filter_new (gboolean    allow_root,
+		     uid_t       minimal_uid,
+		     const char *excludes)
+{
+	MdmUserFilter *filter;
+	char          *shell;
+
+	filter = g_new0 (MdmUserFilter, 1);
+	filter->allow_root = allow_root;
+	filter->minimal_uid = minimal_uid;
+
+	/* /etc/shells is read once here instead of once per user */
+	filter->shells = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	setusershell ();
+	while ((shell = getusershell ()) != NULL)
+		g_hash_table_add (filter->shells, g_strdup (shell));
+	endusershell ();
+
+	/* listed in /etc/shells or not, these are not login shells */
+	g_hash_table_remove (filter->shells, NOLOGIN);
+	g_hash_table_remove (filter->shells, "/bin/true");
+	g_hash_table_remove (filter->shells, "/bin/false");
+
+	filter->excludes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	if (excludes != NULL) {
+		char **names = g_strsplit (excludes, ",", 0);
+		int    i;
+
+		for (i = 0; names[i] != NULL; i++) {
+			g_strstrip (names[i]);
+			if (names[i][0] != '\0')
+				g_hash_table_add (filter->excludes,
+						  g_ascii_strdown (names[i], -1));
+		}
+		g_strfreev (names);
+	}
+
+	return filter;
+}
+
+void
+mdm_user_filter_free (MdmUserFilter *filter)
+{
+	if (filter == NULL)
+		return;
+
+	g_hash_table_destroy (filter->shells);
+	g_hash_table_destroy (filter->excludes);
+	g_free (filter);
+}
+
+gboolean
+mdm_user_filter_shell_is_valid (MdmUserFilter *filter,
+				const char    *shell)
+{
+	return shell != NULL && g_hash_table_contains (filter->shells, shell);
+}
+
+gboolean
+mdm_user_filter_is_excluded (MdmUserFilter *filter,
+			     const char    *login)
+{
+	char     buf[256];
+	char    *folded;
+	gsize    len;
+	gboolean ret;
+
+	if (g_hash_table_size (filter->excludes) == 0)
+		return FALSE;
+
+	/* no allocation for the usual short name */
+	len = strlen (login);
+	if (len < sizeof (buf)) {
+		gsize i;
+
+		for (i = 0; i <= len; i++)
+			buf[i] = g_ascii_tolower (login[i]);
+		return g_hash_table_contains (filter->excludes, buf);
+	}
+
+	folded = g_ascii_strdown (login, -1);
+	ret = g_hash_table_contains (filter->excludes, folded);
+	g_free (folded);
+
+	return ret;
+}
+
+gboolean
+mdm_user_filter_accepts (MdmUserFilter       *filter,
+			 const struct passwd *pwent)
+{
+	if ( ! mdm_user_filter_shell_is_valid (filter, pwent->pw_shell))
+		return FALSE;
+
+	if ( ! filter->allow_root && pwent->pw_uid == 0)
+		return FALSE;
+
+	if (pwent->pw_uid < filter->minimal_uid)
+		return FALSE;
+
+	/* locked out */
+	if (pwent->pw_passwd != NULL && strcmp (pwent->pw_passwd, "!!") == 0)
+		return FALSE;
+
+	return ! mdm_user_filter_is_excluded (filter, pwent->pw_name);
+}
@@ -0,0 +1,56 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Which passwd entries the greeters list
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _MDM_USER_FILTER_H
+#define _MDM_USER_FILTER_H
+
+#include <sys/types.h>
+#include <pwd.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Everything the user list checks an entry against, looked up once
+ * per enumeration: the valid login shells from /etc/shells, the
+ * excluded logins and the configuration values.  Checking an entry is
+ * a few hash lookups after that.
+ */
+typedef struct _MdmUserFilter MdmUserFilter;
+
+/* excludes is the comma separated Exclude list, case is ignored */
+MdmUserFilter * mdm_user_filter_new     (gboolean              allow_root,
+					 uid_t                 minimal_uid,
+					 const char           *excludes);
+void            mdm_user_filter_free    (MdmUserFilter        *filter);
+
+/* TRUE if the entry belongs in the user list */
+gboolean        mdm_user_filter_accepts (MdmUserFilter        *filter,
+					 const struct passwd  *pwent);
+
+/* The single checks, for callers that need them apart */
+gboolean        mdm_user_filter_shell_is_valid (MdmUserFilter *filter,
+						const char    *shell);
+gboolean        mdm_user_filter_is_excluded    (MdmUserFilter *filter,
+						const char    *login);
+
+G_END_DECLS
+
+#endif /* _MDM_USER_FILTER_H */
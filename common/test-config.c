@@ -289,11 +289,224 @@ test_config (void)
         mdm_config_free (config);
 }
 
+static void
+test_config_cache (void)
+{
+        MdmCommonConfigCache *cache;
+        GKeyFile             *keyfile;
+        char                 *file;
+        char                 *missing;
+        char                 *value;
+        int                   i;
+
+        g_message ("Testing the config file cache");
+
+        file = g_build_filename (g_get_tmp_dir (), "mdm-test-config-cache", NULL);
+        missing = g_build_filename (g_get_tmp_dir (), "mdm-test-config-cache-missing", NULL);
+        g_unlink (missing);
+
+        g_file_set_contents (file, "[greeter]\nWelcome=one\n", -1, NULL);
+
+        cache = mdm_common_config_cache_new ();
+
+        /* Any number of lookups parse the file once */
+        for (i = 0; i < 1000; i++) {
+                keyfile = mdm_common_config_cache_lookup (cache, ":0", file);
+                g_assert (keyfile != NULL);
+        }
+        g_assert (mdm_common_config_cache_get_parse_count (cache) == 1);
+
+        mdm_common_config_get_string (keyfile, "greeter/Welcome", &value, NULL);
+        g_assert (strcmp (value, "one") == 0);
+        g_free (value);
+
+        /* A file that is not there is remembered without parsing */
+        for (i = 0; i < 1000; i++) {
+                g_assert (mdm_common_config_cache_lookup (cache, ":1", missing) == NULL);
+        }
+        g_assert (mdm_common_config_cache_get_parse_count (cache) == 1);
+
+        /* Changing the file gets it parsed again */
+        g_file_set_contents (file, "[greeter]\nWelcome=second\n", -1, NULL);
+        keyfile = mdm_common_config_cache_lookup (cache, ":0", file);
+        g_assert (mdm_common_config_cache_get_parse_count (cache) == 2);
+
+        mdm_common_config_get_string (keyfile, "greeter/Welcome", &value, NULL);
+        g_assert (strcmp (value, "second") == 0);
+        g_free (value);
+
+        /* and so does invalidating it */
+        mdm_common_config_cache_invalidate (cache, ":0");
+        mdm_common_config_cache_lookup (cache, ":0", file);
+        g_assert (mdm_common_config_cache_get_parse_count (cache) == 3);
+
+        g_print ("Config file cache: %u parses\n",
+                 mdm_common_config_cache_get_parse_count (cache));
+
+        mdm_common_config_cache_free (cache);
+        g_unlink (file);
+        g_free (file);
+        g_free (missing);
+}
+
+#define LOOKUP_ITERATIONS 1000000
+
+/* Compares the old way the daemon getters found a value (parse the
+ * key string, build the path, copy the value) with peeking by id */
+static void
+test_lookup_speed (void)
+{
+        MdmConfig *config;
+        GTimer    *timer;
+        double     by_string;
+        double     by_id;
+        gboolean   debug;
+        int        i;
+
+        g_message ("Timing configuration lookups");
+
+        config = mdm_config_new ();
+        mdm_config_add_static_entries (config, mdm_daemon_config_entries);
+        /* built-in defaults are enough for this */
+        mdm_config_process_all (config, NULL);
+
+        timer = g_timer_new ();
+        for (i = 0; i < LOOKUP_ITERATIONS; i++) {
+                MdmConfigValue *value;
+                char           *group;
+                char           *key;
+
+                mdm_common_config_parse_key_string (MDM_KEY_DEBUG, &group, &key, NULL, NULL);
+                mdm_config_get_value (config, group, key, &value);
+                debug = mdm_config_value_get_bool (value);
+                mdm_config_value_free (value);
+                g_free (group);
+                g_free (key);
+        }
+        by_string = g_timer_elapsed (timer, NULL);
+
+        g_timer_start (timer);
+        for (i = 0; i < LOOKUP_ITERATIONS; i++) {
+                mdm_config_get_bool_for_id (config, MDM_ID_DEBUG, &debug);
+        }
+        by_id = g_timer_elapsed (timer, NULL);
+
+        g_print ("Lookups by key string: %.0f per second\n", LOOKUP_ITERATIONS / by_string);
+        g_print ("Lookups by id:         %.0f per second\n", LOOKUP_ITERATIONS / by_id);
+
+        g_timer_destroy (timer);
+        mdm_config_free (config);
+}
+
+/* What the peek functions returned stays valid after the key is set
+ * again, the daemon getters hand such pointers out */
+static void
+test_value_lifetime (void)
+{
+        MdmConfig  *config;
+        const char *before;
+        const char *after;
+        guint       n_superseded;
+
+        g_message ("Testing peeked values across sets");
+
+        config = mdm_config_new ();
+        mdm_config_add_static_entries (config, mdm_daemon_config_entries);
+        mdm_config_process_all (config, NULL);
+
+        mdm_config_set_string_for_id (config, MDM_ID_GREETER, "first-greeter");
+        g_assert (mdm_config_peek_string_for_id (config, MDM_ID_GREETER, &before));
+
+        mdm_config_set_string_for_id (config, MDM_ID_GREETER, "second-greeter");
+        g_assert (mdm_config_peek_string_for_id (config, MDM_ID_GREETER, &after));
+
+        g_assert (strcmp (before, "first-greeter") == 0);
+        g_assert (strcmp (after, "second-greeter") == 0);
+
+        /* setting the same value again replaces nothing */
+        n_superseded = mdm_config_get_n_superseded (config);
+        g_assert (n_superseded >= 1);
+        mdm_config_set_string_for_id (config, MDM_ID_GREETER, "second-greeter");
+        g_assert (mdm_config_get_n_superseded (config) == n_superseded);
+
+        /* released where the daemon and the slave are back between
+         * messages, the current value is untouched */
+        mdm_config_release_superseded (config);
+        g_assert (mdm_config_get_n_superseded (config) == 0);
+        g_assert (mdm_config_peek_string_for_id (config, MDM_ID_GREETER, &after));
+        g_assert (strcmp (after, "second-greeter") == 0);
+
+        mdm_config_free (config);
+}
+
+/* Loads and looks up every key of a config with n_entries entries,
+ * the time per entry should not grow with the size of the config */
+static double
+time_entry_index (int n_entries)
+{
+        MdmConfig      *config;
+        MdmConfigEntry  entry;
+        GTimer         *timer;
+        double          elapsed;
+        char            key[32];
+        int             i;
+
+        config = mdm_config_new ();
+
+        entry.group = "test";
+        entry.key = key;
+        entry.type = MDM_CONFIG_VALUE_INT;
+        entry.default_value = "0";
+        for (i = 0; i < n_entries; i++) {
+                g_snprintf (key, sizeof (key), "Key%d", i);
+                entry.id = i;
+                mdm_config_add_entry (config, &entry);
+        }
+
+        timer = g_timer_new ();
+
+        mdm_config_process_all (config, NULL);
+        for (i = 0; i < n_entries; i++) {
+                const MdmConfigEntry *found;
+
+                g_snprintf (key, sizeof (key), "Key%d", i);
+                found = mdm_config_lookup_entry (config, "test", key);
+                g_assert (found != NULL && found->id == i);
+                g_assert (mdm_config_lookup_entry_for_id (config, i) == found);
+        }
+
+        elapsed = g_timer_elapsed (timer, NULL);
+
+        g_timer_destroy (timer);
+        mdm_config_free (config);
+
+        return elapsed;
+}
+
+static void
+test_entry_index_speed (void)
+{
+        int n;
+
+        g_message ("Timing entry lookups");
+
+        for (n = 1000; n <= 16000; n *= 2) {
+                double elapsed = time_entry_index (n);
+
+                g_print ("%5d entries: %.3f ms, %.3f us per entry\n",
+                         n, elapsed * 1000.0, elapsed * 1000000.0 / n);
+        }
+}
+
 int
 main (int argc, char **argv)
 {
 
         test_config ();
+        test_config_cache ();
+        test_lookup_speed ();
+        test_value_lifetime ();
+        test_entry_index_speed ();
 
 	return 0;
 }
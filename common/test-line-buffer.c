@@ -0,0 +1,177 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Micro-benchmark for the protocol line framer: pushes a few million
+ * protocol lines through MdmLineBuffer and through the old per-byte
+ * GString reader and checks both hand out exactly the same lines.
+ *
+ * usage: test-line-buffer [lines]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "mdm-line-buffer.h"
+
+static const char *sample_lines[] = {
+        "FLEXI_XSERVER\n",
+        "GET_CONFIG greeter/ShowLastSession\n",
+        "GET_CONFIG_FILE\n",
+        "AUTH_LOCAL 0123456789abcdef0123456789abcdef\r\n",
+        "\n",
+        "ATTACHED_SERVERS\n",
+        "QUERY_LOGOUT_ACTION\n",
+        "VERSION\n",
+        NULL
+};
+
+static GString *
+make_input (int n_lines)
+{
+        GString *input;
+        int      i;
+
+        input = g_string_sized_new (n_lines * 24);
+
+        for (i = 0; i < n_lines; i++) {
+                if (i % 100000 == 99999) {
+                        /* an overlong line now and then */
+                        int j;
+                        for (j = 0; j < 5000; j++)
+                                g_string_append_c (input, 'A' + j % 26);
+                        g_string_append_c (input, '\n');
+                } else {
+                        g_string_append (input, sample_lines[i % (G_N_ELEMENTS (sample_lines) - 1)]);
+                }
+        }
+
+        return input;
+}
+
+/* What mdm_connection_handler used to do, byte by byte */
+static gulong
+frame_per_byte (const GString *input, gsize chunk, guint32 *hash)
+{
+        GString *buffer = g_string_new (NULL);
+        gulong   n = 0;
+        gsize    off, i;
+
+        for (off = 0; off < input->len; off += chunk) {
+                gsize len = MIN (chunk, input->len - off);
+
+                for (i = 0; i < len; i++) {
+                        char c = input->str[off + i];
+
+                        if (c == '\r' ||
+                            (c == '\n' && buffer->len == 0))
+                                continue;
+                        if (c == '\n' ||
+                            buffer->len > MDM_LINE_BUFFER_MAX_LINE) {
+                                *hash = *hash * 31 + g_str_hash (buffer->str);
+                                n++;
+                                g_string_truncate (buffer, 0);
+                        } else {
+                                g_string_append_c (buffer, c);
+                        }
+                }
+        }
+
+        g_string_free (buffer, TRUE);
+        return n;
+}
+
+static gulong
+frame_line_buffer (const GString *input, gsize chunk, guint32 *hash)
+{
+        MdmLineBuffer lb;
+        gulong        n = 0;
+        gsize         off;
+        char         *line;
+
+        mdm_line_buffer_init (&lb);
+
+        for (off = 0; off < input->len; ) {
+                gsize  avail;
+                char  *dest = mdm_line_buffer_reserve (&lb, &avail);
+                gsize  len = MIN (MIN (chunk, avail), input->len - off);
+
+                memcpy (dest, input->str + off, len);
+                mdm_line_buffer_commit (&lb, len);
+                off += len;
+
+                while (mdm_line_buffer_next (&lb, &line)) {
+                        *hash = *hash * 31 + g_str_hash (line);
+                        n++;
+                }
+        }
+
+        mdm_line_buffer_clear (&lb);
+        return n;
+}
+
+int
+main (int argc, char **argv)
+{
+        static const gsize chunks[] = { 1, 7, 512, 4096 };
+        GString *input;
+        GTimer  *timer;
+        int      n_lines = 3000000;
+        int      failed = 0;
+        guint    i;
+
+        if (argc > 1)
+                n_lines = MAX (1, atoi (argv[1]));
+
+        input = make_input (n_lines);
+        timer = g_timer_new ();
+
+        for (i = 0; i < G_N_ELEMENTS (chunks); i++) {
+                guint32 hash_old = 0, hash_new = 0;
+                gulong  n_old, n_new;
+                double  t_old, t_new;
+
+                g_timer_start (timer);
+                n_old = frame_per_byte (input, chunks[i], &hash_old);
+                t_old = g_timer_elapsed (timer, NULL);
+
+                g_timer_start (timer);
+                n_new = frame_line_buffer (input, chunks[i], &hash_new);
+                t_new = g_timer_elapsed (timer, NULL);
+
+                g_print ("chunk %4lu: per-byte %lu lines in %.3f s, "
+                         "line buffer %lu lines in %.3f s (%.1fx)\n",
+                         (gulong) chunks[i], n_old, t_old, n_new, t_new,
+                         t_new > 0 ? t_old / t_new : 0.0);
+
+                if (n_old != n_new || hash_old != hash_new) {
+                        g_warning ("Framing differs for chunk size %lu",
+                                   (gulong) chunks[i]);
+                        failed = 1;
+                }
+        }
+
+        g_timer_destroy (timer);
+        g_string_free (input, TRUE);
+
+        return failed;
+}
@@ -0,0 +1,224 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Benchmark of the user list enumeration: writes a synthetic passwd
+ * file and runs every entry through the checks the greeters make, once
+ * the old way (/etc/shells scanned and the configuration looked up for
+ * every entry, the Exclude list searched linearly) and once through
+ * MdmUserFilter.  Checks both accept exactly the same entries.
+ *
+ * usage: test-user-filter [entries] [excludes]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pwd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "mdm-bench.h"
+#include "mdm-user-filter.h"
+
+#define KEY_ALLOW_ROOT  "security/AllowRoot=true"
+#define KEY_MINIMAL_UID "greeter/MinimalUID=1000"
+
+static const char *shells[] = {
+        "/bin/bash", "/bin/sh", "/usr/bin/zsh", "/bin/false",
+        "/usr/sbin/nologin", "/bin/true", "/usr/local/bin/fish", NULL
+};
+
+/* Stands in for the greeter's configuration cache */
+static GHashTable *config;
+
+static int
+config_get_int (const char *key)
+{
+        return atoi (g_hash_table_lookup (config, key));
+}
+
+static gboolean
+config_get_bool (const char *key)
+{
+        return strcmp (g_hash_table_lookup (config, key), "true") == 0;
+}
+
+/* The checks as the greeters made them before MdmUserFilter */
+static gboolean
+old_check_shell (const char *usersh)
+{
+        gboolean found = FALSE;
+        char    *csh;
+
+        if (strcmp (usersh, NOLOGIN) == 0 ||
+            strcmp (usersh, "/bin/true") == 0 ||
+            strcmp (usersh, "/bin/false") == 0)
+                return FALSE;
+
+        setusershell ();
+        while ((csh = getusershell ()) != NULL)
+                if (strcmp (csh, usersh) == 0)
+                        found = TRUE;
+        endusershell ();
+
+        return found;
+}
+
+static gboolean
+old_check_exclude (struct passwd *pwent, char **excludes)
+{
+        int i;
+
+        if ( ! config_get_bool (KEY_ALLOW_ROOT) && pwent->pw_uid == 0)
+                return TRUE;
+
+        if (pwent->pw_uid < (uid_t) config_get_int (KEY_MINIMAL_UID))
+                return TRUE;
+
+        if (strcmp ("!!", pwent->pw_passwd) == 0)
+                return TRUE;
+
+        for (i = 0; excludes[i] != NULL; i++)
+                if (g_ascii_strcasecmp (excludes[i], pwent->pw_name) == 0)
+                        return TRUE;
+
+        return FALSE;
+}
+
+static char *
+write_passwd (int n_entries)
+{
+        char *path;
+        FILE *fp;
+        int   fd, i;
+
+        fd = g_file_open_tmp ("mdm-passwd-XXXXXX", &path, NULL);
+        if (fd < 0)
+                return NULL;
+        fp = fdopen (fd, "w");
+
+        fprintf (fp, "root:x:0:0:root:/root:/bin/bash\n");
+        for (i = 1; i < n_entries; i++) {
+                fprintf (fp, "user%05d:%s:%d:%d:User %d,,,:/home/user%05d:%s\n",
+                         i,
+                         (i % 97 == 0) ? "!!" : "x",
+                         (i % 10 == 0) ? 100 + i % 900 : 1000 + i,
+                         100,
+                         i, i,
+                         shells[i % (G_N_ELEMENTS (shells) - 1)]);
+        }
+        fclose (fp);
+
+        return path;
+}
+
+int
+main (int argc, char **argv)
+{
+        int            n_entries = 50000;
+        int            n_excludes = 200;
+        char          *path;
+        GString       *exclude_list;
+        char         **excludes;
+        MdmUserFilter *filter;
+        struct passwd *pwent;
+        FILE          *fp;
+        GPtrArray     *old_accepted;
+        double         start, old_time, new_time;
+        int            i, n_new = 0, mismatches = 0;
+
+        if (argc > 1)
+                n_entries = MAX (1, atoi (argv[1]));
+        if (argc > 2)
+                n_excludes = MAX (0, atoi (argv[2]));
+
+        config = g_hash_table_new (g_str_hash, g_str_equal);
+        g_hash_table_insert (config, KEY_ALLOW_ROOT, "true");
+        g_hash_table_insert (config, KEY_MINIMAL_UID, "1000");
+
+        exclude_list = g_string_new ("bin,daemon,adm,lp,sync,shutdown,halt,mail,nobody");
+        for (i = 0; i < n_excludes; i++)
+                g_string_append_printf (exclude_list, ",USER%05d", i * 7 + 3);
+
+        path = write_passwd (n_entries);
+        if (path == NULL) {
+                perror ("g_file_open_tmp");
+                return 1;
+        }
+
+        g_print ("%d passwd entries, %d excluded names\n", n_entries, n_excludes + 9);
+
+        /* old */
+        old_accepted = g_ptr_array_new_with_free_func (g_free);
+        start = mdm_bench_now ();
+        excludes = g_strsplit (exclude_list->str, ",", 0);
+        for (i = 0; excludes[i] != NULL; i++)
+                g_strstrip (excludes[i]);
+        fp = fopen (path, "r");
+        while ((pwent = fgetpwent (fp)) != NULL) {
+                if (pwent->pw_shell &&
+                    old_check_shell (pwent->pw_shell) &&
+                    ! old_check_exclude (pwent, excludes))
+                        g_ptr_array_add (old_accepted, g_strdup (pwent->pw_name));
+        }
+        fclose (fp);
+        g_strfreev (excludes);
+        old_time = mdm_bench_now () - start;
+
+        /* new */
+        start = mdm_bench_now ();
+        filter = mdm_user_filter_new (config_get_bool (KEY_ALLOW_ROOT),
+                                      config_get_int (KEY_MINIMAL_UID),
+                                      exclude_list->str);
+        fp = fopen (path, "r");
+        while ((pwent = fgetpwent (fp)) != NULL) {
+                if ( ! mdm_user_filter_accepts (filter, pwent))
+                        continue;
+
+                if ((guint) n_new >= old_accepted->len ||
+                    strcmp (g_ptr_array_index (old_accepted, n_new), pwent->pw_name) != 0)
+                        mismatches++;
+                n_new++;
+        }
+        fclose (fp);
+        mdm_user_filter_free (filter);
+        new_time = mdm_bench_now () - start;
+
+        if ((guint) n_new != old_accepted->len)
+                mismatches++;
+
+        g_print ("accepted:      %u old, %d new\n", old_accepted->len, n_new);
+        g_print ("old checks:    %.3f s  (%.2f us per entry)\n",
+                 old_time, old_time * 1000000.0 / n_entries);
+        g_print ("MdmUserFilter: %.3f s  (%.2f us per entry)\n",
+                 new_time, new_time * 1000000.0 / n_entries);
+        g_print ("speedup:       %.0fx\n", new_time > 0 ? old_time / new_time : 0.0);
+        g_print ("mismatches:    %d\n", mismatches);
+
+        g_unlink (path);
+        g_free (path);
+        g_ptr_array_free (old_accepted, TRUE);
+        g_string_free (exclude_list, TRUE);
+        g_hash_table_destroy (config);
+
+        return mismatches == 0 ? 0 : 1;
+}
@@ -293,7 +293,7 @@ mdm_auth_secure_display (MdmDisplay *d)
 	}
 	g_setenv ("XAUTHORITY", MDM_AUTHFILE (d), TRUE);
 
-	if G_UNLIKELY (mdm_daemon_config_get_value_bool (MDM_KEY_DEBUG))
+	if G_UNLIKELY (mdm_daemon_config_get_bool_for_id (MDM_ID_DEBUG))
 		mdm_debug ("mdm_auth_secure_display: Setting up access for %s - %d entries", 
 			   d->name, g_slist_length (d->auths));
 
@@ -468,7 +468,7 @@ get_local_auths (MdmDisplay *d)
 		}
 	}
 
-	if G_UNLIKELY (mdm_daemon_config_get_value_bool (MDM_KEY_DEBUG))
+	if G_UNLIKELY (mdm_daemon_config_get_bool_for_id (MDM_ID_DEBUG))
 		mdm_debug ("get_local_auths: Setting up access for %s - %d entries",
 			   d->name, g_slist_length (auths));
 
@@ -42,11 +42,10 @@
 #include "mdm-common.h"
 #include "mdm-log.h"
 #include "mdm-daemon-config.h"
+#include "mdm-child-watch.h"
 
 /* External vars */
-extern MdmConnection *pipeconn;
 extern MdmConnection *unixconn;
-extern int slave_fifo_pipe_fd; /* the slavepipe (like fifo) connection, this is the write end */
 extern gint flexi_servers;
 
 /**
@@ -112,12 +111,14 @@ mdm_display_alloc (gint id, const gchar *command, const gchar *device)
     d->retry_count = 0;
     d->sleep_before_run = 0;
     d->login = NULL;
+    d->login_uid_known = FALSE;
     d->preset_user = NULL;
 
     d->timed_login_ok = FALSE;
 
     d->slave_notify_fd = -1;
     d->master_notify_fd = -1;
+    d->slave_conn = NULL;
 
     d->xsession_errors_bytes = 0;
     d->xsession_errors_fd = -1;
@@ -241,6 +242,46 @@ mdm_display_check_loop (MdmDisplay *disp)
   return TRUE;
 }
 
+static void
+slave_channel_closed (gpointer data)
+{
+    MdmDisplay *d = data;
+
+    /* the connection closes the fd */
+    d->slave_conn = NULL;
+    d->master_notify_fd = -1;
+}
+
+static gboolean
+open_slave_channel (MdmDisplay *d, int fd)
+{
+    d->slave_conn = mdm_connection_open_fd (fd);
+    if (d->slave_conn == NULL)
+	    return FALSE;
+
+    d->master_notify_fd = fd;
+    mdm_connection_set_handler (d->slave_conn,
+				mdm_handle_slave_request,
+				d /* data */,
+				NULL /* destroy_notify */);
+    mdm_connection_set_close_notify (d->slave_conn, d, slave_channel_closed);
+    return TRUE;
+}
+
+static void
+close_slave_channel (MdmDisplay *d)
+{
+    if (d->slave_conn != NULL) {
+	    MdmConnection *conn = d->slave_conn;
+	    d->slave_conn = NULL;
+	    mdm_connection_set_close_notify (conn, NULL, NULL);
+	    mdm_connection_close (conn);
+    } else if (d->master_notify_fd >= 0) {
+	    VE_IGNORE_EINTR (close (d->master_notify_fd));
+    }
+    d->master_notify_fd = -1;
+}
+
 static void
 whack_old_slave (MdmDisplay *d, gboolean kill_connection)
 {
@@ -256,10 +297,7 @@ whack_old_slave (MdmDisplay *d, gboolean kill_connection)
 	    }
     }
 
-    if (d->master_notify_fd >= 0) {
-	    VE_IGNORE_EINTR (close (d->master_notify_fd));
-	    d->master_notify_fd = -1;
-    }
+    close_slave_channel (d);
 
     /* if we have DISPLAY_DEAD set, then this has already been killed */
     if (d->dispstat == DISPLAY_DEAD)
@@ -268,19 +306,16 @@ whack_old_slave (MdmDisplay *d, gboolean kill_connection)
     /* Kill slave */
     if (d->slavepid > 1 &&
 	(d->dispstat == DISPLAY_DEAD || kill (d->slavepid, SIGTERM) == 0)) {
-	    int exitstatus;
+	    int exitstatus = 0;
 	    int ret;
-wait_again:
-		
-	    if (waitsleep) {
-		    /* wait for some signal, yes this is a race */
-		    mdm_debug ("mdm whack_old_slave: sleeping for 10 seconds");
-		    sleep (10);
-		  }
-	    waitsleep = TRUE;
-	    errno = 0;
-	    ret = waitpid (d->slavepid, &exitstatus, WNOHANG);
-	    if (ret <= 0) {
+
+	    for (;;) {
+		    ret = mdm_child_watch_wait (d->slavepid, &exitstatus,
+						waitsleep ? 10 : 0);
+		    if (ret != 0)
+			    break;
+		    waitsleep = TRUE;
+
 		    /* rekill the slave to tell it to
 		       hurry up and die if we're getting
 		       killed ourselves */
@@ -289,13 +324,10 @@ wait_again:
 			    mdm_debug ("whack_old_slave: GOT ANOTHER SIGTERM (or it was 10 secs already), killing slave again with SIGKILL");
 			    t = time (NULL);
 			    kill (d->slavepid, SIGKILL);
-			    goto wait_again;
-		    } else if (ret < 0 && errno == EINTR) {
-			    goto wait_again;
 		    }
 	    }
 
-	    if (WIFSIGNALED (exitstatus)) {
+	    if (ret > 0 && WIFSIGNALED (exitstatus)) {
 		    mdm_debug ("whack_old_slave: Slave crashed (signal %d), killing its children",
 			       (int)WTERMSIG (exitstatus));
 
@@ -310,10 +342,10 @@ wait_again:
 		    d->chooserpid = 0;
 		    if (d->servpid > 1)
 			    kill (d->servpid, SIGTERM);
-		    d->servpid = 0;
+		    mdm_display_set_servpid (d, 0);
 	    }
     }
-    d->slavepid = 0;
+    mdm_display_set_slavepid (d, 0);
 }
 
 /**
@@ -328,16 +360,13 @@ mdm_display_manage (MdmDisplay *d)
 {
     pid_t pid;
     int fds[2];
+    GSList *li;
 
     if (!d) 
 	return FALSE;
 
     mdm_debug ("mdm_display_manage: Managing %s", d->name);
 
-    if (pipe (fds) < 0) {
-	    mdm_error ("mdm_display_manage: Cannot create pipe");
-    }
-
     if ( ! mdm_display_check_loop (d))
 	    return FALSE;
 
@@ -355,10 +384,18 @@ mdm_display_manage (MdmDisplay *d)
 
     d->managetime = time (NULL);
 
+    /* Every slave gets its own channel, so the daemon knows who is
+     * talking and can answer right away */
+    if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+	    mdm_error ("mdm_display_manage: Cannot create slave channel: %s",
+		       strerror (errno));
+	    return FALSE;
+    }
+
     mdm_debug ("Forking slave process");
 
     /* Fork slave process */
-    pid = d->slavepid = fork ();
+    pid = fork ();
 
     switch (pid) {
 
@@ -375,20 +412,29 @@ mdm_display_manage (MdmDisplay *d)
 	 * default values, we'll make them more fun later */
 	mdm_unset_signals ();
 
-	d->slavepid = getpid ();
+	mdm_display_set_slavepid (d, getpid ());
+
+	/* the slave does its own reaping */
+	mdm_child_watch_shutdown ();
 	
-	mdm_connection_close (pipeconn);
-	pipeconn = NULL;
 	mdm_connection_close (unixconn);
 	unixconn = NULL;
 
+	/* nobody else's channel is any of our business */
+	VE_IGNORE_EINTR (close (fds[1]));
+	for (li = mdm_display_get_list (); li != NULL; li = li->next) {
+		MdmDisplay *disp = li->data;
+		if (disp->master_notify_fd >= 0)
+			VE_IGNORE_EINTR (close (disp->master_notify_fd));
+	}
+
 	mdm_log_shutdown ();
 
 	/* Debian changes */
 #if 0
 	/* upstream version */
 -	/* Close everything */
--	mdm_close_all_descriptors (0 /* from */, fds[0] /* except */, slave_fifo_pipe_fd /* except2 */);
+-	mdm_close_all_descriptors (0 /* from */, fds[0] /* except */, -1 /* except2 */);
 #endif
 	/* Close stdin/stdout/stderr.  Leave others, as pam modules may have them open */
 	VE_IGNORE_EINTR (close (0));
@@ -407,6 +453,8 @@ mdm_display_manage (MdmDisplay *d)
 	d->slave_notify_fd = fds[0];
 
 	fcntl (d->slave_notify_fd, F_SETFL, fcntl (d->slave_notify_fd, F_GETFL) | O_NONBLOCK);
+	/* the greeter and the session have no business on it */
+	fcntl (d->slave_notify_fd, F_SETFD, FD_CLOEXEC);
 
 	mdm_slave_start (d);
 	/* should never retern */
@@ -418,15 +466,22 @@ mdm_display_manage (MdmDisplay *d)
 	break;
 
     case -1:
-	d->slavepid = 0;
+	mdm_display_set_slavepid (d, 0);
 	mdm_error ("mdm_display_manage: Failed forking MDM slave process for %s", d->name);
+	VE_IGNORE_EINTR (close (fds[0]));
+	VE_IGNORE_EINTR (close (fds[1]));
 
 	return FALSE;
 
     default:
 	mdm_debug ("mdm_display_manage: Forked slave: %d", (int)pid);
-	d->master_notify_fd = fds[1];
+	mdm_display_set_slavepid (d, pid);
+	mdm_child_watch_add (pid, mdm_child_action, d);
 	VE_IGNORE_EINTR (close (fds[0]));
+	if ( ! open_slave_channel (d, fds[1])) {
+		mdm_error ("mdm_display_manage: Cannot watch the channel of %s", d->name);
+		VE_IGNORE_EINTR (close (fds[1]));
+	}
 	break;
     }
 
@@ -481,28 +536,6 @@ mdm_display_unmanage (MdmDisplay *d)
 }
 
 
-/* Why recount?  It's just a lot more robust this way and
-   gets around those nasty one off errors and races.  And we never
-   have so many displays that this would get too slow. */
-static void
-count_session_limits (void)
-{
-	GSList *li;
-	GSList *displays;
-
-	displays = mdm_daemon_config_get_display_list ();
-
-	flexi_servers = 0;
-
-	for (li = displays; li != NULL; li = li->next) {
-		MdmDisplay *d = li->data;
-
-		if (SERVER_IS_FLEXI (d)) {
-			flexi_servers++;
-		}
-	}
-}
-
 /**
  * mdm_display_dispose:
  * @d: Pointer to a MdmDisplay struct
@@ -521,6 +554,9 @@ mdm_display_dispose (MdmDisplay *d)
     if (unixconn != NULL)
             mdm_kill_subconnections_with_display (unixconn, d);
 
+    if (d->slavepid > 1)
+	    mdm_child_watch_remove (d->slavepid);
+
     if (d->socket_conn != NULL) {
 	    MdmConnection *conn = d->socket_conn;
 	    d->socket_conn = NULL;
@@ -532,18 +568,13 @@ mdm_display_dispose (MdmDisplay *d)
 	    d->slave_notify_fd = -1;
     }
 
-    if (d->master_notify_fd >= 0) {
-	    VE_IGNORE_EINTR (close (d->master_notify_fd));
-	    d->master_notify_fd = -1;
-    }
+    close_slave_channel (d);
 
-    mdm_daemon_config_display_list_remove (d);
+    mdm_display_remove (d);
 
     d->dispstat = DISPLAY_DEAD;
     d->type = -1;
 
-    count_session_limits ();
-
     if (d->name) {
 	mdm_debug ("mdm_display_dispose: Disposing %s", d->name);
 	g_free (d->name);
@@ -601,6 +632,7 @@ mdm_display_dispose (MdmDisplay *d)
    
     g_free (d->login);
     d->login = NULL;
+    d->login_uid_known = FALSE;
 
     g_free (d->preset_user);
     d->preset_user = NULL;
@@ -636,6 +668,249 @@ mdm_display_dispose (MdmDisplay *d)
 }
 
 
+/*
+ * The display registry.  Every display the daemon knows about is in
+ * one list, which is what callers iterate over, and the list is
+ * indexed by slave pid, X server pid, display number and name so that
+ * slave messages and reaped children do not have to walk it.
+ *
+ * Once a display is registered, the daemon changes those fields only
+ * through the mdm_display_set_* functions.  Lookups check the field
+ * anyway, so a slave process writing to its copy of a display does no
+ * harm, and unregistering drops every index entry for the display.
+ */
+typedef enum {
+	INDEX_SLAVEPID,
+	INDEX_SERVPID,
+	INDEX_NUMBER,
+	INDEX_NAME,
+	N_INDEXES
+} DisplayIndex;
+
+static GSList     *display_list = NULL;
+static GSList     *display_list_tail = NULL;
+static GHashTable *display_index[N_INDEXES] = { NULL };
+
+/* NULL if the display has no key in the index */
+static gconstpointer
+display_index_key (DisplayIndex index, MdmDisplay *d)
+{
+	switch (index) {
+	case INDEX_SLAVEPID:
+		return d->slavepid > 0 ? GINT_TO_POINTER (d->slavepid) : NULL;
+	case INDEX_SERVPID:
+		return d->servpid > 0 ? GINT_TO_POINTER (d->servpid) : NULL;
+	case INDEX_NUMBER:
+		/* :0 is a perfectly good display */
+		return GINT_TO_POINTER (d->dispnum + 1);
+	case INDEX_NAME:
+		return d->name;
+	default:
+		g_assert_not_reached ();
+		return NULL;
+	}
+}
+
+static gboolean
+display_index_key_equal (DisplayIndex index, gconstpointer a, gconstpointer b)
+{
+	if (index == INDEX_NAME)
+		return a != NULL && b != NULL && strcmp (a, b) == 0;
+	return a == b;
+}
+
+static void
+display_index_add (DisplayIndex index, MdmDisplay *d)
+{
+	gconstpointer key;
+
+	if ( ! d->registered)
+		return;
+
+	key = display_index_key (index, d);
+	/* numbers and names may be shared for a moment by flexi
+	 * servers that are starting up, the first one wins */
+	if (key != NULL && g_hash_table_lookup (display_index[index], key) == NULL)
+		g_hash_table_insert (display_index[index], (gpointer) key, d);
+}
+
+static gboolean
+display_is (gpointer key, gpointer value, gpointer d)
+{
+	return value == d;
+}
+
+/* With purge, also drops entries for keys the display no longer has,
+ * which is only worth it when the display goes away */
+static void
+display_index_remove (DisplayIndex index, MdmDisplay *d, gboolean purge)
+{
+	gconstpointer key;
+	GSList       *li;
+
+	if ( ! d->registered)
+		return;
+
+	key = display_index_key (index, d);
+	if (purge)
+		g_hash_table_foreach_remove (display_index[index], display_is, d);
+	else if (key != NULL && g_hash_table_lookup (display_index[index], key) == d)
+		g_hash_table_remove (display_index[index], key);
+
+	/* hand the key to a display that shares it, live displays only
+	 * share the number and name of flexi servers still starting up,
+	 * so this is only needed when one goes away */
+	if ( ! purge || key == NULL ||
+	    index == INDEX_SLAVEPID || index == INDEX_SERVPID)
+		return;
+	for (li = display_list; li != NULL; li = li->next) {
+		MdmDisplay *other = li->data;
+
+		if (other != d &&
+		    display_index_key_equal (index, key, display_index_key (index, other))) {
+			display_index_add (index, other);
+			break;
+		}
+	}
+}
+
+static void
+display_register (MdmDisplay *d)
+{
+	int i;
+
+	if (display_index[INDEX_SLAVEPID] == NULL) {
+		display_index[INDEX_SLAVEPID] = g_hash_table_new (NULL, NULL);
+		display_index[INDEX_SERVPID] = g_hash_table_new (NULL, NULL);
+		display_index[INDEX_NUMBER] = g_hash_table_new (NULL, NULL);
+		display_index[INDEX_NAME] = g_hash_table_new (g_str_hash, g_str_equal);
+	}
+
+	d->registered = TRUE;
+	for (i = 0; i < N_INDEXES; i++)
+		display_index_add (i, d);
+
+	if (SERVER_IS_FLEXI (d))
+		flexi_servers++;
+}
+
+/**
+ * mdm_display_get_list:
+ *
+ * Returns the list of displays, which belongs to the registry
+ */
+GSList *
+mdm_display_get_list (void)
+{
+	return display_list;
+}
+
+/**
+ * mdm_display_add:
+ * @d: Pointer to a MdmDisplay struct
+ *
+ * Adds the display at the end of the display list
+ */
+void
+mdm_display_add (MdmDisplay *d)
+{
+	GSList *link;
+
+	g_return_if_fail (d != NULL && ! d->registered);
+
+	link = g_slist_alloc ();
+	link->data = d;
+	link->next = NULL;
+	if (display_list_tail != NULL)
+		display_list_tail->next = link;
+	else
+		display_list = link;
+	display_list_tail = link;
+
+	display_register (d);
+}
+
+/**
+ * mdm_display_add_sorted:
+ * @d: Pointer to a MdmDisplay struct
+ *
+ * Adds the display to the display list in order of display number,
+ * for the static displays from the configuration file
+ */
+void
+mdm_display_add_sorted (MdmDisplay *d)
+{
+	g_return_if_fail (d != NULL && ! d->registered);
+
+	display_list = g_slist_insert_sorted (display_list, d,
+					      mdm_daemon_config_compare_displays);
+	display_list_tail = g_slist_last (display_list);
+
+	display_register (d);
+}
+
+/**
+ * mdm_display_remove:
+ * @d: Pointer to a MdmDisplay struct
+ *
+ * Takes the display out of the display list and the indexes
+ */
+void
+mdm_display_remove (MdmDisplay *d)
+{
+	int i;
+
+	if ( ! d->registered)
+		return;
+
+	display_list = g_slist_remove (display_list, d);
+	display_list_tail = g_slist_last (display_list);
+
+	for (i = 0; i < N_INDEXES; i++)
+		display_index_remove (i, d, TRUE);
+	d->registered = FALSE;
+
+	if (SERVER_IS_FLEXI (d))
+		flexi_servers--;
+}
+
+void
+mdm_display_set_slavepid (MdmDisplay *d, pid_t pid)
+{
+	display_index_remove (INDEX_SLAVEPID, d, FALSE);
+	d->slavepid = pid;
+	display_index_add (INDEX_SLAVEPID, d);
+}
+
+void
+mdm_display_set_servpid (MdmDisplay *d, pid_t pid)
+{
+	display_index_remove (INDEX_SERVPID, d, FALSE);
+	d->servpid = pid;
+	display_index_add (INDEX_SERVPID, d);
+}
+
+/**
+ * mdm_display_set_number:
+ * @d: Pointer to a MdmDisplay struct
+ * @num: Local display number
+ *
+ * Sets the display number and the name that goes with it
+ */
+void
+mdm_display_set_number (MdmDisplay *d, int num)
+{
+	display_index_remove (INDEX_NUMBER, d, FALSE);
+	display_index_remove (INDEX_NAME, d, FALSE);
+
+	g_free (d->name);
+	d->name = g_strdup_printf (":%d", num);
+	d->dispnum = num;
+
+	display_index_add (INDEX_NUMBER, d);
+	display_index_add (INDEX_NAME, d);
+}
+
 /**
  * mdm_display_lookup:
  * @pid: pid of slave process to look up
@@ -646,23 +921,81 @@ mdm_display_dispose (MdmDisplay *d)
 MdmDisplay *
 mdm_display_lookup (pid_t pid)
 {
-    GSList *li;
-    GSList *displays;
+    MdmDisplay *d;
 
-    displays = mdm_daemon_config_get_display_list ();
+    if (pid <= 0 || display_index[INDEX_SLAVEPID] == NULL)
+	    return NULL;
 
-    /* Find slave in display list */
-    for (li = displays; li != NULL; li = li->next) {
-	    MdmDisplay *d = li->data;
+    d = g_hash_table_lookup (display_index[INDEX_SLAVEPID], GINT_TO_POINTER (pid));
+    if (d != NULL && d->slavepid == pid)
+	    return d;
 
-	    if (d != NULL &&
-		pid == d->slavepid)
-		    return d;
-    }
-     
     /* Slave not found */
     return NULL;
 }
 
+/**
+ * mdm_display_lookup_server:
+ * @pid: pid of the X server to look up
+ *
+ * Return the display the X server with pid belongs to
+ */
+MdmDisplay *
+mdm_display_lookup_server (pid_t pid)
+{
+    MdmDisplay *d;
+
+    if (pid <= 0 || display_index[INDEX_SERVPID] == NULL)
+	    return NULL;
+
+    d = g_hash_table_lookup (display_index[INDEX_SERVPID], GINT_TO_POINTER (pid));
+    if (d != NULL && d->servpid == pid)
+	    return d;
+
+    return NULL;
+}
+
+/**
+ * mdm_display_lookup_number:
+ * @num: Local display number
+ *
+ * Return the display with number num
+ */
+MdmDisplay *
+mdm_display_lookup_number (int num)
+{
+    MdmDisplay *d;
+
+    if (display_index[INDEX_NUMBER] == NULL)
+	    return NULL;
+
+    d = g_hash_table_lookup (display_index[INDEX_NUMBER], GINT_TO_POINTER (num + 1));
+    if (d != NULL && d->dispnum == num)
+	    return d;
+
+    return NULL;
+}
+
+/**
+ * mdm_display_lookup_name:
+ * @name: value of DISPLAY, e.g. ":0"
+ *
+ * Return the display with name
+ */
+MdmDisplay *
+mdm_display_lookup_name (const char *name)
+{
+    MdmDisplay *d;
+
+    if (name == NULL || display_index[INDEX_NAME] == NULL)
+	    return NULL;
+
+    d = g_hash_table_lookup (display_index[INDEX_NAME], name);
+    if (d != NULL && d->name != NULL && strcmp (d->name, name) == 0)
+	    return d;
+
+    return NULL;
+}
+
 
 /* EOF */
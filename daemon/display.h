@@ -57,6 +57,8 @@ struct _MdmDisplay
 	guint8 type;
 	Display *dsp;
 
+	gboolean registered; /* in the display registry, see display.c */
+
 	gchar *name;     /* value of DISPLAY */
 	gchar *hostname; /* remote hostname */
 
@@ -67,6 +69,8 @@ struct _MdmDisplay
 
 	gboolean logged_in; /* TRUE if someone is logged in */
 	char *login;
+	uid_t login_uid;    /* of login, (uid_t) -1 if there is no such user */
+	gboolean login_uid_known; /* login_uid was looked up for login */
 
 	gboolean attached;  /* Display is physically attached to the machine. */
 
@@ -112,9 +116,11 @@ struct _MdmDisplay
 	pid_t fbconsolepid;
 	int last_sess_status; /* status returned by last session */
 
-	/* Notification connection */
-	int master_notify_fd;  /* write part of the connection */
-	int slave_notify_fd; /* read part of the connection */
+	/* The slave's channel, a socketpair: the slave sends its requests
+	 * on it and the daemon answers and notifies on the same socket */
+	int master_notify_fd;  /* daemon end */
+	int slave_notify_fd; /* slave end */
+	MdmConnection *slave_conn; /* reads the requests from master_notify_fd */
 	/* The xsession-errors connection */
 	int xsession_errors_fd; /* write to the file */
 	int session_output_fd; /* read from the session */
@@ -188,5 +194,17 @@ void        mdm_display_dispose  (MdmDisplay *d);
 void        mdm_display_unmanage (MdmDisplay *d);
 MdmDisplay *mdm_display_lookup   (pid_t pid);
 
+/* Display registry */
+GSList     *mdm_display_get_list      (void);
+void        mdm_display_add           (MdmDisplay *d);
+void        mdm_display_add_sorted    (MdmDisplay *d);
+void        mdm_display_remove        (MdmDisplay *d);
+void        mdm_display_set_slavepid  (MdmDisplay *d, pid_t pid);
+void        mdm_display_set_servpid   (MdmDisplay *d, pid_t pid);
+void        mdm_display_set_number    (MdmDisplay *d, int num);
+MdmDisplay *mdm_display_lookup_server (pid_t pid);
+MdmDisplay *mdm_display_lookup_number (int num);
+MdmDisplay *mdm_display_lookup_name   (const char *name);
+
 #endif /* _MDM_DISPLAY_H */
 
@@ -0,0 +1,447 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <glib.h>
+
+#include "mdm-child-watch.h"
+
+#include "mdm-common.h"
+#include "mdm-log.h"
+#include "ve-signal.h"
+
+#ifdef SYS_pidfd_open
+#define HAVE_PIDFD 1
+#endif
+
+/*
+ * How we learn that a child exited, best first:
+ *
+ * pidfd: every watched child has a descriptor in the main loop which
+ * becomes readable when it exits.  Children that die together are all
+ * dispatched in the same main loop iteration and no signal handler is
+ * involved at all.
+ *
+ * signalfd: SIGCHLD stays blocked and is read from a descriptor instead,
+ * each wakeup reaps everything that has exited.
+ *
+ * Otherwise the SIGCHLD handler pokes the main loop through ve-signal,
+ * again reaping everything per wakeup.
+ */
+typedef enum {
+	WATCH_SIGNAL,
+	WATCH_SIGNALFD,
+	WATCH_PIDFD
+} WatchMode;
+
+typedef struct {
+	pid_t             pid;
+	int               pidfd;
+	guint             source;
+	MdmChildWatchFunc func;
+	gpointer          data;
+} ChildWatch;
+
+static WatchMode mode = WATCH_SIGNAL;
+static GHashTable *watches = NULL;
+static MdmChildWatchFunc unwatched_func = NULL;
+static int signal_fd = -1;
+static guint signal_source = 0;
+static guint reap_idle = 0;
+
+/**
+ * mdm_child_watch_open_pidfd:
+ *
+ * Returns a close-on-exec descriptor that becomes readable once pid
+ * exits, or -1 with errno set if the system cannot do that.
+ */
+int
+mdm_child_watch_open_pidfd (pid_t pid)
+{
+#ifdef HAVE_PIDFD
+	return syscall (SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static void
+child_watch_free (ChildWatch *watch)
+{
+	if (watch->source > 0)
+		g_source_remove (watch->source);
+	if (watch->pidfd >= 0)
+		VE_IGNORE_EINTR (close (watch->pidfd));
+	g_free (watch);
+}
+
+static void
+ensure_watches (void)
+{
+	if (watches == NULL)
+		watches = g_hash_table_new_full (NULL, NULL, NULL,
+						 (GDestroyNotify) child_watch_free);
+}
+
+static guint
+add_fd_watch (int fd, GIOFunc func, gpointer data)
+{
+	GIOChannel *chan;
+	guint       source;
+
+	chan = g_io_channel_unix_new (fd);
+	g_io_channel_set_encoding (chan, NULL, NULL);
+	g_io_channel_set_buffered (chan, FALSE);
+
+	source = g_io_add_watch_full (chan, G_PRIORITY_DEFAULT,
+				      G_IO_IN | G_IO_HUP | G_IO_ERR,
+				      func, data, NULL);
+	g_io_channel_unref (chan);
+
+	return source;
+}
+
+static void
+child_exited (pid_t pid, int exitstatus)
+{
+	ChildWatch *watch;
+
+	watch = g_hash_table_lookup (watches, GINT_TO_POINTER (pid));
+	if (watch == NULL) {
+		if (unwatched_func != NULL)
+			(* unwatched_func) (pid, exitstatus, NULL);
+		return;
+	}
+
+	/* The callback may well fork a new child, which can even get the
+	 * same pid, so this watch has to be out of the way first */
+	g_hash_table_steal (watches, GINT_TO_POINTER (pid));
+	(* watch->func) (pid, exitstatus, watch->data);
+	child_watch_free (watch);
+}
+
+static void
+reap_children (void)
+{
+	for (;;) {
+		int   exitstatus;
+		pid_t pid;
+
+		VE_IGNORE_EINTR (pid = waitpid (-1, &exitstatus, WNOHANG));
+		if (pid <= 0)
+			break;
+
+		child_exited (pid, exitstatus);
+	}
+}
+
+static gboolean
+reap_idle_func (gpointer data)
+{
+	reap_idle = 0;
+	reap_children ();
+
+	return FALSE;
+}
+
+/* Returns TRUE for as long as the child is running */
+static gboolean
+check_child (ChildWatch *watch)
+{
+	int   exitstatus;
+	pid_t pid;
+
+	VE_IGNORE_EINTR (pid = waitpid (watch->pid, &exitstatus, WNOHANG));
+	if (pid == 0)
+		return TRUE;
+
+	/* our return value takes care of the source */
+	watch->source = 0;
+
+	if (pid == watch->pid)
+		child_exited (pid, exitstatus);
+	else
+		/* somebody waited for it synchronously */
+		mdm_child_watch_remove (watch->pid);
+
+	/* and whatever else exited meanwhile goes in the same wakeup */
+	reap_children ();
+
+	return FALSE;
+}
+
+#ifdef HAVE_PIDFD
+static gboolean
+pidfd_ready (GIOChannel *source, GIOCondition cond, gpointer data)
+{
+	return check_child (data);
+}
+#endif
+
+static gboolean
+poll_child (gpointer data)
+{
+	return check_child (data);
+}
+
+#ifdef HAVE_SYS_SIGNALFD_H
+static void
+drain_signalfd (void)
+{
+	struct signalfd_siginfo info[8];
+	ssize_t n;
+
+	do {
+		VE_IGNORE_EINTR (n = read (signal_fd, info, sizeof (info)));
+	} while (n == sizeof (info));
+}
+
+static gboolean
+signalfd_ready (GIOChannel *source, GIOCondition cond, gpointer data)
+{
+	drain_signalfd ();
+	reap_children ();
+
+	return TRUE;
+}
+#endif
+
+static gboolean
+sigchld_func (int sig, gpointer data)
+{
+	reap_children ();
+
+	return TRUE;
+}
+
+/**
+ * mdm_child_watch_init:
+ * @unwatched: Called for children that exit without a watch
+ *
+ * Picks the best way of supervising children this system has and
+ * hooks it into the main loop.
+ */
+void
+mdm_child_watch_init (MdmChildWatchFunc unwatched)
+{
+	struct sigaction child;
+	sigset_t mask;
+
+	ensure_watches ();
+	unwatched_func = unwatched;
+
+	sigemptyset (&mask);
+	sigaddset (&mask, SIGCHLD);
+
+#ifdef HAVE_PIDFD
+	{
+		int fd = mdm_child_watch_open_pidfd (getpid ());
+
+		if (fd >= 0) {
+			VE_IGNORE_EINTR (close (fd));
+			mode = WATCH_PIDFD;
+			sigprocmask (SIG_UNBLOCK, &mask, NULL);
+			mdm_debug ("mdm_child_watch_init: Watching children with pidfds");
+			return;
+		}
+	}
+#endif
+
+#ifdef HAVE_SYS_SIGNALFD_H
+	sigprocmask (SIG_BLOCK, &mask, NULL);
+	signal_fd = signalfd (-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd >= 0) {
+		mode = WATCH_SIGNALFD;
+		signal_source = add_fd_watch (signal_fd, signalfd_ready, NULL);
+		mdm_debug ("mdm_child_watch_init: Watching children with a signalfd");
+
+		/* anything that exited before is still to be reaped */
+		reap_children ();
+		return;
+	}
+#endif
+
+	mode = WATCH_SIGNAL;
+	signal_source = ve_signal_add (SIGCHLD, sigchld_func, NULL);
+
+	child.sa_handler = ve_signal_notify;
+	child.sa_flags = SA_RESTART|SA_NOCLDSTOP;
+	sigemptyset (&child.sa_mask);
+	sigaddset (&child.sa_mask, SIGCHLD);
+
+	if G_UNLIKELY (sigaction (SIGCHLD, &child, NULL) < 0)
+		mdm_fail ("mdm_child_watch_init: Error setting up CHLD signal handler");
+
+	sigprocmask (SIG_UNBLOCK, &mask, NULL);
+}
+
+/**
+ * mdm_child_watch_shutdown:
+ *
+ * Forgets about all children without touching them, for a freshly
+ * forked process that is not going to reap its siblings.
+ */
+void
+mdm_child_watch_shutdown (void)
+{
+	if (watches != NULL) {
+		g_hash_table_destroy (watches);
+		watches = NULL;
+	}
+
+	if (signal_source > 0) {
+		g_source_remove (signal_source);
+		signal_source = 0;
+	}
+
+	if (reap_idle > 0) {
+		g_source_remove (reap_idle);
+		reap_idle = 0;
+	}
+
+	if (signal_fd >= 0) {
+		VE_IGNORE_EINTR (close (signal_fd));
+		signal_fd = -1;
+	}
+
+	unwatched_func = NULL;
+}
+
+/**
+ * mdm_child_watch_add:
+ * @pid: A child of ours
+ * @func: Called with the wait status once the child has been reaped
+ * @data: Passed to func
+ */
+void
+mdm_child_watch_add (pid_t pid, MdmChildWatchFunc func, gpointer data)
+{
+	ChildWatch *watch;
+
+	g_return_if_fail (pid > 0);
+	g_return_if_fail (func != NULL);
+
+	ensure_watches ();
+
+	watch = g_new0 (ChildWatch, 1);
+	watch->pid = pid;
+	watch->pidfd = -1;
+	watch->func = func;
+	watch->data = data;
+
+#ifdef HAVE_PIDFD
+	if (mode == WATCH_PIDFD) {
+		watch->pidfd = mdm_child_watch_open_pidfd (pid);
+		if G_LIKELY (watch->pidfd >= 0) {
+			watch->source = add_fd_watch (watch->pidfd, pidfd_ready, watch);
+		} else {
+			/* out of descriptors probably, better late than never */
+			mdm_error ("mdm_child_watch_add: Cannot open pidfd for %d: %s",
+				   (int) pid, strerror (errno));
+			watch->source = g_timeout_add_seconds (1, poll_child, watch);
+		}
+	}
+#endif
+
+	g_hash_table_replace (watches, GINT_TO_POINTER (pid), watch);
+}
+
+void
+mdm_child_watch_remove (pid_t pid)
+{
+	if (watches != NULL)
+		g_hash_table_remove (watches, GINT_TO_POINTER (pid));
+}
+
+/**
+ * mdm_child_watch_wait:
+ * @pid: A child of ours
+ * @exitstatus: Where to store the wait status
+ * @timeout: How many seconds to wait at most
+ *
+ * For the places that have to stop a child synchronously.  Any watch on
+ * pid is dropped, the caller owns the child from now on.
+ *
+ * Returns: pid once it has been reaped, 0 if it is still running after
+ * the timeout or a signal came in, -1 if it is not a child of ours
+ */
+pid_t
+mdm_child_watch_wait (pid_t pid, int *exitstatus, int timeout)
+{
+	struct pollfd pfd;
+	pid_t ret;
+	int   fd = -1;
+
+	mdm_child_watch_remove (pid);
+
+	VE_IGNORE_EINTR (ret = waitpid (pid, exitstatus, WNOHANG));
+	if (ret != 0 || timeout <= 0)
+		return ret;
+
+#ifdef HAVE_PIDFD
+	if (mode == WATCH_PIDFD)
+		fd = mdm_child_watch_open_pidfd (pid);
+#endif
+	if (mode == WATCH_SIGNALFD)
+		fd = signal_fd;
+
+	if (fd >= 0) {
+		/* a signal cuts this short just like it does sleep */
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		poll (&pfd, 1, timeout * 1000);
+
+		if (fd != signal_fd) {
+			VE_IGNORE_EINTR (close (fd));
+#ifdef HAVE_SYS_SIGNALFD_H
+		} else if (pfd.revents != 0) {
+			/* it may have been some other child, the main
+			 * loop still has to hear about that */
+			drain_signalfd ();
+			if (reap_idle == 0)
+				reap_idle = g_idle_add (reap_idle_func, NULL);
+#endif
+		}
+	} else {
+		/* SIGCHLD wakes us up */
+		sleep (timeout);
+	}
+
+	VE_IGNORE_EINTR (ret = waitpid (pid, exitstatus, WNOHANG));
+	return ret;
+}
+
+/* EOF */
@@ -0,0 +1,53 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MDM_CHILD_WATCH_H
+#define MDM_CHILD_WATCH_H
+
+#include <sys/types.h>
+#include <glib.h>
+
+/*
+ * Supervision of the daemon's children from the main loop.  Every
+ * watched child has its own callback which gets the raw wait status
+ * once the child has been reaped, so nobody has to work out who a pid
+ * belonged to.  Children that exit without a watch (should not happen,
+ * but one never knows) are handed to the function given to
+ * mdm_child_watch_init.
+ */
+typedef void (* MdmChildWatchFunc) (pid_t    pid,
+				    int      exitstatus,
+				    gpointer data);
+
+void		mdm_child_watch_init	 (MdmChildWatchFunc unwatched);
+void		mdm_child_watch_shutdown (void);
+
+void		mdm_child_watch_add	 (pid_t             pid,
+					  MdmChildWatchFunc func,
+					  gpointer          data);
+void		mdm_child_watch_remove	 (pid_t             pid);
+
+int		mdm_child_watch_open_pidfd (pid_t       pid);
+
+pid_t		mdm_child_watch_wait	 (pid_t             pid,
+					  int              *exitstatus,
+					  int               timeout);
+
+#endif /* MDM_CHILD_WATCH_H */
+
+/* EOF */
@@ -45,6 +45,7 @@ typedef enum {
 	MDM_ID_LIMIT_SESSION_OUTPUT,
 	MDM_ID_FILTER_SESSION_OUTPUT,
 	MDM_ID_DEBUG_GESTURES,
+	MDM_ID_TRACE_FILE,
 	MDM_ID_AUTOMATIC_LOGIN_ENABLE,
 	MDM_ID_AUTOMATIC_LOGIN,
 	MDM_ID_GREETER,
@@ -89,6 +90,10 @@ typedef enum {
 	MDM_ID_VT_ALLOCATION,
 	MDM_ID_CONSOLE_CANNOT_HANDLE,
 	MDM_ID_XSERVER_TIMEOUT,
+	MDM_ID_MAX_CONNECTIONS,
+	MDM_ID_CONNECTION_BACKLOG,
+	MDM_ID_WATCH_CONFIG_FILES,
+	MDM_ID_FACE_CACHE,
 	MDM_ID_SERVER_PREFIX,
 	MDM_ID_SERVER_NAME,
 	MDM_ID_SERVER_COMMAND,
@@ -108,6 +113,7 @@ typedef enum {
 	MDM_ID_PASSWORD_REQUIRED,
 	MDM_ID_UTMP_LINE_ATTACHED,	
 	MDM_ID_UTMP_PSEUDO_DEVICE,
+	MDM_ID_PEER_CREDENTIAL_AUTH,
 	MDM_ID_GTK_THEME,
 	MDM_ID_GTKRC,
 	MDM_ID_MAX_ICON_WIDTH,
@@ -240,6 +246,7 @@ static const MdmConfigEntry mdm_daemon_config_entries [] = {
 	{ MDM_CONFIG_GROUP_DEBUG, "LimitSessionOutput", MDM_CONFIG_VALUE_BOOL, "true", MDM_ID_LIMIT_SESSION_OUTPUT },
 	{ MDM_CONFIG_GROUP_DEBUG, "FilterSessionOutput", MDM_CONFIG_VALUE_BOOL, "false", MDM_ID_FILTER_SESSION_OUTPUT },
 	{ MDM_CONFIG_GROUP_DEBUG, "Gestures", MDM_CONFIG_VALUE_BOOL, "false", MDM_ID_DEBUG_GESTURES },
+	{ MDM_CONFIG_GROUP_DEBUG, "TraceFile", MDM_CONFIG_VALUE_STRING, "", MDM_ID_TRACE_FILE },
 
 
 	{ MDM_CONFIG_GROUP_DAEMON, "AutomaticLoginEnable", MDM_CONFIG_VALUE_BOOL, "false", MDM_ID_AUTOMATIC_LOGIN_ENABLE },
@@ -307,6 +314,19 @@ static const MdmConfigEntry mdm_daemon_config_entries [] = {
 	/* How long to wait before assuming an Xserver has timed out */
 	{ MDM_CONFIG_GROUP_DAEMON, "MdmXserverTimeout", MDM_CONFIG_VALUE_INT, "10", MDM_ID_XSERVER_TIMEOUT },
 
+	/* How many socket clients are served at once, and how many more may
+	 * wait in the kernel accept queue for a free slot */
+	{ MDM_CONFIG_GROUP_DAEMON, "MaxConnections", MDM_CONFIG_VALUE_INT, "15", MDM_ID_MAX_CONNECTIONS },
+	{ MDM_CONFIG_GROUP_DAEMON, "ConnectionBacklog", MDM_CONFIG_VALUE_INT, "64", MDM_ID_CONNECTION_BACKLOG },
+
+	/* Reload changed configuration files by themselves, set to false
+	 * by the daemon when it cannot watch them */
+	{ MDM_CONFIG_GROUP_DAEMON, "WatchConfigFiles", MDM_CONFIG_VALUE_BOOL, "true", MDM_ID_WATCH_CONFIG_FILES },
+
+	/* Where the scaled user pictures are kept for the greeters, empty
+	 * to scale them on every greeter start */
+	{ MDM_CONFIG_GROUP_DAEMON, "FaceCache", MDM_CONFIG_VALUE_STRING, "/var/cache/mdm/faces", MDM_ID_FACE_CACHE },
+
 	{ MDM_CONFIG_GROUP_DAEMON, "SystemCommandsInMenu", MDM_CONFIG_VALUE_STRING_ARRAY, "HALT;REBOOT;SUSPEND", MDM_ID_SYSTEM_COMMANDS_IN_MENU },
 	{ MDM_CONFIG_GROUP_DAEMON, "AllowLogoutActions", MDM_CONFIG_VALUE_STRING_ARRAY, "HALT;REBOOT;SUSPEND", MDM_ID_ALLOW_LOGOUT_ACTIONS },
 	{ MDM_CONFIG_GROUP_DAEMON, "RBACSystemCommandKeys", MDM_CONFIG_VALUE_STRING_ARRAY, MDM_RBAC_SYSCMD_KEYS, MDM_ID_RBAC_SYSTEM_COMMAND_KEYS },
@@ -324,6 +344,7 @@ static const MdmConfigEntry mdm_daemon_config_entries [] = {
 	{ MDM_CONFIG_GROUP_SECURITY, "PasswordRequired", MDM_CONFIG_VALUE_BOOL, "false", MDM_ID_PASSWORD_REQUIRED },
 	{ MDM_CONFIG_GROUP_SECURITY, "UtmpLineAttached", MDM_CONFIG_VALUE_STRING, "", MDM_ID_UTMP_LINE_ATTACHED },
 	{ MDM_CONFIG_GROUP_SECURITY, "UtmpPseudoDevice", MDM_CONFIG_VALUE_BOOL, "", MDM_ID_UTMP_PSEUDO_DEVICE },
+	{ MDM_CONFIG_GROUP_SECURITY, "PeerCredentialAuth", MDM_CONFIG_VALUE_BOOL, "false", MDM_ID_PEER_CREDENTIAL_AUTH },
 
 	{ MDM_CONFIG_GROUP_GUI, "GtkTheme", MDM_CONFIG_VALUE_STRING, "Default", MDM_ID_GTK_THEME },
 	{ MDM_CONFIG_GROUP_GUI, "GtkRC", MDM_CONFIG_VALUE_STRING, DATADIR "/themes/Default/gtk-2.0/gtkrc", MDM_ID_GTKRC },
@@ -86,6 +86,10 @@ G_BEGIN_DECLS
 #define MDM_KEY_VT_ALLOCATION "daemon/VTAllocation=true"
 #define MDM_KEY_CONSOLE_CANNOT_HANDLE "daemon/ConsoleCannotHandle=am,ar,az,bn,el,fa,gu,hi,ja,ko,ml,mr,pa,ta,zh"
 #define MDM_KEY_XSERVER_TIMEOUT "daemon/MdmXserverTimeout=10"
+#define MDM_KEY_MAX_CONNECTIONS "daemon/MaxConnections=15"
+#define MDM_KEY_CONNECTION_BACKLOG "daemon/ConnectionBacklog=64"
+#define MDM_KEY_WATCH_CONFIG_FILES "daemon/WatchConfigFiles=true"
+#define MDM_KEY_FACE_CACHE "daemon/FaceCache=/var/cache/mdm/faces"
 #define MDM_KEY_SYSTEM_COMMANDS_IN_MENU "daemon/SystemCommandsInMenu=HALT;REBOOT;SUSPEND"
 #define MDM_KEY_ALLOW_LOGOUT_ACTIONS "daemon/AllowLogoutActions=HALT;REBOOT;SUSPEND"
 #define MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS "daemon/RBACSystemCommandKeys=" MDM_RBAC_SYSCMD_KEYS
@@ -110,6 +114,7 @@ G_BEGIN_DECLS
 #define MDM_KEY_PASSWORD_REQUIRED "security/PasswordRequired=false"
 #define MDM_KEY_UTMP_LINE_ATTACHED "security/UtmpLineAttached="
 #define MDM_KEY_UTMP_PSEUDO_DEVICE "security/UtmpPseudoDevice=true"
+#define MDM_KEY_PEER_CREDENTIAL_AUTH "security/PeerCredentialAuth=false"
 #define MDM_KEY_GTK_THEME "gui/GtkTheme=Default"
 #define MDM_KEY_GTKRC "gui/GtkRC=" DATADIR "/themes/Default/gtk-2.0/gtkrc"
 #define MDM_KEY_MAX_ICON_WIDTH "gui/MaxIconWidth=128"
@@ -159,6 +164,7 @@ G_BEGIN_DECLS
 #define MDM_KEY_LIMIT_SESSION_OUTPUT "debug/LimitSessionOutput=true"
 #define MDM_KEY_FILTER_SESSION_OUTPUT "debug/FilterSessionOutput=false"
 #define MDM_KEY_DEBUG_GESTURES "debug/Gestures=false"
+#define MDM_KEY_TRACE_FILE "debug/TraceFile="
 #define MDM_KEY_SECTION_GREETER "greeter"
 #define MDM_KEY_SECTION_SERVERS "servers"
 /* END LEGACY KEYS */
@@ -179,12 +185,14 @@ G_BEGIN_DECLS
 #define MDM_NOTIFY_SOUND_ON_LOGIN_FAILURE_FILE "SoundOnLoginFailureFile" /* <sound file> */
 #define MDM_NOTIFY_ADD_GTK_MODULES "AddGtkModules" /* <true/false as int> */
 #define MDM_NOTIFY_GTK_MODULES_LIST "GtkModulesList" /* <modules list> */
+#define MDM_NOTIFY_PER_DISPLAY_CONFIG "PerDisplayConfig" /* <display>, its file changed */
 
 /* commands, seel MDM_SLAVE_NOTIFY_COMMAND */
 #define MDM_NOTIFY_DIRTY_SERVERS "DIRTY_SERVERS"
 #define MDM_NOTIFY_SOFT_RESTART_SERVERS "SOFT_RESTART_SERVERS"
 #define MDM_NOTIFY_GO "GO"
 #define MDM_NOTIFY_TWIDDLE_POINTER "TWIDDLE_POINTER"
+#define MDM_NOTIFY_TRACE_DUMP "TRACE_DUMP"
 
 G_END_DECLS
 
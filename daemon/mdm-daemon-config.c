@@ -44,8 +44,12 @@
 #include <sys/stat.h>
 #include <sys/resource.h>
 #include <signal.h>
+#include <errno.h>
 #include <pwd.h>
 #include <grp.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
 
 #include <glib.h>
 #include <glib/gi18n.h>
@@ -60,20 +64,26 @@
 
 #include "mdm-common.h"
 #include "mdm-config.h"
+#include "mdm-config-snapshot.h"
 #include "mdm-log.h"
 #include "mdm-daemon-config.h"
+#include "mdm-per-display-config.h"
 
 #include "mdm-socket-protocol.h"
 
+#define MDM_DISTRO_CONF "/usr/share/mdm/distro.conf"
+
 static MdmConfig *daemon_config = NULL;
 
-static GSList *displays = NULL;
 static GSList *xservers = NULL;
 
 static gint high_display_num = 0;
 static const char *default_config_file = NULL;
 static char *custom_config_file = NULL;
 
+/* Bumped for every configuration snapshot, 0 until the first one */
+static guint64 snapshot_generation = 0;
+
 static uid_t MdmUserId;   /* Userid  under which mdm should run */
 static gid_t MdmGroupId;  /* Gruopid under which mdm should run */
 
@@ -114,19 +124,6 @@ is_key (const gchar *key1, const gchar *key2)
 	}
 }
 
-/**
- * mdm_daemon_config_get_per_display_custom_config_file
- *
- * Returns the per-display config file for a given display
- * This is always the custom config file name with the display
- * appended, and never mdm.conf.
- */
-static gchar *
-mdm_daemon_config_get_per_display_custom_config_file (const gchar *display)
-{
-	return g_strdup_printf ("%s%s", custom_config_file, display);
-}
-
 /**
  * mdm_daemon_config_get_custom_config_file
  *
@@ -138,58 +135,61 @@ mdm_daemon_config_get_custom_config_file (void)
 	return custom_config_file;
 }
 
-/**
- * mdm_daemon_config_get_display_list
- *
- * Returns the list of displays being used.
+/*
+ * The getters below are called with the same MDM_KEY_* strings over
+ * and over, also on hot paths like the session output handling.  Each
+ * key string is resolved to its entry id the first time it is seen,
+ * after that the value is peeked at by id without parsing the key
+ * string, building the group/key path or copying the value.
  */
-GSList *
-mdm_daemon_config_get_display_list (void)
-{
-	return displays;
-}
+static GHashTable *key_ids = NULL;
 
-GSList *
-mdm_daemon_config_display_list_append (MdmDisplay *display)
+static int
+lookup_key_id (const char *keystring)
 {
-	displays = g_slist_append (displays, display);
-	return displays;
-}
+	const MdmConfigEntry *entry;
+	gpointer              id;
+	char                 *group;
+	char                 *key;
 
-GSList *
-mdm_daemon_config_display_list_insert (MdmDisplay *display)
-{
-        displays = g_slist_insert_sorted (displays,
-                                          display,
-                                          mdm_daemon_config_compare_displays);
-	return displays;
-}
+	if (daemon_config == NULL)
+		return MDM_CONFIG_INVALID_ID;
 
-GSList *
-mdm_daemon_config_display_list_remove (MdmDisplay *display)
-{
-	displays = g_slist_remove (displays, display);
+	if (key_ids == NULL)
+		key_ids = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-	return displays;
+	if (g_hash_table_lookup_extended (key_ids, keystring, NULL, &id))
+		return GPOINTER_TO_INT (id);
+
+	id = GINT_TO_POINTER (MDM_CONFIG_INVALID_ID);
+	if (mdm_common_config_parse_key_string (keystring, &group, &key, NULL, NULL)) {
+		entry = mdm_config_lookup_entry (daemon_config, group, key);
+		if (entry != NULL)
+			id = GINT_TO_POINTER (entry->id);
+		g_free (group);
+		g_free (key);
+	}
+
+	g_hash_table_insert (key_ids, g_strdup (keystring), id);
+
+	return GPOINTER_TO_INT (id);
 }
 
-/**
- * mdm_daemon_config_get_value_int
- *
- * Gets an integer configuration option by key.  The option must
- * first be loaded, say, by calling mdm_config_parse.
- */
-gint
-mdm_daemon_config_get_value_int (const char *keystring)
+static const MdmConfigValue *
+peek_value (const char *keystring)
 {
-	gboolean res;
-	MdmConfigValue *value;
-	char *group;
-	char *key;
-	int   result;
+	const MdmConfigValue *value;
+	gboolean              res;
+	char                 *group;
+	char                 *key;
+	int                   id;
 
-	result = 0;
+	id = lookup_key_id (keystring);
+	if (id != MDM_CONFIG_INVALID_ID &&
+	    mdm_config_peek_value_for_id (daemon_config, id, &value))
+		return value;
 
+	/* Keys without an entry, like the server definitions */
 	res = mdm_common_config_parse_key_string (keystring,
 						  &group,
 						  &key,
@@ -197,29 +197,45 @@ mdm_daemon_config_get_value_int (const char *keystring)
 						  NULL);
 	if (! res) {
 		mdm_error ("Could not parse configuration key %s", keystring);
-		goto out;
+		return NULL;
 	}
 
-	res = mdm_config_get_value (daemon_config,
-				    group,
-				    key,
-				    &value);
-	if (! res) {
+	res = mdm_config_peek_value (daemon_config,
+				     group,
+				     key,
+				     &value);
+	g_free (group);
+	g_free (key);
+
+	if (! res || value == NULL) {
 		mdm_error ("Request for invalid configuration key %s", keystring);
-		goto out;
+		return NULL;
 	}
 
+	return value;
+}
+
+/**
+ * mdm_daemon_config_get_value_int
+ *
+ * Gets an integer configuration option by key.  The option must
+ * first be loaded, say, by calling mdm_config_parse.
+ */
+gint
+mdm_daemon_config_get_value_int (const char *keystring)
+{
+	const MdmConfigValue *value;
+
+	value = peek_value (keystring);
+	if (value == NULL)
+		return 0;
+
 	if (value->type != MDM_CONFIG_VALUE_INT) {
 		mdm_error ("Request for configuration key %s, but not type INT", keystring);
-		goto out;
+		return 0;
 	}
 
-	result = mdm_config_value_get_int (value);
- out:
-	g_free (group);
-	g_free (key);
-
-	return result;
+	return mdm_config_value_get_int (value);
 }
 
 /**
@@ -227,48 +243,29 @@ mdm_daemon_config_get_value_int (const char *keystring)
  *
  * Gets a string configuration option by key.  The option must
  * first be loaded, say, by calling mdm_daemon_config_parse.
+ * The string belongs to the configuration and must not be freed.
+ * It stays valid when the option is changed later, by UPDATE_CONFIG,
+ * a reload of the files or a notify in the slave, as replaced values
+ * are kept until mdm_daemon_config_release_superseded.  The daemon
+ * calls that after every message it handled and the slave before it
+ * handles notifies, so the string may be used until the caller
+ * returns but must not be kept.
  */
 const char *
 mdm_daemon_config_get_value_string (const char *keystring)
 {
-	gboolean res;
-	MdmConfigValue *value;
-	char *group;
-	char *key;
-	const char *result;
+	const MdmConfigValue *value;
 
-	result = NULL;
-
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  NULL,
-						  NULL);
-	if (! res) {
-		mdm_error ("Could not parse configuration key %s", keystring);
-		goto out;
-	}
-
-	res = mdm_config_get_value (daemon_config,
-				    group,
-				    key,
-				    &value);
-	if (! res) {
-		mdm_error ("Request for invalid configuration key %s", keystring);
-		goto out;
-	}
+	value = peek_value (keystring);
+	if (value == NULL)
+		return NULL;
 
 	if (value->type != MDM_CONFIG_VALUE_STRING) {
 		mdm_error ("Request for configuration key %s, but not type STRING", keystring);
-		goto out;
+		return NULL;
 	}
 
-	result = mdm_config_value_get_string (value);
- out:
-	g_free (group);
-	g_free (key);
-
-	return result;
+	return mdm_config_value_get_string (value);
 }
 
 /**
@@ -276,48 +273,24 @@ mdm_daemon_config_get_value_string (const char *keystring)
  *
  * Gets a string configuration option by key.  The option must
  * first be loaded, say, by calling mdm_daemon_config_parse.
+ * The array is owned and kept like the string of
+ * mdm_daemon_config_get_value_string.
  */
 const char **
 mdm_daemon_config_get_value_string_array (const char *keystring)
 {
-	gboolean res;
-	MdmConfigValue *value;
-	char *group;
-	char *key;
-	const char **result;
+	const MdmConfigValue *value;
 
-	result = NULL;
-
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  NULL,
-						  NULL);
-	if (! res) {
-		mdm_error ("Could not parse configuration key %s", keystring);
-		goto out;
-	}
-
-	res = mdm_config_get_value (daemon_config,
-				    group,
-				    key,
-				    &value);
-	if (! res) {
-		mdm_error ("Request for invalid configuration key %s", keystring);
-		goto out;
-	}
+	value = peek_value (keystring);
+	if (value == NULL)
+		return NULL;
 
 	if (value->type != MDM_CONFIG_VALUE_STRING_ARRAY) {
 		mdm_error ("Request for configuration key %s, but not type STRING-ARRAY", keystring);
-		goto out;
+		return NULL;
 	}
 
-	result = mdm_config_value_get_string_array (value);
- out:
-	g_free (group);
-	g_free (key);
-
-	return result;
+	return mdm_config_value_get_string_array (value);
 }
 
 /**
@@ -359,6 +332,8 @@ mdm_daemon_config_get_int_for_id (int id)
  *
  * Gets a string configuration option by ID.  The option must
  * first be loaded, say, by calling mdm_daemon_config_parse.
+ * The string is owned and kept like the one of
+ * mdm_daemon_config_get_value_string.
  */
 const char *
 mdm_daemon_config_get_string_for_id (int id)
@@ -380,44 +355,18 @@ mdm_daemon_config_get_string_for_id (int id)
 gboolean
 mdm_daemon_config_get_value_bool (const char *keystring)
 {
-	gboolean res;
-	MdmConfigValue *value;
-	char *group;
-	char *key;
-	gboolean result;
-
-	result = FALSE;
-
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  NULL,
-						  NULL);
-	if (! res) {
-		mdm_error ("Could not parse configuration key %s", keystring);
-		goto out;
-	}
+	const MdmConfigValue *value;
 
-	res = mdm_config_get_value (daemon_config,
-				    group,
-				    key,
-				    &value);
-	if (! res) {
-		mdm_error ("Request for invalid configuration key %s", keystring);
-		goto out;
-	}
+	value = peek_value (keystring);
+	if (value == NULL)
+		return FALSE;
 
 	if (value->type != MDM_CONFIG_VALUE_BOOL) {
 		mdm_error ("Request for configuration key %s, but not type BOOLEAN", keystring);
-		goto out;
+		return FALSE;
 	}
 
-	result = mdm_config_value_get_bool (value);
- out:
-	g_free (group);
-	g_free (key);
-
-	return result;
+	return mdm_config_value_get_bool (value);
 }
 
 /**
@@ -506,81 +455,16 @@ mdm_daemon_config_get_value_string_per_display (const char *key,
 	}
 }
 
-/**
- * mdm_daemon_config_key_to_string_per_display
- *
- * If the key makes sense to be per-display, return the value,
- * otherwise return NULL.  Keys that only apply to the daemon
- * process do not make sense for per-display configuration
- * Valid keys include any key in the greeter or gui categories,
- * and the MDM_KEY_PAM_STACK key.
- *
- * If additional keys make sense for per-display usage, make
- * sure they are added to the if-test below.
- */
-gboolean
-mdm_daemon_config_key_to_string_per_display (const char *keystring,
-					     const char *display,
-					     char      **retval)
-{
-	char    *file;
-	char    *group;
-	char    *key;
-	gboolean res;
-	gboolean ret;
-
-	ret = FALSE;
-
-	*retval = NULL;
-	group = key = NULL;
-
-	if (display == NULL) {
-		goto out;
-	}
-
-	mdm_debug ("Looking up per display value for %s", keystring);
-
-	res = mdm_common_config_parse_key_string (keystring,
-						  &group,
-						  &key,
-						  NULL,
-						  NULL);
-	if (! res) {
-		goto out;
-	}
-
-	file = mdm_daemon_config_get_per_display_custom_config_file (display);
-
-	if (strcmp (group, "greeter") == 0 ||
-	    strcmp (group, "gui") == 0 ||
-	    is_key (keystring, MDM_KEY_PAM_STACK)) {
-		ret = mdm_daemon_config_key_to_string (file, keystring, retval);
-	}
-
-	g_free (file);
-
- out:
-	g_free (group);
-	g_free (key);
-
-	return ret;
-}
-
-/**
- * mdm_daemon_config_key_to_string
- *
- * Gets a specific key from the config file.
- * Note this returns the value in string form, so the caller needs
- * to parse it properly if it is a bool or int.
- *
- * Returns TRUE if successful..
+/*
+ * Looks keystring up in an already loaded config file, see
+ * mdm_daemon_config_key_to_string.  config may be NULL if there was
+ * no file, the key is still checked so bad requests get logged.
  */
-gboolean
-mdm_daemon_config_key_to_string (const char *file,
-				 const char *keystring,
-				 char      **retval)
+static gboolean
+key_file_to_string (GKeyFile   *config,
+		    const char *keystring,
+		    char      **retval)
 {
-	GKeyFile             *config;
 	MdmConfigValueType    type;
 	gboolean              res;
 	gboolean              ret;
@@ -617,7 +501,6 @@ mdm_daemon_config_key_to_string (const char *file,
 	}
 	type = entry->type;
 
-	config = mdm_common_config_load (file, NULL);
 	/* If file doesn't exist, then just return */
 	if (config == NULL) {
 		goto out;
@@ -677,7 +560,6 @@ mdm_daemon_config_key_to_string (const char *file,
 		ret = TRUE;
 	}
 
-	g_key_file_free (config);
  out:
 	g_free (result);
 	g_free (group);
@@ -687,6 +569,89 @@ mdm_daemon_config_key_to_string (const char *file,
 	return ret;
 }
 
+/**
+ * mdm_daemon_config_get_per_display_parse_count
+ *
+ * Returns how many times a per-display config file has been parsed,
+ * which is once per display and change of the file.
+ */
+guint
+mdm_daemon_config_get_per_display_parse_count (void)
+{
+	return mdm_per_display_config_get_parse_count ();
+}
+
+/**
+ * mdm_daemon_config_key_to_string_per_display
+ *
+ * If the key makes sense to be per-display, return the value,
+ * otherwise return NULL.  Keys that only apply to the daemon
+ * process do not make sense for per-display configuration
+ * Valid keys include any key in the greeter or gui categories,
+ * and the MDM_KEY_PAM_STACK key.
+ *
+ * If additional keys make sense for per-display usage, make
+ * sure they are added to the if-test below.
+ */
+gboolean
+mdm_daemon_config_key_to_string_per_display (const char *keystring,
+					     const char *display,
+					     char      **retval)
+{
+	const MdmConfigEntry *entry;
+	const char           *default_value;
+	int                   id;
+
+	*retval = NULL;
+
+	if (display == NULL)
+		return FALSE;
+
+	id = lookup_key_id (keystring);
+	if (id == MDM_CONFIG_INVALID_ID)
+		return FALSE;
+
+	entry = mdm_config_lookup_entry_for_id (daemon_config, id);
+	if (entry == NULL ||
+	    (strcmp (entry->group, "greeter") != 0 &&
+	     strcmp (entry->group, "gui") != 0 &&
+	     id != MDM_ID_PAM_STACK))
+		return FALSE;
+
+	/* only a default in the key string itself is used, as
+	 * mdm_common_config_get_string would */
+	default_value = strchr (keystring, '=');
+	if (default_value != NULL)
+		default_value++;
+
+	return mdm_per_display_config_get_value (display, entry, default_value, retval);
+}
+
+/**
+ * mdm_daemon_config_key_to_string
+ *
+ * Gets a specific key from the config file.
+ * Note this returns the value in string form, so the caller needs
+ * to parse it properly if it is a bool or int.
+ *
+ * Returns TRUE if successful..
+ */
+gboolean
+mdm_daemon_config_key_to_string (const char *file,
+				 const char *keystring,
+				 char      **retval)
+{
+	GKeyFile *config;
+	gboolean  ret;
+
+	config = mdm_common_config_load (file, NULL);
+	ret = key_file_to_string (config, keystring, retval);
+	if (config != NULL)
+		g_key_file_free (config);
+
+	return ret;
+}
+
 /**
  * mdm_daemon_config_to_string
  *
@@ -839,9 +804,120 @@ lookup_notify_key (MdmConfig  *config,
 	else if (is_key (keystring, MDM_KEY_TIMED_LOGIN))
 		nkey = g_strdup (MDM_NOTIFY_TIMED_LOGIN);
 
-	g_free (keystring);
+	g_free (keystring);
+
+	return nkey;
+}
+
+static char *
+notify_value_to_string (const MdmConfigValue *value)
+{
+	char *valstr;
+
+	/* unfortunately, can't always mdm_config_value_to_string()
+	 * here because booleans need to be sent as ints
+	 */
+	switch (value->type) {
+	case MDM_CONFIG_VALUE_BOOL:
+		if (mdm_config_value_get_bool (value)) {
+			valstr = g_strdup ("1");
+		} else {
+			valstr = g_strdup ("0");
+		}
+		break;
+	default:
+		valstr = mdm_config_value_to_string (value);
+		break;
+	}
+
+	if (valstr == NULL) {
+		valstr = g_strdup (" ");
+	}
+
+	return valstr;
+}
+
+/*
+ * While a batch is open the notifications for each display are
+ * collected and then written with one write and one SIGUSR2 per
+ * slave, instead of one of each per key.  Batches nest.
+ */
+static int         notify_batch_depth = 0;
+static GHashTable *notify_batches = NULL; /* MdmDisplay * -> GString */
+
+static void
+notify_display (MdmDisplay *disp,
+		const char *keystr,
+		const char *valstr)
+{
+	GString *batch;
+
+	if (disp->master_notify_fd < 0) {
+		/* no point */
+		return;
+	}
+
+	if (notify_batch_depth == 0) {
+		mdm_fdprintf (disp->master_notify_fd,
+			      "%c%s %s\n",
+			      MDM_SLAVE_NOTIFY_KEY,
+			      keystr,
+			      valstr);
+
+		if (disp->slavepid > 1) {
+			kill (disp->slavepid, SIGUSR2);
+		}
+		return;
+	}
+
+	if (notify_batches == NULL)
+		notify_batches = g_hash_table_new (NULL, NULL);
+
+	batch = g_hash_table_lookup (notify_batches, disp);
+	if (batch == NULL) {
+		batch = g_string_new (NULL);
+		g_hash_table_insert (notify_batches, disp, batch);
+	}
+	g_string_append_printf (batch, "%c%s %s\n",
+				MDM_SLAVE_NOTIFY_KEY, keystr, valstr);
+}
+
+static void
+notify_begin_batch (void)
+{
+	notify_batch_depth++;
+}
 
-	return nkey;
+static void
+notify_end_batch (void)
+{
+	GHashTableIter iter;
+	gpointer       disp_ptr;
+	gpointer       batch_ptr;
+
+	g_return_if_fail (notify_batch_depth > 0);
+
+	if (--notify_batch_depth > 0 || notify_batches == NULL)
+		return;
+
+	g_hash_table_iter_init (&iter, notify_batches);
+	while (g_hash_table_iter_next (&iter, &disp_ptr, &batch_ptr)) {
+		MdmDisplay *disp = disp_ptr;
+		GString    *batch = batch_ptr;
+
+		/* the display may have gone away in the meantime */
+		if (disp->registered &&
+		    disp->master_notify_fd >= 0) {
+			mdm_fdprintf (disp->master_notify_fd, "%s", batch->str);
+			if (disp->slavepid > 1) {
+				kill (disp->slavepid, SIGUSR2);
+			}
+		}
+		g_string_free (batch, TRUE);
+	}
+
+	g_hash_table_destroy (notify_batches);
+	notify_batches = NULL;
 }
 
 /**
@@ -852,7 +928,8 @@ lookup_notify_key (MdmConfig  *config,
  * been changed so the slave can update with the new option
  * value.  MDM does this notify when it receives a
  * MDM_CONFIG_UPDATE socket command from mdmsetup or from the
- * mdmflexiserver --command option.
+ * mdmflexiserver --command option, and when it rereads a changed
+ * configuration file.
  */
 static void
 notify_displays_value (MdmConfig      *config,
@@ -865,44 +942,10 @@ notify_displays_value (MdmConfig      *config,
 	char   *keystr;
 
 	keystr = lookup_notify_key (config, group, key);
+	valstr = notify_value_to_string (value);
 
-	/* unfortunately, can't always mdm_config_value_to_string()
-	 * here because booleans need to be sent as ints
-	 */
-	switch (value->type) {
-	case MDM_CONFIG_VALUE_BOOL:
-		if (mdm_config_value_get_bool (value)) {
-			valstr = g_strdup ("1");
-		} else {
-			valstr = g_strdup ("0");
-		}
-		break;
-	default:
-		valstr = mdm_config_value_to_string (value);
-		break;
-	}
-
-	if (valstr == NULL) {
-		valstr = g_strdup (" ");
-	}
-
-	for (li = displays; li != NULL; li = li->next) {
-		MdmDisplay *disp = li->data;
-
-		if (disp->master_notify_fd < 0) {
-			/* no point */
-			continue;
-		}
-
-		mdm_fdprintf (disp->master_notify_fd,
-			      "%c%s %s\n",
-			      MDM_SLAVE_NOTIFY_KEY,
-			      keystr,
-			      valstr);
-
-		if (disp != NULL && disp->slavepid > 1) {
-			kill (disp->slavepid, SIGUSR2);
-		}
+	for (li = mdm_display_get_list (); li != NULL; li = li->next) {
+		notify_display (li->data, keystr, valstr);
 	}
 
 	g_free (keystr);
@@ -1382,8 +1425,7 @@ mdm_daemon_config_load_displays (MdmConfig *config)
 			continue;
 		}
 
-		displays = g_slist_insert_sorted (displays, disp,
-			mdm_daemon_config_compare_displays);
+		mdm_display_add_sorted (disp);
 		if (keynum > high_display_num) {
 			high_display_num = keynum;
 		}
@@ -1671,6 +1713,12 @@ validate_cb (MdmConfig          *config,
 	case MDM_ID_SCAN_TIME:
 		res = validate_at_least_int (config, source, value, 1, 1);
 		break;
+	case MDM_ID_MAX_CONNECTIONS:
+		res = validate_at_least_int (config, source, value, 1, 15);
+		break;
+	case MDM_ID_CONNECTION_BACKLOG:
+		res = validate_at_least_int (config, source, value, 1, 64);
+		break;
         case MDM_ID_NONE:
         case MDM_CONFIG_INVALID_ID:
 		break;
@@ -1713,17 +1761,11 @@ source_to_name (MdmConfigSourceType source)
         return name;
 }
 
+/* The keys the slaves are told about when they change, see
+ * lookup_notify_key and mdm_slave_handle_notify */
 static gboolean
-notify_cb (MdmConfig          *config,
-	   MdmConfigSourceType source,
-	   const char         *group,
-	   const char         *key,
-	   MdmConfigValue     *value,
-	   int                 id,
-	   gpointer            data)
+is_notified_id (int id)
 {
-	char *valstr;
-
         switch (id) {
         case MDM_ID_GREETER:
         case MDM_ID_SOUND_ON_LOGIN_FILE:
@@ -1739,8 +1781,28 @@ notify_cb (MdmConfig          *config,
         case MDM_ID_TIMED_LOGIN_ENABLE:
 	case MDM_ID_RETRY_DELAY:
 	case MDM_ID_TIMED_LOGIN_DELAY:
+		return TRUE;
+	default:
+		return FALSE;
+        }
+}
+
+static gboolean
+notify_cb (MdmConfig          *config,
+	   MdmConfigSourceType source,
+	   const char         *group,
+	   const char         *key,
+	   MdmConfigValue     *value,
+	   int                 id,
+	   gpointer            data)
+{
+	char *valstr;
+
+	if (is_notified_id (id)) {
 		notify_displays_value (config, group, key, value);
-		break;
+	}
+
+        switch (id) {
         case MDM_ID_NONE:
         case MDM_CONFIG_INVALID_ID:
 		{
@@ -1806,7 +1868,7 @@ handle_no_displays (MdmConfig *config,
 		d = mdm_display_alloc (num, server, NULL);
 		d->is_emergency_server = TRUE;
 
-		displays = g_slist_append (displays, d);
+		mdm_display_add (d);
 
 		/* ALWAYS run the greeter and don't log anyone in,
 		 * this is just an emergency session */
@@ -2010,7 +2072,7 @@ mdm_daemon_load_config_file (MdmConfig **load_config)
 	mdm_config_set_validate_func (*load_config, validate_cb, NULL);
 	mdm_config_add_static_entries (*load_config, mdm_daemon_config_entries);
 	mdm_config_set_default_file (*load_config, default_config_file);
-	mdm_config_set_distro_file (*load_config, "/usr/share/mdm/distro.conf");
+	mdm_config_set_distro_file (*load_config, MDM_DISTRO_CONF);
 	mdm_config_set_custom_file (*load_config, custom_config_file);
 
 	/* load the data files */
@@ -2025,6 +2087,28 @@ mdm_daemon_load_config_file (MdmConfig **load_config)
 	mdm_config_process_all (*load_config, &error);
 }
 
+/*
+ * Do not allow these keys to be updated, since MDM would need
+ * additional work, or at least heavy testing, to make these keys
+ * flexible enough to be changed at runtime.
+ */
+static gboolean
+key_is_fixed (const char *keystring)
+{
+	return (is_key (keystring, MDM_KEY_PID_FILE) ||
+		is_key (keystring, MDM_KEY_CONSOLE_NOTIFY) ||
+		is_key (keystring, MDM_KEY_USER) ||
+		is_key (keystring, MDM_KEY_GROUP) ||
+		is_key (keystring, MDM_KEY_LOG_DIR) ||
+		is_key (keystring, MDM_KEY_SERV_AUTHDIR) ||
+		is_key (keystring, MDM_KEY_USER_AUTHDIR) ||
+		is_key (keystring, MDM_KEY_USER_AUTHFILE) ||
+		is_key (keystring, MDM_KEY_USER_AUTHDIR_FALLBACK) ||
+		is_key (keystring, MDM_KEY_MAX_CONNECTIONS) ||
+		is_key (keystring, MDM_KEY_CONNECTION_BACKLOG) ||
+		is_key (keystring, MDM_KEY_WATCH_CONFIG_FILES));
+}
+
 /**
  * mdm_daemon_config_update_key
  *
@@ -2056,20 +2140,7 @@ mdm_daemon_config_update_key (const char *keystring)
 	group = key = locale = NULL;
 	temp_config = NULL;
 
-	/*
-	 * Do not allow these keys to be updated, since MDM would need
-	 * additional work, or at least heavy testing, to make these keys
-	 * flexible enough to be changed at runtime.
-	 */
-	if (is_key (keystring, MDM_KEY_PID_FILE) ||
-	    is_key (keystring, MDM_KEY_CONSOLE_NOTIFY) ||
-	    is_key (keystring, MDM_KEY_USER) ||
-	    is_key (keystring, MDM_KEY_GROUP) ||
-	    is_key (keystring, MDM_KEY_LOG_DIR) ||
-	    is_key (keystring, MDM_KEY_SERV_AUTHDIR) ||
-	    is_key (keystring, MDM_KEY_USER_AUTHDIR) ||
-	    is_key (keystring, MDM_KEY_USER_AUTHFILE) ||
-	    is_key (keystring, MDM_KEY_USER_AUTHDIR_FALLBACK)) {
+	if (key_is_fixed (keystring)) {
 		return FALSE;
 	}
 
@@ -2103,6 +2174,9 @@ mdm_daemon_config_update_key (const char *keystring)
 	mdm_config_get_value_for_id (temp_config, entry->id, &value);
 	mdm_config_set_value_for_id (daemon_config, entry->id, value);
 
+	if (snapshot_generation > 0)
+		mdm_daemon_config_write_snapshot ();
+
  out:
 	if (temp_config != NULL)
 		mdm_config_free (temp_config);
@@ -2113,6 +2187,440 @@ mdm_daemon_config_update_key (const char *keystring)
 	return rc;
 }
 
+/*
+ * Watching the configuration files.  The directories are watched
+ * rather than the files, since editors and mdm_common_config_save
+ * replace a file instead of writing to it.  Events are collected for
+ * CONFIG_RELOAD_DELAY so that a burst of writes ends up as one reload,
+ * which rereads only the files that changed.  The values are diffed
+ * against file_config, which holds what the files said at the last
+ * reload, so values changed at runtime are left alone unless their
+ * key changed in a file.
+ */
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define CONFIG_RELOAD_DELAY 200 /* ms */
+
+typedef struct {
+	int   wd;
+	char *dir;
+} WatchedDir;
+
+static int         inotify_fd = -1;
+static guint       inotify_source = 0;
+static guint       reload_source = 0;
+static GSList     *watched_dirs = NULL;
+static guint       pending_sources = 0;     /* 1 << MdmConfigSourceType */
+static GHashTable *pending_displays = NULL; /* display name -> itself */
+static MdmConfig  *file_config = NULL;
+
+static gboolean
+watch_dir_of (const char *filename)
+{
+	WatchedDir *watched;
+	GSList     *li;
+	char       *dir;
+	int         wd;
+
+	if (filename == NULL)
+		return FALSE;
+
+	dir = g_path_get_dirname (filename);
+	for (li = watched_dirs; li != NULL; li = li->next) {
+		watched = li->data;
+		if (strcmp (watched->dir, dir) == 0) {
+			g_free (dir);
+			return TRUE;
+		}
+	}
+
+	wd = inotify_add_watch (inotify_fd, dir,
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+	if (wd < 0) {
+		mdm_debug ("Cannot watch configuration directory %s: %s",
+			   dir, strerror (errno));
+		g_free (dir);
+		return FALSE;
+	}
+
+	watched = g_new0 (WatchedDir, 1);
+	watched->wd = wd;
+	watched->dir = dir;
+	watched_dirs = g_slist_prepend (watched_dirs, watched);
+
+	return TRUE;
+}
+
+static void
+config_file_changed (const char *filename)
+{
+	if (strcmp (filename, default_config_file) == 0) {
+		pending_sources |= 1 << MDM_CONFIG_SOURCE_DEFAULT;
+	} else if (strcmp (filename, MDM_DISTRO_CONF) == 0) {
+		pending_sources |= 1 << MDM_CONFIG_SOURCE_DISTRO;
+	} else if (strcmp (filename, custom_config_file) == 0) {
+		pending_sources |= 1 << MDM_CONFIG_SOURCE_CUSTOM;
+	} else if (g_str_has_prefix (filename, custom_config_file)) {
+		/* maybe a per-display file, checked when reloading */
+		char *display = g_strdup (filename + strlen (custom_config_file));
+
+		if (pending_displays == NULL)
+			pending_displays = g_hash_table_new_full (g_str_hash, g_str_equal,
+								  g_free, NULL);
+		g_hash_table_replace (pending_displays, display, display);
+	}
+}
+
+static gboolean
+collect_changed_cb (MdmConfig          *config,
+		    MdmConfigSourceType source,
+		    const char         *group,
+		    const char         *key,
+		    MdmConfigValue     *value,
+		    int                 id,
+		    gpointer            data)
+{
+	GArray *changed = data;
+
+	if (id >= 0)
+		g_array_append_val (changed, id);
+
+	return TRUE;
+}
+
+/* Applies the keys that changed in the default, distro or custom file
+ * to the daemon configuration, returns how many did */
+static guint
+reload_config_files (guint sources)
+{
+	GArray *changed;
+	guint   n_applied;
+	guint   i;
+
+	if (sources & (1 << MDM_CONFIG_SOURCE_DEFAULT))
+		mdm_config_load_source (file_config, MDM_CONFIG_SOURCE_DEFAULT, NULL);
+	if (sources & (1 << MDM_CONFIG_SOURCE_DISTRO))
+		mdm_config_load_source (file_config, MDM_CONFIG_SOURCE_DISTRO, NULL);
+	if (sources & (1 << MDM_CONFIG_SOURCE_CUSTOM))
+		mdm_config_load_source (file_config, MDM_CONFIG_SOURCE_CUSTOM, NULL);
+
+	/* file_config only calls notify for values that differ from
+	 * what it had before */
+	changed = g_array_new (FALSE, FALSE, sizeof (int));
+	mdm_config_set_notify_func (file_config, collect_changed_cb, changed);
+	mdm_config_process_all (file_config, NULL);
+	mdm_config_set_notify_func (file_config, NULL, NULL);
+
+	n_applied = 0;
+	for (i = 0; i < changed->len; i++) {
+		const MdmConfigEntry *entry;
+		const MdmConfigValue *value;
+		char                 *keystring;
+		int                   id;
+
+		id = g_array_index (changed, int, i);
+		entry = mdm_config_lookup_entry_for_id (file_config, id);
+		if (entry == NULL ||
+		    ! mdm_config_peek_value_for_id (file_config, id, &value))
+			continue;
+
+		keystring = g_strdup_printf ("%s/%s", entry->group, entry->key);
+		if (key_is_fixed (keystring)) {
+			mdm_info ("Configuration key %s changed, this needs a restart of MDM",
+				  keystring);
+		} else {
+			mdm_debug ("Configuration key %s changed", keystring);
+			/* runs notify_cb, which queues the notification */
+			mdm_config_set_value_for_id (daemon_config, id, (MdmConfigValue *) value);
+			n_applied++;
+		}
+		g_free (keystring);
+	}
+
+	g_array_free (changed, TRUE);
+	/* nothing peeks into file_config outside of here */
+	mdm_config_release_superseded (file_config);
+
+	return n_applied;
+}
+
+static char *
+per_display_notify_value (GKeyFile             *key_file,
+			  const MdmConfigEntry *entry)
+{
+	MdmConfigValue *value;
+	char           *keystring;
+	char           *str;
+	char           *ret;
+
+	keystring = g_strdup_printf ("%s/%s", entry->group, entry->key);
+	str = NULL;
+	if (key_file_to_string (key_file, keystring, &str)) {
+		value = mdm_config_value_new_from_string (entry->type, str, NULL);
+	} else {
+		/* not in the per-display file, the display uses the
+		 * daemon wide value */
+		value = NULL;
+		mdm_config_get_value_for_id (daemon_config, entry->id, &value);
+	}
+
+	ret = value != NULL ? notify_value_to_string (value) : g_strdup (" ");
+
+	if (value != NULL)
+		mdm_config_value_free (value);
+	g_free (str);
+	g_free (keystring);
+
+	return ret;
+}
+
+/* Tells the slave of the display about the per-display keys that
+ * changed with its per-display file */
+static void
+reload_per_display_file (MdmDisplay *disp)
+{
+	GPtrArray *old_values;
+	GKeyFile  *key_file;
+	guint      n;
+	int        i;
+
+	old_values = g_ptr_array_new ();
+	key_file = mdm_per_display_config_peek (disp->name);
+	for (i = 0; mdm_daemon_config_entries[i].group != NULL; i++) {
+		const MdmConfigEntry *entry = &mdm_daemon_config_entries[i];
+
+		/* see mdm_daemon_config_key_to_string_per_display */
+		if (is_notified_id (entry->id) &&
+		    (strcmp (entry->group, "greeter") == 0 ||
+		     strcmp (entry->group, "gui") == 0))
+			g_ptr_array_add (old_values, per_display_notify_value (key_file, entry));
+	}
+
+	mdm_per_display_config_forget (disp->name);
+	key_file = mdm_per_display_config_get (disp->name);
+
+	/* the slave has its own copy of the file to forget */
+	notify_display (disp, MDM_NOTIFY_PER_DISPLAY_CONFIG, disp->name);
+
+	n = 0;
+	for (i = 0; mdm_daemon_config_entries[i].group != NULL; i++) {
+		const MdmConfigEntry *entry = &mdm_daemon_config_entries[i];
+		char                 *valstr;
+
+		if ( ! is_notified_id (entry->id) ||
+		    (strcmp (entry->group, "greeter") != 0 &&
+		     strcmp (entry->group, "gui") != 0))
+			continue;
+
+		valstr = per_display_notify_value (key_file, entry);
+		if (strcmp (valstr, g_ptr_array_index (old_values, n)) != 0) {
+			char *keystr = lookup_notify_key (daemon_config, entry->group, entry->key);
+
+			mdm_debug ("Per-display configuration key %s/%s changed for %s",
+				   entry->group, entry->key, disp->name);
+			notify_display (disp, keystr, valstr);
+			g_free (keystr);
+		}
+		g_free (valstr);
+		n++;
+	}
+
+	g_ptr_array_foreach (old_values, (GFunc) g_free, NULL);
+	g_ptr_array_free (old_values, TRUE);
+}
+
+static gboolean
+reload_timeout (gpointer data)
+{
+	guint sources;
+	guint n_applied;
+
+	reload_source = 0;
+
+	sources = pending_sources;
+	pending_sources = 0;
+
+	notify_begin_batch ();
+
+	n_applied = 0;
+	if (sources != 0)
+		n_applied = reload_config_files (sources);
+
+	if (pending_displays != NULL) {
+		GHashTableIter iter;
+		gpointer       name;
+
+		g_hash_table_iter_init (&iter, pending_displays);
+		while (g_hash_table_iter_next (&iter, &name, NULL)) {
+			MdmDisplay *disp = mdm_display_lookup_name (name);
+
+			if (disp != NULL)
+				reload_per_display_file (disp);
+		}
+		g_hash_table_destroy (pending_displays);
+		pending_displays = NULL;
+	}
+
+	notify_end_batch ();
+
+	if (n_applied > 0 && snapshot_generation > 0)
+		mdm_daemon_config_write_snapshot ();
+
+	/* straight from the main loop, nobody holds an old value */
+	mdm_daemon_config_release_superseded ();
+
+	return FALSE;
+}
+
+static gboolean
+inotify_data (GIOChannel  *source,
+	      GIOCondition cond,
+	      gpointer     data)
+{
+	char    buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+	ssize_t len;
+	char   *p;
+
+	VE_IGNORE_EINTR (len = read (inotify_fd, buf, sizeof (buf)));
+	if (len <= 0)
+		return TRUE;
+
+	for (p = buf; p < buf + len; ) {
+		struct inotify_event *event = (struct inotify_event *) p;
+		GSList               *li;
+
+		p += sizeof (struct inotify_event) + event->len;
+
+		if (event->mask & IN_Q_OVERFLOW) {
+			/* lost track, reread everything */
+			GSList *dl;
+
+			pending_sources |= (1 << MDM_CONFIG_SOURCE_DEFAULT) |
+				(1 << MDM_CONFIG_SOURCE_DISTRO) |
+				(1 << MDM_CONFIG_SOURCE_CUSTOM);
+
+			for (dl = mdm_display_get_list (); dl != NULL; dl = dl->next) {
+				MdmDisplay *disp = dl->data;
+				char       *name;
+
+				if (pending_displays == NULL)
+					pending_displays = g_hash_table_new_full (g_str_hash, g_str_equal,
+										  g_free, NULL);
+				name = g_strdup (disp->name);
+				g_hash_table_replace (pending_displays, name, name);
+			}
+			continue;
+		}
+		if (event->len == 0)
+			continue;
+
+		for (li = watched_dirs; li != NULL; li = li->next) {
+			WatchedDir *watched = li->data;
+
+			if (watched->wd == event->wd) {
+				char *filename = g_build_filename (watched->dir, event->name, NULL);
+				config_file_changed (filename);
+				g_free (filename);
+				break;
+			}
+		}
+	}
+
+	if ((pending_sources != 0 || pending_displays != NULL) && reload_source == 0)
+		reload_source = g_timeout_add (CONFIG_RELOAD_DELAY, reload_timeout, NULL);
+
+	return TRUE;
+}
+
+static void
+unwatch_config_files (void)
+{
+	mdm_per_display_config_set_watched (FALSE);
+
+	if (reload_source > 0) {
+		g_source_remove (reload_source);
+		reload_source = 0;
+	}
+	if (inotify_source > 0) {
+		g_source_remove (inotify_source);
+		inotify_source = 0;
+	}
+	if (inotify_fd >= 0) {
+		VE_IGNORE_EINTR (close (inotify_fd));
+		inotify_fd = -1;
+	}
+	while (watched_dirs != NULL) {
+		WatchedDir *watched = watched_dirs->data;
+
+		watched_dirs = g_slist_delete_link (watched_dirs, watched_dirs);
+		g_free (watched->dir);
+		g_free (watched);
+	}
+	if (pending_displays != NULL) {
+		g_hash_table_destroy (pending_displays);
+		pending_displays = NULL;
+	}
+	pending_sources = 0;
+	if (file_config != NULL) {
+		mdm_config_free (file_config);
+		file_config = NULL;
+	}
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
+
+/**
+ * mdm_daemon_config_watch_files
+ *
+ * Starts watching the configuration files if WatchConfigFiles is set.
+ * If they cannot be watched the key is set to false, so that mdmsetup
+ * knows it has to send UPDATE_CONFIG.
+ */
+void
+mdm_daemon_config_watch_files (void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+	GIOChannel *chan;
+
+	if ( ! mdm_daemon_config_get_bool_for_id (MDM_ID_WATCH_CONFIG_FILES) ||
+	     inotify_fd >= 0)
+		return;
+
+	inotify_fd = inotify_init ();
+	if (inotify_fd < 0) {
+		mdm_debug ("Cannot watch configuration files: %s", strerror (errno));
+		goto fail;
+	}
+	fcntl (inotify_fd, F_SETFD, FD_CLOEXEC);
+	fcntl (inotify_fd, F_SETFL, O_NONBLOCK);
+
+	/* the distro file is optional, its directory may not exist */
+	if ( ! watch_dir_of (default_config_file) ||
+	     ! watch_dir_of (custom_config_file))
+		goto fail;
+	watch_dir_of (MDM_DISTRO_CONF);
+
+	mdm_daemon_load_config_file (&file_config);
+
+	chan = g_io_channel_unix_new (inotify_fd);
+	g_io_channel_set_encoding (chan, NULL, NULL);
+	g_io_channel_set_buffered (chan, FALSE);
+	inotify_source = g_io_add_watch_full (chan, G_PRIORITY_DEFAULT,
+					      G_IO_IN | G_IO_PRI,
+					      inotify_data, NULL, NULL);
+	g_io_channel_unref (chan);
+
+	mdm_per_display_config_set_watched (TRUE);
+
+	mdm_debug ("Watching configuration files");
+	return;
+
+ fail:
+	unwatch_config_files ();
+#endif
+	mdm_config_set_bool_for_id (daemon_config, MDM_ID_WATCH_CONFIG_FILES, FALSE);
+}
+
 /**
  * mdm_daemon_config_parse
  *
@@ -2125,7 +2633,6 @@ mdm_daemon_config_parse (const char *config_file,
 	uid_t         uid;
 	gid_t         gid;
 
-	displays            = NULL;
 	high_display_num    = 0;
 
 	/* Not NULL if config_file was set by command-line option. */
@@ -2135,6 +2642,7 @@ mdm_daemon_config_parse (const char *config_file,
 
 	default_config_file = config_file;
 	custom_config_file  = g_strdup (MDM_CUSTOM_CONF);
+	mdm_per_display_config_set_base_file (custom_config_file);
 
 	mdm_daemon_load_config_file (&daemon_config);
 	mdm_config_set_notify_func (daemon_config, notify_cb, NULL);
@@ -2145,13 +2653,13 @@ mdm_daemon_config_parse (const char *config_file,
 		mdm_daemon_config_load_displays (daemon_config);
 	}
 	
-	if G_UNLIKELY (displays == NULL) {
+	if G_UNLIKELY (mdm_display_get_list () == NULL) {
 		handle_no_displays (daemon_config, no_console);
 	}
 
 	/* If no displays were found, then obviously
 	   we're in a no console mode */
-	if (displays == NULL) {
+	if (mdm_display_get_list () == NULL) {
 		no_console = TRUE;
 	}
 
@@ -2171,6 +2679,56 @@ mdm_daemon_config_parse (const char *config_file,
 	MdmGroupId = gid;
 }
 
+/**
+ * mdm_daemon_config_write_snapshot
+ *
+ * Publishes the current configuration in MDM_SUP_CONFIG_SNAPSHOT so
+ * the greeters can read it without asking over the socket.  This is
+ * done once the socket is up and again after each UPDATE_CONFIG.
+ * Keys that GET_CONFIG does not answer straight from the configuration
+ * are left out, so the greeters keep asking the daemon for those.
+ */
+void
+mdm_daemon_config_write_snapshot (void)
+{
+	GPtrArray *keys;
+	GPtrArray *values;
+	int        i;
+
+	keys = g_ptr_array_new ();
+	values = g_ptr_array_new ();
+
+	for (i = 0; mdm_daemon_config_entries[i].group != NULL; i++) {
+		const MdmConfigEntry *entry = &mdm_daemon_config_entries[i];
+		const MdmConfigValue *value;
+
+		/* GET_CONFIG only hands this out once, see mdm.c */
+		if (entry->id == MDM_ID_PRE_FETCH_PROGRAM)
+			continue;
+
+		if (! mdm_config_peek_value (daemon_config, entry->group, entry->key, &value) ||
+		    value == NULL)
+			continue;
+
+		g_ptr_array_add (keys, g_strdup_printf ("%s/%s", entry->group, entry->key));
+		g_ptr_array_add (values, mdm_config_value_to_string (value));
+	}
+
+	if (mdm_config_snapshot_write (MDM_SUP_CONFIG_SNAPSHOT,
+				       snapshot_generation + 1,
+				       custom_config_file,
+				       keys, values)) {
+		snapshot_generation++;
+		mdm_debug ("Wrote configuration snapshot %" G_GUINT64_FORMAT " with %u keys",
+			   snapshot_generation, keys->len);
+	}
+
+	g_ptr_array_foreach (keys, (GFunc) g_free, NULL);
+	g_ptr_array_foreach (values, (GFunc) g_free, NULL);
+	g_ptr_array_free (keys, TRUE);
+	g_ptr_array_free (values, TRUE);
+}
+
 /**
  * mdm_daemon_config_get_mdmuid
  * mdm_daemon_config_get_mdmgid
@@ -2207,6 +2765,13 @@ mdm_daemon_config_set_high_display_num (gint val)
 	high_display_num = val;
 }
 
+void
+mdm_daemon_config_release_superseded (void)
+{
+	if (daemon_config != NULL)
+		mdm_config_release_superseded (daemon_config);
+}
+
 /**
  *  mdm_daemon_config_close
  *
@@ -2215,7 +2780,15 @@ mdm_daemon_config_set_high_display_num (gint val)
 void
 mdm_daemon_config_close (void)
 {
+#ifdef HAVE_SYS_INOTIFY_H
+	unwatch_config_files ();
+#endif
 	mdm_config_free (daemon_config);
+	mdm_per_display_config_close ();
+	if (key_ids != NULL) {
+		g_hash_table_destroy (key_ids);
+		key_ids = NULL;
+	}
 }
 
 /**
@@ -35,15 +35,13 @@ void           mdm_daemon_config_parse                (const char *config_file,
                                                        gboolean    no_console);
 MdmXserver *   mdm_daemon_config_find_xserver         (const char *id);
 char *         mdm_daemon_config_get_xservers         (void);
-GSList *       mdm_daemon_config_get_display_list     (void);
-GSList *       mdm_daemon_config_display_list_append  (MdmDisplay *display);
-GSList *       mdm_daemon_config_display_list_insert  (MdmDisplay *display);
-GSList *       mdm_daemon_config_display_list_remove  (MdmDisplay *display);
 uid_t          mdm_daemon_config_get_mdmuid           (void);
 uid_t          mdm_daemon_config_get_mdmgid           (void);
 gint           mdm_daemon_config_get_high_display_num (void);
 void           mdm_daemon_config_set_high_display_num (gint val);
 void           mdm_daemon_config_close                (void);
+/* Frees values replaced since the last call, see mdm_daemon_config_get_value_string */
+void           mdm_daemon_config_release_superseded   (void);
 
 /* deprecated */
 char *         mdm_daemon_config_get_display_custom_config_file (const char *display);
@@ -72,6 +70,7 @@ void           mdm_daemon_config_set_value_int        (const char *key,
 gboolean       mdm_daemon_config_key_to_string_per_display (const char *display,
                                                             const char *key,
                                                             char **retval);
+guint          mdm_daemon_config_get_per_display_parse_count (void);
 gboolean       mdm_daemon_config_key_to_string        (const char *file,
                                                        const char *key,
                                                        char **retval);
@@ -79,6 +78,8 @@ gboolean       mdm_daemon_config_to_string            (const char *key,
                                                        const char *display,
                                                        char **retval);
 gboolean       mdm_daemon_config_update_key           (const char *key);
+void           mdm_daemon_config_write_snapshot       (void);
+void           mdm_daemon_config_watch_files          (void);
 
 
 int            mdm_daemon_config_compare_displays     (gconstpointer a,
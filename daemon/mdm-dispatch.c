@@ -0,0 +1,87 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "mdm-dispatch.h"
+
+static int
+compare_entries (const void *a, const void *b)
+{
+	return strcmp (((const MdmDispatchEntry *) a)->opcode,
+		       ((const MdmDispatchEntry *) b)->opcode);
+}
+
+void
+mdm_dispatch_sort (gpointer entries, gsize n_entries, gsize entry_size)
+{
+	qsort (entries, n_entries, entry_size, compare_entries);
+}
+
+gpointer
+mdm_dispatch_lookup (gpointer      entries,
+		     gsize         n_entries,
+		     gsize         entry_size,
+		     const char   *token,
+		     gsize         len)
+{
+	gsize lo = 0;
+	gsize hi = n_entries;
+
+	/* bsearch by hand since the token is not nul terminated */
+	while (lo < hi) {
+		gsize mid = (lo + hi) / 2;
+		MdmDispatchEntry *entry = (MdmDispatchEntry *)
+			((char *) entries + mid * entry_size);
+		int cmp;
+
+		/* most probes differ in the first byte already */
+		cmp = (guchar) token[0] - (guchar) entry->opcode[0];
+		if (cmp == 0)
+			cmp = strncmp (token, entry->opcode, len);
+
+		if (cmp == 0 && entry->opcode[len] != '\0')
+			cmp = -1; /* token is a prefix of the opcode */
+
+		if (cmp == 0)
+			return entry;
+		else if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+gsize
+mdm_dispatch_split (const char *msg, const char **args)
+{
+	gsize len = strcspn (msg, " ");
+
+	*args = (msg[len] == ' ') ? &msg[len + 1] : NULL;
+
+	return len;
+}
+
+/* EOF */
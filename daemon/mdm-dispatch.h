@@ -0,0 +1,55 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MDM_DISPATCH_H
+#define MDM_DISPATCH_H
+
+#include <glib.h>
+
+/*
+ * Opcode tables for the slave and user socket protocols.  A table is a
+ * plain array of structs that all start with the opcode string, so the
+ * caller can put whatever handler and argument description it needs
+ * after it.  The array is sorted once and then searched with bsearch,
+ * so the cost of a lookup does not depend on where in the table a
+ * command was added.
+ */
+typedef struct {
+	const char *opcode;
+} MdmDispatchEntry;
+
+void		mdm_dispatch_sort	(gpointer     entries,
+					 gsize        n_entries,
+					 gsize        entry_size);
+
+/* The entry is returned as the table was passed, the tables keep
+ * counters next to their handlers */
+gpointer	mdm_dispatch_lookup	(gpointer     entries,
+					 gsize        n_entries,
+					 gsize        entry_size,
+					 const char  *token,
+					 gsize        len);
+
+/* Splits "OPCODE args" into the opcode length and the arguments,
+ * args is set to NULL if there are none */
+gsize		mdm_dispatch_split	(const char  *msg,
+					 const char **args);
+
+#endif /* MDM_DISPATCH_H */
+
+/* EOF */
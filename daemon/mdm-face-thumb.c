@@ -0,0 +1,345 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <grp.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "mdm-common.h"
+#include "mdm-log.h"
+#include "mdm-face-cache.h"
+#include "mdm-face-thumb.h"
+
+/* A picture that takes longer than this to decode does not get cached */
+#define DECODE_TIMEOUT 10
+
+MdmFaceThumbRequest *
+mdm_face_thumb_request_new (uid_t       uid,
+			    gid_t       gid,
+			    const char *path,
+			    gint64      mtime,
+			    guint64     size)
+{
+	MdmFaceThumbRequest *request = g_new0 (MdmFaceThumbRequest, 1);
+
+	request->uid = uid;
+	request->gid = gid;
+	request->path = g_strdup (path);
+	request->mtime = mtime;
+	request->size = size;
+
+	return request;
+}
+
+void
+mdm_face_thumb_request_free (MdmFaceThumbRequest *request)
+{
+	if (request == NULL)
+		return;
+
+	g_free (request->path);
+	g_free (request);
+}
+
+/**
+ * mdm_face_thumb_scale_fd
+ *
+ * Scales the picture to the thumbnail size the same way the greeters
+ * always did, ignoring the aspect ratio, and adds an alpha channel if
+ * it has none.
+ */
+gboolean
+mdm_face_thumb_scale_fd (int     fd,
+			 gsize   size,
+			 guchar *pixels)
+{
+	GdkPixbufLoader *loader;
+	GdkPixbuf *img, *scaled, *rgba;
+	guchar     buf[16384];
+	gsize      pos = 0;
+	int        rowstride, row;
+
+	loader = gdk_pixbuf_loader_new ();
+	while (pos < size) {
+		ssize_t n;
+
+		VE_IGNORE_EINTR (n = read (fd, buf, MIN (sizeof (buf), size - pos)));
+		if (n <= 0)
+			break;
+		if ( ! gdk_pixbuf_loader_write (loader, buf, n, NULL))
+			break;
+		pos += n;
+	}
+	gdk_pixbuf_loader_close (loader, NULL);
+
+	img = gdk_pixbuf_loader_get_pixbuf (loader);
+	if (img == NULL) {
+		g_object_unref (G_OBJECT (loader));
+		return FALSE;
+	}
+
+	scaled = gdk_pixbuf_scale_simple (img,
+					  MDM_FACE_CACHE_THUMB_SIZE,
+					  MDM_FACE_CACHE_THUMB_SIZE,
+					  GDK_INTERP_BILINEAR);
+	g_object_unref (G_OBJECT (loader));
+	if (scaled == NULL)
+		return FALSE;
+
+	rgba = gdk_pixbuf_add_alpha (scaled, FALSE, 0, 0, 0);
+	g_object_unref (G_OBJECT (scaled));
+	if (rgba == NULL)
+		return FALSE;
+
+	rowstride = gdk_pixbuf_get_rowstride (rgba);
+	for (row = 0; row < MDM_FACE_CACHE_THUMB_SIZE; row++)
+		memcpy (pixels + row * MDM_FACE_CACHE_THUMB_SIZE * 4,
+			gdk_pixbuf_get_pixels (rgba) + row * rowstride,
+			MDM_FACE_CACHE_THUMB_SIZE * 4);
+
+	g_object_unref (G_OBJECT (rgba));
+
+	return TRUE;
+}
+
+static gboolean
+read_all (int fd, guchar *data, gsize len)
+{
+	while (len > 0) {
+		ssize_t n;
+
+		VE_IGNORE_EINTR (n = read (fd, data, len));
+		if (n <= 0)
+			return FALSE;
+		data += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+/* Never returns, the exit code is all the parent looks at besides
+ * the pixels */
+static void
+decode_as_user (MdmFaceThumbRequest *request,
+		gsize                max_file,
+		int                  out)
+{
+	guchar      pixels[MDM_FACE_CACHE_THUMB_BYTES];
+	struct stat s;
+	gsize       written = 0;
+	int         fd;
+
+	if (setgroups (0, NULL) < 0 ||
+	    setgid (request->gid) < 0 ||
+	    setuid (request->uid) < 0)
+		_exit (1);
+
+	alarm (DECODE_TIMEOUT);
+
+	/* the same checks as for handing the picture to the greeter, and
+	 * it must still be the file the slave looked at */
+	VE_IGNORE_EINTR (fd = open (request->path, O_RDONLY | O_NOCTTY | O_NONBLOCK));
+	if (fd < 0 ||
+	    fstat (fd, &s) < 0 ||
+	    ! S_ISREG (s.st_mode) ||
+	    (gsize) s.st_size > max_file ||
+	    (gint64) s.st_mtime != request->mtime ||
+	    (guint64) s.st_size != request->size)
+		_exit (1);
+
+	if ( ! mdm_face_thumb_scale_fd (fd, s.st_size, pixels))
+		_exit (1);
+
+	while (written < sizeof (pixels)) {
+		ssize_t n;
+
+		VE_IGNORE_EINTR (n = write (out, pixels + written, sizeof (pixels) - written));
+		if (n <= 0)
+			_exit (1);
+		written += n;
+	}
+
+	_exit (0);
+}
+
+static gboolean
+decode_picture (MdmFaceThumbRequest *request,
+		gsize                max_file,
+		guchar              *pixels)
+{
+	gboolean ok;
+	pid_t    pid;
+	int      p[2];
+	int      status;
+
+	if (pipe (p) < 0)
+		return FALSE;
+
+	pid = fork ();
+	if (pid < 0) {
+		VE_IGNORE_EINTR (close (p[0]));
+		VE_IGNORE_EINTR (close (p[1]));
+		return FALSE;
+	}
+
+	if (pid == 0) {
+		VE_IGNORE_EINTR (close (p[0]));
+		decode_as_user (request, max_file, p[1]);
+	}
+
+	VE_IGNORE_EINTR (close (p[1]));
+	ok = read_all (p[0], pixels, MDM_FACE_CACHE_THUMB_BYTES);
+	VE_IGNORE_EINTR (close (p[0]));
+
+	VE_IGNORE_EINTR (waitpid (pid, &status, 0));
+	return ok && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+/* Serializes the read, merge and rename of the pack between the
+ * slaves, which would otherwise lose each other's new pictures */
+static int
+lock_cache (const char *cache_file)
+{
+	char *lock_file;
+	int   fd;
+	int   res;
+
+	lock_file = g_strconcat (cache_file, ".lock", NULL);
+	VE_IGNORE_EINTR (fd = open (lock_file, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600));
+	if (fd < 0) {
+		mdm_error ("Cannot open face cache lock %s: %s",
+			   lock_file, strerror (errno));
+		g_free (lock_file);
+		return -1;
+	}
+	g_free (lock_file);
+
+	VE_IGNORE_EINTR (res = flock (fd, LOCK_EX));
+	if (res < 0) {
+		VE_IGNORE_EINTR (close (fd));
+		return -1;
+	}
+
+	return fd;
+}
+
+void
+mdm_face_thumb_update (const char *cache_file,
+		       GSList     *requests,
+		       gsize       max_file)
+{
+	MdmFaceCache *old;
+	GHashTable   *requested;
+	GPtrArray    *buffers;
+	GArray       *fresh;
+	GArray       *thumbs;
+	GSList       *li;
+	char         *dir;
+	guint         i;
+	int           lock_fd;
+
+	if (ve_string_empty (cache_file) || requests == NULL)
+		return;
+
+	fresh = g_array_new (FALSE, FALSE, sizeof (MdmFaceCacheThumb));
+	buffers = g_ptr_array_new_with_free_func (g_free);
+
+	/* the slow part, before taking the lock */
+	for (li = requests; li != NULL; li = li->next) {
+		MdmFaceThumbRequest *request = li->data;
+		MdmFaceCacheThumb    thumb;
+		guchar              *pixels;
+
+		pixels = g_malloc (MDM_FACE_CACHE_THUMB_BYTES);
+		g_ptr_array_add (buffers, pixels);
+
+		if ( ! decode_picture (request, max_file, pixels)) {
+			mdm_debug ("mdm_face_thumb_update: cannot scale %s", request->path);
+			continue;
+		}
+
+		thumb.uid = request->uid;
+		thumb.path = request->path;
+		thumb.mtime = request->mtime;
+		thumb.size = request->size;
+		thumb.pixels = pixels;
+		g_array_append_val (fresh, thumb);
+	}
+
+	if (fresh->len == 0)
+		goto out;
+
+	dir = g_path_get_dirname (cache_file);
+	if (g_mkdir_with_parents (dir, 0755) < 0)
+		mdm_error ("Cannot create face cache directory %s: %s",
+			   dir, strerror (errno));
+	g_free (dir);
+
+	lock_fd = lock_cache (cache_file);
+
+	requested = g_hash_table_new (NULL, NULL);
+	for (i = 0; i < fresh->len; i++)
+		g_hash_table_add (requested,
+				  GUINT_TO_POINTER (g_array_index (fresh, MdmFaceCacheThumb, i).uid));
+
+	/* everybody else's thumbnails carry over as they are, read
+	 * under the lock so that another slave's are in there */
+	thumbs = g_array_new (FALSE, FALSE, sizeof (MdmFaceCacheThumb));
+	old = mdm_face_cache_open (cache_file);
+	if (old != NULL) {
+		for (i = 0; i < mdm_face_cache_get_n_thumbs (old); i++) {
+			MdmFaceCacheThumb thumb;
+
+			mdm_face_cache_get_thumb (old, i, &thumb);
+			if ( ! g_hash_table_contains (requested, GUINT_TO_POINTER (thumb.uid)))
+				g_array_append_val (thumbs, thumb);
+		}
+	}
+	g_array_append_vals (thumbs, fresh->data, fresh->len);
+
+	if (mdm_face_cache_write (cache_file, thumbs))
+		mdm_debug ("mdm_face_thumb_update: added %u pictures to %s, %u in all",
+			   fresh->len, cache_file, thumbs->len);
+
+	if (lock_fd >= 0)
+		VE_IGNORE_EINTR (close (lock_fd));
+
+	mdm_face_cache_close (old);
+	g_array_free (thumbs, TRUE);
+	g_hash_table_destroy (requested);
+
+ out:
+	g_ptr_array_free (buffers, TRUE);
+	g_array_free (fresh, TRUE);
+}
+
+/* EOF */
@@ -0,0 +1,61 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MDM_FACE_THUMB_H
+#define MDM_FACE_THUMB_H
+
+#include <sys/types.h>
+#include <glib.h>
+
+/*
+ * Filling the face cache (see mdm-face-cache.h).  The slave notes the
+ * pictures the cache did not have while it serves them to the greeter
+ * and then hands the list to mdm_face_thumb_update in a child of its
+ * own.  Pictures are decoded in a further child running as their
+ * owner, root only ever sees the scaled pixels.
+ */
+typedef struct {
+	uid_t    uid;
+	gid_t    gid;
+	char    *path;
+	gint64   mtime;
+	guint64  size;
+} MdmFaceThumbRequest;
+
+MdmFaceThumbRequest *	mdm_face_thumb_request_new	(uid_t        uid,
+							 gid_t        gid,
+							 const char  *path,
+							 gint64       mtime,
+							 guint64      size);
+void			mdm_face_thumb_request_free	(MdmFaceThumbRequest *request);
+
+/* Decodes size bytes of picture from fd into a
+ * MDM_FACE_CACHE_THUMB_BYTES RGBA thumbnail */
+gboolean		mdm_face_thumb_scale_fd		(int          fd,
+							 gsize        size,
+							 guchar      *pixels);
+
+/* Adds the requested pictures to cache_file, keeping what is already
+ * there for other users.  Blocks until done. */
+void			mdm_face_thumb_update		(const char  *cache_file,
+							 GSList      *requests,
+							 gsize        max_file);
+
+#endif /* MDM_FACE_THUMB_H */
+
+/* EOF */
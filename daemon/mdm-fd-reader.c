@@ -0,0 +1,112 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "mdm-common.h"
+#include "mdm-fd-reader.h"
+
+void
+mdm_fd_reader_init (MdmFdReader *reader, int fd)
+{
+	reader->fd = fd;
+	reader->start = 0;
+	reader->end = 0;
+}
+
+/* Blocks like the read() of a single byte used to, the signal handlers
+ * may jump out of it, so nothing is changed until the read returned */
+static gboolean
+fill (MdmFdReader *reader)
+{
+	ssize_t bytes;
+
+	if (reader->fd < 0)
+		return FALSE;
+
+	VE_IGNORE_EINTR (bytes = read (reader->fd, reader->buf, sizeof (reader->buf)));
+	if (bytes <= 0)
+		return FALSE;
+
+	reader->start = 0;
+	reader->end = bytes;
+	return TRUE;
+}
+
+int
+mdm_fd_reader_getc (MdmFdReader *reader)
+{
+	if (reader->start == reader->end && ! fill (reader))
+		return EOF;
+
+	/*
+	 * The buffer is unsigned because the GUI sends username/password
+	 * data as utf8 and any character with its high bit set would
+	 * look like EOF otherwise.
+	 */
+	return reader->buf[reader->start++];
+}
+
+gboolean
+mdm_fd_reader_has_data (MdmFdReader *reader)
+{
+	return reader->start < reader->end;
+}
+
+char *
+mdm_fd_reader_gets (MdmFdReader *reader)
+{
+	GString *gs = NULL;
+
+	for (;;) {
+		guchar *p, *nl;
+		gsize len;
+
+		if (reader->start == reader->end && ! fill (reader)) {
+			/* on EOF */
+			if (gs == NULL)
+				return NULL;
+			return g_string_free (gs, FALSE);
+		}
+
+		p = reader->buf + reader->start;
+		len = reader->end - reader->start;
+		nl = memchr (p, '\n', len);
+
+		if (gs == NULL)
+			gs = g_string_sized_new (nl != NULL ? (gsize) (nl - p) : len);
+
+		if (nl != NULL) {
+			g_string_append_len (gs, (char *) p, nl - p);
+			reader->start += (nl - p) + 1;
+			return g_string_free (gs, FALSE);
+		}
+
+		g_string_append_len (gs, (char *) p, len);
+		reader->start = reader->end;
+	}
+}
+
+/* EOF */
@@ -0,0 +1,55 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MDM_FD_READER_H
+#define MDM_FD_READER_H
+
+#include <glib.h>
+
+#define MDM_FD_READER_SIZE 4096
+
+/*
+ * Buffered reading of a pipe, for the greeter's replies.  One read()
+ * takes whatever the other side has written instead of one read() per
+ * byte.  Bytes past the current reply stay in the buffer for the next
+ * call, just as they would have stayed in the pipe, so the reader must
+ * be reset whenever the fd is closed or replaced.
+ */
+typedef struct {
+	int    fd;
+	gsize  start;	/* first unread byte */
+	gsize  end;	/* end of the data read so far */
+	guchar buf[MDM_FD_READER_SIZE];
+} MdmFdReader;
+
+void	mdm_fd_reader_init	(MdmFdReader *reader,
+				 int          fd);
+
+/* Same as getc, EOF on end of file or error */
+int	mdm_fd_reader_getc	(MdmFdReader *reader);
+
+/* Reads up to the next newline, which is dropped.  Returns what was
+ * read before end of file, or NULL if that was nothing */
+char *	mdm_fd_reader_gets	(MdmFdReader *reader);
+
+/* TRUE if the next getc or gets does not have to read the fd */
+gboolean mdm_fd_reader_has_data	(MdmFdReader *reader);
+
+#endif /* MDM_FD_READER_H */
+
+/* EOF */
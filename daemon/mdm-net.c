@@ -24,6 +24,7 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
@@ -31,6 +32,9 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <errno.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include <glib/gi18n.h>
 
@@ -40,49 +44,65 @@
 
 #include "mdm-common.h"
 #include "mdm-log.h"
+#include "mdm-line-buffer.h"
 #include "mdm-daemon-config.h"
 
 /*
- * Kind of a weird setup, new connections whack old connections.
- *
- * We may want to allow tuning of the max connections, since
- * this number means that only a certain number of slaves can
- * talk to the daemon at once.  Note that since new connections
- * whack old connections, this tends to cause traffic problems
- * if the daemon is really being hammered.
- *
- * This is because the slaves retry a failed connection 5 times,
- * though they are at least smart enough to sleep 1 second
- * between retries if the connection failed on the connect()
- * call.  But, this means that throwing off a connection causes
- * that slave to come back in another second and try to
- * connect again.  So if the daemon is really being hammered,
- * this just causes more traffic problems.  It's really faster
- * to let each connection finish.
+ * All connections (the user socket, the slave pipe and every client
+ * connected to the socket) are watched through a single event source.
+ * Where epoll is available this is one epoll set hooked into the main
+ * loop, otherwise we fall back to a GIOChannel watch per connection.
  *
- * This may cause problems for some setups (perhaps terminal
- * servers) where lots of connections may hit the server at once
- * and 15 connections may not be enough (especially since the
- * console login screen may also be using one of them).  Perhaps
- * this number should be in configuration file so it can be
- * tuned by the end user?
- *
- * If, when you turn on debug, you notice messages like this
- * in the log, "Closing connection, x subconnections reached"
- * and some slaves are not working properly, then bumping this
- * number up is probably a reasonable fix if you can't simply
- * reduce the socket load the daemon must handle.
+ * We used to accept everything and then whack the oldest connection
+ * once MAX_CONNECTIONS was reached.  That made the whacked slave come
+ * back a second later and just caused more traffic exactly when the
+ * daemon was busiest.  Now the listening socket simply stops accepting
+ * when MaxConnections clients are being served, so further clients
+ * wait in the kernel accept queue (ConnectionBacklog long) until a slot
+ * frees up.  The clients keep their connection between commands and
+ * open a new one when it is gone, so when we are full the connection
+ * that has been idle the longest is closed to make room right away.
+ * Only connections that have not said anything for IDLE_TIMEOUT_MS
+ * count as idle, a client in the middle of a burst of commands is not
+ * cut off only to come back at once.
+ */
+#define IDLE_TIMEOUT_MS 500
+
+/* How many ready connections are handled per wakeup */
+#define EPOLL_BATCH 32
+
+/*
+ * Replies are queued per connection and flushed with one sendmsg over
+ * all queued blocks, once after each batch of requests read and then
+ * whenever the socket becomes writable again.  A client that keeps
+ * sending requests without reading the answers is not read from
+ * anymore once OUT_HIGH_WATER bytes are waiting for it, until it has
+ * drained the queue below OUT_LOW_WATER.
  */
-#define MAX_CONNECTIONS 15
+#define OUT_BLOCK_SIZE 4096
+#define OUT_MAX_IOV 16
+#define OUT_HIGH_WATER (64 * 1024)
+#define OUT_LOW_WATER (16 * 1024)
+
+typedef gboolean (* MdmConnectionIOFunc) (MdmConnection *conn,
+					  GIOCondition cond);
 
 struct _MdmConnection {
 	int fd;
-	guint source;
+	guint source; /* only used without epoll */
+	gboolean watched;
+	MdmConnectionIOFunc io_func;
 	gboolean writable;
 
-	GString *buffer;
+	MdmLineBuffer input;
+
+	GQueue out_blocks; /* GStrings waiting to be sent */
+	gsize out_offset;  /* how much of the first block was sent */
+	gsize out_len;     /* total bytes waiting */
+	gboolean throttled;
 
 	int message_count;
+	gint64 last_activity; /* monotonic, in microseconds */
 
 	gboolean nonblock;
 
@@ -102,24 +122,311 @@ struct _MdmConnection {
 	GDestroyNotify close_notify;
 
 	MdmConnection *parent;
+	GList *link; /* our link in parent->subconnections */
+	gboolean close_on_hup; /* a slave channel, see mdm_connection_open_fd */
 
-	GList *subconnections;
-	int n_subconnections;
+	GQueue subconnections;
+	int max_connections;
+	gboolean accept_paused;
+	guint accept_retry;
 
 	MdmDisplay *disp;
+
+	/* who connected, for clients of the unix socket */
+	gboolean have_peer_cred;
+	uid_t peer_uid;
+	pid_t peer_pid;
 };
 
+static gulong bytes_queued = 0;
+static gulong bytes_flushed = 0;
+static gulong connections_accepted = 0;
+static gulong connections_evicted = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+static int epoll_fd = -1;
+static pid_t epoll_pid = 0;
+static guint epoll_source = 0;
+static int epoll_watches = 0;
+
+/* The batch being dispatched, so that connections closed by some
+ * earlier handler in the same batch can be dropped from it */
+static struct epoll_event *dispatch_events = NULL;
+static int dispatch_n_events = 0;
+
+static GIOCondition
+epoll_to_condition (guint32 events)
+{
+	GIOCondition cond = 0;
+
+	if (events & EPOLLIN)
+		cond |= G_IO_IN;
+	if (events & EPOLLPRI)
+		cond |= G_IO_PRI;
+	if (events & EPOLLOUT)
+		cond |= G_IO_OUT;
+	if (events & EPOLLERR)
+		cond |= G_IO_ERR;
+	if (events & EPOLLHUP)
+		cond |= G_IO_HUP;
+
+	return cond;
+}
+
+static gboolean
+epoll_dispatch (GIOChannel *source,
+		GIOCondition cond,
+		gpointer data)
+{
+	struct epoll_event events[EPOLL_BATCH];
+	int n, i;
+
+	VE_IGNORE_EINTR (n = epoll_wait (epoll_fd, events, EPOLL_BATCH, 0));
+	if (n <= 0)
+		return TRUE;
+
+	dispatch_events = events;
+	dispatch_n_events = n;
+
+	for (i = 0; i < n; i++) {
+		MdmConnection *conn = events[i].data.ptr;
+
+		/* closed by an earlier handler in this batch */
+		if (conn == NULL)
+			continue;
+
+		conn->io_func (conn, epoll_to_condition (events[i].events));
+	}
+
+	dispatch_events = NULL;
+	dispatch_n_events = 0;
+
+	return TRUE;
+}
+
+static gboolean
+epoll_init (void)
+{
+	GIOChannel *epollchan;
+
+	if (epoll_fd >= 0)
+		return TRUE;
+
+	epoll_fd = epoll_create (EPOLL_BATCH);
+	if G_UNLIKELY (epoll_fd < 0) {
+		mdm_error ("epoll_init: Could not create epoll set: %s",
+			   strerror (errno));
+		return FALSE;
+	}
+	fcntl (epoll_fd, F_SETFD, FD_CLOEXEC);
+	epoll_pid = getpid ();
+
+	epollchan = g_io_channel_unix_new (epoll_fd);
+	g_io_channel_set_encoding (epollchan, NULL, NULL);
+	g_io_channel_set_buffered (epollchan, FALSE);
+
+	epoll_source = g_io_add_watch_full
+		(epollchan, G_PRIORITY_DEFAULT,
+		 G_IO_IN|G_IO_PRI,
+		 epoll_dispatch, NULL, NULL);
+	g_io_channel_unref (epollchan);
+
+	return TRUE;
+}
+
+static void
+epoll_shutdown (void)
+{
+	if (epoll_source > 0) {
+		g_source_remove (epoll_source);
+		epoll_source = 0;
+	}
+
+	if (epoll_fd >= 0) {
+		VE_IGNORE_EINTR (close (epoll_fd));
+		epoll_fd = -1;
+	}
+}
+#else /* ! HAVE_SYS_EPOLL_H */
+static gboolean
+channel_dispatch (GIOChannel *source,
+		  GIOCondition cond,
+		  gpointer data)
+{
+	MdmConnection *conn = data;
+
+	/* If the connection got closed the source is already gone */
+	return conn->io_func (conn, cond);
+}
+#endif /* HAVE_SYS_EPOLL_H */
+
+/* What we currently want to hear about: input unless the connection
+ * is paused, and whether the fd is writable while output is queued */
+static GIOCondition
+watch_condition (MdmConnection *conn)
+{
+	GIOCondition cond = 0;
+
+	if ( ! conn->accept_paused && ! conn->throttled)
+		cond |= G_IO_IN|G_IO_PRI;
+	/* a throttled connection is let go again from the writable
+	 * callback, so keep listening for that even when the queue
+	 * got emptied some other way */
+	if (conn->out_len > 0 || conn->throttled)
+		cond |= G_IO_OUT;
+
+	return cond;
+}
+
+static gboolean
+watch_add (MdmConnection *conn, MdmConnectionIOFunc io_func)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+
+	if G_UNLIKELY ( ! epoll_init ())
+		return FALSE;
+
+	memset (&ev, 0, sizeof (ev));
+	ev.events = EPOLLIN|EPOLLPRI;
+	ev.data.ptr = conn;
+
+	if G_UNLIKELY (epoll_ctl (epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+		mdm_error ("watch_add: Could not watch fd %d: %s",
+			   conn->fd, strerror (errno));
+		return FALSE;
+	}
+	epoll_watches++;
+#else
+	GIOChannel *chan;
+
+	chan = g_io_channel_unix_new (conn->fd);
+	g_io_channel_set_encoding (chan, NULL, NULL);
+	g_io_channel_set_buffered (chan, FALSE);
+
+	conn->source = g_io_add_watch_full
+		(chan, G_PRIORITY_DEFAULT,
+		 watch_condition (conn)|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
+		 channel_dispatch, conn, NULL);
+	g_io_channel_unref (chan);
+#endif
+	conn->io_func = io_func;
+	conn->watched = TRUE;
+
+	return TRUE;
+}
+
+/* Changes the events watched without dropping the fd from the set */
+static void
+watch_update (MdmConnection *conn)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+	GIOCondition cond;
+
+	if ( ! conn->watched || epoll_fd < 0)
+		return;
+
+	cond = watch_condition (conn);
+
+	memset (&ev, 0, sizeof (ev));
+	if (cond & G_IO_IN)
+		ev.events |= EPOLLIN|EPOLLPRI;
+	if (cond & G_IO_OUT)
+		ev.events |= EPOLLOUT;
+	ev.data.ptr = conn;
+	epoll_ctl (epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+#else
+	if ( ! conn->watched)
+		return;
+
+	if (conn->source > 0) {
+		g_source_remove (conn->source);
+		conn->source = 0;
+	}
+	if (watch_condition (conn) != 0) {
+		conn->watched = FALSE;
+		watch_add (conn, conn->io_func);
+	}
+#endif
+}
+
+static void
+watch_remove (MdmConnection *conn)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	int i;
+
+	if ( ! conn->watched)
+		return;
+	conn->watched = FALSE;
+
+	/* Never touch the set from a forked child, it is shared with
+	 * the parent daemon */
+	if (epoll_fd >= 0 && epoll_pid == getpid ())
+		epoll_ctl (epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+	for (i = 0; i < dispatch_n_events; i++) {
+		if (dispatch_events[i].data.ptr == conn)
+			dispatch_events[i].data.ptr = NULL;
+	}
+
+	epoll_watches--;
+	if (epoll_watches <= 0) {
+		epoll_watches = 0;
+		epoll_shutdown ();
+	}
+#else
+	conn->watched = FALSE;
+	if (conn->source > 0) {
+		g_source_remove (conn->source);
+		conn->source = 0;
+	}
+#endif
+}
+
+static MdmConnection *
+connection_new (int fd)
+{
+	MdmConnection *conn;
+
+	conn = g_new0 (MdmConnection, 1);
+	conn->disp = NULL;
+	conn->message_count = 0;
+	conn->last_activity = g_get_monotonic_time ();
+	conn->nonblock = FALSE;
+	conn->close_level = 0;
+	conn->fd = fd;
+	conn->writable = FALSE;
+	mdm_line_buffer_init (&conn->input);
+	g_queue_init (&conn->out_blocks);
+	conn->out_offset = 0;
+	conn->out_len = 0;
+	conn->throttled = FALSE;
+	conn->filename = NULL;
+	conn->user_flags = 0;
+	conn->parent = NULL;
+	conn->link = NULL;
+	conn->close_on_hup = FALSE;
+	g_queue_init (&conn->subconnections);
+	conn->max_connections = 0;
+	conn->accept_paused = FALSE;
+	conn->accept_retry = 0;
+
+	return conn;
+}
+
 int 
 mdm_connection_is_server_busy (MdmConnection *conn) {
-	int max_connections = MAX_CONNECTIONS;
+	int n_subconnections = conn->subconnections.length;
 
-	if (conn->n_subconnections >= (max_connections / 2)) {
+	if (n_subconnections >= (conn->max_connections / 2)) {
 		mdm_debug ("Connections is %d, max is %d, busy TRUE",
-			conn->n_subconnections, max_connections);
+			n_subconnections, conn->max_connections);
 		return TRUE;
 	} else {
 		mdm_debug ("Connections is %d, max is %d, busy FALSE",
-			conn->n_subconnections, max_connections);
+			n_subconnections, conn->max_connections);
 		return FALSE;
 	}
 }
@@ -127,8 +434,9 @@ mdm_connection_is_server_busy (MdmConnection *conn) {
 static gboolean
 close_if_needed (MdmConnection *conn, GIOCondition cond, gboolean error)
 {
-	/* non-subconnections are never closed */
-	if (conn->parent == NULL)
+	/* non-subconnections are never closed, except for a slave
+	 * channel whose slave has gone away */
+	if (conn->parent == NULL && ! conn->close_on_hup)
 		return TRUE;
 
 	if (cond & G_IO_ERR ||
@@ -139,64 +447,245 @@ close_if_needed (MdmConnection *conn, GIOCondition cond, gboolean error)
 			mdm_debug ("close_if_needed: Got G_IO_HUP on %d", conn->fd);
 		if (error)
 			mdm_debug ("close_if_needed: Got error on %d", conn->fd);
-		conn->source = 0;
 		mdm_connection_close (conn);
 		return FALSE;
 	}
 	return TRUE;
 }
 
+static void
+connection_drop_output (MdmConnection *conn)
+{
+	GString *block;
+
+	while ((block = g_queue_pop_head (&conn->out_blocks)) != NULL)
+		g_string_free (block, TRUE);
+	conn->out_offset = 0;
+	conn->out_len = 0;
+}
+
+/* Sends as much of the queued output as the socket takes, returns
+ * FALSE if the connection is broken */
 static gboolean
-mdm_connection_handler (GIOChannel *source,
-		        GIOCondition cond,
-		        gpointer data)
+connection_flush (MdmConnection *conn)
 {
-	MdmConnection *conn = data;
-	char buf[PIPE_SIZE];
-	char *p;
-	size_t len;
+	struct iovec iov[OUT_MAX_IOV];
+	struct msghdr msg;
+	GList *li;
+	gsize sent;
+	int n, ret;
+	int save_errno;
+	int flags = 0;
+#ifndef MSG_NOSIGNAL
+	void (*old_handler)(int);
+#endif
 
-	if ( ! (cond & G_IO_IN))
-		return close_if_needed (conn, cond, FALSE);
+#ifdef MSG_DONTWAIT
+	if (conn->nonblock)
+		flags |= MSG_DONTWAIT;
+#endif
 
-	VE_IGNORE_EINTR (len = read (conn->fd, buf, sizeof (buf) -1));
-	if (len <= 0)
-		return close_if_needed (conn, cond, TRUE);
+	while (conn->out_len > 0) {
+		n = 0;
+		for (li = conn->out_blocks.head;
+		     li != NULL && n < OUT_MAX_IOV;
+		     li = li->next) {
+			GString *block = li->data;
+			gsize skip = (n == 0) ? conn->out_offset : 0;
+
+			iov[n].iov_base = block->str + skip;
+			iov[n].iov_len = block->len - skip;
+			n++;
+		}
 
-	buf[len] = '\0';
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
 
-	if (conn->buffer == NULL)
-		conn->buffer = g_string_new (NULL);
+#ifdef MSG_NOSIGNAL
+		VE_IGNORE_EINTR (ret = sendmsg (conn->fd, &msg, MSG_NOSIGNAL | flags));
+		save_errno = errno;
+#else
+		old_handler = signal (SIGPIPE, SIG_IGN);
+		VE_IGNORE_EINTR (ret = sendmsg (conn->fd, &msg, flags));
+		save_errno = errno;
+		signal (SIGPIPE, old_handler);
+#endif
 
-	for (p = buf; *p != '\0'; p++) {
-		if (*p == '\r' ||
-		    (*p == '\n' &&
-		     ve_string_empty (conn->buffer->str)))
-			/*ignore \r or empty lines*/
-			continue;
-		if (*p == '\n' || 
-		    /* cut lines short at 4096 to prevent DoS attacks */
-		    conn->buffer->len > 4096) {
-			conn->close_level = 1;
-			conn->message_count++;
-			conn->handler (conn, conn->buffer->str,
-				       conn->data);
-			if (conn->close_level == 2) {
-				conn->close_level = 0;
-				conn->source = 0;
-				mdm_connection_close (conn);
-				return FALSE;
-			}
+		if (ret < 0) {
+			if (save_errno == EAGAIN || save_errno == EWOULDBLOCK)
+				return TRUE;
+
+			mdm_debug ("connection_flush: Could not write to %d: %s",
+				   conn->fd, strerror (save_errno));
+			connection_drop_output (conn);
+			conn->writable = FALSE;
+			/* just so that 'signal' doesn't whack it */
+			errno = save_errno;
+			return FALSE;
+		}
+
+		bytes_flushed += ret;
+		conn->out_len -= ret;
+
+		/* free the blocks that went out completely */
+		sent = conn->out_offset + ret;
+		while (sent > 0) {
+			GString *block = g_queue_peek_head (&conn->out_blocks);
+
+			if (block == NULL || sent < block->len)
+				break;
+			sent -= block->len;
+			g_string_free (g_queue_pop_head (&conn->out_blocks), TRUE);
+		}
+		conn->out_offset = sent;
+	}
+
+	return TRUE;
+}
+
+static GString *
+connection_tail_block (MdmConnection *conn)
+{
+	GString *block = g_queue_peek_tail (&conn->out_blocks);
+
+	if (block == NULL || block->len >= OUT_BLOCK_SIZE) {
+		block = g_string_sized_new (OUT_BLOCK_SIZE);
+		g_queue_push_tail (&conn->out_blocks, block);
+	}
+
+	return block;
+}
+
+/* Called after len bytes were added to the output queue */
+static gboolean
+connection_queued (MdmConnection *conn, gsize len, GIOCondition before)
+{
+	gboolean ret = TRUE;
+
+	conn->out_len += len;
+	bytes_queued += len;
+
+	/* While the connection's handler runs, replies are only queued
+	 * and go out together once the whole batch was handled */
+	if (conn->close_level != 0)
+		return TRUE;
+
+	ret = connection_flush (conn);
+
+	if ( ! conn->throttled && conn->out_len > OUT_HIGH_WATER) {
+		mdm_debug ("Connection %d has %lu bytes unread, not reading from it for now",
+			   conn->fd, (gulong) conn->out_len);
+		conn->throttled = TRUE;
+	}
+
+	if (watch_condition (conn) != before)
+		watch_update (conn);
+
+	return ret;
+}
+
+/* Hands the complete lines read so far to the handler, returns FALSE
+ * if the connection got closed */
+static gboolean
+connection_process_input (MdmConnection *conn)
+{
+	GIOCondition before;
+	char *line;
+
+	before = watch_condition (conn);
+
+	/* lines are handed to the handler in place, empty lines and
+	 * carriage returns are skipped and overlong lines cut short */
+	while ( ! conn->throttled &&
+		mdm_line_buffer_next (&conn->input, &line)) {
+		conn->close_level = 1;
+		conn->message_count++;
+		conn->handler (conn, line, conn->data);
+		if (conn->close_level == 2) {
 			conn->close_level = 0;
-			g_string_truncate (conn->buffer, 0);
-		} else {
-			g_string_append_c (conn->buffer, *p);
+			mdm_connection_close (conn);
+			return FALSE;
+		}
+		conn->close_level = 0;
+
+		if G_UNLIKELY (conn->out_len > OUT_HIGH_WATER) {
+			mdm_debug ("Connection %d has %lu bytes unread, not reading from it for now",
+				   conn->fd, (gulong) conn->out_len);
+			conn->throttled = TRUE;
 		}
 	}
 
+	if (conn->out_len > 0)
+		connection_flush (conn);
+
+	if (watch_condition (conn) != before)
+		watch_update (conn);
+
+	return TRUE;
+}
+
+static gboolean
+mdm_connection_handler (MdmConnection *conn,
+		        GIOCondition cond)
+{
+	char *buf;
+	gsize avail;
+	int len;
+
+	if (cond & G_IO_OUT) {
+		GIOCondition before = watch_condition (conn);
+
+		conn->last_activity = g_get_monotonic_time ();
+		connection_flush (conn);
+
+		if (conn->throttled && conn->out_len < OUT_LOW_WATER) {
+			conn->throttled = FALSE;
+			/* handle what was left over when we stopped */
+			if ( ! connection_process_input (conn))
+				return FALSE;
+		}
+
+		if (watch_condition (conn) != before)
+			watch_update (conn);
+	}
+
+	if ( ! (cond & G_IO_IN) || conn->throttled)
+		return close_if_needed (conn, cond, FALSE);
+
+	buf = mdm_line_buffer_reserve (&conn->input, &avail);
+	VE_IGNORE_EINTR (len = read (conn->fd, buf, MIN (avail, PIPE_SIZE)));
+	if (len <= 0)
+		return close_if_needed (conn, cond, TRUE);
+
+	mdm_line_buffer_commit (&conn->input, len);
+
+	conn->last_activity = g_get_monotonic_time ();
+
+	if ( ! connection_process_input (conn))
+		return FALSE;
+
 	return close_if_needed (conn, cond, FALSE);
 }
 
+void
+mdm_connection_get_output_stats (gulong *queued, gulong *flushed)
+{
+	if (queued != NULL)
+		*queued = bytes_queued;
+	if (flushed != NULL)
+		*flushed = bytes_flushed;
+}
+
+void
+mdm_connection_get_accept_stats (gulong *accepted, gulong *evicted)
+{
+	if (accepted != NULL)
+		*accepted = connections_accepted;
+	if (evicted != NULL)
+		*evicted = connections_evicted;
+}
+
 gboolean
 mdm_connection_is_writable (MdmConnection *conn)
 {
@@ -208,12 +697,8 @@ mdm_connection_is_writable (MdmConnection *conn)
 gboolean
 mdm_connection_write (MdmConnection *conn, const char *str)
 {
-	int ret;
-	int save_errno;
-	int flags = 0;
-#ifndef MSG_NOSIGNAL
-	void (*old_handler)(int);
-#endif
+	GIOCondition before;
+	gsize len;
 
 	g_return_val_if_fail (conn != NULL, FALSE);
 	g_return_val_if_fail (str != NULL, FALSE);
@@ -221,98 +706,171 @@ mdm_connection_write (MdmConnection *conn, const char *str)
 	if G_UNLIKELY ( ! conn->writable)
 		return FALSE;
 
-#ifdef MSG_DONTWAIT
-	if (conn->nonblock)
-		flags |= MSG_DONTWAIT;
-#endif
+	len = strlen (str);
+	if (len == 0)
+		return TRUE;
 
-#ifdef MSG_NOSIGNAL
-	VE_IGNORE_EINTR (ret = send (conn->fd, str, strlen (str), MSG_NOSIGNAL | flags));
-	save_errno = errno;
-#else
-	old_handler = signal (SIGPIPE, SIG_IGN);
-	VE_IGNORE_EINTR (ret = send (conn->fd, str, strlen (str), flags));
-	save_errno = errno;
-	signal (SIGPIPE, old_handler);
+	before = watch_condition (conn);
+	g_string_append_len (connection_tail_block (conn), str, len);
+
+	return connection_queued (conn, len, before);
+}
+
+static void
+add_subconnection (MdmConnection *conn, int fd)
+{
+	MdmConnection *newconn;
+
+	newconn = connection_new (fd);
+	newconn->nonblock = conn->nonblock;
+	newconn->writable = TRUE;
+	newconn->parent = conn;
+	newconn->handler = conn->handler;
+	newconn->data = conn->data;
+	newconn->destroy_notify = NULL; /* the data belongs to
+					   parent connection */
+
+#ifdef SO_PEERCRED
+	{
+		struct ucred cred;
+		socklen_t len = sizeof (cred);
+
+		if (getsockopt (fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+		    len == sizeof (cred)) {
+			newconn->have_peer_cred = TRUE;
+			newconn->peer_uid = cred.uid;
+			newconn->peer_pid = cred.pid;
+		}
+	}
 #endif
 
-	/* just so that 'signal' doesn't whack it */
-	errno = save_errno;
+	g_queue_push_tail (&conn->subconnections, newconn);
+	newconn->link = conn->subconnections.tail;
+
+	if G_UNLIKELY ( ! watch_add (newconn, mdm_connection_handler))
+		mdm_connection_close (newconn);
+}
 
-	if G_UNLIKELY (ret < 0)
+/* Close the subconnection that has been silent for the longest time,
+ * if any has been for IDLE_TIMEOUT_MS.  Connections someone waits on
+ * (a flexi server starting up for example) have a close notify set
+ * and ones with answers still going out are never touched. */
+static gboolean
+reap_idle_subconnection (MdmConnection *conn)
+{
+	MdmConnection *oldest = NULL;
+	GList *li;
+	gint64 now = g_get_monotonic_time ();
+
+	for (li = conn->subconnections.head; li != NULL; li = li->next) {
+		MdmConnection *subconn = li->data;
+
+		if (subconn->close_notify == NULL &&
+		    subconn->close_level == 0 &&
+		    subconn->out_len == 0 &&
+		    subconn->last_activity + IDLE_TIMEOUT_MS * 1000 <= now &&
+		    (oldest == NULL || subconn->last_activity < oldest->last_activity))
+			oldest = subconn;
+	}
+
+	if (oldest == NULL)
 		return FALSE;
-	else
-		return TRUE;
+
+	mdm_debug ("Closing connection %d, idle for %ld ms",
+		   oldest->fd, (long) ((now - oldest->last_activity) / 1000));
+	connections_evicted++;
+	mdm_connection_close (oldest);
+
+	return TRUE;
 }
 
+static void pause_accept (MdmConnection *conn);
+
 static gboolean
-mdm_socket_handler (GIOChannel *source,
-		    GIOCondition cond,
-		    gpointer data)
+accept_retry_timeout (gpointer data)
 {
-	GIOChannel *unixchan;
 	MdmConnection *conn = data;
-	MdmConnection *newconn;
+
+	conn->accept_retry = 0;
+
+	/* closing an idle connection resumes accepting */
+	if ( ! reap_idle_subconnection (conn))
+		pause_accept (conn);
+
+	return FALSE;
+}
+
+static void
+pause_accept (MdmConnection *conn)
+{
+	if ( ! conn->accept_paused) {
+		mdm_debug ("Connection limit of %d reached, deferring new connections",
+			   conn->max_connections);
+		conn->accept_paused = TRUE;
+		watch_update (conn);
+	}
+
+	/* check back when the busy connections may have gone idle */
+	if (conn->accept_retry == 0)
+		conn->accept_retry = g_timeout_add (IDLE_TIMEOUT_MS,
+						    accept_retry_timeout,
+						    conn);
+}
+
+static void
+resume_accept (MdmConnection *conn)
+{
+	if ( ! conn->accept_paused)
+		return;
+
+	mdm_debug ("Accepting connections again");
+	conn->accept_paused = FALSE;
+	watch_update (conn);
+
+	if (conn->accept_retry > 0) {
+		g_source_remove (conn->accept_retry);
+		conn->accept_retry = 0;
+	}
+}
+
+static gboolean
+mdm_socket_handler (MdmConnection *conn,
+		    GIOCondition cond)
+{
 	struct sockaddr_un addr;
-	socklen_t addr_size = sizeof (addr);
+	socklen_t addr_size;
 	int fd;
-	int max_connections;
 
 	if ( ! (cond & G_IO_IN))
 		return TRUE;
 
-	VE_IGNORE_EINTR (fd = accept (conn->fd,
-				   (struct sockaddr *)&addr,
-				   &addr_size));
-	if G_UNLIKELY (fd < 0) {
-		mdm_debug ("mdm_socket_handler: Rejecting connection");
-		return TRUE;
-	}
+	/* The listening socket is non-blocking, so take everything
+	 * that is waiting as long as there is room for it */
+	while ((int) conn->subconnections.length < conn->max_connections) {
+		addr_size = sizeof (addr);
+		VE_IGNORE_EINTR (fd = accept (conn->fd,
+					      (struct sockaddr *)&addr,
+					      &addr_size));
+		if (fd < 0) {
+			if G_UNLIKELY (errno != EAGAIN && errno != EWOULDBLOCK)
+				mdm_debug ("mdm_socket_handler: Rejecting connection");
+			return TRUE;
+		}
 
-	mdm_debug ("mdm_socket_handler: Accepting new connection fd %d", fd);
+		mdm_debug ("mdm_socket_handler: Accepting new connection fd %d", fd);
 
-	newconn = g_new0 (MdmConnection, 1);
-	newconn->disp = NULL;
-	newconn->message_count = 0;
-	newconn->nonblock = conn->nonblock;
-	newconn->close_level = 0;
-	newconn->fd = fd;
-	newconn->writable = TRUE;
-	newconn->filename = NULL;
-	newconn->user_flags = 0;
-	newconn->buffer = NULL;
-	newconn->parent = conn;
-	newconn->subconnections = NULL;
-	newconn->n_subconnections = 0;
-	newconn->handler = conn->handler;
-	newconn->data = conn->data;
-	newconn->destroy_notify = NULL; /* the data belongs to
-					   parent connection */
+		/* clients are talked to in blocking mode as before, and
+		 * never leak into slaves and sessions */
+		fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
+		fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+		connections_accepted++;
+		add_subconnection (conn, fd);
+	}
 
-	conn->subconnections = g_list_append (conn->subconnections, newconn);
-	conn->n_subconnections++;
-	
-	max_connections = MAX_CONNECTIONS;
-             
-	if (conn->n_subconnections > max_connections) {
-		MdmConnection *old;
-		mdm_debug ("Closing connection, %d subconnections reached",
-			max_connections);
-		old = conn->subconnections->data;
-		conn->subconnections =
-			g_list_remove (conn->subconnections, old);
-		mdm_connection_close (old);
-	}
-
-	unixchan = g_io_channel_unix_new (newconn->fd);
-	g_io_channel_set_encoding (unixchan, NULL, NULL);
-	g_io_channel_set_buffered (unixchan, FALSE);
-
-	newconn->source = g_io_add_watch_full
-		(unixchan, G_PRIORITY_DEFAULT,
-		 G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
-		 mdm_connection_handler, newconn, NULL);
-	g_io_channel_unref (unixchan);
+	/* We are full, the rest waits in the accept queue */
+	if ( ! reap_idle_subconnection (conn))
+		pause_accept (conn);
 
 	return TRUE;
 }
@@ -320,7 +878,6 @@ mdm_socket_handler (GIOChannel *source,
 MdmConnection *
 mdm_connection_open_unix (const char *sockname, mode_t mode)
 {
-	GIOChannel *unixchan;
 	MdmConnection *conn;
 	struct sockaddr_un addr;
 	int fd;
@@ -369,66 +926,41 @@ try_again:
 
 	VE_IGNORE_EINTR (g_chmod (sockname, mode));
 
-	conn = g_new0 (MdmConnection, 1);
-	conn->disp = NULL;
-	conn->message_count = 0;
-	conn->nonblock = FALSE;
-	conn->close_level = 0;
-	conn->fd = fd;
-	conn->writable = FALSE;
-	conn->buffer = NULL;
-	conn->filename = g_strdup (sockname);
-	conn->user_flags = 0;
-	conn->parent = NULL;
-	conn->subconnections = NULL;
-	conn->n_subconnections = 0;
+	fcntl (fd, F_SETFD, FD_CLOEXEC);
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
 
-	unixchan = g_io_channel_unix_new (conn->fd);
-	g_io_channel_set_encoding (unixchan, NULL, NULL);
-	g_io_channel_set_buffered (unixchan, FALSE);
+	conn = connection_new (fd);
+	conn->filename = g_strdup (sockname);
+	conn->max_connections = mdm_daemon_config_get_value_int (MDM_KEY_MAX_CONNECTIONS);
 
-	conn->source = g_io_add_watch_full
-		(unixchan, G_PRIORITY_DEFAULT,
-		 G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
-		 mdm_socket_handler, conn, NULL);
-	g_io_channel_unref (unixchan);
+	if G_UNLIKELY ( ! watch_add (conn, mdm_socket_handler)) {
+		VE_IGNORE_EINTR (close (fd));
+		g_free (conn->filename);
+		g_free (conn);
+		return NULL;
+	}
 
-	listen (fd, 5);
+	listen (fd, mdm_daemon_config_get_value_int (MDM_KEY_CONNECTION_BACKLOG));
 
 	return conn;
 }
 
+/* The daemon end of a slave's channel.  Unlike the listening socket it
+ * is closed (and its close notify called) once the slave hangs up */
 MdmConnection *
 mdm_connection_open_fd (int fd)
 {
-	GIOChannel *unixchan;
 	MdmConnection *conn;
 
 	g_return_val_if_fail (fd >= 0, NULL);
 
-	conn = g_new0 (MdmConnection, 1);
-	conn->disp = NULL;
-	conn->message_count = 0;
-	conn->nonblock = FALSE;
-	conn->close_level = 0;
-	conn->fd = fd;
-	conn->writable = FALSE;
-	conn->buffer = NULL;
-	conn->filename = NULL;
-	conn->user_flags = 0;
-	conn->parent = NULL;
-	conn->subconnections = NULL;
-	conn->n_subconnections = 0;
-
-	unixchan = g_io_channel_unix_new (conn->fd);
-	g_io_channel_set_encoding (unixchan, NULL, NULL);
-	g_io_channel_set_buffered (unixchan, FALSE);
+	conn = connection_new (fd);
+	conn->close_on_hup = TRUE;
 
-	conn->source = g_io_add_watch_full
-		(unixchan, G_PRIORITY_DEFAULT,
-		 G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
-		 mdm_connection_handler, conn, NULL);
-	g_io_channel_unref (unixchan);
+	if G_UNLIKELY ( ! watch_add (conn, mdm_connection_handler)) {
+		g_free (conn);
+		return NULL;
+	}
 
 	return conn;
 }
@@ -436,7 +968,6 @@ mdm_connection_open_fd (int fd)
 MdmConnection *
 mdm_connection_open_fifo (const char *fifo, mode_t mode)
 {
-	GIOChannel *fifochan;
 	MdmConnection *conn;
 	int fd;
 
@@ -456,29 +987,15 @@ mdm_connection_open_fifo (const char *fifo, mode_t mode)
 
 	VE_IGNORE_EINTR (g_chmod (fifo, mode));
 
-	conn = g_new0 (MdmConnection, 1);
-	conn->disp = NULL;
-	conn->message_count = 0;
-	conn->nonblock = FALSE;
-	conn->close_level = 0;
-	conn->fd = fd;
-	conn->writable = FALSE;
-	conn->buffer = NULL;
+	conn = connection_new (fd);
 	conn->filename = g_strdup (fifo);
-	conn->user_flags = 0;
-	conn->parent = NULL;
-	conn->subconnections = NULL;
-	conn->n_subconnections = 0;
-
-	fifochan = g_io_channel_unix_new (conn->fd);
-	g_io_channel_set_encoding (fifochan, NULL, NULL);
-	g_io_channel_set_buffered (fifochan, FALSE);
 
-	conn->source = g_io_add_watch_full
-		(fifochan, G_PRIORITY_DEFAULT,
-		 G_IO_IN|G_IO_PRI|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
-		 mdm_connection_handler, conn, NULL);
-	g_io_channel_unref (fifochan);
+	if G_UNLIKELY ( ! watch_add (conn, mdm_connection_handler)) {
+		VE_IGNORE_EINTR (close (fd));
+		g_free (conn->filename);
+		g_free (conn);
+		return NULL;
+	}
 
 	return conn;
 }
@@ -519,7 +1036,7 @@ mdm_connection_set_user_flags (MdmConnection *conn,
 void
 mdm_connection_close (MdmConnection *conn)
 {
-	GList *list;
+	MdmConnection *parent;
 
 	g_return_if_fail (conn != NULL);
 
@@ -535,24 +1052,34 @@ mdm_connection_close (MdmConnection *conn)
 	}
 	conn->close_data = NULL;
 
-	if (conn->buffer != NULL) {
-		g_string_free (conn->buffer, TRUE);
-		conn->buffer = NULL;
+	mdm_line_buffer_clear (&conn->input);
+
+	if (conn->out_len > 0) {
+		/* last chance for the final answer to go out */
+		if (conn->writable)
+			connection_flush (conn);
+		if (conn->out_len > 0)
+			mdm_debug ("mdm_connection_close: Dropping %lu unsent bytes on %d",
+				   (gulong) conn->out_len, conn->fd);
+		connection_drop_output (conn);
 	}
 
-	if (conn->parent != NULL) {
-		conn->parent->subconnections =
-			g_list_remove (conn->parent->subconnections, conn);
-		/* This is evil a bit, but safe, whereas -- would not be */
-		conn->parent->n_subconnections =
-			g_list_length (conn->parent->subconnections);
+	parent = conn->parent;
+	if (parent != NULL) {
+		g_queue_delete_link (&parent->subconnections, conn->link);
+		conn->link = NULL;
 		conn->parent = NULL;
 	}
 
-	list = conn->subconnections;
-	conn->subconnections = NULL;
-	g_list_foreach (list, (GFunc) mdm_connection_close, NULL);
-	g_list_free (list);
+	while ( ! g_queue_is_empty (&conn->subconnections)) {
+		MdmConnection *subconn = g_queue_peek_head (&conn->subconnections);
+		mdm_connection_close (subconn);
+	}
+
+	if (conn->accept_retry > 0) {
+		g_source_remove (conn->accept_retry);
+		conn->accept_retry = 0;
+	}
 
 	if (conn->destroy_notify != NULL) {
 		conn->destroy_notify (conn->data);
@@ -560,10 +1087,7 @@ mdm_connection_close (MdmConnection *conn)
 	}
 	conn->data = NULL;
 
-	if (conn->source > 0) {
-		g_source_remove (conn->source);
-		conn->source = 0;
-	}
+	watch_remove (conn);
 
 	if (conn->fd > 0) {
 		VE_IGNORE_EINTR (close (conn->fd));
@@ -574,6 +1098,10 @@ mdm_connection_close (MdmConnection *conn)
 	conn->filename = NULL;
 
 	g_free (conn);
+
+	/* a slot just freed up */
+	if (parent != NULL)
+		resume_accept (parent);
 }
 
 void
@@ -590,22 +1118,49 @@ mdm_connection_set_close_notify (MdmConnection *conn,
 	conn->close_notify = close_notify;
 }
 
-gboolean 
+gboolean
 mdm_connection_printf (MdmConnection *conn, const gchar *format, ...)
 {
 	va_list args;
-	gboolean ret;
-	gchar *s;
+	GIOCondition before;
+	GString *block;
+	gsize len;
+
+	g_return_val_if_fail (conn != NULL, FALSE);
+	g_return_val_if_fail (format != NULL, FALSE);
+
+	if G_UNLIKELY ( ! conn->writable)
+		return FALSE;
+
+	before = watch_condition (conn);
 
+	/* format straight into the output queue */
+	block = connection_tail_block (conn);
+	len = block->len;
 	va_start (args, format);
-	s = g_strdup_vprintf (format, args);
+	g_string_append_vprintf (block, format, args);
 	va_end (args);
 
-	ret = mdm_connection_write (conn, s);
+	return connection_queued (conn, block->len - len, before);
+}
 
-	g_free (s);
+/* The credentials the kernel gave for the client when it connected */
+gboolean
+mdm_connection_get_peer_cred (MdmConnection *conn,
+			      uid_t *uid,
+			      pid_t *pid)
+{
+	g_return_val_if_fail (conn != NULL, FALSE);
 
-	return ret;
+	if ( ! conn->have_peer_cred)
+		return FALSE;
+
+	if (uid != NULL)
+		*uid = conn->peer_uid;
+	if (pid != NULL)
+		*pid = conn->peer_pid;
+
+	return TRUE;
 }
 
 int
@@ -649,22 +1204,21 @@ void
 mdm_kill_subconnections_with_display (MdmConnection *conn,
 				      MdmDisplay *disp)
 {
-	GList *subs;
+	GList *li;
 
 	g_return_if_fail (conn != NULL);
 	g_return_if_fail (disp != NULL);
 
-	subs = conn->subconnections;
-	while (subs != NULL) {
-		MdmConnection *subcon = subs->data;
+	li = conn->subconnections.head;
+	while (li != NULL) {
+		MdmConnection *subcon = li->data;
 		if (subcon->disp == disp) {
 			subcon->disp = NULL;
-			conn->subconnections =
-				g_list_remove (conn->subconnections, subcon);
 			mdm_connection_close (subcon);
-			subs = conn->subconnections;
+			/* close notifies may have closed others too */
+			li = conn->subconnections.head;
 		} else {
-			subs = subs->next;
+			li = li->next;
 		}
 	}
 }
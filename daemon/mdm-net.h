@@ -19,6 +19,7 @@
 #ifndef MDM_NET_H
 #define MDM_NET_H
 
+#include <sys/types.h>
 #include <glib.h>
 
 typedef struct _MdmConnection MdmConnection;
@@ -87,6 +88,15 @@ void		mdm_kill_subconnections_with_display  (MdmConnection *conn,
 						       MdmDisplay *disp);
 
 int		mdm_connection_get_message_count      (MdmConnection *conn);
+gboolean	mdm_connection_get_peer_cred          (MdmConnection *conn,
+						       uid_t *uid,
+						       pid_t *pid);
+
+/* Totals over all connections since startup */
+void		mdm_connection_get_output_stats       (gulong *queued,
+						       gulong *flushed);
+void		mdm_connection_get_accept_stats       (gulong *accepted,
+						       gulong *evicted);
 
 
 void		mdm_connection_close                  (MdmConnection *conn);
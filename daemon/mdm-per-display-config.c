@@ -0,0 +1,168 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "mdm-common.h"
+#include "mdm-per-display-config.h"
+
+static MdmCommonConfigCache *files = NULL;
+static char                 *base_file = NULL;
+static gboolean              watched = FALSE;
+
+void
+mdm_per_display_config_set_base_file (const char *custom_config_file)
+{
+	g_free (base_file);
+	base_file = g_strdup (custom_config_file);
+
+	if (files != NULL)
+		mdm_common_config_cache_invalidate (files, NULL);
+}
+
+void
+mdm_per_display_config_set_watched (gboolean is_watched)
+{
+	watched = is_watched;
+}
+
+GKeyFile *
+mdm_per_display_config_get (const char *display)
+{
+	GKeyFile *key_file;
+	char     *file;
+
+	if (files == NULL)
+		files = mdm_common_config_cache_new ();
+
+	/* nothing to stat, the watch says when it changes */
+	if (watched && mdm_common_config_cache_contains (files, display))
+		return mdm_common_config_cache_peek (files, display);
+
+	file = g_strconcat (ve_sure_string (base_file), display, NULL);
+	key_file = mdm_common_config_cache_lookup (files, display, file);
+	g_free (file);
+
+	return key_file;
+}
+
+GKeyFile *
+mdm_per_display_config_peek (const char *display)
+{
+	if (files == NULL)
+		return NULL;
+
+	return mdm_common_config_cache_peek (files, display);
+}
+
+void
+mdm_per_display_config_forget (const char *display)
+{
+	if (files != NULL)
+		mdm_common_config_cache_invalidate (files, display);
+}
+
+gboolean
+mdm_per_display_config_get_value (const char           *display,
+				  const MdmConfigEntry *entry,
+				  const char           *default_value,
+				  char                **retval)
+{
+	GKeyFile *key_file;
+	GError   *error;
+	char     *result;
+
+	*retval = NULL;
+
+	key_file = mdm_per_display_config_get (display);
+	if (key_file == NULL)
+		return FALSE;
+
+	error = NULL;
+	result = NULL;
+
+	switch (entry->type) {
+	case MDM_CONFIG_VALUE_BOOL:
+		{
+			gboolean value;
+
+			value = g_key_file_get_boolean (key_file, entry->group, entry->key, &error);
+			if (error == NULL)
+				result = g_strdup (value ? "true" : "false");
+			else if (default_value != NULL)
+				result = g_strdup ((default_value[0] == 'T' ||
+						    default_value[0] == 't' ||
+						    default_value[0] == 'Y' ||
+						    default_value[0] == 'y' ||
+						    atoi (default_value) != 0) ? "true" : "false");
+		}
+		break;
+	case MDM_CONFIG_VALUE_INT:
+		{
+			int value;
+
+			value = g_key_file_get_integer (key_file, entry->group, entry->key, &error);
+			if (error == NULL)
+				result = g_strdup_printf ("%d", value);
+			else if (default_value != NULL)
+				result = g_strdup_printf ("%d", atoi (default_value));
+		}
+		break;
+	case MDM_CONFIG_VALUE_STRING:
+	case MDM_CONFIG_VALUE_LOCALE_STRING:
+		result = g_key_file_get_string (key_file, entry->group, entry->key, &error);
+		if (error != NULL)
+			result = g_strdup (default_value);
+		break;
+	default:
+		break;
+	}
+
+	if (error != NULL)
+		g_error_free (error);
+
+	*retval = result;
+
+	return result != NULL;
+}
+
+guint
+mdm_per_display_config_get_parse_count (void)
+{
+	if (files == NULL)
+		return 0;
+
+	return mdm_common_config_cache_get_parse_count (files);
+}
+
+void
+mdm_per_display_config_close (void)
+{
+	mdm_common_config_cache_free (files);
+	files = NULL;
+	g_free (base_file);
+	base_file = NULL;
+	watched = FALSE;
+}
+
+/* EOF */
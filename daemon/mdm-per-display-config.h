@@ -0,0 +1,56 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MDM_PER_DISPLAY_CONFIG_H
+#define MDM_PER_DISPLAY_CONFIG_H
+
+#include <glib.h>
+
+#include "mdm-config.h"
+
+/*
+ * The per-display config files, the custom config file name with the
+ * display name appended.  Each is parsed once.  While the files are
+ * watched it is then only looked at again after
+ * mdm_per_display_config_forget, otherwise a stat on every lookup
+ * tells whether it changed.
+ */
+void	  mdm_per_display_config_set_base_file	(const char *custom_config_file);
+void	  mdm_per_display_config_set_watched	(gboolean    watched);
+
+/* NULL if the display has no file, owned by the cache and valid until
+ * the file is forgotten or found changed */
+GKeyFile *mdm_per_display_config_get		(const char *display);
+GKeyFile *mdm_per_display_config_peek		(const char *display);
+void	  mdm_per_display_config_forget		(const char *display);
+
+/* The value of entry in the display's file as a string, default_value
+ * is used if the file has no such key.  FALSE if there is no file or
+ * no value. */
+gboolean  mdm_per_display_config_get_value	(const char           *display,
+						 const MdmConfigEntry *entry,
+						 const char           *default_value,
+						 char                **retval);
+
+/* How many times a file was parsed, for the tests */
+guint	  mdm_per_display_config_get_parse_count (void);
+void	  mdm_per_display_config_close		(void);
+
+#endif /* MDM_PER_DISPLAY_CONFIG_H */
+
+/* EOF */
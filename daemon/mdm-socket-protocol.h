@@ -34,7 +34,7 @@
 
 /* This will change if there are incompatible
  * protocol changes */
-#define MDM_GREETER_PROTOCOL_VERSION "3"
+#define MDM_GREETER_PROTOCOL_VERSION "5"
 
 #define MDM_MSG        'D'
 #define MDM_NOECHO     'U'
@@ -56,7 +56,12 @@
 #define MDM_RESETOK    'r' /* reset but don't shake */
 #define MDM_NEEDPIC    '#' /* need a user picture?, sent after greeter
 			    *  is started */
-#define MDM_READPIC    '%' /* Send a user picture in a temp file */
+#define MDM_READPIC    '%' /* Send a user picture in a temp file; with
+			    * "fd:<size>" the open picture file has been
+			    * passed over the MDM_FACE_SOCKET socket, with
+			    * "cache:<mtime>:<size>" the picture is in the
+			    * FaceCache pack (the greeter answers "miss"
+			    * if its copy of the pack does not have it) */
 #define MDM_ERRBOX     'e' /* Puts string in the error box */
 #define MDM_ERRDLG     'E' /* Puts string up in an error dialog */
 #define MDM_NOFOCUS    'f' /* Don't focus the login window (optional) */
@@ -64,6 +69,11 @@
 #define MDM_SAVEDIE    '!' /* Save wm order and die (and set busy cursor) */
 #define MDM_QUERY_CAPSLOCK 'Q' /* Is capslock on? */
 #define MDM_ALWAYS_RESTART 'W' /* Retart greeter when the user accepts restarts */
+#define MDM_BATCH      'b' /* Several commands separated by MDM_BATCH_SEP,
+			    * only the last one is answered.  The others
+			    * must be ones that are answered with a bare
+			    * STX right away */
+#define MDM_BATCH_SEP  "\036" /* Record separator */
 
 /* Different login interruptions */
 #define MDM_INTERRUPT_TIMED_LOGIN 'T'
@@ -85,11 +95,12 @@
  * or mdmconfig or whatnot
  */
 
-/* The ones that pass a <slave pid> must be from a valid slave, and
- * the slave will be sent a SIGUSR2.  Nowdays there is a pipe that is
- * used from inside slaves, so those messages may stop being processed
- * by the fifo at some point perhaps.  */
-/* The fifo protocol, used only by mdm internally */
+/* The ones that pass a <slave pid> must be from a valid slave.  Every
+ * slave has its own socketpair channel with the daemon and sends each
+ * message as "<request id> <send time> <message>", the send time being
+ * CLOCK_MONOTONIC microseconds.  The ack or dialog response goes back
+ * on the same channel carrying the request id, see below. */
+/* The slave protocol, used only by mdm internally */
 #define MDM_SOP_XPID         "XPID" /* <slave pid> <xpid> */
 #define MDM_SOP_SESSPID      "SESSPID" /* <slave pid> <sesspid> */
 #define MDM_SOP_GREETPID     "GREETPID" /* <slave pid> <greetpid> */
@@ -119,19 +130,27 @@
 #define MDM_SOP_SUSPEND_MACHINE "SUSPEND_MACHINE"  /* no arguments */
 #define MDM_SOP_CHOSEN_THEME "CHOSEN_THEME"  /* <slave pid> <theme name> */
 
+/* How long a phase of bringing up the display took, for the STATS
+ * command.  Never acked, the slave does not wait for it */
+#define MDM_SOP_TIMING "TIMING"  /* <slave pid> <phase> <usec> */
+#define MDM_TIMING_XSERVER "xserver" /* mdm_server_start */
+#define MDM_TIMING_GREETER "greeter" /* up to the greeter's first answer */
+#define MDM_TIMING_PAM     "pam"     /* mdm_verify_user less the prompts */
+#define MDM_TIMING_SESSION "session" /* up to the session being forked */
+
 #define MDM_SOP_SHOW_ERROR_DIALOG "SHOW_ERROR_DIALOG"  /* show the error dialog from daemon */
 #define MDM_SOP_SHOW_YESNO_DIALOG "SHOW_YESNO_DIALOG"  /* show the yesno dialog from daemon */
 #define MDM_SOP_SHOW_QUESTION_DIALOG "SHOW_QUESTION_DIALOG"  /* show the question dialog from daemon */
 #define MDM_SOP_SHOW_ASKBUTTONS_DIALOG "SHOW_ASKBUTTON_DIALOG"  /* show the askbutton dialog from daemon */
 
-/* Ack for a slave message */
-/* Note that an extra response can follow an 'ack' */
+/* Ack for a slave message, "A<request id> <response>" */
+/* Note that the response may be empty */
 #define MDM_SLAVE_NOTIFY_ACK 'A'
-/* Update this key */
+/* Update this key, the daemon sends these on its own with a SIGUSR2 */
 #define MDM_SLAVE_NOTIFY_KEY '!'
-/* notify a command */
+/* notify a command, also with a SIGUSR2 */
 #define MDM_SLAVE_NOTIFY_COMMAND '#'
-/* send the response */
+/* send the response, "R<request id> <type><response>" */
 #define MDM_SLAVE_NOTIFY_RESPONSE 'R'
 /* send the error dialog response */
 #define MDM_SLAVE_NOTIFY_ERROR_RESPONSE 'E'
@@ -149,7 +168,14 @@
  * all to be grabbed in one pull.
  */
 #define MDM_SUP_MAX_MESSAGES 80
+/*
+ * Clients that authenticated keep one connection for as long as they
+ * run, they get many more before they have to reconnect.
+ */
+#define MDM_SUP_MAX_MESSAGES_AUTHENTICATED 10000
 #define MDM_SUP_SOCKET "/var/run/gdm_socket"
+/* Configuration snapshot the daemon publishes for the greeters */
+#define MDM_SUP_CONFIG_SNAPSHOT "/var/run/mdm_config"
 
 /*
  * The user socket protocol.  Each command is given on a separate line
@@ -172,6 +198,7 @@
 #define MDM_SUP_FLEXI_XSERVER "FLEXI_XSERVER"
 #define MDM_SUP_ATTACHED_SERVERS "ATTACHED_SERVERS"
 #define MDM_SUP_GET_CONFIG "GET_CONFIG"
+#define MDM_SUP_GET_CONFIG_MULTI "GET_CONFIG_MULTI"
 #define MDM_SUP_GET_CONFIG_FILE  "GET_CONFIG_FILE"
 #define MDM_SUP_GET_CUSTOM_CONFIG_FILE  "GET_CUSTOM_CONFIG_FILE"
 #define MDM_SUP_UPDATE_CONFIG "UPDATE_CONFIG"
@@ -186,6 +213,8 @@
 #define MDM_SUP_QUERY_VT "QUERY_VT"
 #define MDM_SUP_SET_VT "SET_VT"
 #define MDM_SUP_CLOSE        "CLOSE"
+#define MDM_SUP_STATS        "STATS"
+#define MDM_SUP_TRACE_DUMP   "TRACE_DUMP"
 
 /* User flags for the SUP protocol */
 enum {
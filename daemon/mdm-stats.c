@@ -0,0 +1,187 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "mdm-stats.h"
+#include "mdm-socket-protocol.h"
+
+static const char *phases[] = {
+	MDM_TIMING_XSERVER,
+	MDM_TIMING_GREETER,
+	MDM_TIMING_PAM,
+	MDM_TIMING_SESSION
+};
+
+/* Remote displays come and go under new names, only the ones timed
+ * most recently are kept */
+#define MAX_DISPLAYS 32
+
+typedef struct {
+	char              *name;
+	GList             *link;	/* in recent_displays */
+	MdmStatsHistogram  hists[G_N_ELEMENTS (phases)];
+} DisplayTimes;
+
+/* display name -> DisplayTimes */
+static GHashTable *display_times = NULL;
+/* the DisplayTimes, the last timed first */
+static GQueue      recent_displays = G_QUEUE_INIT;
+
+static void
+display_times_free (DisplayTimes *times)
+{
+	g_free (times->name);
+	g_free (times);
+}
+
+void
+mdm_stats_histogram_add (MdmStatsHistogram *hist, gint64 usec)
+{
+	guint bucket;
+
+	if G_UNLIKELY (usec < 0)
+		usec = 0;
+
+	bucket = (usec > 0) ? g_bit_storage ((gulong) usec) - 1 : 0;
+	if G_UNLIKELY (bucket >= MDM_STATS_BUCKETS)
+		bucket = MDM_STATS_BUCKETS - 1;
+
+	hist->count++;
+	hist->total += usec;
+	if (usec > hist->max)
+		hist->max = usec;
+	hist->buckets[bucket]++;
+}
+
+static void
+append_separator (GString *str)
+{
+	/* the answer starts with "OK " */
+	if (str->len > 0 && str->str[str->len - 1] != ' ')
+		g_string_append_c (str, ';');
+}
+
+void
+mdm_stats_append_counter (GString *str, const char *name, gulong value)
+{
+	append_separator (str);
+	g_string_append_printf (str, "%s=%lu", name, value);
+}
+
+void
+mdm_stats_append_histogram (GString                 *str,
+			    const char              *name,
+			    const MdmStatsHistogram *hist)
+{
+	int last, i;
+
+	append_separator (str);
+	g_string_append_printf (str, "%s=%lu,%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT,
+				name, hist->count, hist->total, hist->max);
+
+	for (last = MDM_STATS_BUCKETS - 1; last >= 0; last--)
+		if (hist->buckets[last] != 0)
+			break;
+	for (i = 0; i <= last; i++)
+		g_string_append_printf (str, ",%u", hist->buckets[i]);
+}
+
+void
+mdm_stats_add_display_time (const char *display,
+			    const char *phase,
+			    gint64      usec)
+{
+	DisplayTimes *times;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (phases); i++)
+		if (strcmp (phase, phases[i]) == 0)
+			break;
+	if (i == G_N_ELEMENTS (phases) || display == NULL)
+		return;
+
+	if (display_times == NULL)
+		display_times = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+						       (GDestroyNotify) display_times_free);
+
+	times = g_hash_table_lookup (display_times, display);
+	if (times != NULL) {
+		g_queue_unlink (&recent_displays, times->link);
+		g_queue_push_head_link (&recent_displays, times->link);
+	} else {
+		times = g_new0 (DisplayTimes, 1);
+		times->name = g_strdup (display);
+		g_queue_push_head (&recent_displays, times);
+		times->link = recent_displays.head;
+		g_hash_table_insert (display_times, times->name, times);
+
+		if (recent_displays.length > MAX_DISPLAYS) {
+			DisplayTimes *oldest = g_queue_pop_tail (&recent_displays);
+
+			g_hash_table_remove (display_times, oldest->name);
+		}
+	}
+
+	mdm_stats_histogram_add (&times->hists[i], usec);
+}
+
+static gint
+compare_names (gconstpointer a, gconstpointer b)
+{
+	return strcmp (a, b);
+}
+
+void
+mdm_stats_append_display_times (GString *str)
+{
+	GList *names, *li;
+
+	if (display_times == NULL)
+		return;
+
+	/* the same order every time */
+	names = g_list_sort (g_hash_table_get_keys (display_times), compare_names);
+
+	for (li = names; li != NULL; li = li->next) {
+		const char *display = li->data;
+		MdmStatsHistogram *hists;
+		guint i;
+
+		hists = ((DisplayTimes *) g_hash_table_lookup (display_times, display))->hists;
+
+		for (i = 0; i < G_N_ELEMENTS (phases); i++) {
+			char *name;
+
+			if (hists[i].count == 0)
+				continue;
+
+			name = g_strdup_printf ("display.%s.%s", display, phases[i]);
+			mdm_stats_append_histogram (str, name, &hists[i]);
+			g_free (name);
+		}
+	}
+
+	g_list_free (names);
+}
+
+/* EOF */
@@ -0,0 +1,63 @@
+/* MDM - The MDM Display Manager
+ * Copyright (C) 1998, 1999, 2000 Martin K. Petersen <mkp@mkp.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MDM_STATS_H
+#define MDM_STATS_H
+
+#include <glib.h>
+
+/*
+ * Latency histograms for the STATS command.  Bucket i counts the
+ * samples of 2^i up to 2^(i+1) microseconds, bucket 0 also takes
+ * anything shorter and the last one anything longer.  Adding a sample
+ * is a few additions and no allocation, so it can be done for every
+ * message.
+ */
+#define MDM_STATS_BUCKETS 32
+
+typedef struct {
+	gulong  count;
+	gint64  total;	/* usec */
+	gint64  max;	/* usec */
+	guint32 buckets[MDM_STATS_BUCKETS];
+} MdmStatsHistogram;
+
+void	mdm_stats_histogram_add		(MdmStatsHistogram       *hist,
+					 gint64                   usec);
+
+/* Append "<name>=<value>" or "<name>=<count>,<total>,<max>,<bucket 0>,..."
+ * to a STATS answer, the histogram buckets after the last one that
+ * is not empty are left out */
+void	mdm_stats_append_counter	(GString                 *str,
+					 const char              *name,
+					 gulong                   value);
+void	mdm_stats_append_histogram	(GString                 *str,
+					 const char              *name,
+					 const MdmStatsHistogram *hist);
+
+/* The phases of bringing up a display the slaves time, kept by display
+ * name so that they outlive the MdmDisplay, for the last 32 displays
+ * timed */
+void	mdm_stats_add_display_time	(const char              *display,
+					 const char              *phase,
+					 gint64                   usec);
+void	mdm_stats_append_display_times	(GString                 *str);
+
+#endif /* MDM_STATS_H */
+
+/* EOF */
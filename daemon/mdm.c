@@ -63,6 +63,10 @@
 #include "display.h"
 #include "getvt.h"
 #include "mdm-net.h"
+#include "mdm-dispatch.h"
+#include "mdm-stats.h"
+#include "mdm-trace.h"
+#include "mdm-child-watch.h"
 #include "cookie.h"
 #include "filecheck.h"
 #include "errorgui.h"
@@ -100,9 +104,7 @@ static gboolean no_console       = FALSE; /* There are no static servers, this
                                              and second, don't display info on
                                              the console */
 
-MdmConnection *pipeconn = NULL; /* slavepipe connection */
 MdmConnection *unixconn = NULL; /* UNIX Socket connection */
-int slave_fifo_pipe_fd = -1;    /* The slavepipe connection */
 
 unsigned char *mdm_global_cookie  = NULL;
 unsigned char *mdm_global_bcookie = NULL;
@@ -184,7 +186,7 @@ mdm_start_first_unborn_local (int delay)
 	GSList *li;
 	GSList *displays;
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 
 	/* tickle the random stuff */
 	mdm_random_tick ();
@@ -254,7 +256,7 @@ mdm_final_cleanup (void)
 	sigaction (SIGXFSZ, &sig, NULL);
 #endif
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 
 	mdm_debug ("mdm_final_cleanup");
 
@@ -294,16 +296,6 @@ mdm_final_cleanup (void)
 	
 	/* Close stuff */	
 
-	if (pipeconn != NULL) {
-		mdm_connection_close (pipeconn);
-		pipeconn = NULL;
-	}
-
-	if (slave_fifo_pipe_fd >= 0) {
-		VE_IGNORE_EINTR (close (slave_fifo_pipe_fd));
-		slave_fifo_pipe_fd = -1;
-	}
-
 	if (unixconn != NULL) {
 		mdm_connection_close (unixconn);
 		VE_IGNORE_EINTR (g_unlink (MDM_SUP_SOCKET));
@@ -319,6 +311,7 @@ mdm_final_cleanup (void)
 		if (pidfile != NULL) {
 			VE_IGNORE_EINTR (g_unlink (pidfile));
 		}
+		VE_IGNORE_EINTR (g_unlink (MDM_SUP_CONFIG_SNAPSHOT));
 	}
 
 	mdm_daemon_config_close ();
@@ -416,23 +409,16 @@ deal_with_x_crashes (MdmDisplay *d)
 			if (extra_process > 1) {
 				int ret;
 				int killsignal = SIGTERM;
-				int storeerrno;
-				errno = 0;
-				ret = waitpid (extra_process, &status, WNOHANG);
-				do {
-					/* wait for some signal, yes this is a race */
-					if (ret <= 0) {
-						mdm_debug("mdm deal_with_x_crashes: sleeping for 10 seconds");
-						sleep (10);
-					}
-					errno = 0;
-					ret = waitpid (extra_process, &status, WNOHANG);
-					storeerrno = errno;
-					if ((ret <= 0) && mdm_daemon_config_signal_terminthup_was_notified ()) {
+
+				for (;;) {
+					ret = mdm_child_watch_wait (extra_process, &status, 10);
+					if (ret != 0)
+						break;
+					if (mdm_daemon_config_signal_terminthup_was_notified ()) {
 						kill (-(extra_process), killsignal);
 						killsignal = SIGKILL;
 					}
-				} while (ret == 0 || (ret < 0 && storeerrno == EINTR));
+				}
 			}
 			extra_process = 0;
 
@@ -742,25 +728,38 @@ mdm_exec_script (const gchar *dir,
   }
 }
 
-static gboolean
-mdm_cleanup_children (void)
+/* Children without a watch, the extra processes are normally waited
+ * for synchronously but one might get here still */
+static void
+mdm_unwatched_child (pid_t pid, int exitstatus, gpointer data)
 {
-	gint exitstatus = 0, status;
-	MdmDisplay *d = NULL;
-	gboolean crashed;
-	gboolean sysmenu;
-	pid_t pid;
+	mdm_debug ("mdm_unwatched_child: child %d exited with status %d", pid, exitstatus);
 
-	/* Pid and exit status of slave that died */
-	pid = waitpid (-1, &exitstatus, WNOHANG);
+	if (pid == extra_process) {
+		/* An extra process died, yay! */
+		extra_process = 0;
+		extra_status  = exitstatus;
+	}
+}
 
-	if (pid <= 0)
-		return FALSE;
+/**
+ * mdm_child_action:
+ *
+ * Called with the wait status of a slave that has just been reaped,
+ * data is its display.
+ */
+void
+mdm_child_action (pid_t pid, int exitstatus, gpointer data)
+{
+	gint status;
+	MdmDisplay *d = data;
+	gboolean crashed;
+	gboolean sysmenu;
 
 	if G_LIKELY (WIFEXITED (exitstatus)) {
 		status = WEXITSTATUS (exitstatus);
 		crashed = FALSE;
-		mdm_debug ("mdm_cleanup_children: child %d returned %d", pid, status);
+		mdm_debug ("mdm_child_action: child %d returned %d", pid, status);
 	} else {
 		status = EXIT_SUCCESS;
 		crashed = TRUE;
@@ -771,36 +770,23 @@ mdm_cleanup_children (void)
 				 * We send these signals, sometimes children
 				 * do not handle them
 				 */
-				mdm_debug ("mdm_cleanup_children: child %d died of signal %d (TERM/INT)", pid,
+				mdm_debug ("mdm_child_action: child %d died of signal %d (TERM/INT)", pid,
 					   (int)WTERMSIG (exitstatus));
 			} else {
-				mdm_error ("mdm_cleanup_children: child %d crashed of signal %d", pid,
+				mdm_error ("mdm_child_action: child %d crashed of signal %d", pid,
 					   (int)WTERMSIG (exitstatus));
 			}
 		} else {
-			mdm_error ("mdm_cleanup_children: child %d crashed", pid);
+			mdm_error ("mdm_child_action: child %d crashed", pid);
 		}
 	}
 
-	if (pid == extra_process) {
-		/* An extra process died, yay! */
-		extra_process = 0;
-		extra_status  = exitstatus;
-		return TRUE;
-	}
-
-	/* Find out who this slave belongs to */
-	d = mdm_display_lookup (pid);
-
-	if (d == NULL)
-		return TRUE;
-
 	/* Whack connections about this display */
 	if (unixconn != NULL)
 		mdm_kill_subconnections_with_display (unixconn, d);
 
 	if G_UNLIKELY (crashed) {
-		mdm_error ("mdm_cleanup_children: Slave crashed, killing its "
+		mdm_error ("mdm_child_action: Slave crashed, killing its "
 			   "children");
 
 		if (d->sesspid > 1)
@@ -811,14 +797,14 @@ mdm_cleanup_children (void)
 		d->greetpid = 0;	
 		if (d->servpid > 1)
 			kill (d->servpid, SIGTERM);
-		d->servpid = 0;	
+		mdm_display_set_servpid (d, 0);
 
 		/* Race avoider */
 		mdm_sleep_no_signal (1);
 	}
 
 	/* null all these, they are not valid most definately */
-	d->servpid    = 0;
+	mdm_display_set_servpid (d, 0);
 	d->sesspid    = 0;
 	d->greetpid   = 0;
 
@@ -826,9 +812,10 @@ mdm_cleanup_children (void)
 	d->logged_in = FALSE;
 	g_free (d->login);
 	d->login = NULL;
+	d->login_uid_known = FALSE;
 
 	/* Declare the display dead */
-	d->slavepid = 0;
+	mdm_display_set_slavepid (d, 0);
 	d->dispstat = DISPLAY_DEAD;
 
 	/* Run SuperPost script */
@@ -1035,7 +1022,7 @@ mdm_cleanup_children (void)
 			 */			
 			mdm_debug ("mdm_child_action: Flexible server died, scanning for a greeter");
 			GSList *li;
-			for (li = mdm_daemon_config_get_display_list (); li != NULL; li = li->next) {
+			for (li = mdm_display_get_list (); li != NULL; li = li->next) {
 				MdmDisplay *disp = li->data;
 				if (disp->greetpid > 0) {
 					mdm_debug ("mdm_child_action: Found a greeter on %d, changing VT.", disp->vt);
@@ -1065,8 +1052,6 @@ mdm_cleanup_children (void)
 
 	mdm_try_logout_action (d);
 	mdm_safe_restart ();
-
-	return TRUE;
 }
 
 static void
@@ -1086,7 +1071,7 @@ mdm_safe_restart (void)
 	GSList *li;
 	GSList *displays;
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 
 	if ( ! mdm_restart_mode)
 		return;
@@ -1128,7 +1113,7 @@ mdm_try_logout_action (MdmDisplay *disp)
 	GSList *li;
 	GSList *displays;
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 
 	if (disp != NULL &&
 	    disp->logout_action != MDM_LOGOUT_ACTION_NONE &&
@@ -1170,12 +1155,6 @@ mainloop_sig_callback (int sig, gpointer data)
 	mdm_debug ("mainloop_sig_callback: Got signal %d", (int)sig);
 	switch (sig)
 		{
-		case SIGCHLD:
-			mdm_debug ("mainloop_sig_callback: Got SIGCHLD!");
-			while (mdm_cleanup_children ())
-				;
-			break;
-
 		case SIGINT:
 		case SIGTERM:
 			mdm_debug ("mainloop_sig_callback: Got SIGTERM/SIGINT. Going down!");
@@ -1242,30 +1221,6 @@ close_notify (gpointer data)
 static void
 create_connections (void)
 {
-	int p[2];
-
-	if G_UNLIKELY (pipe (p) < 0) {
-		slave_fifo_pipe_fd = -1;
-		pipeconn = NULL;
-	} else {
-		slave_fifo_pipe_fd = p[1];
-		pipeconn = mdm_connection_open_fd (p[0]);
-	}
-
-	if G_LIKELY (pipeconn != NULL) {
-		mdm_connection_set_handler (pipeconn,
-					    mdm_handle_message,
-					    NULL /* data */,
-					    NULL /* destroy_notify */);
-		mdm_connection_set_close_notify (pipeconn,
-						 &pipeconn,
-						 close_notify);
-	} else {
-		VE_IGNORE_EINTR (close (p[0]));
-		VE_IGNORE_EINTR (close (p[1]));
-		slave_fifo_pipe_fd = -1;
-	}
-
 	unixconn = mdm_connection_open_unix (MDM_SUP_SOCKET, 0666);
 
 	if G_LIKELY (unixconn != NULL) {
@@ -1278,6 +1233,10 @@ create_connections (void)
 						 &unixconn,
 						 close_notify);
 	}
+
+	/* before the snapshot, which says whether the files are watched */
+	mdm_daemon_config_watch_files ();
+	mdm_daemon_config_write_snapshot ();
 }
 
 GOptionEntry options [] = {
@@ -1392,7 +1351,7 @@ main (int argc, char *argv[])
 {	
 	FILE *pf;
 	sigset_t mask;
-	struct sigaction sig, child, abrt;
+	struct sigaction sig, abrt;
 	GOptionContext *ctx;
 	const char *pidfile;
 	int i;
@@ -1467,6 +1426,13 @@ main (int argc, char *argv[])
 	/* Parse configuration file */
 	mdm_daemon_config_parse (config_file, no_console);
 
+	/* every daemon start gets a trace of its own */
+	mdm_trace_init (mdm_daemon_config_get_value_string (MDM_KEY_TRACE_FILE),
+			"mdm", NULL);
+	mdm_trace_new_file (mdm_daemon_config_get_mdmuid (),
+			    mdm_daemon_config_get_mdmgid ());
+	mdm_trace_begin ("daemon startup");
+
 	main_loop = g_main_loop_new (NULL, FALSE);
 
 	mdm_system_locale = g_strdup (setlocale (LC_MESSAGES, NULL));
@@ -1543,7 +1509,6 @@ main (int argc, char *argv[])
 		mdm_daemonify ();
 
 	/* Signal handling */
-	ve_signal_add (SIGCHLD, mainloop_sig_callback, NULL);
 	ve_signal_add (SIGTERM, mainloop_sig_callback, NULL);
 	ve_signal_add (SIGINT,  mainloop_sig_callback, NULL);
 	ve_signal_add (SIGHUP,  mainloop_sig_callback, NULL);
@@ -1589,18 +1554,9 @@ main (int argc, char *argv[])
 	if G_UNLIKELY (sigaction (SIGABRT, &abrt, NULL) < 0)
 		mdm_fail ("main: Error setting up %s signal handler: %s", "ABRT", strerror (errno));
 
-	child.sa_handler = ve_signal_notify;
-	child.sa_flags = SA_RESTART|SA_NOCLDSTOP;
-	sigemptyset (&child.sa_mask);
-	sigaddset (&child.sa_mask, SIGCHLD);
-
-	if G_UNLIKELY (sigaction (SIGCHLD, &child, NULL) < 0)
-		mdm_fail ("mdm_main: Error setting up CHLD signal handler");
-
 	sigemptyset (&mask);
 	sigaddset (&mask, SIGINT);
 	sigaddset (&mask, SIGTERM);
-	sigaddset (&mask, SIGCHLD);
 	sigaddset (&mask, SIGHUP);
 	sigaddset (&mask, SIGUSR1);
 	sigaddset (&mask, SIGABRT);
@@ -1612,6 +1568,9 @@ main (int argc, char *argv[])
 #endif
 	sigprocmask (SIG_UNBLOCK, &mask, NULL);
 
+	/* SIGCHLD is up to the child watch, it may want it blocked */
+	mdm_child_watch_init (mdm_unwatched_child);
+
 	mdm_signal_ignore (SIGUSR2);
 	mdm_signal_ignore (SIGPIPE);
 
@@ -1639,6 +1598,8 @@ main (int argc, char *argv[])
 	/* Start static X servers */
 	mdm_start_first_unborn_local (0 /* delay */);	
 
+	mdm_trace_end ("daemon startup");
+
 	/* We always exit via exit (), and sadly we need to g_main_quit ()
 	 * at times not knowing if it's this main or a recursive one we're
 	 * quitting.
@@ -1658,7 +1619,7 @@ order_exists (int order)
 	GSList *li;
 	GSList *displays;
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 	for (li = displays; li != NULL; li = li->next) {
 		MdmDisplay *d = li->data;
 		if (d->x_servers_order == order)
@@ -1674,7 +1635,7 @@ get_new_order (MdmDisplay *d)
 	GSList *li;
 	GSList *displays;
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 	/* first try the position in the 'displays' list as
 	 * our order */
 	for (order = 0, li = displays; li != NULL; order++, li = li->next) {
@@ -1750,17 +1711,92 @@ write_x_servers (MdmDisplay *d)
 	g_free (file);
 }
 
+/* Arguments of a slave message, parsed before the handler is called.
+ * Most messages are "OPCODE <slave pid> [number|string]". */
+typedef struct {
+	long        slave_pid;
+	long        num; /* SOP_ARG_NUM */
+	const char *str; /* SOP_ARG_STR and SOP_ARG_OPT_STR, the whole
+			  * message for SOP_ARG_RAW */
+} SopArgs;
+
+enum {
+	SOP_ARG_NONE    = 0,      /* no arguments at all */
+	SOP_ARG_PID     = 1 << 0, /* slave pid, display is looked up */
+	SOP_ARG_NUM     = 1 << 1, /* a number after the slave pid */
+	SOP_ARG_STR     = 1 << 2, /* a string after the slave pid */
+	SOP_ARG_OPT_STR = 1 << 3, /* same but may be missing */
+	SOP_ARG_RAW     = 1 << 4  /* "opcode=X$$..." dialog message */
+};
+
+typedef struct {
+	const char *opcode;
+	guint       args;
+	void     (* func) (MdmDisplay *d, const SopArgs *args);
+
+	/* time spent in func */
+	MdmStatsHistogram handled;
+	/* time from the slave sending the request to the answer going out */
+	MdmStatsHistogram answered;
+} SopHandler;
+
+/* The slave request being handled, the answer carries its id so that
+ * the slave can tell it from answers to requests it gave up on */
+typedef struct {
+	MdmDisplay *d;       /* whose channel it came in on */
+	gulong      id;
+	gint64      sent;    /* monotonic time the slave sent it */
+	SopHandler *handler; /* once the opcode is known */
+} SlaveRequest;
+
+static SlaveRequest current_request = { NULL, 0, 0, NULL };
+
+/* 0 is never waited for, that is what requests that did not come in
+ * on d's own channel get */
+static gulong
+slave_request_id (MdmDisplay *d)
+{
+	return (d == current_request.d) ? current_request.id : 0;
+}
+
+static void
+slave_request_answered (MdmDisplay *d)
+{
+	SopHandler *handler = current_request.handler;
+	gint64 usec;
+
+	if (d != current_request.d || handler == NULL || current_request.sent <= 0)
+		return;
+
+	/* only the first answer counts */
+	current_request.handler = NULL;
+
+	usec = MAX (g_get_monotonic_time () - current_request.sent, 0);
+	mdm_stats_histogram_add (&handler->answered, usec);
+
+	mdm_debug ("Slave request %s answered after %" G_GINT64_FORMAT " us "
+		   "(%lu answers, average %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us)",
+		   handler->opcode, usec, handler->answered.count,
+		   handler->answered.total / (gint64) handler->answered.count,
+		   handler->answered.max);
+}
+
 static void
 send_slave_ack_dialog_int (MdmDisplay *d, int type, int response)
 {
 	if (d->master_notify_fd >= 0) {
 		char *not;
 
-		not = g_strdup_printf ("%c%c%d\n", MDM_SLAVE_NOTIFY_RESPONSE, type, response);
+		not = g_strdup_printf ("%c%lu %c%d\n",
+				       MDM_SLAVE_NOTIFY_RESPONSE,
+				       slave_request_id (d),
+				       type,
+				       response);
 		VE_IGNORE_EINTR (write (d->master_notify_fd, not, strlen (not)));
 
 		g_free (not);
 	}
+	slave_request_answered (d);
 	if (d->slavepid > 1) {
 		/* now yield the CPU as the other process has more
 		   useful work to do then we do */
@@ -1774,22 +1810,15 @@ static void
 send_slave_ack_dialog_char (MdmDisplay *d, int type, const char *resp)
 {
 	if (d->master_notify_fd >= 0) {
-		if (resp == NULL) {
-			char not[3];
-
-			not[0] = MDM_SLAVE_NOTIFY_RESPONSE;
-			not[1] = type;
-			not[2] = '\n';
-			VE_IGNORE_EINTR (write (d->master_notify_fd, not, 3));
-		} else {
-			char *not = g_strdup_printf ("%c%c%s\n",
-						     MDM_SLAVE_NOTIFY_RESPONSE,
-						     type,
-						     resp);
-			VE_IGNORE_EINTR (write (d->master_notify_fd, not, strlen (not)));
-			g_free (not);
-		}
+		char *not = g_strdup_printf ("%c%lu %c%s\n",
+					     MDM_SLAVE_NOTIFY_RESPONSE,
+					     slave_request_id (d),
+					     type,
+					     ve_sure_string (resp));
+		VE_IGNORE_EINTR (write (d->master_notify_fd, not, strlen (not)));
+		g_free (not);
 	}
+	slave_request_answered (d);
 	if (d->slavepid > 1) {
 		/* now yield the CPU as the other process has more
 		   useful work to do then we do */
@@ -1799,25 +1828,21 @@ send_slave_ack_dialog_char (MdmDisplay *d, int type, const char *resp)
 	}
 }
 
+/* The slave is waiting on its channel for this, so unlike commands it
+ * needs no signal */
 static void
 send_slave_ack (MdmDisplay *d, const char *resp)
 {
 	if (d->master_notify_fd >= 0) {
-		if (resp == NULL) {
-			char not[2];
-			not[0] = MDM_SLAVE_NOTIFY_ACK;
-			not[1] = '\n';
-			VE_IGNORE_EINTR (write (d->master_notify_fd, not, 2));
-		} else {
-			char *not = g_strdup_printf ("%c%s\n",
-						     MDM_SLAVE_NOTIFY_ACK,
-						     resp);
-			VE_IGNORE_EINTR (write (d->master_notify_fd, not, strlen (not)));
-			g_free (not);
-		}
+		char *not = g_strdup_printf ("%c%lu %s\n",
+					     MDM_SLAVE_NOTIFY_ACK,
+					     slave_request_id (d),
+					     ve_sure_string (resp));
+		VE_IGNORE_EINTR (write (d->master_notify_fd, not, strlen (not)));
+		g_free (not);
 	}
+	slave_request_answered (d);
 	if (d->slavepid > 1) {
-		kill (d->slavepid, SIGUSR2);
 		/* now yield the CPU as the other process has more
 		   useful work to do then we do */
 #if defined (_POSIX_PRIORITY_SCHEDULING) && defined (HAVE_SCHED_YIELD)
@@ -1846,668 +1871,676 @@ send_slave_command (MdmDisplay *d, const char *command)
 	}
 }
 
+
 static void
-mdm_handle_message (MdmConnection *conn, const char *msg, gpointer data)
+sop_handle_xpid (MdmDisplay *d, const SopArgs *args)
 {
-	/* Evil!, all this for debugging? */
-	if G_UNLIKELY (mdm_daemon_config_get_value_bool (MDM_KEY_DEBUG)) {
-		if (strncmp (msg, MDM_SOP_COOKIE " ",
-			     strlen (MDM_SOP_COOKIE " ")) == 0) {
-			char *s = g_strndup
-				(msg, strlen (MDM_SOP_COOKIE " XXXX XX"));
-			/* cut off most of the cookie for "security" */
-			mdm_debug ("Handling message: '%s...'", s);
-			g_free (s);
-		}
+	mdm_display_set_servpid (d, args->num);
+	mdm_debug ("Got XPID == %ld", args->num);
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
+
+static void
+sop_handle_sesspid (MdmDisplay *d, const SopArgs *args)
+{
+	d->sesspid = args->num;
+	mdm_debug ("Got SESSPID == %ld", args->num);
+	/* send ack */
+	send_slave_ack (d, NULL);
+
+	if (d->sesspid > 0) {
+		mdm_trace_mark ("session started");
+		mdm_trace_dump ();
 	}
+}
 
-	if (strncmp (msg, MDM_SOP_XPID " ",
-		            strlen (MDM_SOP_XPID " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid, pid;
+static void
+sop_handle_greetpid (MdmDisplay *d, const SopArgs *args)
+{
+	d->greetpid = args->num;
+	mdm_debug ("Got GREETPID == %ld", args->num);
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		if (sscanf (msg, MDM_SOP_XPID " %ld %ld", &slave_pid, &pid)
-		    != 2)
-			return;
+static void
+sop_handle_logged_in (MdmDisplay *d, const SopArgs *args)
+{
+	int logged_in = (int) args->num;
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	d->logged_in = logged_in ? TRUE : FALSE;
+	mdm_debug ("Got logged in == %s",
+		   d->logged_in ? "TRUE" : "FALSE");
 
-		if (d != NULL) {
-			d->servpid = pid;
-			mdm_debug ("Got XPID == %ld", (long)pid);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_SESSPID " ",
-		            strlen (MDM_SOP_SESSPID " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid, pid;
+	/* whack connections about this display if a user
+	 * just logged out since we don't want such
+	 * connections persisting to be authenticated */
+	if ( ! logged_in && unixconn != NULL)
+		mdm_kill_subconnections_with_display (unixconn, d);
 
-		if (sscanf (msg, MDM_SOP_SESSPID " %ld %ld", &slave_pid, &pid)
-		    != 2)
-			return;
+	/* if the user just logged out,
+	 * let's see if it's safe to restart */
+	if ( ! d->logged_in) {
+		mdm_try_logout_action (d);
+		mdm_safe_restart ();
+	}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		if (d != NULL) {
-			d->sesspid = pid;
-			mdm_debug ("Got SESSPID == %ld", (long)pid);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_GREETPID " ",
-		            strlen (MDM_SOP_GREETPID " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid, pid;
+static void
+sop_handle_disp_num (MdmDisplay *d, const SopArgs *args)
+{
+	int disp_num = (int) args->num;
 
-		if (sscanf (msg, MDM_SOP_GREETPID " %ld %ld", &slave_pid, &pid)
-		    != 2)
-			return;
+	mdm_display_set_number (d, disp_num);
+	mdm_debug ("Got DISP_NUM == %d", disp_num);
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+static void
+sop_handle_vt_num (MdmDisplay *d, const SopArgs *args)
+{
+	d->vt = (int) args->num;
+	mdm_debug ("Got VT_NUM == %d", d->vt);
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		if (d != NULL) {
-			d->greetpid = pid;
-			mdm_debug ("Got GREETPID == %ld", (long)pid);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_LOGGED_IN " ",
-		            strlen (MDM_SOP_LOGGED_IN " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		int logged_in;
-		if (sscanf (msg, MDM_SOP_LOGGED_IN " %ld %d", &slave_pid,
-			    &logged_in) != 2)
-			return;
+static void
+sop_handle_login (MdmDisplay *d, const SopArgs *args)
+{
+	g_free (d->login);
+	d->login = g_strdup (args->str);
+	d->login_uid_known = FALSE;
+	mdm_debug ("Got LOGIN == %s", args->str);
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+static void
+sop_handle_querylogin (MdmDisplay *d, const SopArgs *args)
+{
+	GString *resp = NULL;
+	GSList *li;
+	GSList *displays;
 
-		if (d != NULL) {
-			d->logged_in = logged_in ? TRUE : FALSE;
-			mdm_debug ("Got logged in == %s",
-				   d->logged_in ? "TRUE" : "FALSE");
-
-			/* whack connections about this display if a user
-			 * just logged out since we don't want such
-			 * connections persisting to be authenticated */
-			if ( ! logged_in && unixconn != NULL)
-				mdm_kill_subconnections_with_display (unixconn, d);
-
-			/* if the user just logged out,
-			 * let's see if it's safe to restart */
-			if ( ! d->logged_in) {
-				mdm_try_logout_action (d);
-				mdm_safe_restart ();
-			}
+	displays = mdm_display_get_list ();
+	mdm_debug ("Got QUERYLOGIN %s", args->str);
+	for (li = displays; li != NULL; li = li->next) {
+		MdmDisplay *di = li->data;
+		if (di->logged_in &&
+		    di->login != NULL &&
+		    strcmp (di->login, args->str) == 0) {
+			gboolean migratable = FALSE;
+
+			if (resp == NULL)
+				resp = g_string_new (NULL);
+			else
+				resp = g_string_append_c (resp, ',');
+
+			g_string_append (resp, di->name);
+			g_string_append_c (resp, ',');
 
-			/* send ack */
-			send_slave_ack (d, NULL);
+			if (d->attached && di->attached && di->vt > 0)
+				migratable = TRUE;
+
+			g_string_append_c (resp, migratable ? '1' : '0');
 		}
-	} else if (strncmp (msg, MDM_SOP_DISP_NUM " ",
-		            strlen (MDM_SOP_DISP_NUM " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		int disp_num;
+	}
 
-		if (sscanf (msg, MDM_SOP_DISP_NUM " %ld %d",
-			    &slave_pid, &disp_num) != 2)
-			return;
+	/* send ack */
+	if (resp != NULL) {
+		send_slave_ack (d, resp->str);
+		g_string_free (resp, TRUE);
+	} else {
+		send_slave_ack (d, NULL);
+	}
+}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+static void
+sop_handle_migrate (MdmDisplay *d, const SopArgs *args)
+{
+	MdmDisplay *di;
 
-		if (d != NULL) {
-			g_free (d->name);
-			d->name = g_strdup_printf (":%d", disp_num);
-			d->dispnum = disp_num;
-			mdm_debug ("Got DISP_NUM == %d", disp_num);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_VT_NUM " ",
-		            strlen (MDM_SOP_VT_NUM " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		int vt_num;
+	mdm_debug ("Got MIGRATE %s", args->str);
+	di = mdm_display_lookup_name (args->str);
+	if (di != NULL && di->logged_in) {
+		if (d->attached && di->vt > 0)
+			mdm_change_vt (di->vt);
+	}
+	send_slave_ack (d, NULL);
+}
 
-		if (sscanf (msg, MDM_SOP_VT_NUM " %ld %d",
-			    &slave_pid, &vt_num) != 2)
-			return;
+static void
+sop_handle_cookie (MdmDisplay *d, const SopArgs *args)
+{
+	g_free (d->cookie);
+	d->cookie = g_strdup (args->str);
+	mdm_debug ("Got COOKIE == <secret>");
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+static void
+sop_handle_authfile (MdmDisplay *d, const SopArgs *args)
+{
+	g_free (d->authfile);
+	d->authfile = g_strdup (args->str);
+	mdm_debug ("Got AUTHFILE == %s", d->authfile);
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		if (d != NULL) {
-			d->vt = vt_num;
-			mdm_debug ("Got VT_NUM == %d", vt_num);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_LOGIN " ",
-		            strlen (MDM_SOP_LOGIN " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
+static void
+sop_handle_flexi_err (MdmDisplay *d, const SopArgs *args)
+{
+	char *error = NULL;
+	int err = (int) args->num;
+	MdmConnection *conn = d->socket_conn;
+	d->socket_conn = NULL;
 
-		if (sscanf (msg, MDM_SOP_LOGIN " %ld",
-			    &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
+	if (conn != NULL)
+		mdm_connection_set_close_notify (conn,
+						 NULL, NULL);
+
+	if (err == 3)
+		error = "ERROR 3 X failed\n";
+	else if (err == 4)
+		error = "ERROR 4 X too busy\n";
+	else if (err == 5)
+		error = "ERROR 5 Nested display can't connect\n";
+	else
+		error = "ERROR 999 Unknown error\n";
+	if (conn != NULL)
+		mdm_connection_write (conn, error);
 
-		p++;
+	mdm_debug ("Got FLEXI_ERR == %d", err);
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+static void
+sop_handle_flexi_ok (MdmDisplay *d, const SopArgs *args)
+{
+	MdmConnection *conn = d->socket_conn;
+	d->socket_conn = NULL;
 
-		if (d != NULL) {
-			g_free (d->login);
-			d->login = g_strdup (p);
-			mdm_debug ("Got LOGIN == %s", p);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_QUERYLOGIN " ",
-		            strlen (MDM_SOP_QUERYLOGIN " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
+	if (conn != NULL) {
+		mdm_connection_set_close_notify (conn,
+						 NULL, NULL);
+		if ( ! mdm_connection_printf (conn, "OK %s\n", d->name))
+			mdm_display_unmanage (d);
+	}
 
-		if (sscanf (msg, MDM_SOP_QUERYLOGIN " %ld",
-			    &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
+	mdm_debug ("Got FLEXI_OK");
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-		p++;
+static void
+sop_handle_start_next_local (MdmDisplay *d, const SopArgs *args)
+{
+	mdm_start_first_unborn_local (3 /* delay */);
+}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+static void
+sop_handle_write_x_servers (MdmDisplay *d, const SopArgs *args)
+{
+	write_x_servers (d);
 
-		if (d != NULL) {
-			GString *resp = NULL;
-			GSList *li;
-			GSList *displays;
+	/* send ack */
+	send_slave_ack (d, NULL);
+}
 
-			displays = mdm_daemon_config_get_display_list ();
-			mdm_debug ("Got QUERYLOGIN %s", p);
-			for (li = displays; li != NULL; li = li->next) {
-				MdmDisplay *di = li->data;
-				if (di->logged_in &&
-				    di->login != NULL &&
-				    strcmp (di->login, p) == 0) {
-					gboolean migratable = FALSE;
+static void
+sop_handle_suspend_machine (MdmDisplay *d, const SopArgs *args)
+{
+	gboolean sysmenu;
 
-					if (resp == NULL)
-						resp = g_string_new (NULL);
-					else
-						resp = g_string_append_c (resp, ',');
+	mdm_info ("Master suspending...");
 
-					g_string_append (resp, di->name);
-					g_string_append_c (resp, ',');
+	sysmenu = mdm_daemon_config_get_value_bool_per_display (MDM_KEY_SYSTEM_MENU, d->name);
+	if (sysmenu && mdm_daemon_config_get_value_string_array (MDM_KEY_SUSPEND) != NULL) {
+		suspend_machine ();
+	}
+}
 
-					if (d->attached && di->attached && di->vt > 0)
-						migratable = TRUE;					
+static void
+sop_handle_chosen_theme (MdmDisplay *d, const SopArgs *args)
+{
+	g_free (d->theme_name);
+	d->theme_name = NULL;
 
-					g_string_append_c (resp, migratable ? '1' : '0');
-				}
-			}
+	/* Syntax errors are partially OK here, if there
+	   was no theme argument we just wanted to clear the
+	   theme field */
+	if ( ! ve_string_empty (args->str))
+		d->theme_name = g_strdup (args->str);
 
-			/* send ack */
-			if (resp != NULL) {
-				send_slave_ack (d, resp->str);
-				g_string_free (resp, TRUE);
-			} else {
-				send_slave_ack (d, NULL);
-			}
-		}
-	} else if (strncmp (msg, MDM_SOP_MIGRATE " ",
-		            strlen (MDM_SOP_MIGRATE " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
-		GSList *li;
-		GSList *displays;
+	send_slave_ack (d, NULL);
+}
 
-		displays = mdm_daemon_config_get_display_list ();
+static void
+sop_handle_timing (MdmDisplay *d, const SopArgs *args)
+{
+	const char *usec = strchr (args->str, ' ');
+	char *phase;
 
-		if (sscanf (msg, MDM_SOP_MIGRATE " %ld", &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
+	/* not acked, the slave does not wait */
+	if (usec == NULL)
+		return;
 
-		p++;
+	phase = g_strndup (args->str, usec - args->str);
+	mdm_stats_add_display_time (d->name, phase,
+				    g_ascii_strtoll (usec + 1, NULL, 10));
+	g_free (phase);
+}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
-		if (d == NULL)
-			return;
+static void
+sop_handle_show_error_dialog (MdmDisplay *unused, const SopArgs *args)
+{
+	const char *msg = args->str;
+	char **list;
+	list = g_strsplit (msg, "$$", -1);
 
-		mdm_debug ("Got MIGRATE %s", p);
-		for (li = displays; li != NULL; li = li->next) {
-			MdmDisplay *di = li->data;
-			if (di->logged_in && strcmp (di->name, p) == 0) {
-				if (d->attached && di->vt > 0)
-					mdm_change_vt (di->vt);				
-			}
-		}
-		send_slave_ack (d, NULL);
-	} else if (strncmp (msg, MDM_SOP_COOKIE " ",
-		            strlen (MDM_SOP_COOKIE " ")) == 0) {
+	if (mdm_vector_len (list) == 8) {
 		MdmDisplay *d;
+		GtkMessageType type;
+		char *ptr;
+		char *error;
+		char *details_label;
+		char *details_file;
 		long slave_pid;
-		char *p;
+		int uid, gid;
 
-		if (sscanf (msg, MDM_SOP_COOKIE " %ld",
-			    &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
+		ptr = strchr (list[1], '=');
+		slave_pid = atol (ptr + 1);
 
-		p++;
+		ptr = strchr (list[2], '=');
+		type = atoi (ptr + 1);
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+		ptr = strchr (list[3], '=');
+		error = g_malloc0 (strlen (ptr));
+		strcpy (error, ptr + 1);
 
-		if (d != NULL) {
-			g_free (d->cookie);
-			d->cookie = g_strdup (p);
-			mdm_debug ("Got COOKIE == <secret>");
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_AUTHFILE " ",
-		            strlen (MDM_SOP_AUTHFILE " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		char *p;
+		ptr = strchr (list[4], '=');
+		details_label = g_malloc0 (strlen (ptr));
+		strcpy (details_label, ptr + 1);
 
-		if (sscanf (msg, MDM_SOP_AUTHFILE " %ld",
-			    &slave_pid) != 1)
-			return;
-		p = strchr (msg, ' ');
-		if (p != NULL)
-			p = strchr (p+1, ' ');
-		if (p == NULL)
-			return;
+		ptr = strchr (list[5], '=');
+		details_file = g_malloc0 (strlen (ptr));
+		strcpy (details_file, ptr + 1);
 
-		p++;
+		ptr = strchr (list[6], '=');
+		uid = atoi (ptr + 1);
+
+		ptr = strchr (list[7], '=');
+		gid = atoi (ptr + 1);
 
-		/* Find out who this slave belongs to */
 		d = mdm_display_lookup (slave_pid);
 
 		if (d != NULL) {
-			g_free (d->authfile);
-			d->authfile = g_strdup (p);
-			mdm_debug ("Got AUTHFILE == %s", d->authfile);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_FLEXI_ERR " ",
-		            strlen (MDM_SOP_FLEXI_ERR " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
-		int err;
+			if (MDM_AUTHFILE (d)) {
+				VE_IGNORE_EINTR (
+					chmod (MDM_AUTHFILE (d), 0644));
+			}
 
-		if (sscanf (msg, MDM_SOP_FLEXI_ERR " %ld %d",
-			    &slave_pid, &err) != 2)
-			return;
+			/* FIXME: this is really bad */
+			mdm_errorgui_error_box_full (d, type, error,
+			     details_label, details_file, 0, 0);
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+			if (MDM_AUTHFILE (d)) {
+				VE_IGNORE_EINTR (
+					chmod (MDM_AUTHFILE (d), 0640));
+			}
 
-		if (d != NULL) {
-			char *error = NULL;
-			MdmConnection *conn = d->socket_conn;
-			d->socket_conn = NULL;
+			send_slave_ack_dialog_char (d,
+				MDM_SLAVE_NOTIFY_ERROR_RESPONSE, NULL);
+		}
 
-			if (conn != NULL)
-				mdm_connection_set_close_notify (conn,
-								 NULL, NULL);
+		g_free (error);
+		g_free (details_label);
+		g_free (details_file);
+	}
+	g_strfreev (list);
+}
 
-			if (err == 3)
-				error = "ERROR 3 X failed\n";
-			else if (err == 4)
-				error = "ERROR 4 X too busy\n";
-			else if (err == 5)
-				error = "ERROR 5 Nested display can't connect\n";
-			else
-				error = "ERROR 999 Unknown error\n";
-			if (conn != NULL)
-				mdm_connection_write (conn, error);
+static void
+sop_handle_show_yesno_dialog (MdmDisplay *unused, const SopArgs *args)
+{
+	const char *msg = args->str;
+	char **list;
+	list = g_strsplit (msg, "$$", -1);
 
-			mdm_debug ("Got FLEXI_ERR == %d", err);
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_FLEXI_OK " ",
-		            strlen (MDM_SOP_FLEXI_OK " ")) == 0) {
+	if (mdm_vector_len (list) == 3) {
 		MdmDisplay *d;
+		char *ptr;
+		char *yesno_msg;
 		long slave_pid;
+		gboolean resp;
 
-		if (sscanf (msg, MDM_SOP_FLEXI_OK " %ld",
-			    &slave_pid) != 1)
-			return;
+		ptr = strchr (list [1], '=');
+		slave_pid = atol (ptr + 1);
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+		ptr = strchr (list [2], '=');
+		yesno_msg = g_malloc0 (strlen (ptr));
+		strcpy (yesno_msg, ptr + 1);
 
+		d = mdm_display_lookup (slave_pid);
 		if (d != NULL) {
-			MdmConnection *conn = d->socket_conn;
-			d->socket_conn = NULL;
-
-			if (conn != NULL) {
-				mdm_connection_set_close_notify (conn,
-								 NULL, NULL);
-				if ( ! mdm_connection_printf (conn, "OK %s\n", d->name))
-					mdm_display_unmanage (d);
+			if (MDM_AUTHFILE (d)) {
+				VE_IGNORE_EINTR (
+					chmod (MDM_AUTHFILE (d), 0644));
 			}
 
-			mdm_debug ("Got FLEXI_OK");
-			/* send ack */
-			send_slave_ack (d, NULL);
+			resp = mdm_errorgui_failsafe_yesno (d,
+				yesno_msg);
+
+			send_slave_ack_dialog_int (d,
+				MDM_SLAVE_NOTIFY_YESNO_RESPONSE,
+				resp);
+
+			if (MDM_AUTHFILE (d)) {
+				VE_IGNORE_EINTR (
+					chmod (MDM_AUTHFILE (d), 0640));
+			}
 		}
-	} else if (strcmp (msg, MDM_SOP_START_NEXT_LOCAL) == 0) {
-		mdm_start_first_unborn_local (3 /* delay */);
-	} else if (strncmp (msg, MDM_SOP_WRITE_X_SERVERS " ",
-		            strlen (MDM_SOP_WRITE_X_SERVERS " ")) == 0) {
-		MdmDisplay *d;
-		long slave_pid;
+		g_free (yesno_msg);
+	}
 
-		if (sscanf (msg, MDM_SOP_WRITE_X_SERVERS " %ld",
-			    &slave_pid) != 1)
-			return;
+	g_strfreev (list);
+}
 
-		/* Find out who this slave belongs to */
-		d = mdm_display_lookup (slave_pid);
+static void
+sop_handle_show_question_dialog (MdmDisplay *unused, const SopArgs *args)
+{
+	const char *msg = args->str;
+	char **list;
 
-		if (d != NULL) {
-			write_x_servers (d);
+	list = g_strsplit (msg, "$$", -1);
 
-			/* send ack */
-			send_slave_ack (d, NULL);
-		}
-	} else if (strncmp (msg, MDM_SOP_SUSPEND_MACHINE " ",
-			    strlen (MDM_SOP_SUSPEND_MACHINE " ")) == 0) {
+	if (mdm_vector_len (list) == 4) {
 		MdmDisplay *d;
+		char *ptr;
+		char *question_msg;
+		char *resp;
 		long slave_pid;
-		gboolean sysmenu;
+		gboolean echo;
+
+		ptr = strchr (list [1], '=');
+		slave_pid = atol (ptr + 1);
+
+		ptr = strchr (list [2], '=');
+		question_msg = g_malloc0 (strlen (ptr));
+		strcpy (question_msg, ptr + 1);
+
+		ptr = strchr (list [3], '=');
+		echo = atoi (ptr + 1);
 
-		if (sscanf (msg, MDM_SOP_SUSPEND_MACHINE " %ld", &slave_pid) != 1)
-			return;
 		d = mdm_display_lookup (slave_pid);
+		if (d != NULL) {
+			if (MDM_AUTHFILE (d)) {
+				VE_IGNORE_EINTR (
+					chmod (MDM_AUTHFILE (d), 0644));
+			}
 
-		mdm_info ("Master suspending...");
+			resp = mdm_errorgui_failsafe_question (d,
+				question_msg, echo);
 
-		sysmenu = mdm_daemon_config_get_value_bool_per_display (MDM_KEY_SYSTEM_MENU, d->name);
-		if (sysmenu && mdm_daemon_config_get_value_string_array (MDM_KEY_SUSPEND) != NULL) {
-			suspend_machine ();
+			send_slave_ack_dialog_char (d,
+				MDM_SLAVE_NOTIFY_QUESTION_RESPONSE,
+				resp);
+
+			if (MDM_AUTHFILE (d)) {
+				VE_IGNORE_EINTR (
+					chmod (MDM_AUTHFILE (d), 0640));
+			}
 		}
-	} else if (strncmp (msg, MDM_SOP_CHOSEN_THEME " ",
-		            strlen (MDM_SOP_CHOSEN_THEME " ")) == 0) {
+
+		g_free (question_msg);
+	}
+	g_strfreev (list);
+}
+
+static void
+sop_handle_show_askbuttons_dialog (MdmDisplay *unused, const SopArgs *args)
+{
+	const char *msg = args->str;
+	char **list;
+	list = g_strsplit (msg, "$$", -1);
+
+	if (mdm_vector_len (list) == 7) {
 		MdmDisplay *d;
+		char *askbuttons_msg;
+		char *ptr;
+		char *options[4];
 		long slave_pid;
-		const char *p;
+		int i;
 
-		if (sscanf (msg, MDM_SOP_CHOSEN_THEME " %ld", &slave_pid) != 1)
-			return;
-		d = mdm_display_lookup (slave_pid);
+		int resp;
+		ptr = strchr (list [1], '=');
+		slave_pid = atol (ptr + 1);
+
+		ptr = strchr (list [2], '=');
+		askbuttons_msg = g_malloc0 (strlen (ptr));
+		strcpy (askbuttons_msg, ptr + 1);
+
+		ptr = strchr (list [3], '=');
+		options[0] = g_malloc0 (strlen (ptr));
+		strcpy (options[0], ptr + 1);
+
+		ptr = strchr (list [4], '=');
+		options[1] = g_malloc0 (strlen (ptr));
+		strcpy (options[1], ptr + 1);
+
+		ptr = strchr (list [5], '=');
+		options[2] = g_malloc0 (strlen (ptr));
+		strcpy (options[2], ptr + 1);
 
+		ptr = strchr (list [6], '=');
+		options[3] = g_malloc0 (strlen (ptr));
+		strcpy (options[3], ptr + 1);
+
+		d = mdm_display_lookup (slave_pid);
 		if (d != NULL) {
-			g_free (d->theme_name);
-			d->theme_name = NULL;
-
-			/* Syntax errors are partially OK here, if there
-			   was no theme argument we just wanted to clear the
-			   theme field */
-			p = strchr (msg, ' ');
-			if (p != NULL) {
-				p = strchr (p+1, ' ');
-				if (p != NULL) {
-					while (*p == ' ')
-						p++;
-					if ( ! ve_string_empty (p))
-						d->theme_name = g_strdup (p);
-				}
+			if (MDM_AUTHFILE (d)) {
+				VE_IGNORE_EINTR (
+					chmod (MDM_AUTHFILE (d), 0644));
 			}
 
-			send_slave_ack (d, NULL);
+			resp = mdm_errorgui_failsafe_ask_buttons (d,
+				askbuttons_msg, options);
+
+			send_slave_ack_dialog_int (d,
+				MDM_SLAVE_NOTIFY_ASKBUTTONS_RESPONSE,
+				resp);
+
+			if (MDM_AUTHFILE (d)) {
+				VE_IGNORE_EINTR (
+					chmod (MDM_AUTHFILE (d), 0640));
+			}
 		}
-	} else if (strncmp (msg, "opcode="MDM_SOP_SHOW_ERROR_DIALOG,
-			    strlen ("opcode="MDM_SOP_SHOW_ERROR_DIALOG)) == 0) {
-		char **list;
-		list = g_strsplit (msg, "$$", -1);
-
-		if (mdm_vector_len (list) == 8) {
-			MdmDisplay *d;
-			GtkMessageType type;
-			char *ptr;
-			char *error;
-			char *details_label;
-			char *details_file;
-			long slave_pid;
-			int uid, gid;
-
-			ptr = strchr (list[1], '=');
-			slave_pid = atol (ptr + 1);
-
-			ptr = strchr (list[2], '=');
-			type = atoi (ptr + 1);
-
-			ptr = strchr (list[3], '=');
-			error = g_malloc0 (strlen (ptr));
-			strcpy (error, ptr + 1);
-
-			ptr = strchr (list[4], '=');
-			details_label = g_malloc0 (strlen (ptr));
-			strcpy (details_label, ptr + 1);
-
-			ptr = strchr (list[5], '=');
-			details_file = g_malloc0 (strlen (ptr));
-			strcpy (details_file, ptr + 1);
-
-			ptr = strchr (list[6], '=');
-			uid = atoi (ptr + 1);
-
-			ptr = strchr (list[7], '=');
-			gid = atoi (ptr + 1);
-
-			d = mdm_display_lookup (slave_pid);
-
-			if (d != NULL) {
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0644));
-				}
 
-				/* FIXME: this is really bad */
-				mdm_errorgui_error_box_full (d, type, error,
-				     details_label, details_file, 0, 0);
+		g_free (askbuttons_msg);
 
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0640));
-				}
+		for (i = 0; i < 3; i ++)
+			g_free (options[i]);
+	}
+	g_strfreev (list);
+}
 
-				send_slave_ack_dialog_char (d,
-					MDM_SLAVE_NOTIFY_ERROR_RESPONSE, NULL);
-			}
+static SopHandler sop_handlers[] = {
+	{ MDM_SOP_XPID,              SOP_ARG_PID | SOP_ARG_NUM, sop_handle_xpid },
+	{ MDM_SOP_SESSPID,           SOP_ARG_PID | SOP_ARG_NUM, sop_handle_sesspid },
+	{ MDM_SOP_GREETPID,          SOP_ARG_PID | SOP_ARG_NUM, sop_handle_greetpid },
+	{ MDM_SOP_LOGGED_IN,         SOP_ARG_PID | SOP_ARG_NUM, sop_handle_logged_in },
+	{ MDM_SOP_DISP_NUM,          SOP_ARG_PID | SOP_ARG_NUM, sop_handle_disp_num },
+	{ MDM_SOP_VT_NUM,            SOP_ARG_PID | SOP_ARG_NUM, sop_handle_vt_num },
+	{ MDM_SOP_LOGIN,             SOP_ARG_PID | SOP_ARG_STR, sop_handle_login },
+	{ MDM_SOP_QUERYLOGIN,        SOP_ARG_PID | SOP_ARG_STR, sop_handle_querylogin },
+	{ MDM_SOP_MIGRATE,           SOP_ARG_PID | SOP_ARG_STR, sop_handle_migrate },
+	{ MDM_SOP_COOKIE,            SOP_ARG_PID | SOP_ARG_STR, sop_handle_cookie },
+	{ MDM_SOP_AUTHFILE,          SOP_ARG_PID | SOP_ARG_STR, sop_handle_authfile },
+	{ MDM_SOP_FLEXI_ERR,         SOP_ARG_PID | SOP_ARG_NUM, sop_handle_flexi_err },
+	{ MDM_SOP_FLEXI_OK,          SOP_ARG_PID, sop_handle_flexi_ok },
+	{ MDM_SOP_START_NEXT_LOCAL,  SOP_ARG_NONE, sop_handle_start_next_local },
+	{ MDM_SOP_WRITE_X_SERVERS,   SOP_ARG_PID, sop_handle_write_x_servers },
+	{ MDM_SOP_SUSPEND_MACHINE,   SOP_ARG_PID, sop_handle_suspend_machine },
+	{ MDM_SOP_CHOSEN_THEME,      SOP_ARG_PID | SOP_ARG_OPT_STR, sop_handle_chosen_theme },
+	{ MDM_SOP_TIMING,            SOP_ARG_PID | SOP_ARG_STR, sop_handle_timing },
+	/* the dialog messages look up the display themselves */
+	{ MDM_SOP_SHOW_ERROR_DIALOG, SOP_ARG_RAW, sop_handle_show_error_dialog },
+	{ MDM_SOP_SHOW_YESNO_DIALOG, SOP_ARG_RAW, sop_handle_show_yesno_dialog },
+	{ MDM_SOP_SHOW_QUESTION_DIALOG, SOP_ARG_RAW, sop_handle_show_question_dialog },
+	{ MDM_SOP_SHOW_ASKBUTTONS_DIALOG, SOP_ARG_RAW, sop_handle_show_askbuttons_dialog },
+};
 
-			g_free (error);
-			g_free (details_label);
-			g_free (details_file);
-		}
-		g_strfreev (list);
-	} else if (strncmp (msg, "opcode="MDM_SOP_SHOW_YESNO_DIALOG,
-                            strlen ("opcode="MDM_SOP_SHOW_YESNO_DIALOG)) == 0) {
-		char **list;
-		list = g_strsplit (msg, "$$", -1);
-
-		if (mdm_vector_len (list) == 3) {
-			MdmDisplay *d;
-			char *ptr;
-			char *yesno_msg;
-			long slave_pid;
-			gboolean resp;
-
-			ptr = strchr (list [1], '=');
-			slave_pid = atol (ptr + 1);
-
-			ptr = strchr (list [2], '=');
-			yesno_msg = g_malloc0 (strlen (ptr));
-			strcpy (yesno_msg, ptr + 1);
-
-			d = mdm_display_lookup (slave_pid);
-			if (d != NULL) {
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0644));
-				}
+static void
+call_sop_handler (SopHandler *handler, MdmDisplay *d, const SopArgs *args)
+{
+	gint64 start = g_get_monotonic_time ();
 
-				resp = mdm_errorgui_failsafe_yesno (d,
-					yesno_msg);
+	handler->func (d, args);
+	mdm_stats_histogram_add (&handler->handled,
+				 g_get_monotonic_time () - start);
 
-				send_slave_ack_dialog_int (d,
-					MDM_SLAVE_NOTIFY_YESNO_RESPONSE,
-					resp);
+	/* back to the main loop next, whatever the handler peeked is
+	 * not used any more */
+	mdm_daemon_config_release_superseded ();
+}
 
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0640));
-				}
-			}
-			g_free (yesno_msg);
+static void
+mdm_handle_message (MdmConnection *conn, const char *msg, gpointer data)
+{
+	static gboolean sorted = FALSE;
+	SopHandler *handler;
+	const char *rest;
+	char *end;
+	SopArgs args;
+	MdmDisplay *d;
+	gsize len;
+
+	/* Evil!, all this for debugging? */
+	if G_UNLIKELY (mdm_daemon_config_get_bool_for_id (MDM_ID_DEBUG)) {
+		if (strncmp (msg, MDM_SOP_COOKIE " ",
+			     strlen (MDM_SOP_COOKIE " ")) == 0) {
+			char *s = g_strndup
+				(msg, strlen (MDM_SOP_COOKIE " XXXX XX"));
+			/* cut off most of the cookie for "security" */
+			mdm_debug ("Handling message: '%s...'", s);
+			g_free (s);
 		}
+	}
 
-		g_strfreev (list);
-	} else if (strncmp (msg, "opcode="MDM_SOP_SHOW_QUESTION_DIALOG,
-                            strlen ("opcode="MDM_SOP_SHOW_QUESTION_DIALOG)) == 0) {
-		char **list;
+	if G_UNLIKELY ( ! sorted) {
+		mdm_dispatch_sort (sop_handlers, G_N_ELEMENTS (sop_handlers),
+				   sizeof (SopHandler));
+		sorted = TRUE;
+	}
 
-		list = g_strsplit (msg, "$$", -1);
+	memset (&args, 0, sizeof (args));
 
-		if (mdm_vector_len (list) == 4) {
-			MdmDisplay *d;
-			char *ptr;
-			char *question_msg;
-			char *resp;
-			long slave_pid;
-			gboolean echo;
+	if (strncmp (msg, "opcode=", strlen ("opcode=")) == 0) {
+		const char *token = msg + strlen ("opcode=");
+		const char *sep = strstr (token, "$$");
 
-			ptr = strchr (list [1], '=');
-			slave_pid = atol (ptr + 1);
+		len = (sep != NULL) ? (gsize) (sep - token) : strlen (token);
+		handler = mdm_dispatch_lookup (sop_handlers,
+					       G_N_ELEMENTS (sop_handlers),
+					       sizeof (SopHandler),
+					       token, len);
+		current_request.handler = handler;
+		if (handler == NULL || ! (handler->args & SOP_ARG_RAW))
+			return;
 
-			ptr = strchr (list [2], '=');
-			question_msg = g_malloc0 (strlen (ptr));
-			strcpy (question_msg, ptr + 1);
+		args.str = msg;
+		call_sop_handler (handler, NULL, &args);
+		return;
+	}
 
-			ptr = strchr (list [3], '=');
-			echo = atoi (ptr + 1);
+	len = mdm_dispatch_split (msg, &rest);
+	handler = mdm_dispatch_lookup (sop_handlers,
+				       G_N_ELEMENTS (sop_handlers),
+				       sizeof (SopHandler),
+				       msg, len);
+	current_request.handler = handler;
+	if (handler == NULL || (handler->args & SOP_ARG_RAW))
+		return;
 
-			d = mdm_display_lookup (slave_pid);
-			if (d != NULL) {
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0644));
-				}
+	if (handler->args == SOP_ARG_NONE) {
+		if (rest == NULL)
+			call_sop_handler (handler, NULL, &args);
+		return;
+	}
 
-				resp = mdm_errorgui_failsafe_question (d,
-					question_msg, echo);
+	if (rest == NULL)
+		return;
 
-				send_slave_ack_dialog_char (d,
-					MDM_SLAVE_NOTIFY_QUESTION_RESPONSE,
-					resp);
+	args.slave_pid = strtol (rest, &end, 10);
+	if (end == rest)
+		return;
+	rest = end;
 
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0640));
-				}
-			}
+	if (handler->args & SOP_ARG_NUM) {
+		args.num = strtol (rest, &end, 10);
+		if (end == rest)
+			return;
+	}
+
+	if (handler->args & (SOP_ARG_STR | SOP_ARG_OPT_STR)) {
+		/* the string is everything after the slave pid */
+		const char *p = strchr (rest, ' ');
 
-			g_free (question_msg);
+		if (p != NULL) {
+			p++;
+			if (handler->args & SOP_ARG_OPT_STR) {
+				while (*p == ' ')
+					p++;
+			}
+		} else if (handler->args & SOP_ARG_STR) {
+			return;
 		}
-		g_strfreev (list);
-	} else if (strncmp (msg, "opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG,
-                            strlen ("opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG)) == 0) {
-		char **list;
-		list = g_strsplit (msg, "$$", -1);
-
-		if (mdm_vector_len (list) == 7) {
-			MdmDisplay *d;
-			char *askbuttons_msg;
-			char *ptr;
-			char *options[4];
-			long slave_pid;
-			int i;
-
-			int resp;
-			ptr = strchr (list [1], '=');
-			slave_pid = atol (ptr + 1);
-
-			ptr = strchr (list [2], '=');
-			askbuttons_msg = g_malloc0 (strlen (ptr));
-			strcpy (askbuttons_msg, ptr + 1);
-
-			ptr = strchr (list [3], '=');
-			options[0] = g_malloc0 (strlen (ptr));
-			strcpy (options[0], ptr + 1);
-
-			ptr = strchr (list [4], '=');
-			options[1] = g_malloc0 (strlen (ptr));
-			strcpy (options[1], ptr + 1);
-
-			ptr = strchr (list [5], '=');
-			options[2] = g_malloc0 (strlen (ptr));
-			strcpy (options[2], ptr + 1);
-
-			ptr = strchr (list [6], '=');
-			options[3] = g_malloc0 (strlen (ptr));
-			strcpy (options[3], ptr + 1);
-
-			d = mdm_display_lookup (slave_pid);
-			if (d != NULL) {
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0644));
-				}
+		args.str = (p != NULL) ? p : "";
+	}
+
+	/* Find out who this slave belongs to */
+	d = mdm_display_lookup (args.slave_pid);
+	if (d == NULL)
+		return;
 
-				resp = mdm_errorgui_failsafe_ask_buttons (d,
-					askbuttons_msg, options);
+	call_sop_handler (handler, d, &args);
+}
 
-				send_slave_ack_dialog_int (d,
-					MDM_SLAVE_NOTIFY_ASKBUTTONS_RESPONSE,
-					resp);
+/* Requests on a slave's channel are "<id> <send time> <message>" */
+void
+mdm_handle_slave_request (MdmConnection *conn, const char *msg, gpointer data)
+{
+	SlaveRequest outer = current_request;
+	gulong id;
+	gint64 sent;
+	char *end;
 
-				if (MDM_AUTHFILE (d)) {
-					VE_IGNORE_EINTR (
-						chmod (MDM_AUTHFILE (d), 0640));
-				}
-			}
+	id = strtoul (msg, &end, 10);
+	if (end == msg || *end != ' ')
+		return;
+	sent = g_ascii_strtoll (end + 1, &end, 10);
+	if (*end != ' ')
+		return;
 
-			g_free (askbuttons_msg);
+	current_request.d = data;
+	current_request.id = id;
+	current_request.sent = sent;
+	current_request.handler = NULL;
 
-			for (i = 0; i < 3; i ++)
-				g_free (options[i]);
-		}
-		g_strfreev (list);
-	}
+	mdm_handle_message (conn, end + 1, data);
+
+	/* the dialogs wait for the user, other requests may have been
+	 * handled meanwhile */
+	current_request = outer;
 }
 
 static void
@@ -2569,15 +2602,14 @@ handle_flexi_server (MdmConnection *conn, int type, const char *server, gboolean
 	   oh well, this makes other things simpler */
 	display->handled = handled;
 
-	flexi_servers++;
-
 	display->preset_user = g_strdup (username);
 	display->type = type;
 	display->socket_conn = conn;
 		
 	if (conn != NULL)
 		mdm_connection_set_close_notify (conn, display, close_conn);
-	mdm_daemon_config_display_list_append (display);
+	/* counts it in flexi_servers */
+	mdm_display_add (display);
 
 	if ( ! mdm_display_manage (display)) {
 		mdm_display_unmanage (display);
@@ -2600,7 +2632,7 @@ sup_handle_auth_local (MdmConnection *conn,
 
 	cookie = g_strdup (&msg[strlen (MDM_SUP_AUTH_LOCAL " ")]);
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 
 	g_strstrip (cookie);
 	if (strlen (cookie) != 16*2) /* 16 bytes in hex form */ {
@@ -2657,7 +2689,7 @@ sup_handle_attached_servers (MdmConnection *conn,
 	int     msgLen=0;
 	GSList *displays;
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 
 	if (strncmp (msg, MDM_SUP_ATTACHED_SERVERS,
 		     strlen (MDM_SUP_ATTACHED_SERVERS)) == 0)
@@ -2687,6 +2719,45 @@ sup_handle_attached_servers (MdmConnection *conn,
 	g_string_free (retMsg, TRUE);
 }
 
+/*
+ * Looks up one key for GET_CONFIG and GET_CONFIG_MULTI.  Returns
+ * FALSE for an unsupported key, otherwise *value is set to the value
+ * or NULL if the key has none.
+ */
+static gboolean
+get_config_value (const char *key,
+		  const char *display,
+		  char      **value)
+{
+	static gboolean done_prefetch = FALSE;
+
+	*value = NULL;
+
+	/*
+	 * It is not meaningful to manage this in a per-display
+	 * fashion since the prefetch program is only run once the
+	 * for the first display that requests the key.  So process
+	 * this first and return "Unsupported key" for requests
+	 * after the first request.
+	 */
+	if (strcmp (key, MDM_KEY_PRE_FETCH_PROGRAM) == 0) {
+		if (done_prefetch)
+			return TRUE;
+		done_prefetch = TRUE;
+		return FALSE;
+	}
+
+	/*
+	 * Note passing in the display is backwards compatible
+	 * since if it is NULL, it won't try to load the display
+	 * value at all.
+	 */
+	if (mdm_daemon_config_to_string (key, display, value))
+		return TRUE;
+
+	return mdm_daemon_config_is_valid_key ((gchar *)key);
+}
+
 static void
 sup_handle_get_config (MdmConnection *conn,
 		       const char    *msg,
@@ -2695,9 +2766,6 @@ sup_handle_get_config (MdmConnection *conn,
 	const char *parms;
 	char **splitstr;
 	char *retval;
-	static gboolean done_prefetch = FALSE;
-
-	retval = NULL;
 
 	parms = &msg[strlen (MDM_SUP_GET_CONFIG " ")];
 
@@ -2708,50 +2776,74 @@ sup_handle_get_config (MdmConnection *conn,
 		goto out;
 	}
 
-	/*
-	 * It is not meaningful to manage this in a per-display
-	 * fashion since the prefetch program is only run once the
-	 * for the first display that requests the key.  So process
-	 * this first and return "Unsupported key" for requests
-	 * after the first request.
-	 */
-	if (strcmp (splitstr[0], MDM_KEY_PRE_FETCH_PROGRAM) == 0) {
-		if (done_prefetch) {
-			mdm_connection_printf (conn, "OK \n");
-		} else {
-			mdm_connection_printf (conn, "ERROR 50 Unsupported key <%s>\n", splitstr[0]);
-			done_prefetch = TRUE;
-		}
-		goto out;
+	mdm_debug ("Handling GET_CONFIG: %s for display %s", splitstr[0],
+		   splitstr[1] ? splitstr[1] : "(null)");
+
+	if (get_config_value (splitstr[0], splitstr[1], &retval)) {
+		mdm_connection_printf (conn, "OK %s\n", ve_sure_string (retval));
+		g_free (retval);
+	} else {
+		mdm_connection_printf (conn,
+				       "ERROR 50 Unsupported key <%s>\n",
+				       splitstr[0]);
+	}
+ out:
+	g_strfreev (splitstr);
+}
+
+/*
+ * GET_CONFIG_MULTI <display or -> <key> [<key> ...]
+ *
+ * Answers all keys on one line, tab separated and in the order they
+ * were asked for.  Each value is "=" followed by the value escaped
+ * with g_strescape, or "!" for an unsupported key.
+ */
+static void
+sup_handle_get_config_multi (MdmConnection *conn,
+			     const char    *msg,
+			     gpointer       data)
+{
+	const char *display;
+	char **splitstr;
+	GString *resp;
+	int i;
+
+	splitstr = g_strsplit (&msg[strlen (MDM_SUP_GET_CONFIG_MULTI " ")], " ", -1);
+
+	if (splitstr[0] == NULL || splitstr[1] == NULL) {
+		mdm_connection_printf (conn, "ERROR 50 Unsupported key <null>\n");
+		g_strfreev (splitstr);
+		return;
 	}
 
-	if (splitstr[0] != NULL) {
-		gboolean res;
+	display = (strcmp (splitstr[0], "-") == 0) ? NULL : splitstr[0];
 
-		/*
-		 * Note passing in the display is backwards compatible
-		 * since if it is NULL, it won't try to load the display
-		 * value at all.
-		 */
+	mdm_debug ("Handling GET_CONFIG_MULTI: %d keys for display %s",
+		   g_strv_length (splitstr) - 1, ve_sure_string (display));
+
+	resp = g_string_new ("OK ");
+	for (i = 1; splitstr[i] != NULL; i++) {
+		char *value;
 
-		mdm_debug ("Handling GET_CONFIG: %s for display %s", splitstr[0],
-			   splitstr[1] ? splitstr[1] : "(null)");
+		if (i > 1)
+			g_string_append_c (resp, '\t');
 
-		res = mdm_daemon_config_to_string (splitstr[0], splitstr[1], &retval);
+		if (get_config_value (splitstr[i], display, &value)) {
+			char *escaped = g_strescape (ve_sure_string (value), NULL);
 
-		if (res) {
-			mdm_connection_printf (conn, "OK %s\n", retval);
-			g_free (retval);
+			g_string_append_c (resp, '=');
+			g_string_append (resp, escaped);
+			g_free (escaped);
+			g_free (value);
 		} else {
-			if (mdm_daemon_config_is_valid_key ((gchar *)splitstr[0]))
-				mdm_connection_printf (conn, "OK \n");
-			else
-				mdm_connection_printf (conn,
-						       "ERROR 50 Unsupported key <%s>\n",
-						       splitstr[0]);
+			g_string_append_c (resp, '!');
 		}
 	}
- out:
+	g_string_append_c (resp, '\n');
+
+	mdm_connection_write (conn, resp->str);
+
+	g_string_free (resp, TRUE);
 	g_strfreev (splitstr);
 }
 
@@ -2864,7 +2956,7 @@ sup_handle_greeterpids (MdmConnection *conn,
 	const gchar *sep = " ";
 	GSList *displays;
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 
 	reply = g_string_new ("OK");
 	for (li = displays; li != NULL; li = li->next) {
@@ -3017,7 +3109,7 @@ sup_handle_set_vt (MdmConnection *conn,
 	GSList *li;
 	GSList *displays;
 
-	displays = mdm_daemon_config_get_display_list ();
+	displays = mdm_display_get_list ();
 
 	if (sscanf (msg, MDM_SUP_SET_VT " %d", &vt) != 1 ||
 	    vt < 0) {
@@ -3049,101 +3141,405 @@ sup_handle_set_vt (MdmConnection *conn,
 }
 
 static void
-mdm_handle_user_message (MdmConnection *conn,
-			 const char    *msg,
-			 gpointer       data)
+sup_handle_flexi_xserver (MdmConnection *conn,
+			  const char    *msg,
+			  gpointer       data)
 {
+	/* Only allow locally authenticated connections */
+	if ( ! MDM_CONN_AUTHENTICATED (conn)) {
+		mdm_info ("%s request denied: Not authenticated", "FLEXI_XSERVER");
+		mdm_connection_write (conn, "ERROR 100 Not authenticated\n");
+		return;
+	}
 
-	mdm_debug ("Handling user message: '%s'", msg);
+	handle_flexi_server (conn, TYPE_FLEXI, mdm_daemon_config_get_value_string (MDM_KEY_STANDARD_XSERVER), TRUE, NULL);
+}
 
-	if (mdm_connection_get_message_count (conn) > MDM_SUP_MAX_MESSAGES) {
-		mdm_debug ("Closing connection, %d messages reached", MDM_SUP_MAX_MESSAGES);
-		mdm_connection_write (conn, "ERROR 200 Too many messages\n");
-		mdm_connection_close (conn);
+static void
+sup_handle_update_config (MdmConnection *conn,
+			  const char    *msg,
+			  gpointer       data)
+{
+	const char *key;
+
+	key = &msg[strlen (MDM_SUP_UPDATE_CONFIG " ")];
+
+	if (! mdm_daemon_config_update_key ((gchar *)key))
+		mdm_connection_printf (conn, "ERROR 50 Unsupported key <%s>\n", key);
+	else
+		mdm_connection_write (conn, "OK\n");
+}
+
+static void
+sup_handle_get_config_file (MdmConnection *conn,
+			    const char    *msg,
+			    gpointer       data)
+{
+	/*
+	 * Value is only non-null if passed in on command line.
+	 * Otherwise print compiled-in default file location.
+	 */
+	if (config_file == NULL) {
+		mdm_connection_printf (conn, "OK %s\n",
+				       MDM_DEFAULTS_CONF);
+	} else {
+		mdm_connection_printf (conn, "OK %s\n", config_file);
+	}
+}
+
+static void
+sup_handle_version (MdmConnection *conn,
+		    const char    *msg,
+		    gpointer       data)
+{
+	mdm_connection_write (conn, "MDM " VERSION "\n");
+}
+
+static void
+sup_handle_close (MdmConnection *conn,
+		  const char    *msg,
+		  gpointer       data)
+{
+	mdm_connection_close (conn);
+}
+
+enum {
+	SUP_ARG_NONE,     /* the command alone */
+	SUP_ARG_REQUIRED, /* "COMMAND <args>" */
+	SUP_ARG_OPTIONAL  /* either */
+};
+
+typedef struct {
+	const char *opcode;
+	int         args;
+	void     (* func) (MdmConnection *conn,
+			   const char    *msg,
+			   gpointer       data);
+
+	/* time spent in func */
+	MdmStatsHistogram handled;
+} SupHandler;
+
+/* messages that were not understood */
+static gulong unknown_user_messages = 0;
+
+/* Authenticated for a display, or root */
+static gboolean
+conn_is_privileged (MdmConnection *conn)
+{
+	uid_t uid;
+	pid_t pid;
+
+	if (MDM_CONN_AUTHENTICATED (conn))
+		return TRUE;
+
+	return mdm_connection_get_peer_cred (conn, &uid, &pid) && uid == 0;
+}
+
+static void
+sup_handle_trace_dump (MdmConnection *conn,
+		       const char    *msg,
+		       gpointer       data)
+{
+	GSList *li;
+
+	/* it makes every process of every display write to disk */
+	if ( ! conn_is_privileged (conn)) {
+		mdm_info ("%s request denied: Not authenticated", "TRACE_DUMP");
+		mdm_connection_write (conn, "ERROR 100 Not authenticated\n");
 		return;
 	}
 
-	if (strncmp (msg, MDM_SUP_AUTH_LOCAL " ",
-		     strlen (MDM_SUP_AUTH_LOCAL " ")) == 0) {
+	if ( ! mdm_trace_enabled ()) {
+		mdm_connection_write (conn, "ERROR 1 Tracing is off\n");
+		return;
+	}
 
-		sup_handle_auth_local (conn, msg, data);
+	mdm_trace_dump ();
+	/* the slaves dump theirs when they get to it */
+	for (li = mdm_display_get_list (); li != NULL; li = li->next)
+		send_slave_command (li->data, MDM_NOTIFY_TRACE_DUMP);
 
-	} else if (strcmp (msg, MDM_SUP_FLEXI_XSERVER) == 0) {
-		/* Only allow locally authenticated connections */
-		if ( ! MDM_CONN_AUTHENTICATED (conn)) {
-			mdm_info ("%s request denied: Not authenticated", "FLEXI_XSERVER");
-			mdm_connection_write (conn, "ERROR 100 Not authenticated\n");
-			return;
+	mdm_connection_write (conn, "OK\n");
+}
+
+static void sup_handle_stats (MdmConnection *conn,
+			      const char    *msg,
+			      gpointer       data);
+
+/* The handlers get the whole message */
+static SupHandler sup_handlers[] = {
+	{ MDM_SUP_AUTH_LOCAL,             SUP_ARG_REQUIRED, sup_handle_auth_local },
+	{ MDM_SUP_FLEXI_XSERVER,          SUP_ARG_NONE,     sup_handle_flexi_xserver },
+	{ MDM_SUP_ATTACHED_SERVERS,       SUP_ARG_OPTIONAL, sup_handle_attached_servers },
+	{ MDM_SUP_GREETERPIDS,            SUP_ARG_NONE,     sup_handle_greeterpids },
+	{ MDM_SUP_UPDATE_CONFIG,          SUP_ARG_REQUIRED, sup_handle_update_config },
+	{ MDM_SUP_GET_CONFIG,             SUP_ARG_REQUIRED, sup_handle_get_config },
+	{ MDM_SUP_GET_CONFIG_MULTI,       SUP_ARG_REQUIRED, sup_handle_get_config_multi },
+	{ MDM_SUP_GET_CONFIG_FILE,        SUP_ARG_NONE,     sup_handle_get_config_file },
+	{ MDM_SUP_GET_CUSTOM_CONFIG_FILE, SUP_ARG_NONE,     sup_handle_get_custom_config_file },
+	{ MDM_SUP_QUERY_LOGOUT_ACTION,    SUP_ARG_NONE,     sup_handle_query_logout_action },
+	{ MDM_SUP_SET_LOGOUT_ACTION,      SUP_ARG_REQUIRED, sup_handle_set_logout_action },
+	{ MDM_SUP_SET_SAFE_LOGOUT_ACTION, SUP_ARG_REQUIRED, sup_handle_set_safe_logout_action },
+	{ MDM_SUP_QUERY_VT,               SUP_ARG_NONE,     sup_handle_query_vt },
+	{ MDM_SUP_SET_VT,                 SUP_ARG_REQUIRED, sup_handle_set_vt },
+	{ MDM_SUP_VERSION,                SUP_ARG_NONE,     sup_handle_version },
+	{ MDM_SUP_CLOSE,                  SUP_ARG_NONE,     sup_handle_close },
+	{ MDM_SUP_STATS,                  SUP_ARG_NONE,     sup_handle_stats },
+	{ MDM_SUP_TRACE_DUMP,             SUP_ARG_NONE,     sup_handle_trace_dump },
+};
+
+/*
+ * Everything is counted all the time, the answer is one line of
+ * "<name>=<value>" items separated by semicolons, see mdm-stats.h for
+ * how the histograms look.  The per-display times tell when users log
+ * in and how long their PAM modules take, they are left out for
+ * anybody but root and authenticated connections.
+ */
+static void
+sup_handle_stats (MdmConnection *conn,
+		  const char    *msg,
+		  gpointer       data)
+{
+	GString *str;
+	gulong accepted, evicted, queued, flushed;
+	guint i;
+
+	str = g_string_new ("OK ");
+
+	mdm_connection_get_accept_stats (&accepted, &evicted);
+	mdm_connection_get_output_stats (&queued, &flushed);
+	mdm_stats_append_counter (str, "connections.accepted", accepted);
+	mdm_stats_append_counter (str, "connections.evicted", evicted);
+	mdm_stats_append_counter (str, "output.queued", queued);
+	mdm_stats_append_counter (str, "output.flushed", flushed);
+	mdm_stats_append_counter (str, "user.unknown", unknown_user_messages);
+
+	for (i = 0; i < G_N_ELEMENTS (sup_handlers); i++) {
+		char *name;
+
+		if (sup_handlers[i].handled.count == 0)
+			continue;
+
+		name = g_strconcat ("user.", sup_handlers[i].opcode, NULL);
+		mdm_stats_append_histogram (str, name, &sup_handlers[i].handled);
+		g_free (name);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (sop_handlers); i++) {
+		char *name;
+
+		if (sop_handlers[i].handled.count > 0) {
+			name = g_strconcat ("slave.", sop_handlers[i].opcode, NULL);
+			mdm_stats_append_histogram (str, name, &sop_handlers[i].handled);
+			g_free (name);
 		}
 
-		handle_flexi_server (conn, TYPE_FLEXI, mdm_daemon_config_get_value_string (MDM_KEY_STANDARD_XSERVER), TRUE, NULL);
+		if (sop_handlers[i].answered.count > 0) {
+			name = g_strconcat ("slave.", sop_handlers[i].opcode, ".ack", NULL);
+			mdm_stats_append_histogram (str, name, &sop_handlers[i].answered);
+			g_free (name);
+		}
+	}
+
+	if (conn_is_privileged (conn))
+		mdm_stats_append_display_times (str);
 
-	} else if ((strncmp (msg, MDM_SUP_ATTACHED_SERVERS,
-	                     strlen (MDM_SUP_ATTACHED_SERVERS)) == 0)) {
+	g_string_append_c (str, '\n');
+	mdm_connection_write (conn, str->str);
+	g_string_free (str, TRUE);
+}
 
-		sup_handle_attached_servers (conn, msg, data);
+/* Compares two DISPLAY values of local displays, only the display
+ * number counts */
+static gboolean
+same_display (const char *a, const char *b)
+{
+	const char *ac = strrchr (a, ':');
+	const char *bc = strrchr (b, ':');
 
-	} else if (strcmp (msg, MDM_SUP_GREETERPIDS) == 0) {
+	if (ac == NULL || bc == NULL)
+		return FALSE;
 
-		sup_handle_greeterpids (conn, msg, data);
+	return strspn (ac + 1, "0123456789") > 0 &&
+		atoi (ac + 1) == atoi (bc + 1) &&
+		strspn (bc + 1, "0123456789") > 0;
+}
 
-	} else if (strncmp (msg, MDM_SUP_UPDATE_CONFIG " ",
-			    strlen (MDM_SUP_UPDATE_CONFIG " ")) == 0) {
-		const char *key;
+/* The DISPLAY in the environment of a process, or NULL */
+static char *
+get_process_display (pid_t pid)
+{
+	GString *env;
+	char    *path, *ret = NULL;
+	char     buf[4096];
+	gsize    pos;
+	int      fd;
+
+	path = g_strdup_printf ("/proc/%d/environ", (int) pid);
+	VE_IGNORE_EINTR (fd = open (path, O_RDONLY | O_NOCTTY));
+	g_free (path);
+	if (fd < 0)
+		return NULL;
+
+	env = g_string_new (NULL);
+	for (;;) {
+		ssize_t n;
 
-		key = &msg[strlen (MDM_SUP_UPDATE_CONFIG " ")];
+		VE_IGNORE_EINTR (n = read (fd, buf, sizeof (buf)));
+		if (n <= 0 || env->len + n > 256 * 1024)
+			break;
+		g_string_append_len (env, buf, n);
+	}
+	VE_IGNORE_EINTR (close (fd));
 
-		if (! mdm_daemon_config_update_key ((gchar *)key))
-			mdm_connection_printf (conn, "ERROR 50 Unsupported key <%s>\n", key);
-		else
-			mdm_connection_write (conn, "OK\n");
-	} else if (strncmp (msg, MDM_SUP_GET_CONFIG " ",
-			    strlen (MDM_SUP_GET_CONFIG " ")) == 0) {
+	for (pos = 0; pos < env->len; pos += strlen (env->str + pos) + 1) {
+		if (strncmp (env->str + pos, "DISPLAY=", strlen ("DISPLAY=")) == 0) {
+			ret = g_strdup (env->str + pos + strlen ("DISPLAY="));
+			break;
+		}
+	}
+	g_string_free (env, TRUE);
+
+	return ret;
+}
 
-		sup_handle_get_config (conn, msg, data);
+/* Only looked up when a client needs it, and then once per login, the
+ * passwd lookup can block on the network */
+static uid_t
+display_login_uid (MdmDisplay *disp)
+{
+	struct passwd *pwent = NULL;
 
-	} else if (strcmp (msg, MDM_SUP_GET_CONFIG_FILE) == 0) {
-		/*
-		 * Value is only non-null if passed in on command line.
-		 * Otherwise print compiled-in default file location.
-		 */
-		if (config_file == NULL) {
-			mdm_connection_printf (conn, "OK %s\n",
-					       MDM_DEFAULTS_CONF);
-		} else {
-			mdm_connection_printf (conn, "OK %s\n", config_file);
+	if ( ! disp->login_uid_known) {
+		if ( ! ve_string_empty (disp->login))
+			pwent = getpwnam (disp->login);
+		disp->login_uid = pwent != NULL ? pwent->pw_uid : (uid_t) -1;
+		disp->login_uid_known = TRUE;
+	}
+
+	return disp->login_uid;
+}
+
+/*
+ * The attached display the user of a local client is logged in on.
+ * If that is more than one, the DISPLAY the client runs with says
+ * which, it can only pick among the user's own displays that way.
+ */
+static MdmDisplay *
+display_for_peer (uid_t uid, pid_t pid)
+{
+	GSList     *li;
+	MdmDisplay *found = NULL;
+	char       *display;
+	int         n_found = 0;
+
+	for (li = mdm_display_get_list (); li != NULL; li = li->next) {
+		MdmDisplay *disp = li->data;
+
+		if (disp->attached && disp->logged_in &&
+		    display_login_uid (disp) == uid) {
+			found = disp;
+			n_found++;
 		}
-	} else if (strcmp (msg, MDM_SUP_GET_CUSTOM_CONFIG_FILE) == 0) {
+	}
+
+	if (n_found <= 1)
+		return found;
 
-		sup_handle_get_custom_config_file (conn, msg, data);
+	display = get_process_display (pid);
+	found = NULL;
+	if (display != NULL) {
+		for (li = mdm_display_get_list (); li != NULL; li = li->next) {
+			MdmDisplay *disp = li->data;
 
-	} else if (strcmp (msg, MDM_SUP_QUERY_LOGOUT_ACTION) == 0) {
+			if (disp->attached && disp->logged_in &&
+			    display_login_uid (disp) == uid &&
+			    same_display (disp->name, display)) {
+				found = disp;
+				break;
+			}
+		}
+	}
+	g_free (display);
 
-		sup_handle_query_logout_action (conn, msg, data);
+	return found;
+}
 
-	} else if (strncmp (msg, MDM_SUP_SET_LOGOUT_ACTION " ",
-			    strlen (MDM_SUP_SET_LOGOUT_ACTION " ")) == 0) {
+/*
+ * Authenticates a connection from a user logged in on an attached
+ * display for that display, the same as AUTH_LOCAL with its cookie
+ * would, so the client can send FLEXI_XSERVER and friends right away.
+ */
+static void
+authenticate_peer (MdmConnection *conn)
+{
+	MdmDisplay *disp;
+	uid_t uid;
+	pid_t pid;
 
-		sup_handle_set_logout_action (conn, msg, data);
+	if ( ! mdm_daemon_config_get_value_bool (MDM_KEY_PEER_CREDENTIAL_AUTH) ||
+	    ! mdm_connection_get_peer_cred (conn, &uid, &pid))
+		return;
 
-	} else if (strncmp (msg, MDM_SUP_SET_SAFE_LOGOUT_ACTION " ",
-			    strlen (MDM_SUP_SET_SAFE_LOGOUT_ACTION " ")) == 0) {
+	disp = display_for_peer (uid, pid);
+	if (disp == NULL)
+		return;
 
-		sup_handle_set_safe_logout_action (conn, msg, data);
+	mdm_debug ("Connection from uid %d pid %d authenticated for %s",
+		   (int) uid, (int) pid, disp->name);
+	MDM_CONNECTION_SET_USER_FLAG (conn, MDM_SUP_FLAG_AUTHENTICATED);
+	mdm_connection_set_display (conn, disp);
+}
 
-	} else if (strcmp (msg, MDM_SUP_QUERY_VT) == 0) {
+static void
+mdm_handle_user_message (MdmConnection *conn,
+			 const char    *msg,
+			 gpointer       data)
+{
+	static gboolean sorted = FALSE;
+	SupHandler *handler;
+	const char *args;
+	gsize len;
+	int max_messages;
 
-		sup_handle_query_vt (conn, msg, data);
+	mdm_debug ("Handling user message: '%s'", msg);
 
-	} else if (strncmp (msg, MDM_SUP_SET_VT " ",
-			    strlen (MDM_SUP_SET_VT " ")) == 0) {
+	if (mdm_connection_get_message_count (conn) == 1)
+		authenticate_peer (conn);
 
-		sup_handle_set_vt (conn, msg, data);	
-	} else if (strcmp (msg, MDM_SUP_VERSION) == 0) {
-		mdm_connection_write (conn, "MDM " VERSION "\n");
-	} else if (strcmp (msg, MDM_SUP_CLOSE) == 0) {
+	max_messages = MDM_CONN_AUTHENTICATED (conn) ? MDM_SUP_MAX_MESSAGES_AUTHENTICATED
+						     : MDM_SUP_MAX_MESSAGES;
+	if (mdm_connection_get_message_count (conn) > max_messages) {
+		mdm_debug ("Closing connection, %d messages reached", max_messages);
+		mdm_connection_write (conn, "ERROR 200 Too many messages\n");
 		mdm_connection_close (conn);
+		return;
+	}
+
+	if G_UNLIKELY ( ! sorted) {
+		mdm_dispatch_sort (sup_handlers, G_N_ELEMENTS (sup_handlers),
+				   sizeof (SupHandler));
+		sorted = TRUE;
+	}
+
+	len = mdm_dispatch_split (msg, &args);
+	handler = mdm_dispatch_lookup (sup_handlers,
+				       G_N_ELEMENTS (sup_handlers),
+				       sizeof (SupHandler),
+				       msg, len);
+
+	if (handler != NULL &&
+	    ! (handler->args == SUP_ARG_NONE && args != NULL) &&
+	    ! (handler->args == SUP_ARG_REQUIRED && args == NULL)) {
+		gint64 start = g_get_monotonic_time ();
+
+		handler->func (conn, msg, data);
+		mdm_stats_histogram_add (&handler->handled,
+					 g_get_monotonic_time () - start);
+		mdm_daemon_config_release_superseded ();
 	} else {
+		unknown_user_messages++;
 		mdm_connection_write (conn, "ERROR 0 Not implemented\n");
 		mdm_connection_close (conn);
 	}
@@ -21,6 +21,9 @@
 #ifndef MDM_H
 #define MDM_H
 
+#include <sys/types.h>
+#include <glib.h>
+
 #define MDM_MAX_PASS 256	/* Define a value for password length. Glibc
 				 * leaves MAX_PASS undefined. */
 
@@ -57,6 +60,16 @@ enum {
 /* If id == NULL, then get the first X server */
 void		mdm_final_cleanup	(void);
 
+void		mdm_child_action	(pid_t pid,
+					 int exitstatus,
+					 gpointer data);
+
+/* Handler for the daemon end of a slave's channel, data is the display */
+struct _MdmConnection;
+void		mdm_handle_slave_request (struct _MdmConnection *conn,
+					  const char *msg,
+					  gpointer data);
+
 #endif /* MDM_H */
 
 /* EOF */
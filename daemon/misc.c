@@ -212,22 +212,14 @@ mdm_get_free_display (int start, uid_t server_uid)
          */
 	for (i = start; i < 3000; i++) {
 		FILE *fp;
-		GSList *li;
-		GSList *displays;
+		MdmDisplay *dsp;
 		struct stat s;
 		char buf[256];
 		int r;
 		gboolean try_ipv4 = TRUE;
 
-                displays = mdm_daemon_config_get_display_list ();
-
-		for (li = displays; li != NULL; li = li->next) {
-			MdmDisplay *dsp = li->data;
-			if (SERVER_IS_LOCAL (dsp) &&
-			    dsp->dispnum == i)
-				break;
-		}
-		if (li != NULL) {
+		dsp = mdm_display_lookup_number (i);
+		if (dsp != NULL && SERVER_IS_LOCAL (dsp)) {
 			/* found one */
 			continue;
 		}
@@ -1007,50 +999,6 @@ mdm_test_opt (const char *cmd, const char *help, const char *option)
 	return got_it;
 }
 
-int
-mdm_fdgetc (int fd)
-{
-	unsigned char buf[1];
-	int bytes;
-
-	/*
-	 * Must used an unsigned char buffer here because the GUI sends
-	 * username/password data as utf8 and the daemon will interpret
-	 * any character sent with its high bit set as EOF unless we 
-	 * used unsigned here.
-	 */
-	VE_IGNORE_EINTR (bytes = read (fd, buf, 1));
-	if (bytes != 1)
-		return EOF;
-	else
-		return (int)buf[0];
-}
-
-char *
-mdm_fdgets (int fd)
-{
-	int c;
-	int bytes = 0;
-	GString *gs = g_string_new (NULL);
-	for (;;) {
-		c = mdm_fdgetc (fd);
-		if (c == '\n')
-			return g_string_free (gs, FALSE);
-		/* on EOF */
-		if (c < 0) {
-			if (bytes == 0) {
-				g_string_free (gs, TRUE);
-				return NULL;
-			} else {
-				return g_string_free (gs, FALSE);
-			}
-		} else {
-			bytes++;
-			g_string_append_c (gs, c);
-		}
-	}
-}
-
 void
 mdm_close_all_descriptors (int from, int except, int except2)
 {
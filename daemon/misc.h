@@ -28,8 +28,6 @@
 void mdm_fail   (const gchar *format, ...) G_GNUC_PRINTF (1, 2);
 
 void mdm_fdprintf  (int fd, const gchar *format, ...) G_GNUC_PRINTF (2, 3);
-int mdm_fdgetc     (int fd);
-char *mdm_fdgets   (int fd);
 
 /* clear environment, but keep the i18n ones (LANG, LC_ALL, etc...),
  * note that this leak memory so only use before exec */
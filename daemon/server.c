@@ -52,6 +52,7 @@
 
 #include "mdm-common.h"
 #include "mdm-log.h"
+#include "mdm-trace.h"
 #include "mdm-daemon-config.h"
 
 #include "mdm-socket-protocol.h"
@@ -560,7 +561,9 @@ mdm_server_start (MdmDisplay *disp,
     g_free (vtarg);
 
     /* we can now use d->handled since that's set up above */
+    mdm_trace_begin ("do_server_wait");
     do_server_wait (d);
+    mdm_trace_end ("do_server_wait");
 
     /* If we were holding a vt open for the server, close it now as it has
      * already taken the bait. */
@@ -45,6 +45,7 @@
 #include <netinet/in.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
@@ -80,6 +81,12 @@
 #include <grp.h>
 #include <errno.h>
 #include <time.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
 
 #ifdef HAVE_SELINUX
 #include <selinux/selinux.h>
@@ -105,9 +112,19 @@
 #include "mdm-common.h"
 #include "mdm-log.h"
 #include "mdm-daemon-config.h"
+#include "mdm-child-watch.h"
+#include "mdm-fd-reader.h"
+#include "mdm-face-cache.h"
+#include "mdm-face-thumb.h"
+#include "mdm-per-display-config.h"
+#include "mdm-trace.h"
 
 #include "mdm-socket-protocol.h"
 
+#if defined (HAVE_SYS_EPOLL_H) && defined (HAVE_SYS_TIMERFD_H)
+#define SLAVE_EPOLL 1
+#endif
+
 #ifdef WITH_CONSOLE_KIT
 #include "mdmconsolekit.h"
 #endif
@@ -145,18 +162,25 @@ static gboolean always_restart_greeter = FALSE; /* Always restart greeter when
 static gboolean mdm_wait_for_ack       = TRUE;  /* Wait for ack on all messages
                                                    to the daemon */
 static int in_session_stop             = 0;
-static int in_usr2_signal              = 0;
+static guint slave_request_id          = 0;     /* of the last request sent
+						   to the daemon */
 static gboolean need_to_quit_after_session_stop = FALSE;
 static int exit_code_to_use            = DISPLAY_REMANAGE;
 static gboolean session_started        = FALSE;
 static gboolean greeter_disabled       = FALSE;
 static gboolean greeter_no_focus       = FALSE;
+static gint64 greeter_prompt_usec      = 0;     /* spent waiting for the
+						   user to answer prompts */
+static gboolean trace_dump_pending     = FALSE; /* asked for in a signal */
 
 static uid_t logged_in_uid             = -1;
 static gid_t logged_in_gid             = -1;
 
 static int greeter_fd_out              = -1;
 static int greeter_fd_in               = -1;
+static MdmFdReader greeter_reader      = { -1, 0, 0 }; /* on greeter_fd_in */
+static int greeter_face_fd             = -1;    /* socket the pictures
+						   are passed over */
 
 static gboolean interrupted            = FALSE;
 static gchar *ParsedAutomaticLogin     = NULL;
@@ -171,10 +195,13 @@ static int slave_waitpid_r             = -1;
 static int slave_waitpid_w             = -1;
 static GSList *slave_waitpids          = NULL;
 
-extern gboolean mdm_first_login;
+#ifdef SLAVE_EPOLL
+static int slave_epoll_fd              = -1;
+static int slave_child_fd              = -1;
+static int slave_touch_fd              = -1;
+#endif
 
-/* The slavepipe, this is the write end */
-extern int slave_fifo_pipe_fd;
+extern gboolean mdm_first_login;
 
 /* wait for a GO in the SOP protocol */
 extern gboolean mdm_wait_for_go;
@@ -207,6 +234,9 @@ static void   mdm_slave_handle_usr2_message (void);
 static void   mdm_slave_handle_notify (const char *msg);
 static void   check_notifies_now (void);
 static void   restart_the_greeter (void);
+static void   greeter_batch_drop (void);
+static void   flush_served_thumb_requests (void);
+static void   send_timing (const char *phase, gint64 start);
 
 gboolean mdm_is_user_valid (const char *username);
 
@@ -277,6 +307,9 @@ slave_waitpid_setpid (pid_t pid)
 		} else {
 			slave_waitpid_r = p[0];
 			slave_waitpid_w = p[1];
+			/* so that a wakeup can be drained in one go */
+			fcntl (slave_waitpid_r, F_SETFL,
+			       fcntl (slave_waitpid_r, F_GETFL) | O_NONBLOCK);
 		}
 	}
 
@@ -317,8 +350,8 @@ run_session_output (gboolean read_until_eof)
 		}
 	}
 
-	gboolean limit_output = mdm_daemon_config_get_value_bool (MDM_KEY_LIMIT_SESSION_OUTPUT);
-	gboolean filter_output = mdm_daemon_config_get_value_bool (MDM_KEY_FILTER_SESSION_OUTPUT);
+	gboolean limit_output = mdm_daemon_config_get_bool_for_id (MDM_ID_LIMIT_SESSION_OUTPUT);
+	gboolean filter_output = mdm_daemon_config_get_bool_for_id (MDM_ID_FILTER_SESSION_OUTPUT);
 
 	/* the fd is non-blocking */
 	for (;;) {
@@ -407,23 +440,35 @@ run_session_output (gboolean read_until_eof)
 /* Try to touch an authfb auth file every 12 hours.  That way if it's
  * in /tmp it doesn't get whacked by tmpwatch */
 #define TRY_TO_TOUCH_TIME (60*60*12)
+/* and if touching it failed try again after a minute */
+#define TRY_TO_TOUCH_RETRY 60
+
+/* Seconds until the authfb auth file wants touching, -1 if there is
+ * nothing to touch (no authfb or nobody logged in) */
+static int
+time_to_touch_fb_userauth (void)
+{
+	time_t ct;
+
+	if ( ! d->authfb || d->userauth == NULL || logged_in_uid < 0)
+		return -1;
+
+	ct = time (NULL);
+	if (d->last_auth_touch + TRY_TO_TOUCH_TIME <= ct)
+		return TRY_TO_TOUCH_RETRY;
+
+	return (d->last_auth_touch + TRY_TO_TOUCH_TIME) - ct;
+}
 
 static struct timeval *
 min_time_to_wait (struct timeval *tv)
 {
-	if (d->authfb) {
-		time_t ct = time (NULL);
-		time_t sec_to_wait;
+	int sec_to_wait = time_to_touch_fb_userauth ();
 
-		if (d->last_auth_touch + TRY_TO_TOUCH_TIME + 5 <= ct)
-			sec_to_wait = 5;
-		else
-			sec_to_wait = (d->last_auth_touch + TRY_TO_TOUCH_TIME) - ct;
+	if (sec_to_wait >= 0 &&
+	    (TIME_UNSET_P (tv) || sec_to_wait < tv->tv_sec))
+		tv->tv_sec = sec_to_wait;
 
-		if (TIME_UNSET_P (tv) ||
-		    sec_to_wait < tv->tv_sec)
-			tv->tv_sec = sec_to_wait;
-	}
 	if (TIME_UNSET_P (tv))
 		return NULL;    
 	else 
@@ -474,6 +519,183 @@ try_to_touch_fb_userauth (void)
 	}
 }
 
+#ifdef SLAVE_EPOLL
+/* What woke slave_waitpid_epoll up */
+enum {
+	WAIT_WAKEUP,
+	WAIT_CHILD,
+	WAIT_NOTIFY,
+	WAIT_SESSION_OUTPUT,
+	WAIT_TOUCH
+};
+
+static void
+slave_epoll_watch (int fd, guint32 what, guint32 flags)
+{
+	struct epoll_event ev;
+
+	memset (&ev, 0, sizeof (ev));
+	ev.events = EPOLLIN | flags;
+	ev.data.u32 = what;
+
+	if (epoll_ctl (slave_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 &&
+	    errno == EEXIST)
+		epoll_ctl (slave_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static void
+slave_epoll_close (void)
+{
+	if (slave_epoll_fd >= 0)
+		VE_IGNORE_EINTR (close (slave_epoll_fd));
+	slave_epoll_fd = -1;
+
+	if (slave_child_fd >= 0)
+		VE_IGNORE_EINTR (close (slave_child_fd));
+	slave_child_fd = -1;
+}
+
+static void
+arm_touch_timer (void)
+{
+	struct itimerspec its;
+	int sec_to_wait;
+
+	memset (&its, 0, sizeof (its));
+
+	/* zero disarms it */
+	sec_to_wait = time_to_touch_fb_userauth ();
+	if (sec_to_wait > 0)
+		its.it_value.tv_sec = sec_to_wait;
+
+	timerfd_settime (slave_touch_fd, 0, &its, NULL);
+}
+
+/*
+ * Sleeps until wp exits without waking up for anything else than
+ * something to do: the child exiting (its pidfd, or the SIGCHLD handler
+ * poking the waitpid pipe), a notification from the daemon, session
+ * output and the authfb touch timer.  Returns FALSE if the descriptors
+ * could not be set up, the caller then falls back to select.
+ */
+static gboolean
+slave_waitpid_epoll (MdmWaitPid *wp)
+{
+	struct epoll_event events[8];
+	int session_fd = -1;
+
+	/* left behind if a signal jumped out of a previous wait */
+	slave_epoll_close ();
+
+	slave_epoll_fd = epoll_create (G_N_ELEMENTS (events));
+	if G_UNLIKELY (slave_epoll_fd < 0)
+		return FALSE;
+	fcntl (slave_epoll_fd, F_SETFD, FD_CLOEXEC);
+
+	slave_child_fd = mdm_child_watch_open_pidfd (wp->pid);
+
+	/* without either we could sleep through the child exiting */
+	if G_UNLIKELY (slave_child_fd < 0 && slave_waitpid_r < 0) {
+		slave_epoll_close ();
+		return FALSE;
+	}
+
+	if (slave_child_fd >= 0)
+		slave_epoll_watch (slave_child_fd, WAIT_CHILD, 0);
+	if (slave_waitpid_r >= 0)
+		slave_epoll_watch (slave_waitpid_r, WAIT_WAKEUP, 0);
+	if (d->slave_notify_fd >= 0)
+		slave_epoll_watch (d->slave_notify_fd, WAIT_NOTIFY, 0);
+
+	if (slave_touch_fd < 0)
+		slave_touch_fd = timerfd_create (CLOCK_MONOTONIC,
+						 TFD_NONBLOCK | TFD_CLOEXEC);
+	if (slave_touch_fd >= 0)
+		slave_epoll_watch (slave_touch_fd, WAIT_TOUCH, 0);
+
+	while (wp->pid > 1) {
+		int n, i;
+
+		/* the session output pipe comes and goes, and it is one
+		 * shot so that nothing fires once it is closed */
+		if (d->session_output_fd >= 0 &&
+		    d->session_output_fd != session_fd) {
+			session_fd = d->session_output_fd;
+			slave_epoll_watch (session_fd, WAIT_SESSION_OUTPUT, EPOLLONESHOT);
+		}
+
+		try_to_touch_fb_userauth ();
+		if (slave_touch_fd >= 0)
+			arm_touch_timer ();
+
+		/* EINTR just means a handler already did the work */
+		n = epoll_wait (slave_epoll_fd, events, G_N_ELEMENTS (events), -1);
+
+		for (i = 0; i < n; i++) {
+			char buf[64];
+			guint64 expirations;
+
+			switch (events[i].data.u32) {
+			case WAIT_WAKEUP:
+				while (read (slave_waitpid_r, buf, sizeof (buf)) > 0)
+					;
+				break;
+
+			case WAIT_CHILD:
+				/* normally the SIGCHLD handler got there first */
+				if (wp->pid > 1) {
+					mdm_sigchld_block_push ();
+					mdm_slave_child_handler (SIGCHLD);
+					mdm_sigchld_block_pop ();
+				}
+				/* it would not reap now, so wait for the pipe */
+				if (wp->pid > 1)
+					epoll_ctl (slave_epoll_fd, EPOLL_CTL_DEL,
+						   slave_child_fd, NULL);
+				break;
+
+			case WAIT_NOTIFY:
+				/* usually SIGUSR2 already read it */
+				if (events[i].events & EPOLLIN) {
+					mdm_sigusr2_block_push ();
+					mdm_slave_usr2_handler (SIGUSR2);
+					mdm_sigusr2_block_pop ();
+				}
+				/* the daemon went away, SIGTERM is on its way */
+				if (events[i].events & (EPOLLHUP | EPOLLERR))
+					epoll_ctl (slave_epoll_fd, EPOLL_CTL_DEL,
+						   d->slave_notify_fd, NULL);
+				break;
+
+			case WAIT_SESSION_OUTPUT:
+				if (d->session_output_fd >= 0)
+					run_session_output (FALSE /* read_until_eof */);
+				if (d->session_output_fd >= 0 &&
+				    d->session_output_fd == session_fd)
+					slave_epoll_watch (session_fd, WAIT_SESSION_OUTPUT,
+							   EPOLLONESHOT);
+				else
+					session_fd = -1;
+				break;
+
+			case WAIT_TOUCH:
+				/* the touch itself happens at the top */
+				VE_IGNORE_EINTR (read (slave_touch_fd, &expirations,
+						       sizeof (expirations)));
+				break;
+			}
+		}
+
+		check_notifies_now ();
+	}
+	check_notifies_now ();
+
+	slave_epoll_close ();
+
+	return TRUE;
+}
+#endif /* SLAVE_EPOLL */
+
 /* must call slave_waitpid_setpid before calling this */
 static void
 slave_waitpid (MdmWaitPid *wp)
@@ -483,6 +705,11 @@ slave_waitpid (MdmWaitPid *wp)
 
 	mdm_debug ("slave_waitpid: waiting on %d", (int)wp->pid);
 
+#ifdef SLAVE_EPOLL
+	if G_LIKELY (slave_waitpid_epoll (wp)) {
+		/* done */
+	} else
+#endif
 	if G_UNLIKELY (slave_waitpid_r < 0) {
 		mdm_error ("slave_waitpid: no pipe, trying to wing it");
 
@@ -593,6 +820,10 @@ check_notifies_now (void)
 		restart_the_greeter ();
 	}
 
+	/* values replaced since the last time, by notifies or by the
+	 * slave itself, nobody looks at those any more */
+	mdm_daemon_config_release_superseded ();
+
 	while (unhandled_notifies != NULL) {
 		mdm_sigusr2_block_push ();
 		list = unhandled_notifies;
@@ -615,6 +846,11 @@ check_notifies_now (void)
 		do_restart_greeter = FALSE;
 		restart_the_greeter ();
 	}
+
+	if G_UNLIKELY (trace_dump_pending) {
+		trace_dump_pending = FALSE;
+		mdm_trace_dump ();
+	}
 }
 
 static void
@@ -666,6 +902,13 @@ whack_greeter_fds (void)
 	if (greeter_fd_in > 0)
 		VE_IGNORE_EINTR (close (greeter_fd_in));
 	greeter_fd_in = -1;
+	if (greeter_face_fd > 0)
+		VE_IGNORE_EINTR (close (greeter_face_fd));
+	greeter_face_fd = -1;
+	/* whatever the old greeter left unread goes with it, and so
+	 * does what it was never sent */
+	mdm_fd_reader_init (&greeter_reader, -1);
+	greeter_batch_drop ();
 }
 
 static void
@@ -796,6 +1039,10 @@ mdm_slave_start (MdmDisplay *display)
 	 */
 	d = display;
 
+	/* what the daemon recorded before the fork is its to dump */
+	mdm_trace_init (mdm_daemon_config_get_value_string (MDM_KEY_TRACE_FILE),
+			"mdm slave", d->name);
+
 	mdm_normal_runlevel = get_runlevel ();
 
 	/* Ignore SIGUSR1/SIGPIPE, and especially ignore it
@@ -1106,6 +1353,9 @@ mdm_slave_whack_greeter (void)
 
 	greet = FALSE;
 
+	/* whatever pictures it showed that the cache did not have */
+	flush_served_thumb_requests ();
+
 	wp = slave_waitpid_setpid (d->greetpid);
 	mdm_sigchld_block_pop ();
 
@@ -1324,6 +1574,9 @@ mdm_slave_run (MdmDisplay *display)
 	 * exist */
 	if (SERVER_IS_LOCAL (d) &&
 	    d->servpid <= 0) {
+		gint64 start = g_get_monotonic_time ();
+
+		mdm_trace_begin ("mdm_server_start");
 		if G_UNLIKELY ( ! mdm_server_start (d,
 						    TRUE /* try_again_if_busy */,
 						    FALSE /* treat_as_flexi */,
@@ -1349,6 +1602,8 @@ mdm_slave_run (MdmDisplay *display)
 			}
 			mdm_slave_quick_exit (DISPLAY_ABORT);
 		}
+		mdm_trace_end ("mdm_server_start");
+		send_timing (MDM_TIMING_XSERVER, start);
 		mdm_slave_send_num (MDM_SOP_XPID, d->servpid);
 
 		check_notifies_now ();
@@ -1562,11 +1817,13 @@ mdm_slave_run (MdmDisplay *display)
 		}
 
 		if (greet) {
+			mdm_slave_greeter_batch_begin ();
 			greeter_no_focus = FALSE;
 			mdm_slave_greeter_ctl_no_ret (MDM_FOCUS, "");
 			greeter_disabled = FALSE;
 			mdm_slave_greeter_ctl_no_ret (MDM_ENABLE, "");
 			mdm_slave_greeter_ctl_no_ret (MDM_RESETOK, "");
+			mdm_slave_greeter_batch_end ();
 		}
 		/* Note that greet is only true if the above was no 'login',
 		 * so no need to reinit the server nor rebake cookies
@@ -1669,7 +1926,7 @@ run_config (MdmDisplay *display, struct passwd *pwent)
 		/* Debian changes */
 #if 0
 		/* upstream version */
-		mdm_close_all_descriptors (0 /* from */, slave_fifo_pipe_fd /* except */, d->slave_notify_fd /* except2 */);
+		mdm_close_all_descriptors (0 /* from */, -1 /* except */, d->slave_notify_fd /* except2 */);
 
 		/* No error checking here - if it's messed the best response
 		 * is to ignore & try to continue */
@@ -1680,7 +1937,7 @@ run_config (MdmDisplay *display, struct passwd *pwent)
 		/* Leave stderr open to the log */
 		VE_IGNORE_EINTR (close (0));
 		VE_IGNORE_EINTR (close (1));
-		mdm_close_all_descriptors (3 /* from */, slave_fifo_pipe_fd /* except */, d->slave_notify_fd /* except2 */);
+		mdm_close_all_descriptors (3 /* from */, -1 /* except */, d->slave_notify_fd /* except2 */);
 
 		/* No error checking here - if it's messed the best response
 		 * is to ignore & try to continue */
@@ -1771,6 +2028,7 @@ restart_the_greeter (void)
 		mdm_slave_greeter_ctl_no_ret (MDM_SAVEDIE, "");
 
 		greet = FALSE;
+		flush_served_thumb_requests ();
 
 		wp = slave_waitpid_setpid (d->greetpid);
 
@@ -1786,11 +2044,13 @@ restart_the_greeter (void)
 	}
 	mdm_slave_greeter ();
 
+	mdm_slave_greeter_batch_begin ();
 	if (greeter_disabled)
 		mdm_slave_greeter_ctl_no_ret (MDM_DISABLE, "");
 
 	if (greeter_no_focus)
 		mdm_slave_greeter_ctl_no_ret (MDM_NOFOCUS, "");
+	mdm_slave_greeter_batch_end ();
 
 	mdm_slave_sensitize_config ();
 }
@@ -1819,6 +2079,7 @@ mdm_slave_wait_for_login (void)
 {
 	const char *successsound;
 	char *username;
+	gint64 start, prompted;
 	g_free (login_user);
 	login_user = NULL;
 
@@ -1845,11 +2106,20 @@ mdm_slave_wait_for_login (void)
 		mdm_debug ("mdm_slave_wait_for_login: In loop");
 		username = d->preset_user;
 		d->preset_user = NULL;
+		start = g_get_monotonic_time ();
+		prompted = greeter_prompt_usec;
+		mdm_trace_begin ("mdm_verify_user");
 		login_user = mdm_verify_user (d /* the display */,
 					      username /* username */,
 					      TRUE /* allow retry */);
+		mdm_trace_end ("mdm_verify_user");
 		g_free (username);
 
+		/* what the user took to answer does not count */
+		if (login_user != NULL)
+			send_timing (MDM_TIMING_PAM,
+				     start + (greeter_prompt_usec - prompted));
+
 		mdm_debug ("mdm_slave_wait_for_login: end verify for '%s'",
 			   ve_sure_string (login_user));
 
@@ -1875,10 +2145,12 @@ mdm_slave_wait_for_login (void)
 			g_free (login_user);
 			login_user = NULL;
 			/* clear any error */
+			mdm_slave_greeter_batch_begin ();
 			mdm_slave_greeter_ctl_no_ret (MDM_ERRBOX, "");
 			mdm_slave_greeter_ctl_no_ret
 				(MDM_MSG,
 				 _("You must authenticate as root to run configuration."));
+			mdm_slave_greeter_batch_end ();
 
 			/* we always allow root for this */
 			oldAllowRoot = mdm_daemon_config_get_value_bool (MDM_KEY_ALLOW_ROOT);
@@ -1956,12 +2228,14 @@ mdm_slave_wait_for_login (void)
 
 			/* Disable the login screen, we don't want people to
 			 * log in in the meantime */
+			mdm_slave_greeter_batch_begin ();
 			mdm_slave_greeter_ctl_no_ret (MDM_DISABLE, "");
 			greeter_disabled = TRUE;
 
 			/* Make the login screen not focusable */
 			mdm_slave_greeter_ctl_no_ret (MDM_NOFOCUS, "");
 			greeter_no_focus = TRUE;
+			mdm_slave_greeter_batch_end ();
 
 			check_notifies_now ();
 			restart_greeter_now = TRUE;
@@ -1983,12 +2257,14 @@ mdm_slave_wait_for_login (void)
 				mdm_slave_quick_exit (DISPLAY_REMANAGE);
 			}
 
+			mdm_slave_greeter_batch_begin ();
 			greeter_no_focus = FALSE;
 			mdm_slave_greeter_ctl_no_ret (MDM_FOCUS, "");
 
 			greeter_disabled = FALSE;
 			mdm_slave_greeter_ctl_no_ret (MDM_ENABLE, "");
 			mdm_slave_greeter_ctl_no_ret (MDM_RESETOK, "");
+			mdm_slave_greeter_batch_end ();
 			continue;
 		}
 
@@ -2040,6 +2316,239 @@ mdm_slave_wait_for_login (void)
 
 }
 
+/* Sends one message over the picture socket, with the open file fd
+ * attached unless it is -1.  The terminating nul goes along so the
+ * greeter can tell an empty message from none.  FALSE if the greeter
+ * has no socket for that and has to get the bytes through the pipe */
+static gboolean
+send_face_message (const char *str, int fd)
+{
+	struct msghdr   msg;
+	struct iovec    iov;
+	struct cmsghdr *cmsg;
+	char            control[CMSG_SPACE (sizeof (int))];
+	ssize_t         n;
+
+	if (greeter_face_fd < 0)
+		return FALSE;
+
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = (char *) str;
+	iov.iov_len = strlen (str) + 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (fd >= 0) {
+		memset (control, 0, sizeof (control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof (control);
+
+		cmsg = CMSG_FIRSTHDR (&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+		memcpy (CMSG_DATA (cmsg), &fd, sizeof (int));
+	}
+
+	VE_IGNORE_EINTR (n = sendmsg (greeter_face_fd, &msg, 0));
+	if G_UNLIKELY (n != (ssize_t) iov.iov_len) {
+		mdm_debug ("send_face_message: cannot pass picture: %s", strerror (errno));
+		/* don't try again with this greeter */
+		VE_IGNORE_EINTR (close (greeter_face_fd));
+		greeter_face_fd = -1;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Scales the pictures the face cache did not have in the background,
+ * for the next greeter */
+static void
+update_face_cache (GSList *requests)
+{
+	pid_t pid;
+
+	if (requests == NULL)
+		return;
+
+	pid = mdm_fork_extra ();
+	if (pid == 0) {
+		mdm_log_shutdown ();
+		mdm_close_all_descriptors (0 /* from */, -1 /* except */, -1 /* except2 */);
+		mdm_open_dev_null (O_RDONLY); /* open stdin - fd 0 */
+		mdm_open_dev_null (O_RDWR);   /* open stdout - fd 1 */
+		mdm_open_dev_null (O_RDWR);   /* open stderr - fd 2 */
+		mdm_log_init ();
+
+		mdm_face_thumb_update (mdm_daemon_config_get_value_string (MDM_KEY_FACE_CACHE),
+				       requests,
+				       mdm_daemon_config_get_value_int (MDM_KEY_USER_MAX_FILE));
+		_exit (0);
+	} else if (pid < 0) {
+		mdm_debug ("update_face_cache: cannot fork: %s", strerror (errno));
+	}
+}
+
+/* Opens the user's picture as the user, never a fifo or a device and
+ * never more than UserMaxFile.  Returns -1 if there is none to be had.
+ * Comes back as root with the mdm group either way. */
+static int
+open_face_as_user (struct passwd *pwent, struct stat *s, char **picfile)
+{
+	int fd;
+
+	*picfile = NULL;
+
+	NEVER_FAILS_seteuid (0);
+	if G_UNLIKELY (setegid (pwent->pw_gid) != 0 ||
+		       seteuid (pwent->pw_uid) != 0) {
+		NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
+		return -1;
+	}
+
+	*picfile = mdm_common_get_facefile (pwent->pw_dir, pwent->pw_name, pwent->pw_uid);
+	if (*picfile == NULL) {
+		NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
+		return -1;
+	}
+
+	VE_IGNORE_EINTR (fd = open (*picfile, O_RDONLY | O_NOCTTY | O_NONBLOCK));
+	NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
+
+	if G_UNLIKELY (fd >= 0 &&
+		       (fstat (fd, s) < 0 || ! S_ISREG (s->st_mode) ||
+			s->st_size > mdm_daemon_config_get_value_int (MDM_KEY_USER_MAX_FILE))) {
+		VE_IGNORE_EINTR (close (fd));
+		fd = -1;
+	}
+
+	if (fd < 0) {
+		g_free (*picfile);
+		*picfile = NULL;
+	}
+
+	return fd;
+}
+
+/* The pictures the greeter asks for as rows scroll into view, see
+ * serve_face_request.  The ones the face cache misses are scaled for
+ * the next greeter a batch at a time. */
+#define FACE_THUMB_BATCH 64
+
+static MdmFaceCache *served_face_cache = NULL;
+static GSList *served_thumb_requests = NULL;
+static int n_served_thumb_requests = 0;
+
+static void
+flush_served_thumb_requests (void)
+{
+	update_face_cache (served_thumb_requests);
+	g_slist_foreach (served_thumb_requests, (GFunc) mdm_face_thumb_request_free, NULL);
+	g_slist_free (served_thumb_requests);
+	served_thumb_requests = NULL;
+	n_served_thumb_requests = 0;
+}
+
+/*
+ * Answers one picture request from a greeter that loads the user list
+ * in the background.  The request is the login, the answer is
+ * "<login>\t" if there is no picture, "<login>\tfd:<size>" or
+ * "<login>\tcache:<mtime>:<size>" with the open file attached to both,
+ * so a greeter whose copy of the cache is stale can still read it.
+ */
+static void
+serve_face_request (void)
+{
+	char           login[256];
+	char          *reply, *picfile;
+	const char    *cache_file;
+	struct passwd *pwent;
+	struct stat    s;
+	ssize_t        n;
+	int            fd;
+
+	VE_IGNORE_EINTR (n = recv (greeter_face_fd, login, sizeof (login) - 1, MSG_DONTWAIT));
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if G_UNLIKELY (n <= 0) {
+		/* the greeter is gone or does not want any more */
+		VE_IGNORE_EINTR (close (greeter_face_fd));
+		greeter_face_fd = -1;
+		return;
+	}
+	login[n] = '\0';
+
+	pwent = getpwnam (login);
+	fd = (pwent != NULL) ? open_face_as_user (pwent, &s, &picfile) : -1;
+	if (fd < 0) {
+		reply = g_strdup_printf ("%s\t", login);
+		send_face_message (reply, -1);
+		g_free (reply);
+		return;
+	}
+
+	cache_file = mdm_daemon_config_get_value_string (MDM_KEY_FACE_CACHE);
+	if (served_face_cache != NULL &&
+	    ! mdm_face_cache_is_current (served_face_cache)) {
+		mdm_face_cache_close (served_face_cache);
+		served_face_cache = NULL;
+	}
+	if (served_face_cache == NULL)
+		served_face_cache = mdm_face_cache_open (cache_file);
+
+	if (served_face_cache != NULL &&
+	    mdm_face_cache_lookup (served_face_cache, pwent->pw_uid, picfile,
+				   s.st_mtime, s.st_size) != NULL) {
+		reply = g_strdup_printf ("%s\tcache:%" G_GINT64_FORMAT ":%" G_GUINT64_FORMAT,
+					 login, (gint64) s.st_mtime, (guint64) s.st_size);
+	} else {
+		reply = g_strdup_printf ("%s\tfd:%d", login, (int) s.st_size);
+
+		if ( ! ve_string_empty (cache_file)) {
+			served_thumb_requests = g_slist_prepend (served_thumb_requests,
+				mdm_face_thumb_request_new (pwent->pw_uid, pwent->pw_gid, picfile,
+							    s.st_mtime, s.st_size));
+			if (++n_served_thumb_requests >= FACE_THUMB_BATCH)
+				flush_served_thumb_requests ();
+		}
+	}
+
+	send_face_message (reply, fd);
+	g_free (reply);
+	g_free (picfile);
+	VE_IGNORE_EINTR (close (fd));
+}
+
+/* Serves picture requests for as long as the greeter has nothing else
+ * to say, and returns once it has */
+static void
+serve_faces_until_reply (void)
+{
+	struct pollfd pfd[2];
+	int n;
+
+	while (greeter_face_fd >= 0) {
+		pfd[0].fd = greeter_fd_in;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		pfd[1].fd = greeter_face_fd;
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+
+		VE_IGNORE_EINTR (n = poll (pfd, 2, -1));
+		if G_UNLIKELY (n < 0 || pfd[0].revents != 0)
+			return;
+
+		if (pfd[1].revents & POLLIN)
+			serve_face_request ();
+		else if (pfd[1].revents != 0) {
+			VE_IGNORE_EINTR (close (greeter_face_fd));
+			greeter_face_fd = -1;
+		}
+	}
+}
+
 /* This is VERY evil! */
 static void
 run_pictures (void)
@@ -2051,17 +2560,25 @@ run_pictures (void)
 	struct passwd *pwent;
 	char *picfile;
 	FILE *fp;
+	MdmFaceCache *face_cache;
+	GSList *thumb_requests = NULL;
+
+	face_cache = mdm_face_cache_open (mdm_daemon_config_get_value_string (MDM_KEY_FACE_CACHE));
 
 	response = NULL;
 	for (;;) {
 		struct stat s;
 		char *tmp, *ret;
-		int i, r;
+		int i, fd;
 
 		g_free (response);
 		response = mdm_slave_greeter_ctl (MDM_NEEDPIC, "");
 		if (ve_string_empty (response)) {
 			g_free (response);
+			mdm_face_cache_close (face_cache);
+			update_face_cache (thumb_requests);
+			g_slist_foreach (thumb_requests, (GFunc) mdm_face_thumb_request_free, NULL);
+			g_slist_free (thumb_requests);
 			return;
 		}
 
@@ -2071,37 +2588,51 @@ run_pictures (void)
 			continue;
 		}
 
-		picfile = NULL;
-
-		NEVER_FAILS_seteuid (0);
-		if G_UNLIKELY (setegid (pwent->pw_gid) != 0 ||
-			       seteuid (pwent->pw_uid) != 0) {
-			NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
+		fd = open_face_as_user (pwent, &s, &picfile);
+		if (fd < 0) {
 			mdm_slave_greeter_ctl_no_ret (MDM_READPIC, "");
 			continue;
 		}
 
-		picfile = mdm_common_get_facefile (pwent->pw_dir, pwent->pw_name, pwent->pw_uid);
-
-		if (! picfile) {
-			NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
-			mdm_slave_greeter_ctl_no_ret (MDM_READPIC, "");
-			continue;
+		/* The greeter has the thumbnail mapped already if the cache
+		 * has one for this very file, it says "miss" if its copy of
+		 * the cache does not */
+		if (face_cache != NULL &&
+		    mdm_face_cache_lookup (face_cache, pwent->pw_uid, picfile,
+					   s.st_mtime, s.st_size) != NULL) {
+			tmp = g_strdup_printf ("cache:%" G_GINT64_FORMAT ":%" G_GUINT64_FORMAT,
+					       (gint64) s.st_mtime, (guint64) s.st_size);
+			ret = mdm_slave_greeter_ctl (MDM_READPIC, tmp);
+			g_free (tmp);
+
+			if (ret == NULL || strcmp (ret, "miss") != 0) {
+				g_free (ret);
+				g_free (picfile);
+				VE_IGNORE_EINTR (close (fd));
+				continue;
+			}
+			g_free (ret);
+		} else if ( ! ve_string_empty (mdm_daemon_config_get_value_string (MDM_KEY_FACE_CACHE))) {
+			thumb_requests = g_slist_prepend (thumb_requests,
+				mdm_face_thumb_request_new (pwent->pw_uid, pwent->pw_gid, picfile,
+							    s.st_mtime, s.st_size));
 		}
+		g_free (picfile);
 
-		VE_IGNORE_EINTR (r = g_stat (picfile, &s));
-		if G_UNLIKELY (r < 0 || s.st_size > mdm_daemon_config_get_value_int (MDM_KEY_USER_MAX_FILE)) {
-			NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
+		/* The greeter reads the file itself, one round trip and
+		 * nothing goes through the pipe */
+		if (send_face_message ("", fd)) {
+			VE_IGNORE_EINTR (close (fd));
 
-			mdm_slave_greeter_ctl_no_ret (MDM_READPIC, "");
+			tmp = g_strdup_printf ("fd:%d", (int)s.st_size);
+			mdm_slave_greeter_ctl_no_ret (MDM_READPIC, tmp);
+			g_free (tmp);
 			continue;
 		}
 
-		VE_IGNORE_EINTR (fp = fopen (picfile, "r"));
-		g_free (picfile);
+		VE_IGNORE_EINTR (fp = fdopen (fd, "r"));
 		if G_UNLIKELY (fp == NULL) {
-			NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
-
+			VE_IGNORE_EINTR (close (fd));
 			mdm_slave_greeter_ctl_no_ret (MDM_READPIC, "");
 			continue;
 		}
@@ -2113,13 +2644,11 @@ run_pictures (void)
 		if G_UNLIKELY (ret == NULL || strcmp (ret, "OK") != 0) {
 			VE_IGNORE_EINTR (fclose (fp));
 			g_free (ret);
-
-			NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
-
 			continue;
 		}
 		g_free (ret);
 
+
 		mdm_fdprintf (greeter_fd_out, "%c", STX);
 
 #ifdef PIPE_BUF
@@ -2191,8 +2720,6 @@ run_pictures (void)
 		}
 
 		mdm_slave_greeter_ctl_no_ret (MDM_READPIC, "done");
-
-		NEVER_FAILS_root_set_euid_egid (0, mdm_daemon_config_get_mdmgid ());
 	}
 	g_free (response); /* not reached */
 }
@@ -2228,7 +2755,7 @@ exec_command (const char *command, const char *extra_arg)
 static void
 mdm_slave_greeter (void)
 {
-	gint pipe1[2], pipe2[2];
+	gint pipe1[2], pipe2[2], facepair[2];
 	struct passwd *pwent;
 	pid_t pid;
 	const char *command;
@@ -2236,7 +2763,9 @@ mdm_slave_greeter (void)
 	const char *mdmuser;
 	const char *moduleslist;
 	const char *mdmlang;
+	gint64 start = g_get_monotonic_time ();
 
+	mdm_trace_begin ("mdm_slave_greeter");
 	mdm_debug ("mdm_slave_greeter: Running greeter on %s", d->name);
 
 	/* Run the init script. mdmslave suspends until script has terminated */
@@ -2254,6 +2783,15 @@ mdm_slave_greeter (void)
 				"mdm_slave_greeter");
 	}	
 
+	/* Pictures are passed as open files over this one, without it
+	 * they go through the pipe.  One message per request and answer,
+	 * see serve_face_request */
+	if G_UNLIKELY (socketpair (AF_UNIX, SOCK_SEQPACKET, 0, facepair) < 0) {
+		mdm_debug ("mdm_slave_greeter: Can't init picture socket: %s",
+			   strerror (errno));
+		facepair[0] = facepair[1] = -1;
+	}
+
 	command = mdm_daemon_config_get_value_string (MDM_KEY_GREETER);	
 
 	mdm_debug ("Forking greeter process: %s", command);
@@ -2282,9 +2820,12 @@ mdm_slave_greeter (void)
 		VE_IGNORE_EINTR (dup2 (pipe1[0], STDIN_FILENO));
 		VE_IGNORE_EINTR (dup2 (pipe2[1], STDOUT_FILENO));
 
+		if (facepair[0] >= 0)
+			VE_IGNORE_EINTR (close (facepair[0]));
+
 		mdm_log_shutdown ();
 
-		mdm_close_all_descriptors (2 /* from */, slave_fifo_pipe_fd/* except */, d->slave_notify_fd/* except2 */);
+		mdm_close_all_descriptors (2 /* from */, facepair[1] /* except */, d->slave_notify_fd/* except2 */);
 
 		mdm_open_dev_null (O_RDWR); /* open stderr - fd 2 */
 
@@ -2323,6 +2864,17 @@ mdm_slave_greeter (void)
 		g_setenv ("MDM_GREETER_PROTOCOL_VERSION",
 			  MDM_GREETER_PROTOCOL_VERSION, TRUE);
 		g_setenv ("MDM_VERSION", VERSION, TRUE);
+		if (mdm_trace_enabled ())
+			g_setenv (MDM_TRACE_FILE_ENV, mdm_trace_get_file (), TRUE);
+		else
+			g_unsetenv (MDM_TRACE_FILE_ENV);
+		if (facepair[1] >= 0) {
+			char *fdstr = g_strdup_printf ("%d", facepair[1]);
+			g_setenv ("MDM_FACE_SOCKET", fdstr, TRUE);
+			g_free (fdstr);
+		} else {
+			g_unsetenv ("MDM_FACE_SOCKET");
+		}
 
 		pwent = getpwnam (mdmuser);
 		if G_LIKELY (pwent != NULL) {
@@ -2484,16 +3036,24 @@ mdm_slave_greeter (void)
 
 	case -1:
 		d->greetpid = 0;
+		if (facepair[0] >= 0) {
+			VE_IGNORE_EINTR (close (facepair[0]));
+			VE_IGNORE_EINTR (close (facepair[1]));
+		}
 		mdm_slave_exit (DISPLAY_REMANAGE, _("%s: Can't fork mdmgreeter process"), "mdm_slave_greeter");
 
 	default:
 		VE_IGNORE_EINTR (close (pipe1[0]));
 		VE_IGNORE_EINTR (close (pipe2[1]));
+		if (facepair[1] >= 0)
+			VE_IGNORE_EINTR (close (facepair[1]));
 
 		whack_greeter_fds ();
 
 		greeter_fd_out = pipe1[1];
 		greeter_fd_in = pipe2[0];
+		greeter_face_fd = facepair[0];
+		mdm_fd_reader_init (&greeter_reader, greeter_fd_in);
 
 		mdm_debug ("mdm_slave_greeter: Greeter on pid %d", (int)pid);
 
@@ -2502,6 +3062,7 @@ mdm_slave_greeter (void)
 		// Append pictures to greeter (except for mdmwebkit)
 		run_pictures ();
 		
+		mdm_slave_greeter_batch_begin ();
 		if (always_restart_greeter)
 			mdm_slave_greeter_ctl_no_ret (MDM_ALWAYS_RESTART, "Y");
 		else
@@ -2509,6 +3070,10 @@ mdm_slave_greeter (void)
 		mdmlang = g_getenv ("MDM_LANG");
 		if (mdmlang)
 			mdm_slave_greeter_ctl_no_ret (MDM_SETLANG, mdmlang);
+		/* waits for the greeter to answer */
+		mdm_slave_greeter_batch_end ();
+		mdm_trace_end ("mdm_slave_greeter");
+		send_timing (MDM_TIMING_GREETER, start);
 
 
 		check_notifies_now ();
@@ -2516,86 +3081,120 @@ mdm_slave_greeter (void)
 	}
 }
 
+/* How long to wait for the daemon to answer, except for the dialogs
+ * which wait for the user */
+#define SLAVE_ANSWER_TIMEOUT 10
+
+/* Writes to our channel, waiting for room if the daemon is behind */
+static void
+slave_channel_write (const char *buf, gsize len)
+{
+	while (len > 0) {
+		ssize_t n;
+
+		VE_IGNORE_EINTR (n = write (d->slave_notify_fd, buf, len));
+		if (n < 0 && errno == EAGAIN) {
+			struct pollfd pfd;
+
+			pfd.fd = d->slave_notify_fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			VE_IGNORE_EINTR (n = poll (&pfd, 1, SLAVE_ANSWER_TIMEOUT * 1000));
+			if (n <= 0)
+				return;
+			continue;
+		}
+		if (n <= 0)
+			return;
+		buf += n;
+		len -= n;
+	}
+}
+
+static gboolean
+is_dialog_request (const char *str)
+{
+	return strncmp (str, "opcode="MDM_SOP_SHOW_ERROR_DIALOG,
+			strlen ("opcode="MDM_SOP_SHOW_ERROR_DIALOG)) == 0 ||
+	       strncmp (str, "opcode="MDM_SOP_SHOW_YESNO_DIALOG,
+			strlen ("opcode="MDM_SOP_SHOW_YESNO_DIALOG)) == 0 ||
+	       strncmp (str, "opcode="MDM_SOP_SHOW_QUESTION_DIALOG,
+			strlen ("opcode="MDM_SOP_SHOW_QUESTION_DIALOG)) == 0 ||
+	       strncmp (str, "opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG,
+			strlen ("opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG)) == 0;
+}
+
 /* This should not call anything that could cause a syslog in case we
  * are in a signal */
 void
 mdm_slave_send (const char *str, gboolean wait_for_ack)
 {
-	int i;
-	uid_t old;
+	gboolean dialog;
+	gint64 deadline;
+	char *msg;
 
 	if ( ! mdm_wait_for_ack)
 		wait_for_ack = FALSE;
 
+	if (d->slave_notify_fd < 0)
+		return;
+
+	/* answers to earlier requests that are still on their way get
+	 * ignored from now on */
+	if (++slave_request_id == 0)
+		slave_request_id = 1;
+
 	if (wait_for_ack) {
 		mdm_got_ack = FALSE;
 		g_free (mdm_ack_response);
 		mdm_ack_response = NULL;
 	}
 
-	mdm_fdprintf (slave_fifo_pipe_fd, "\n%s\n", str);	
+	msg = g_strdup_printf ("%u %" G_GINT64_FORMAT " %s\n",
+			       slave_request_id, g_get_monotonic_time (), str);
+	slave_channel_write (msg, strlen (msg));
+	g_free (msg);
 
-#if defined (_POSIX_PRIORITY_SCHEDULING) && defined (HAVE_SCHED_YIELD)
-	if (wait_for_ack && ! mdm_got_ack) {
-		/* let the other process do its stuff */
-		sched_yield ();
-	}
-#endif
+	if ( ! wait_for_ack)
+		return;
 
-	/* Wait till you get a response from the daemon */
-	if (strncmp (str, "opcode="MDM_SOP_SHOW_ERROR_DIALOG,
-		     strlen ("opcode="MDM_SOP_SHOW_ERROR_DIALOG)) == 0 ||
-	    strncmp (str, "opcode="MDM_SOP_SHOW_YESNO_DIALOG,
-		     strlen ("opcode="MDM_SOP_SHOW_YESNO_DIALOG)) == 0 ||
-	    strncmp (str, "opcode="MDM_SOP_SHOW_QUESTION_DIALOG,
-		     strlen ("opcode="MDM_SOP_SHOW_QUESTION_DIALOG)) == 0 ||
-	    strncmp (str, "opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG,
-		     strlen ("opcode="MDM_SOP_SHOW_ASKBUTTONS_DIALOG)) == 0) {
-
-		for (; wait_for_ack && !mdm_got_ack ; ) {
-			fd_set rfds;
+	/* Wait till you get a response from the daemon, the notifications
+	 * that arrive meanwhile are handled as if SIGUSR2 had told us */
+	dialog = is_dialog_request (str);
+	deadline = g_get_monotonic_time () + SLAVE_ANSWER_TIMEOUT * G_USEC_PER_SEC;
 
-			FD_ZERO (&rfds);
-			FD_SET (d->slave_notify_fd, &rfds);
+	mdm_sigusr2_block_push ();
+	while ( ! mdm_got_ack) {
+		struct pollfd pfd;
+		int timeout = -1;
+		int ret;
 
-			if (select (d->slave_notify_fd+1, &rfds, NULL, NULL, NULL) > 0) {
-				mdm_slave_handle_usr2_message ();
-			}
-		}
-        } else {
-		for (i = 0;
-		     wait_for_ack &&
-			     ! mdm_got_ack &&
-			     parent_exists () &&
-			     i < 10;
-		     i++) {
-			if (in_usr2_signal > 0) {
-				fd_set rfds;
-				struct timeval tv;
+		if ( ! dialog) {
+			gint64 left = deadline - g_get_monotonic_time ();
 
-				FD_ZERO (&rfds);
-				FD_SET (d->slave_notify_fd, &rfds);
+			if (left <= 0 || ! parent_exists ())
+				break;
+			timeout = (left + 999) / 1000;
+		}
 
-				/* Wait up to 1 second. */
-				tv.tv_sec = 1;
-				tv.tv_usec = 0;
+		pfd.fd = d->slave_notify_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		ret = poll (&pfd, 1, timeout);
+		if (ret < 0 && errno != EINTR)
+			break;
+		if (ret <= 0)
+			continue;
 
-				if (select (d->slave_notify_fd+1, &rfds, NULL, NULL, &tv) > 0) {
-					mdm_slave_handle_usr2_message ();
-				}
-			} else {
-				struct timeval tv;
-				/* Wait 1 second. */
-				tv.tv_sec = 1;
-				tv.tv_usec = 0;
-				select (0, NULL, NULL, NULL, &tv);
-			
-			}
-		}
+		if (pfd.revents & POLLIN)
+			mdm_slave_handle_usr2_message ();
+		/* nobody left to answer */
+		if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))
+			break;
 	}
+	mdm_sigusr2_block_pop ();
 
-	if G_UNLIKELY (wait_for_ack  &&
-		       ! mdm_got_ack &&
+	if G_UNLIKELY ( ! mdm_got_ack &&
 		       mdm_in_signal == 0) {
 		if (strncmp (str, MDM_SOP_COOKIE " ",
 			     strlen (MDM_SOP_COOKIE " ")) == 0) {
@@ -2634,7 +3233,7 @@ mdm_slave_send_string (const char *opcode, const char *str)
 {
 	char *msg;
 
-	if G_UNLIKELY (mdm_daemon_config_get_value_bool (MDM_KEY_DEBUG) && mdm_in_signal == 0) {
+	if G_UNLIKELY (mdm_daemon_config_get_bool_for_id (MDM_ID_DEBUG) && mdm_in_signal == 0) {
 		mdm_debug ("Sending %s == <secret> for slave %ld",
 			   opcode,
 			   (long)getpid ());
@@ -2656,6 +3255,19 @@ mdm_slave_send_string (const char *opcode, const char *str)
 	g_free (msg);
 }
 
+/* Tells the daemon how long a phase took, for the STATS command */
+static void
+send_timing (const char *phase, gint64 start)
+{
+	char *msg;
+
+	msg = g_strdup_printf ("%s %ld %s %" G_GINT64_FORMAT, MDM_SOP_TIMING,
+			       (long)getpid (), phase,
+			       MAX (g_get_monotonic_time () - start, 0));
+	mdm_slave_send (msg, FALSE);
+	g_free (msg);
+}
+
 static gboolean
 is_session_valid (const char *session_name)
 {
@@ -2902,6 +3514,9 @@ session_child_run (struct passwd *pwent,
 		/* should never happen */
 		mdm_error ("session_child_run: setsid () failed: %s!", strerror (errno));
 
+	mdm_trace_init (mdm_trace_get_file (), "mdm session", d->name);
+	mdm_trace_begin ("session_child_run");
+
 	g_setenv ("XAUTHORITY", MDM_AUTHFILE (d), TRUE);
 
 	/* Here we setup our 0,1,2 descriptors, we do it here
@@ -3068,6 +3683,11 @@ session_child_run (struct passwd *pwent,
                         close (iceauth_fd);
         }
 
+	/* the trace file is not the user's to write, the exec follows
+	 * becoming the user with nothing slow in between */
+	mdm_trace_end ("session_child_run");
+	mdm_trace_dump ();
+
 	NEVER_FAILS_setegid (pwent->pw_gid);
 #ifdef HAVE_LOGINCAP
 	if (setusercontext (NULL, pwent, pwent->pw_uid,
@@ -3103,7 +3723,7 @@ session_child_run (struct passwd *pwent,
 
 	mdm_log_shutdown ();
 
-	mdm_close_all_descriptors (3 /* from */, slave_fifo_pipe_fd /* except */, d->slave_notify_fd /* except2 */);
+	mdm_close_all_descriptors (3 /* from */, -1 /* except */, d->slave_notify_fd /* except2 */);
 
 	mdm_log_init ();
 
@@ -3593,7 +4213,9 @@ mdm_slave_session_start (void)
 	gid_t gid;
 	int logpipe[2];
 	int logfilefd;
+	gint64 start = g_get_monotonic_time ();
 
+	mdm_trace_begin ("mdm_slave_session_start");
 	mdm_debug ("mdm_slave_session_start: Attempting session for user '%s'",
 		   login_user);
 
@@ -4000,8 +4622,12 @@ mdm_slave_session_start (void)
 				pwent->pw_name,
 				pid);
 
+	send_timing (MDM_TIMING_SESSION, start);
 	mdm_slave_send_num (MDM_SOP_SESSPID, pid);
 
+	mdm_trace_end ("mdm_slave_session_start");
+	mdm_trace_dump ();
+
 	mdm_sigchld_block_push ();
 	wp = slave_waitpid_setpid (d->sesspid);
 	mdm_sigchld_block_pop ();
@@ -4389,33 +5015,67 @@ mdm_slave_child_handler (int sig)
 	mdm_in_signal--;
 }
 
+/* Answers from the daemon are "<id> <answer>", returns the answer or
+ * NULL if it is for a request we are not waiting for anymore */
+static const char *
+slave_reply_payload (const char *s)
+{
+	char *end;
+	gulong id;
+
+	id = strtoul (s, &end, 10);
+	if (end == s || *end != ' ' || id != slave_request_id)
+		return NULL;
+	return end + 1;
+}
+
 static void
 mdm_slave_handle_usr2_message (void)
 {
+	/* the daemon sends configuration changes in batches, so read
+	 * everything there is and keep an incomplete last line for the
+	 * next signal */
+	static GString *pending = NULL;
 	char buf[256];
 	ssize_t count;
+	char *end;
 	char **vec;
 	int i;
 
-	VE_IGNORE_EINTR (count = read (d->slave_notify_fd, buf, sizeof (buf) -1));
-	if (count <= 0) {
-		return;
+	if (pending == NULL)
+		pending = g_string_new (NULL);
+
+	for (;;) {
+		VE_IGNORE_EINTR (count = read (d->slave_notify_fd, buf, sizeof (buf)));
+		if (count <= 0)
+			break;
+		g_string_append_len (pending, buf, count);
 	}
 
-	buf[count] = '\0';
+	end = strrchr (pending->str, '\n');
+	if (end == NULL) {
+		return;
+	}
 
-	vec = g_strsplit (buf, "\n", -1);
+	*end = '\0';
+	vec = g_strsplit (pending->str, "\n", -1);
+	g_string_erase (pending, 0, end - pending->str + 1);
 	if (vec == NULL) {
 		return;
 	}
 
 	for (i = 0; vec[i] != NULL; i++) {
 		char *s = vec[i];
+		const char *reply;
+
 		if (s[0] == MDM_SLAVE_NOTIFY_ACK) {
+			reply = slave_reply_payload (&s[1]);
+			if (reply == NULL)
+				continue;
 			mdm_got_ack = TRUE;
 			g_free (mdm_ack_response);
-			if (s[1] != '\0')
-				mdm_ack_response = g_strdup (&s[1]);
+			if (reply[0] != '\0')
+				mdm_ack_response = g_strdup (reply);
 			else
 				mdm_ack_response = NULL;
 		} else if (s[0] == MDM_SLAVE_NOTIFY_KEY) {
@@ -4452,25 +5112,30 @@ mdm_slave_handle_usr2_message (void)
 				mdm_wait_for_go = FALSE;
 			} else if (strcmp (&s[1], MDM_NOTIFY_TWIDDLE_POINTER) == 0) {
 				mdm_twiddle_pointer (d);
+			} else if (strcmp (&s[1], MDM_NOTIFY_TRACE_DUMP) == 0) {
+				trace_dump_pending = TRUE;
 			}
 		} else if (s[0] == MDM_SLAVE_NOTIFY_RESPONSE) {
+			reply = slave_reply_payload (&s[1]);
+			if (reply == NULL || reply[0] == '\0')
+				continue;
 			mdm_got_ack = TRUE;
-			if (mdm_ack_response)
-				g_free (mdm_ack_response);
+			g_free (mdm_ack_response);
+			mdm_ack_response = NULL;
 
-			if (s[1] == MDM_SLAVE_NOTIFY_YESNO_RESPONSE) {
-				if (s[2] == '0') {
+			if (reply[0] == MDM_SLAVE_NOTIFY_YESNO_RESPONSE) {
+				if (reply[1] == '0') {
 					mdm_ack_response =  g_strdup ("no");
 				} else {
 					mdm_ack_response =  g_strdup ("yes");
 				}
-			} else if (s[1] == MDM_SLAVE_NOTIFY_ASKBUTTONS_RESPONSE) {
-				mdm_ack_response = g_strdup (&s[2]);
-			} else if (s[1] == MDM_SLAVE_NOTIFY_QUESTION_RESPONSE) {
-				mdm_ack_question_response = g_strdup (&s[2]);
-			} else if (s[1] == MDM_SLAVE_NOTIFY_ERROR_RESPONSE) {
-				if (s[2] != '\0') {
-					mdm_ack_response = g_strdup (&s[2]);
+			} else if (reply[0] == MDM_SLAVE_NOTIFY_ASKBUTTONS_RESPONSE) {
+				mdm_ack_response = g_strdup (&reply[1]);
+			} else if (reply[0] == MDM_SLAVE_NOTIFY_QUESTION_RESPONSE) {
+				mdm_ack_question_response = g_strdup (&reply[1]);
+			} else if (reply[0] == MDM_SLAVE_NOTIFY_ERROR_RESPONSE) {
+				if (reply[1] != '\0') {
+					mdm_ack_response = g_strdup (&reply[1]);
 				} else {
 					mdm_ack_response = NULL;
 				}
@@ -4485,11 +5150,9 @@ static void
 mdm_slave_usr2_handler (int sig)
 {
 	mdm_in_signal++;
-	in_usr2_signal++;
 
 	mdm_slave_handle_usr2_message ();
 
-	in_usr2_signal--;
 	mdm_in_signal--;
 }
 
@@ -4658,45 +5321,144 @@ check_for_interruption (const char *msg)
 }
 
 
-char *
-mdm_slave_greeter_ctl (char cmd, const char *str)
-{
-	char *buf = NULL;
-	int c;
+/* A batch must fit in what the greeters read at once */
+#define GREETER_BATCH_MAX 2048
 
-	/* There is no spoon^H^H^H^H^Hgreeter */
-	if G_UNLIKELY ( ! greet)
-		return NULL;
-
-	check_notifies_now ();
+static GString *greeter_batch      = NULL; /* queued commands */
+static int greeter_batch_level     = 0;
 
-	if ( ! ve_string_empty (str)) {
-		mdm_fdprintf (greeter_fd_out, "%c%c%s\n", STX, cmd, str);
-	} else {
-		mdm_fdprintf (greeter_fd_out, "%c%c\n", STX, cmd);
+/* The commands the greeters answer with a bare STX right away */
+static gboolean
+greeter_cmd_can_batch (char cmd)
+{
+	switch (cmd) {
+	case MDM_SETLOGIN:
+	case MDM_MSG:
+	case MDM_ERRBOX:
+	case MDM_SETSESS:
+	case MDM_SETLANG:
+	case MDM_ALWAYS_RESTART:
+	case MDM_STARTTIMER:
+	case MDM_STOPTIMER:
+	case MDM_DISABLE:
+	case MDM_ENABLE:
+	case MDM_RESETOK:
+	case MDM_NOFOCUS:
+	case MDM_FOCUS:
+		return TRUE;
+	default:
+		return FALSE;
 	}
+}
 
-#if defined (_POSIX_PRIORITY_SCHEDULING) && defined (HAVE_SCHED_YIELD)
-	/* let the other process (greeter) do its stuff */
-	sched_yield ();
-#endif
+static gboolean
+greeter_batch_fits (const char *str)
+{
+	str = ve_sure_string (str);
+	return strchr (str, MDM_BATCH_SEP[0]) == NULL &&
+		(greeter_batch != NULL ? greeter_batch->len : 0) + strlen (str) + 2 < GREETER_BATCH_MAX;
+}
+
+static void
+greeter_batch_drop (void)
+{
+	greeter_batch_level = 0;
+	if (greeter_batch != NULL)
+		g_string_truncate (greeter_batch, 0);
+}
+
+static char *
+greeter_ctl_read_reply (void)
+{
+	char *buf = NULL;
+	int c;
 
 	do {
 		g_free (buf);
 		buf = NULL;
 		/* Skip random junk that might have accumulated */
 		do {
-			c = mdm_fdgetc (greeter_fd_in);
+			/* the greeter may want pictures in the meantime */
+			if (greeter_face_fd >= 0 &&
+			    ! mdm_fd_reader_has_data (&greeter_reader))
+				serve_faces_until_reply ();
+			c = mdm_fd_reader_getc (&greeter_reader);
 		} while (c != EOF && c != STX);
 
 		if (c == EOF ||
-		    (buf = mdm_fdgets (greeter_fd_in)) == NULL) {
+		    (buf = mdm_fd_reader_gets (&greeter_reader)) == NULL) {
 			interrupted = TRUE;
 			/* things don't seem well with the greeter, it probably died */
 			return NULL;
 		}
 	} while (check_for_interruption (buf) && ! interrupted);
 
+	return buf;
+}
+
+/* Sends a command, after whatever is queued if anything is, and returns
+ * the greeter's answer.  With cmd 0 only the queue is sent. */
+static char *
+greeter_ctl_send (char cmd, const char *str)
+{
+	if (greeter_batch != NULL && greeter_batch->len > 0) {
+		if (cmd != 0) {
+			g_string_append (greeter_batch, MDM_BATCH_SEP);
+			g_string_append_c (greeter_batch, cmd);
+			g_string_append (greeter_batch, ve_sure_string (str));
+		}
+		mdm_fdprintf (greeter_fd_out, "%c%c%s\n", STX, MDM_BATCH, greeter_batch->str);
+		g_string_truncate (greeter_batch, 0);
+	} else if (cmd == 0) {
+		return NULL;
+	} else if ( ! ve_string_empty (str)) {
+		mdm_fdprintf (greeter_fd_out, "%c%c%s\n", STX, cmd, str);
+	} else {
+		mdm_fdprintf (greeter_fd_out, "%c%c\n", STX, cmd);
+	}
+
+#if defined (_POSIX_PRIORITY_SCHEDULING) && defined (HAVE_SCHED_YIELD)
+	/* let the other process (greeter) do its stuff */
+	sched_yield ();
+#endif
+
+	return greeter_ctl_read_reply ();
+}
+
+char *
+mdm_slave_greeter_ctl (char cmd, const char *str)
+{
+	char *buf;
+
+	/* There is no spoon^H^H^H^H^Hgreeter */
+	if G_UNLIKELY ( ! greet) {
+		greeter_batch_drop ();
+		return NULL;
+	}
+
+	check_notifies_now ();
+
+	/* the queued commands go first, in the same message if this one
+	 * fits in */
+	if (greeter_batch != NULL && greeter_batch->len > 0 &&
+	    ! greeter_batch_fits (str)) {
+		buf = greeter_ctl_send (0, NULL);
+		if (buf == NULL)
+			return NULL;
+		g_free (buf);
+	}
+
+	if (cmd == MDM_PROMPT || cmd == MDM_NOECHO) {
+		gint64 start = g_get_monotonic_time ();
+
+		buf = greeter_ctl_send (cmd, str);
+		greeter_prompt_usec += g_get_monotonic_time () - start;
+	} else {
+		buf = greeter_ctl_send (cmd, str);
+	}
+	if (buf == NULL)
+		return NULL;
+
 	/* user responses take kind of random amount of time */
 	mdm_random_tick ();
 
@@ -4711,9 +5473,43 @@ mdm_slave_greeter_ctl (char cmd, const char *str)
 void
 mdm_slave_greeter_ctl_no_ret (char cmd, const char *str)
 {
+	if (greeter_batch_level > 0 && greet &&
+	    greeter_cmd_can_batch (cmd) && greeter_batch_fits (str)) {
+		if (greeter_batch == NULL)
+			greeter_batch = g_string_sized_new (GREETER_BATCH_MAX);
+		if (greeter_batch->len > 0)
+			g_string_append (greeter_batch, MDM_BATCH_SEP);
+		g_string_append_c (greeter_batch, cmd);
+		g_string_append (greeter_batch, ve_sure_string (str));
+		return;
+	}
+
 	g_free (mdm_slave_greeter_ctl (cmd, str));
 }
 
+/*
+ * Commands that need no answer between these two are not sent one by
+ * one but queued, and go to the greeter as one MDM_BATCH with the next
+ * command that does need an answer or at the end.  The greeter answers
+ * the batch once.  Nothing that waits for anything else should happen
+ * in between, since the greeter does not see the queued commands yet.
+ */
+void
+mdm_slave_greeter_batch_begin (void)
+{
+	greeter_batch_level++;
+}
+
+void
+mdm_slave_greeter_batch_end (void)
+{
+	if (greeter_batch_level == 0 || --greeter_batch_level > 0)
+		return;
+
+	if (greet && greeter_batch != NULL && greeter_batch->len > 0)
+		g_free (mdm_slave_greeter_ctl (0, NULL));
+}
+
 static void
 mdm_slave_quick_exit (gint status)
 {
@@ -5110,7 +5906,12 @@ mdm_slave_handle_notify (const char *msg)
 
 	mdm_debug ("Handling slave notify: '%s'", msg);
 
-	if (sscanf (msg, MDM_NOTIFY_ALLOW_ROOT " %d", &val) == 1) {
+	if (strncmp (msg, MDM_NOTIFY_PER_DISPLAY_CONFIG " ",
+		     strlen (MDM_NOTIFY_PER_DISPLAY_CONFIG) + 1) == 0) {
+		/* read the file again on the next lookup, the values
+		 * that changed follow as notifies of their own */
+		mdm_per_display_config_forget (d->name);
+	} else if (sscanf (msg, MDM_NOTIFY_ALLOW_ROOT " %d", &val) == 1) {
 		mdm_daemon_config_set_value_bool (MDM_KEY_ALLOW_ROOT, val);	
 	} else if (sscanf (msg, MDM_NOTIFY_SYSTEM_MENU " %d", &val) == 1) {
 		mdm_daemon_config_set_value_bool (MDM_KEY_SYSTEM_MENU, val);
@@ -33,6 +33,8 @@ typedef enum {
 void     mdm_slave_start       (MdmDisplay *d);
 void     mdm_slave_greeter_ctl_no_ret (char cmd, const char *str);
 char    *mdm_slave_greeter_ctl (char cmd, const char *str);
+void     mdm_slave_greeter_batch_begin (void);
+void     mdm_slave_greeter_batch_end   (void);
 gboolean mdm_slave_greeter_check_interruption (void);
 gboolean mdm_slave_action_pending (void);
 
@@ -0,0 +1,230 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Load test for the daemon socket: opens many clients at once against
+ * the user socket, sends each a VERSION request and reports how long
+ * the answers took and how many clients never got one.
+ *
+ * usage: test-connections [socket] [clients] [hold-seconds]
+ *
+ * With hold-seconds > 0 every client stays connected that long after
+ * its answer arrived, which exercises the admission control path (the
+ * clients beyond MaxConnections have to wait until the daemon closes
+ * the ones that sit idle).  Run it next to "test-mdmcomm --greeters N"
+ * to see that greeters keeping their connection between commands do
+ * not hold the others up.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <glib.h>
+
+#include "mdm-bench.h"
+#include "mdm-socket-protocol.h"
+
+/* Give up on clients that did not get an answer after this long */
+#define TEST_TIMEOUT 120
+
+typedef enum {
+        CLIENT_WAITING,
+        CLIENT_ANSWERED,
+        CLIENT_HOLDING,
+        CLIENT_REFUSED,
+        CLIENT_DROPPED,
+        CLIENT_TIMED_OUT
+} ClientState;
+
+typedef struct {
+        int         fd;
+        ClientState state;
+        double      started;
+        double      latency;
+        char        buf[64];
+        int         len;
+} Client;
+
+static void
+client_connect (Client *client, const char *path)
+{
+        struct sockaddr_un addr;
+        static const char request[] = MDM_SUP_VERSION "\n";
+
+        client->state = CLIENT_WAITING;
+        client->len = 0;
+        client->started = mdm_bench_now ();
+
+        client->fd = socket (AF_UNIX, SOCK_STREAM, 0);
+        if (client->fd < 0) {
+                client->state = CLIENT_REFUSED;
+                return;
+        }
+        fcntl (client->fd, F_SETFL, O_NONBLOCK);
+
+        memset (&addr, 0, sizeof (addr));
+        addr.sun_family = AF_UNIX;
+        strncpy (addr.sun_path, path, sizeof (addr.sun_path) - 1);
+
+        /* A full accept queue shows up as EAGAIN on a nonblocking
+         * unix socket, that is a refused client as far as we care */
+        if (connect (client->fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+            write (client->fd, request, sizeof (request) - 1) != sizeof (request) - 1) {
+                close (client->fd);
+                client->fd = -1;
+                client->state = CLIENT_REFUSED;
+        }
+}
+
+static void
+client_read (Client *client)
+{
+        int n;
+
+        n = read (client->fd, client->buf + client->len,
+                  sizeof (client->buf) - 1 - client->len);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN))
+                return;
+
+        if (n <= 0) {
+                /* Closed on us before we got a full answer */
+                close (client->fd);
+                client->fd = -1;
+                client->state = (client->state == CLIENT_HOLDING) ?
+                        CLIENT_ANSWERED : CLIENT_DROPPED;
+                return;
+        }
+
+        if (client->state == CLIENT_HOLDING)
+                return;
+
+        client->len += n;
+        client->buf[client->len] = '\0';
+        if (strchr (client->buf, '\n') != NULL ||
+            client->len == sizeof (client->buf) - 1) {
+                client->latency = mdm_bench_now () - client->started;
+                client->state = CLIENT_HOLDING;
+        }
+}
+
+int
+main (int argc, char **argv)
+{
+        const char    *path = MDM_SUP_SOCKET;
+        int            n_clients = 300;
+        int            hold = 0;
+        Client        *clients;
+        struct pollfd *pfds;
+        GArray        *latencies;
+        MdmBenchPercentiles pct;
+        double         start, answered_at;
+        int            counts[CLIENT_TIMED_OUT + 1] = { 0 };
+        int            i;
+
+        if (argc > 1)
+                path = argv[1];
+        if (argc > 2)
+                n_clients = MAX (1, atoi (argv[2]));
+        if (argc > 3)
+                hold = MAX (0, atoi (argv[3]));
+
+        clients = g_new0 (Client, n_clients);
+        pfds = g_new0 (struct pollfd, n_clients);
+        latencies = g_array_new (FALSE, FALSE, sizeof (double));
+
+        g_print ("Connecting %d clients to %s (hold %d s)\n", n_clients, path, hold);
+
+        start = mdm_bench_now ();
+        for (i = 0; i < n_clients; i++)
+                client_connect (&clients[i], path);
+
+        for (;;) {
+                double t = mdm_bench_now ();
+                int    n_active = 0;
+
+                for (i = 0; i < n_clients; i++) {
+                        Client *client = &clients[i];
+
+                        if (client->state == CLIENT_HOLDING &&
+                            t - client->started - client->latency >= hold) {
+                                close (client->fd);
+                                client->fd = -1;
+                                client->state = CLIENT_ANSWERED;
+                        } else if (client->state == CLIENT_WAITING &&
+                                   t - client->started > TEST_TIMEOUT) {
+                                close (client->fd);
+                                client->fd = -1;
+                                client->state = CLIENT_TIMED_OUT;
+                        }
+
+                        pfds[i].fd = client->fd;
+                        pfds[i].events = POLLIN;
+                        pfds[i].revents = 0;
+                        if (client->fd >= 0)
+                                n_active++;
+                }
+
+                if (n_active == 0)
+                        break;
+
+                if (poll (pfds, n_clients, 100) < 0 && errno != EINTR) {
+                        perror ("poll");
+                        return 1;
+                }
+
+                for (i = 0; i < n_clients; i++) {
+                        if (pfds[i].fd >= 0 && pfds[i].revents != 0)
+                                client_read (&clients[i]);
+                }
+        }
+        answered_at = mdm_bench_now ();
+
+        for (i = 0; i < n_clients; i++) {
+                counts[clients[i].state]++;
+                if (clients[i].state == CLIENT_ANSWERED)
+                        g_array_append_val (latencies, clients[i].latency);
+        }
+
+        g_print ("answered:  %d\n", counts[CLIENT_ANSWERED]);
+        g_print ("refused:   %d\n", counts[CLIENT_REFUSED]);
+        g_print ("dropped:   %d\n", counts[CLIENT_DROPPED]);
+        g_print ("timed out: %d\n", counts[CLIENT_TIMED_OUT]);
+        g_print ("wall time: %.3f s\n", answered_at - start);
+
+        if (mdm_bench_percentiles (latencies, &pct))
+                g_print ("latency ms: min %.2f  median %.2f  p99 %.2f  max %.2f\n",
+                         pct.min * 1000.0,
+                         pct.median * 1000.0,
+                         pct.p99 * 1000.0,
+                         pct.max * 1000.0);
+
+        g_array_free (latencies, TRUE);
+        g_free (pfds);
+        g_free (clients);
+
+        return (counts[CLIENT_ANSWERED] == n_clients) ? 0 : 1;
+}
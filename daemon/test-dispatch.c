@@ -0,0 +1,167 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Benchmark of the per-message dispatch cost of the user socket
+ * protocol: the old strncmp chain against the sorted opcode table.
+ *
+ * usage: test-dispatch [iterations]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "mdm-dispatch.h"
+#include "mdm-socket-protocol.h"
+
+typedef struct {
+        const char *opcode;
+        int         id;
+} TestHandler;
+
+/* same order as the daemon used to test them in */
+static TestHandler handlers[] = {
+        { MDM_SUP_AUTH_LOCAL, 1 },
+        { MDM_SUP_FLEXI_XSERVER, 2 },
+        { MDM_SUP_ATTACHED_SERVERS, 3 },
+        { MDM_SUP_GREETERPIDS, 4 },
+        { MDM_SUP_UPDATE_CONFIG, 5 },
+        { MDM_SUP_GET_CONFIG, 6 },
+        { MDM_SUP_GET_CONFIG_FILE, 7 },
+        { MDM_SUP_GET_CUSTOM_CONFIG_FILE, 8 },
+        { MDM_SUP_QUERY_LOGOUT_ACTION, 9 },
+        { MDM_SUP_SET_LOGOUT_ACTION, 10 },
+        { MDM_SUP_SET_SAFE_LOGOUT_ACTION, 11 },
+        { MDM_SUP_QUERY_VT, 12 },
+        { MDM_SUP_SET_VT, 13 },
+        { MDM_SUP_VERSION, 14 },
+        { MDM_SUP_CLOSE, 15 },
+};
+
+static const char *messages[] = {
+        MDM_SUP_AUTH_LOCAL " 0123456789abcdef",
+        MDM_SUP_GET_CONFIG " greeter/ShowLastSession",
+        MDM_SUP_ATTACHED_SERVERS,
+        MDM_SUP_QUERY_VT,
+        MDM_SUP_SET_VT " 7",
+        MDM_SUP_VERSION,
+        MDM_SUP_CLOSE,
+        "BOGUS_COMMAND",
+};
+
+/* The strncmp chain of the old mdm_handle_user_message */
+static int
+dispatch_chain (const char *msg)
+{
+        if (strncmp (msg, MDM_SUP_AUTH_LOCAL " ", strlen (MDM_SUP_AUTH_LOCAL " ")) == 0)
+                return 1;
+        else if (strcmp (msg, MDM_SUP_FLEXI_XSERVER) == 0)
+                return 2;
+        else if (strncmp (msg, MDM_SUP_ATTACHED_SERVERS, strlen (MDM_SUP_ATTACHED_SERVERS)) == 0)
+                return 3;
+        else if (strcmp (msg, MDM_SUP_GREETERPIDS) == 0)
+                return 4;
+        else if (strncmp (msg, MDM_SUP_UPDATE_CONFIG " ", strlen (MDM_SUP_UPDATE_CONFIG " ")) == 0)
+                return 5;
+        else if (strncmp (msg, MDM_SUP_GET_CONFIG " ", strlen (MDM_SUP_GET_CONFIG " ")) == 0)
+                return 6;
+        else if (strcmp (msg, MDM_SUP_GET_CONFIG_FILE) == 0)
+                return 7;
+        else if (strcmp (msg, MDM_SUP_GET_CUSTOM_CONFIG_FILE) == 0)
+                return 8;
+        else if (strcmp (msg, MDM_SUP_QUERY_LOGOUT_ACTION) == 0)
+                return 9;
+        else if (strncmp (msg, MDM_SUP_SET_LOGOUT_ACTION " ", strlen (MDM_SUP_SET_LOGOUT_ACTION " ")) == 0)
+                return 10;
+        else if (strncmp (msg, MDM_SUP_SET_SAFE_LOGOUT_ACTION " ", strlen (MDM_SUP_SET_SAFE_LOGOUT_ACTION " ")) == 0)
+                return 11;
+        else if (strcmp (msg, MDM_SUP_QUERY_VT) == 0)
+                return 12;
+        else if (strncmp (msg, MDM_SUP_SET_VT " ", strlen (MDM_SUP_SET_VT " ")) == 0)
+                return 13;
+        else if (strcmp (msg, MDM_SUP_VERSION) == 0)
+                return 14;
+        else if (strcmp (msg, MDM_SUP_CLOSE) == 0)
+                return 15;
+        return 0;
+}
+
+static int
+dispatch_table (const char *msg)
+{
+        const TestHandler *handler;
+        const char        *args;
+        gsize              len;
+
+        len = mdm_dispatch_split (msg, &args);
+        handler = mdm_dispatch_lookup (handlers, G_N_ELEMENTS (handlers),
+                                       sizeof (TestHandler), msg, len);
+
+        return (handler != NULL) ? handler->id : 0;
+}
+
+int
+main (int argc, char **argv)
+{
+        GTimer *timer;
+        int     iterations = 5000000;
+        int     failed = 0;
+        guint   i;
+
+        if (argc > 1)
+                iterations = MAX (1, atoi (argv[1]));
+
+        mdm_dispatch_sort (handlers, G_N_ELEMENTS (handlers), sizeof (TestHandler));
+        timer = g_timer_new ();
+
+        g_print ("%-45s %10s %10s\n", "message", "chain ns", "table ns");
+
+        for (i = 0; i < G_N_ELEMENTS (messages); i++) {
+                const char *msg = messages[i];
+                volatile int sink = 0;
+                double t_chain, t_table;
+                int n;
+
+                if (dispatch_chain (msg) != dispatch_table (msg)) {
+                        g_warning ("Dispatch differs for '%s'", msg);
+                        failed = 1;
+                }
+
+                g_timer_start (timer);
+                for (n = 0; n < iterations; n++)
+                        sink += dispatch_chain (msg);
+                t_chain = g_timer_elapsed (timer, NULL);
+
+                g_timer_start (timer);
+                for (n = 0; n < iterations; n++)
+                        sink += dispatch_table (msg);
+                t_table = g_timer_elapsed (timer, NULL);
+
+                g_print ("%-45s %10.1f %10.1f\n", msg,
+                         t_chain * 1e9 / iterations,
+                         t_table * 1e9 / iterations);
+        }
+
+        g_timer_destroy (timer);
+
+        return failed;
+}
@@ -0,0 +1,217 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Benchmark of the face cache: writes a picture for each of a number
+ * of synthetic users, then times what a greeter start costs when every
+ * picture is decoded and scaled, what building the cache pack costs,
+ * and what a greeter start costs when it takes the thumbnails out of
+ * the mapped pack.  Also checks that both give the same pixels.
+ *
+ * usage: test-face-cache [users] [picture-size]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "mdm-bench.h"
+#include "mdm-face-cache.h"
+#include "mdm-face-thumb.h"
+
+#define FIRST_UID 10000
+
+typedef struct {
+        guint32  uid;
+        char    *path;
+        gint64   mtime;
+        guint64  size;
+        guchar   pixels[MDM_FACE_CACHE_THUMB_BYTES];
+} User;
+
+/* Something a bit more work to decode than a flat colour */
+static gboolean
+write_picture (const char *path, guint32 uid, int size)
+{
+        GdkPixbuf *img;
+        guchar    *pixels;
+        int        rowstride, x, y;
+        gboolean   ret;
+
+        img = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, size, size);
+        pixels = gdk_pixbuf_get_pixels (img);
+        rowstride = gdk_pixbuf_get_rowstride (img);
+
+        for (y = 0; y < size; y++) {
+                for (x = 0; x < size; x++) {
+                        guchar *p = pixels + y * rowstride + x * 3;
+
+                        p[0] = (x * 255 / size) ^ (uid & 0xff);
+                        p[1] = (y * 255 / size) ^ ((uid >> 8) & 0xff);
+                        p[2] = ((x + y) * 127 / size) + (uid % 7) * 16;
+                }
+        }
+
+        ret = gdk_pixbuf_save (img, path, "png", NULL, NULL);
+        g_object_unref (G_OBJECT (img));
+        return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+        int           n_users = 2000;
+        int           picture_size = 256;
+        char         *dir, *pack;
+        User         *users;
+        GArray       *thumbs;
+        MdmFaceCache *cache;
+        struct stat   s;
+        double        start, scaled, built, mapped;
+        int           i, mismatches = 0, misses = 0;
+
+        if (argc > 1)
+                n_users = MAX (1, atoi (argv[1]));
+        if (argc > 2)
+                picture_size = MAX (1, atoi (argv[2]));
+
+        dir = g_dir_make_tmp ("mdm-face-cache-XXXXXX", NULL);
+        if (dir == NULL) {
+                perror ("g_dir_make_tmp");
+                return 1;
+        }
+        pack = g_build_filename (dir, "faces", NULL);
+
+        g_print ("Writing %d pictures of %dx%d to %s\n",
+                 n_users, picture_size, picture_size, dir);
+
+        users = g_new0 (User, n_users);
+        for (i = 0; i < n_users; i++) {
+                User *user = &users[i];
+
+                user->uid = FIRST_UID + i;
+                user->path = g_strdup_printf ("%s/face-%u.png", dir, user->uid);
+                if ( ! write_picture (user->path, user->uid, picture_size) ||
+                     g_stat (user->path, &s) < 0) {
+                        g_printerr ("cannot write %s\n", user->path);
+                        return 1;
+                }
+                user->mtime = s.st_mtime;
+                user->size = s.st_size;
+        }
+
+        /* what every greeter start did so far */
+        start = mdm_bench_now ();
+        for (i = 0; i < n_users; i++) {
+                int fd = open (users[i].path, O_RDONLY);
+
+                if (fd < 0 ||
+                    ! mdm_face_thumb_scale_fd (fd, users[i].size, users[i].pixels)) {
+                        g_printerr ("cannot scale %s\n", users[i].path);
+                        return 1;
+                }
+                close (fd);
+        }
+        scaled = mdm_bench_now () - start;
+
+        /* what the slave does once */
+        start = mdm_bench_now ();
+        thumbs = g_array_sized_new (FALSE, FALSE, sizeof (MdmFaceCacheThumb), n_users);
+        for (i = 0; i < n_users; i++) {
+                MdmFaceCacheThumb thumb;
+
+                thumb.uid = users[i].uid;
+                thumb.path = users[i].path;
+                thumb.mtime = users[i].mtime;
+                thumb.size = users[i].size;
+                thumb.pixels = users[i].pixels;
+                g_array_append_val (thumbs, thumb);
+        }
+        if ( ! mdm_face_cache_write (pack, thumbs)) {
+                g_printerr ("cannot write %s\n", pack);
+                return 1;
+        }
+        built = mdm_bench_now () - start;
+        g_array_free (thumbs, TRUE);
+
+        /* what every greeter start does from now on */
+        start = mdm_bench_now ();
+        cache = mdm_face_cache_open (pack);
+        if (cache == NULL) {
+                g_printerr ("cannot open %s\n", pack);
+                return 1;
+        }
+        for (i = 0; i < n_users; i++) {
+                const guchar *pixels;
+                GdkPixbuf    *img;
+
+                pixels = mdm_face_cache_lookup (cache, users[i].uid, NULL,
+                                                users[i].mtime, users[i].size);
+                if (pixels == NULL) {
+                        misses++;
+                        continue;
+                }
+
+                img = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+                                      MDM_FACE_CACHE_THUMB_SIZE,
+                                      MDM_FACE_CACHE_THUMB_SIZE);
+                if (gdk_pixbuf_get_rowstride (img) == MDM_FACE_CACHE_THUMB_SIZE * 4)
+                        memcpy (gdk_pixbuf_get_pixels (img), pixels,
+                                MDM_FACE_CACHE_THUMB_BYTES);
+                if (memcmp (pixels, users[i].pixels, MDM_FACE_CACHE_THUMB_BYTES) != 0)
+                        mismatches++;
+                g_object_unref (G_OBJECT (img));
+        }
+        mapped = mdm_bench_now () - start;
+
+        g_stat (pack, &s);
+
+        g_print ("users:             %d\n", n_users);
+        g_print ("decode and scale:  %.3f s  (%.3f ms per user)\n",
+                 scaled, scaled * 1000.0 / n_users);
+        g_print ("build pack:        %.3f s  (%ld KB)\n",
+                 built, (long) s.st_size / 1024);
+        g_print ("from pack:         %.3f s  (%.4f ms per user)\n",
+                 mapped, mapped * 1000.0 / n_users);
+        g_print ("speedup:           %.0fx\n", mapped > 0 ? scaled / mapped : 0.0);
+        g_print ("misses:            %d\n", misses);
+        g_print ("mismatches:        %d\n", mismatches);
+
+        mdm_face_cache_close (cache);
+
+        for (i = 0; i < n_users; i++) {
+                g_unlink (users[i].path);
+                g_free (users[i].path);
+        }
+        g_unlink (pack);
+        g_rmdir (dir);
+        g_free (users);
+        g_free (pack);
+        g_free (dir);
+
+        return (misses == 0 && mismatches == 0) ? 0 : 1;
+}
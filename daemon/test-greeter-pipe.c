@@ -0,0 +1,232 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Benchmark of the slave side of a greeter round trip: sends a command
+ * to a fake greeter over a pipe and reads the STX framed reply, once
+ * one byte per read() as the slave used to and once through the
+ * buffered MdmFdReader.  Reports the read syscalls (from
+ * /proc/self/io) and the latency per round trip.
+ *
+ * usage: test-greeter-pipe [round-trips] [reply-bytes]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include "mdm-bench.h"
+#include "mdm-fd-reader.h"
+
+#define STX 0x2
+
+/* read syscalls made by this process so far, -1 if unknown */
+static long
+read_syscalls (void)
+{
+        char  line[128];
+        long  syscr = -1;
+        FILE *fp;
+
+        fp = fopen ("/proc/self/io", "r");
+        if (fp == NULL)
+                return -1;
+        while (fgets (line, sizeof (line), fp) != NULL) {
+                if (sscanf (line, "syscr: %ld", &syscr) == 1)
+                        break;
+        }
+        fclose (fp);
+        return syscr;
+}
+
+/* Answers every command line with an STX framed reply written in one
+ * go, like the greeters do with printf and fflush */
+static void
+fake_greeter (int in, int out, int reply_bytes)
+{
+        FILE *fp = fdopen (in, "r");
+        char  line[256];
+        char *reply;
+
+        reply = g_malloc (reply_bytes + 2);
+        reply[0] = STX;
+        memset (reply + 1, 'x', reply_bytes);
+        reply[reply_bytes + 1] = '\n';
+
+        while (fgets (line, sizeof (line), fp) != NULL) {
+                if (write (out, reply, reply_bytes + 2) != reply_bytes + 2)
+                        break;
+        }
+        _exit (0);
+}
+
+/* The slave's reply reading before MdmFdReader */
+static int
+bytewise_getc (int fd)
+{
+        unsigned char buf[1];
+        int bytes;
+
+        bytes = read (fd, buf, 1);
+        return (bytes == 1) ? (int) buf[0] : EOF;
+}
+
+static char *
+bytewise_gets (int fd)
+{
+        GString *gs = g_string_new (NULL);
+        int c;
+
+        while ((c = bytewise_getc (fd)) != '\n') {
+                if (c == EOF) {
+                        if (gs->len == 0) {
+                                g_string_free (gs, TRUE);
+                                return NULL;
+                        }
+                        break;
+                }
+                g_string_append_c (gs, c);
+        }
+        return g_string_free (gs, FALSE);
+}
+
+static char *
+read_reply (int fd, MdmFdReader *reader)
+{
+        int c;
+
+        do {
+                c = (reader != NULL) ? mdm_fd_reader_getc (reader) : bytewise_getc (fd);
+        } while (c != EOF && c != STX);
+
+        if (c == EOF)
+                return NULL;
+        return (reader != NULL) ? mdm_fd_reader_gets (reader) : bytewise_gets (fd);
+}
+
+static gboolean
+run (const char *name, gboolean buffered, int round_trips, int reply_bytes)
+{
+        static const char command[] = "\002" "Eusername\n";
+        MdmFdReader reader;
+        GArray *latencies;
+        double  start, total;
+        MdmBenchPercentiles pct;
+        long    syscr;
+        int     to_greeter[2], from_greeter[2];
+        pid_t   pid;
+        int     i;
+
+        if (pipe (to_greeter) < 0 || pipe (from_greeter) < 0) {
+                perror ("pipe");
+                return FALSE;
+        }
+
+        pid = fork ();
+        if (pid < 0) {
+                perror ("fork");
+                return FALSE;
+        }
+        if (pid == 0) {
+                close (to_greeter[1]);
+                close (from_greeter[0]);
+                fake_greeter (to_greeter[0], from_greeter[1], reply_bytes);
+        }
+        close (to_greeter[0]);
+        close (from_greeter[1]);
+
+        mdm_fd_reader_init (&reader, from_greeter[0]);
+        latencies = g_array_sized_new (FALSE, FALSE, sizeof (double), round_trips);
+
+        syscr = read_syscalls ();
+        start = mdm_bench_now ();
+        for (i = 0; i < round_trips; i++) {
+                double t = mdm_bench_now ();
+                char  *reply;
+
+                if (write (to_greeter[1], command, sizeof (command) - 1) != sizeof (command) - 1) {
+                        perror ("write");
+                        break;
+                }
+                reply = read_reply (from_greeter[0], buffered ? &reader : NULL);
+                if (reply == NULL || (int) strlen (reply) != reply_bytes) {
+                        g_printerr ("%s: bad reply on round trip %d\n", name, i);
+                        g_free (reply);
+                        break;
+                }
+                g_free (reply);
+
+                t = mdm_bench_now () - t;
+                g_array_append_val (latencies, t);
+        }
+        total = mdm_bench_now () - start;
+        if (syscr >= 0)
+                syscr = read_syscalls () - syscr;
+
+        close (to_greeter[1]);
+        close (from_greeter[0]);
+        waitpid (pid, NULL, 0);
+
+        if ( ! mdm_bench_percentiles (latencies, &pct)) {
+                g_array_free (latencies, TRUE);
+                return FALSE;
+        }
+
+        g_print ("%-9s %6u round trips in %.3f s", name, latencies->len, total);
+        if (syscr >= 0)
+                /* the /proc read itself counts once */
+                g_print (", %.1f reads each", (double) (syscr - 1) / latencies->len);
+        g_print ("\n          latency us: median %.1f  p99 %.1f  max %.1f\n",
+                 pct.median * 1000000.0,
+                 pct.p99 * 1000000.0,
+                 pct.max * 1000000.0);
+
+        i = latencies->len;
+        g_array_free (latencies, TRUE);
+        return i == round_trips;
+}
+
+int
+main (int argc, char **argv)
+{
+        int      round_trips = 10000;
+        int      reply_bytes = 64;
+        gboolean ok;
+
+        if (argc > 1)
+                round_trips = MAX (1, atoi (argv[1]));
+        if (argc > 2)
+                reply_bytes = CLAMP (atoi (argv[2]), 1, 64 * 1024);
+
+        signal (SIGPIPE, SIG_IGN);
+
+        g_print ("Greeter round trips with %d byte replies\n", reply_bytes);
+
+        ok = run ("bytewise", FALSE, round_trips, reply_bytes);
+        ok = run ("buffered", TRUE, round_trips, reply_bytes) && ok;
+
+        return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Checks that the daemon's per-display lookups parse a display's file
+ * once, and while the files are watched do not look at it again until
+ * it is forgotten.  Reports the cost of a lookup.
+ *
+ * usage: test-per-display-config [lookups]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "mdm-common.h"
+#include "mdm-per-display-config.h"
+#include "mdm-daemon-config-entries.h"
+
+static const MdmConfigEntry *
+entry_for_id (int id)
+{
+        int i;
+
+        for (i = 0; mdm_daemon_config_entries[i].group != NULL; i++)
+                if (mdm_daemon_config_entries[i].id == id)
+                        return &mdm_daemon_config_entries[i];
+
+        g_assert_not_reached ();
+        return NULL;
+}
+
+static gboolean
+lookup_is (const char *display, const MdmConfigEntry *entry,
+           const char *default_value, const char *expected)
+{
+        char    *value;
+        gboolean ret;
+
+        if ( ! mdm_per_display_config_get_value (display, entry, default_value, &value))
+                return expected == NULL;
+
+        ret = expected != NULL && strcmp (value, expected) == 0;
+        g_free (value);
+
+        return ret;
+}
+
+int
+main (int argc, char **argv)
+{
+        const MdmConfigEntry *system_menu;
+        const MdmConfigEntry *pam_stack;
+        const MdmConfigEntry *welcome;
+        GTimer               *timer;
+        char                 *base;
+        char                 *file;
+        int                   n_lookups = 1000000;
+        int                   i;
+
+        if (argc > 1)
+                n_lookups = MAX (1, atoi (argv[1]));
+
+        system_menu = entry_for_id (MDM_ID_SYSTEM_MENU);
+        pam_stack = entry_for_id (MDM_ID_PAM_STACK);
+        welcome = entry_for_id (MDM_ID_WELCOME);
+
+        base = g_build_filename (g_get_tmp_dir (), "mdm-test-custom.conf", NULL);
+        file = g_strconcat (base, ":0", NULL);
+        g_file_set_contents (file,
+                             "[greeter]\nSystemMenu=false\n"
+                             "[security]\nPamStack=other\n", -1, NULL);
+
+        mdm_per_display_config_set_base_file (base);
+        mdm_per_display_config_set_watched (TRUE);
+
+        /* Any number of lookups parse the file once */
+        timer = g_timer_new ();
+        for (i = 0; i < n_lookups; i++)
+                g_assert (lookup_is (":0", system_menu, "true", "false"));
+        g_timer_stop (timer);
+        g_assert (mdm_per_display_config_get_parse_count () == 1);
+
+        g_assert (lookup_is (":0", pam_stack, "mdm", "other"));
+
+        /* A key the file does not have gives the key string's default,
+         * or nothing so that the daemon wide value is used */
+        g_assert (lookup_is (":0", welcome, "Welcome", "Welcome"));
+        g_assert (lookup_is (":0", welcome, NULL, NULL));
+
+        /* A display without a file is never parsed */
+        for (i = 0; i < 1000; i++)
+                g_assert (lookup_is (":1", system_menu, "true", NULL));
+        g_assert (mdm_per_display_config_get_parse_count () == 1);
+
+        /* While watched a change is only seen once the watch says so */
+        g_file_set_contents (file, "[greeter]\nSystemMenu=true\n", -1, NULL);
+        g_assert (lookup_is (":0", system_menu, "true", "false"));
+        g_assert (mdm_per_display_config_get_parse_count () == 1);
+
+        mdm_per_display_config_forget (":0");
+        g_assert (lookup_is (":0", system_menu, "true", "true"));
+        g_assert (mdm_per_display_config_get_parse_count () == 2);
+
+        /* and without the watch the file is checked on every lookup */
+        mdm_per_display_config_set_watched (FALSE);
+        g_file_set_contents (file, "[greeter]\nSystemMenu=false\nExtra=1\n", -1, NULL);
+        g_assert (lookup_is (":0", system_menu, "true", "false"));
+        g_assert (mdm_per_display_config_get_parse_count () == 3);
+
+        g_print ("%d per-display lookups: %.3f s (%.3f us per lookup), %u parses\n",
+                 n_lookups, g_timer_elapsed (timer, NULL),
+                 g_timer_elapsed (timer, NULL) * 1000000.0 / n_lookups,
+                 mdm_per_display_config_get_parse_count ());
+
+        mdm_per_display_config_close ();
+        g_timer_destroy (timer);
+        g_unlink (file);
+        g_free (file);
+        g_free (base);
+
+        return 0;
+}
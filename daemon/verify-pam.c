@@ -134,6 +134,7 @@ void mdm_verify_set_user_settings (const char *user) {
 			return;
 		}
 		mdm_daemon_config_get_user_session_lang (&session, &language, home_dir);
+		mdm_slave_greeter_batch_begin ();
 		if (!ve_string_empty(session)) {
 			mdm_debug("mdm_verify_set_user_settings: Found session '%s'.", session);
 			mdm_slave_greeter_ctl_no_ret (MDM_SETSESS, session);
@@ -153,6 +154,7 @@ void mdm_verify_set_user_settings (const char *user) {
 				mdm_slave_greeter_ctl_no_ret (MDM_SETLANG, mdmlang);
 			}
 		}
+		mdm_slave_greeter_batch_end ();
 
 		g_free (home_dir);
 	}
@@ -287,9 +289,12 @@ mdm_verify_pam_conv (int num_msg,
 					   know this is a username prompt.  However we SHOULD NOT
 					   rely on this working.  The pam modules can set their
 					   prompt to whatever they wish to */
+					/* the message goes out with the prompt */
+					mdm_slave_greeter_batch_begin ();
 					mdm_slave_greeter_ctl_no_ret
 						(MDM_MSG, _("Please enter your username"));
 					s = mdm_slave_greeter_ctl (MDM_PROMPT, m);
+					mdm_slave_greeter_batch_end ();
 					/* this will clear the message */
 					mdm_slave_greeter_ctl_no_ret (MDM_MSG, "");
 				}
@@ -181,8 +181,7 @@ process_operation (guchar       op_code,
 	 * wants to log in, and well, we are the gullible kind */
 	
 	greeter_item_pam_set_user (args);
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_PROMPT:
@@ -230,8 +229,7 @@ process_operation (guchar       op_code,
 	tmp = ve_locale_to_utf8 (args);
 	greeter_item_pam_message (tmp);
 	g_free (tmp);
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_ERRBOX:
@@ -239,8 +237,7 @@ process_operation (guchar       op_code,
 	greeter_item_pam_error (tmp);
 	g_free (tmp);
 	
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_ERRDLG:
@@ -282,8 +279,7 @@ process_operation (guchar       op_code,
 
 	case MDM_SETSESS:
 		current_session = args;
-		printf ("%c\n", STX);
-        fflush (stdout);
+		mdm_common_greeter_ack ();
 		break;
 
     case MDM_SETLANG:
@@ -317,8 +313,7 @@ process_operation (guchar       op_code,
 	    g_free (tmp);
 	  }
 
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	greeter_ignore_buttons (FALSE);
         greeter_item_ulist_enable ();
 
@@ -374,15 +369,13 @@ process_operation (guchar       op_code,
     case MDM_STARTTIMER:
 	greeter_item_timed_start ();
 	
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_STOPTIMER:
 	greeter_item_timed_stop ();
 
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_DISABLE:
@@ -401,8 +394,7 @@ process_operation (guchar       op_code,
 		     NULL);
 	  }
 
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_ENABLE:
@@ -414,8 +406,7 @@ process_operation (guchar       op_code,
 	    disabled_cover = NULL;
 	  }
 
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     /* These are handled separately so ignore them here and send
@@ -429,15 +420,13 @@ process_operation (guchar       op_code,
     case MDM_NOFOCUS:
 	mdm_wm_no_login_focus_push ();
 	
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_FOCUS:
 	mdm_wm_no_login_focus_pop ();
 	
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_SAVEDIE:
@@ -461,6 +450,10 @@ process_operation (guchar       op_code,
 
 	break;
 	
+    case MDM_BATCH:
+	mdm_common_greeter_batch (args, process_operation);
+	break;
+
     default:
 	mdm_common_fail_greeter ("Unexpected greeter command received: '%c'", op_code);
 	break;
@@ -536,7 +529,7 @@ greeter_setup_items (void)
   greeter_item_clock_setup ();
   greeter_item_pam_setup ();
 
-  /* This will query the daemon for pictures through stdin/stdout! */
+  /* The faces are asked for over the face socket as rows show up */
   greeter_item_ulist_setup ();
 
   greeter_item_capslock_setup (window);
@@ -574,12 +567,53 @@ mdm_set_welcomemsg (void)
 
 /*
  * If new configuration keys are added to this program, make sure to add the
- * key to the mdm_read_config and mdm_reread_config functions.  Note if the
- * number of configuration values used by mdmlogin is greater than 
- * MDM_SUP_MAX_MESSAGES defined in daemon/mdm.h (currently defined to be 80),
- * consider bumping that number so that all the config can be read in one
- * socket connection.
+ * key to config_keys and to one of the key groups greeter_reread_config reads
+ * again.  The keys in config_keys are all read with a single
+ * GET_CONFIG_MULTI request.
  */
+static const MdmConfigKey config_keys[] = {
+	{ MDM_KEY_GRAPHICAL_THEME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GRAPHICAL_THEME_DIR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTKRC, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTK_THEME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INCLUDE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_EXCLUDE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SESSION_DESKTOP_DIR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_LOCALE_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_HALT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_REBOOT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SUSPEND, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_CONFIGURATOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INFO_MSG_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INFO_MSG_FONT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_TIMED_LOGIN, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_BACKGROUND_COLOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_FACE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_SESSION, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SOUND_PROGRAM, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SOUND_ON_LOGIN_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_USE_24_CLOCK, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_WELCOME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SYSTEM_COMMANDS_IN_MENU, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_PRIMARY_MONITOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_TIMED_LOGIN_DELAY, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_FLEXI_REAP_DELAY_MINUTES, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MAX_ICON_HEIGHT, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MAX_ICON_WIDTH, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MINIMAL_UID, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_ENTRY_CIRCLES, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ENTRY_INVISIBLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_INCLUDE_ALL, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_SYSTEM_MENU, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_CONFIG_AVAILABLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_TIMED_LOGIN_ENABLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ALLOW_ROOT, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_SOUND_ON_LOGIN, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_DEFAULT_WELCOME, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ADD_GTK_MODULES, MDM_CONFIG_KEY_BOOL },
+};
+
 static void
 mdm_read_config (void)
 {
@@ -592,47 +626,7 @@ mdm_read_config (void)
 	 * Read all the keys at once and close sockets connection so we do
 	 * not have to keep the socket open.
 	 */
-	mdm_config_get_string (MDM_KEY_GRAPHICAL_THEME);
-	mdm_config_get_string (MDM_KEY_GRAPHICAL_THEME_DIR);
-	mdm_config_get_string (MDM_KEY_GTKRC);
-	mdm_config_get_string (MDM_KEY_GTK_THEME);
-	mdm_config_get_string (MDM_KEY_INCLUDE);
-	mdm_config_get_string (MDM_KEY_EXCLUDE);
-	mdm_config_get_string (MDM_KEY_SESSION_DESKTOP_DIR);
-	mdm_config_get_string (MDM_KEY_LOCALE_FILE);
-	mdm_config_get_string (MDM_KEY_HALT);
-	mdm_config_get_string (MDM_KEY_REBOOT);
-	mdm_config_get_string (MDM_KEY_SUSPEND);
-	mdm_config_get_string (MDM_KEY_CONFIGURATOR);
-	mdm_config_get_string (MDM_KEY_INFO_MSG_FILE);
-	mdm_config_get_string (MDM_KEY_INFO_MSG_FONT);
-	mdm_config_get_string (MDM_KEY_TIMED_LOGIN);
-	mdm_config_get_string (MDM_KEY_BACKGROUND_COLOR);
-	mdm_config_get_string (MDM_KEY_DEFAULT_FACE);
-	mdm_config_get_string (MDM_KEY_DEFAULT_SESSION);
-	mdm_config_get_string (MDM_KEY_SOUND_PROGRAM);
-	mdm_config_get_string (MDM_KEY_SOUND_ON_LOGIN_FILE);
-	mdm_config_get_string (MDM_KEY_USE_24_CLOCK);
-	mdm_config_get_string (MDM_KEY_WELCOME);
-        mdm_config_get_string (MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS);
-        mdm_config_get_string (MDM_KEY_SYSTEM_COMMANDS_IN_MENU);
-
-	mdm_config_get_string    (MDM_KEY_PRIMARY_MONITOR);
-	mdm_config_get_int    (MDM_KEY_TIMED_LOGIN_DELAY);
-	mdm_config_get_int    (MDM_KEY_FLEXI_REAP_DELAY_MINUTES);
-	mdm_config_get_int    (MDM_KEY_MAX_ICON_HEIGHT);
-	mdm_config_get_int    (MDM_KEY_MAX_ICON_WIDTH);
-	mdm_config_get_int    (MDM_KEY_MINIMAL_UID);
-	mdm_config_get_bool   (MDM_KEY_ENTRY_CIRCLES);
-	mdm_config_get_bool   (MDM_KEY_ENTRY_INVISIBLE);
-	mdm_config_get_bool   (MDM_KEY_INCLUDE_ALL);
-	mdm_config_get_bool   (MDM_KEY_SYSTEM_MENU);
-	mdm_config_get_bool   (MDM_KEY_CONFIG_AVAILABLE);
-	mdm_config_get_bool   (MDM_KEY_TIMED_LOGIN_ENABLE);
-	mdm_config_get_bool   (MDM_KEY_ALLOW_ROOT);
-	mdm_config_get_bool   (MDM_KEY_SOUND_ON_LOGIN);
-	mdm_config_get_bool   (MDM_KEY_DEFAULT_WELCOME);
-	mdm_config_get_bool   (MDM_KEY_ADD_GTK_MODULES);		
+	mdm_config_prefetch (config_keys, G_N_ELEMENTS (config_keys));
 
 	/* Keys not to include in reread_config */
 	mdm_config_get_string (MDM_KEY_SESSION_DESKTOP_DIR);
@@ -641,83 +635,100 @@ mdm_read_config (void)
 	mdmcomm_close_connection_to_daemon ();
 }
 
-static gboolean
-greeter_reread_config (int sig, gpointer data)
-{
-	gint i;
-	gchar *key_string = NULL;
-		
-	mdmcomm_open_connection_to_daemon ();
+/* A change to any of these restarts the greeter */
+static const MdmConfigKey restart_keys[] = {
+	{ MDM_KEY_GRAPHICAL_THEME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GRAPHICAL_THEME_DIR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTKRC, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTK_THEME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INCLUDE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_EXCLUDE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SESSION_DESKTOP_DIR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_LOCALE_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_HALT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_REBOOT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SUSPEND, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_CONFIGURATOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INFO_MSG_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INFO_MSG_FONT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_TIMED_LOGIN, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_BACKGROUND_COLOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_FACE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_SESSION, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SYSTEM_COMMANDS_IN_MENU, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_PRIMARY_MONITOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_TIMED_LOGIN_DELAY, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_FLEXI_REAP_DELAY_MINUTES, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MAX_ICON_HEIGHT, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MAX_ICON_WIDTH, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MINIMAL_UID, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_ENTRY_CIRCLES, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ENTRY_INVISIBLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_INCLUDE_ALL, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_SYSTEM_MENU, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_CONFIG_AVAILABLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_TIMED_LOGIN_ENABLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ALLOW_ROOT, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ADD_GTK_MODULES, MDM_CONFIG_KEY_BOOL },
+};
+
+/* Only used when needed, nothing to do but keep them current */
+static const MdmConfigKey sound_keys[] = {
+	{ MDM_KEY_SOUND_PROGRAM, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SOUND_ON_LOGIN, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_SOUND_ON_LOGIN_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_USE_24_CLOCK, MDM_CONFIG_KEY_STRING },
+};
+
+static const MdmConfigKey welcome_keys[] = {
+	{ MDM_KEY_WELCOME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_WELCOME, MDM_CONFIG_KEY_BOOL },
+};
 
+static void
+restart_keys_reloaded (gboolean changed, gpointer data)
+{
 	/* FIXME: The following is evil, we should update on the fly rather
 	 * then just restarting */
-	/* Also we may not need to check ALL those keys but just a few */
-	if (mdm_config_reload_string (MDM_KEY_GRAPHICAL_THEME) ||	    
-	    mdm_config_reload_string (MDM_KEY_GRAPHICAL_THEME_DIR) ||
-	    mdm_config_reload_string (MDM_KEY_GTKRC) ||
-	    mdm_config_reload_string (MDM_KEY_GTK_THEME) ||
-	    mdm_config_reload_string (MDM_KEY_INCLUDE) ||
-	    mdm_config_reload_string (MDM_KEY_EXCLUDE) ||
-	    mdm_config_reload_string (MDM_KEY_SESSION_DESKTOP_DIR) ||
-	    mdm_config_reload_string (MDM_KEY_LOCALE_FILE) ||
-	    mdm_config_reload_string (MDM_KEY_HALT) ||
-	    mdm_config_reload_string (MDM_KEY_REBOOT) ||
-	    mdm_config_reload_string (MDM_KEY_SUSPEND) ||
-	    mdm_config_reload_string (MDM_KEY_CONFIGURATOR) ||
-	    mdm_config_reload_string (MDM_KEY_INFO_MSG_FILE) ||
-	    mdm_config_reload_string (MDM_KEY_INFO_MSG_FONT) ||
-	    mdm_config_reload_string (MDM_KEY_TIMED_LOGIN) ||
-	    mdm_config_reload_string (MDM_KEY_BACKGROUND_COLOR) ||
-	    mdm_config_reload_string (MDM_KEY_DEFAULT_FACE) ||
-	    mdm_config_reload_string (MDM_KEY_DEFAULT_SESSION) ||
-            mdm_config_reload_string (MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS) ||
-            mdm_config_reload_string (MDM_KEY_SYSTEM_COMMANDS_IN_MENU) ||
-
-	    mdm_config_reload_string    (MDM_KEY_PRIMARY_MONITOR) ||
-	    mdm_config_reload_int    (MDM_KEY_TIMED_LOGIN_DELAY) ||
-	    mdm_config_reload_int    (MDM_KEY_FLEXI_REAP_DELAY_MINUTES) ||
-	    mdm_config_reload_int    (MDM_KEY_MAX_ICON_HEIGHT) ||
-	    mdm_config_reload_int    (MDM_KEY_MAX_ICON_WIDTH) ||
-	    mdm_config_reload_int    (MDM_KEY_MINIMAL_UID) ||
-
-	    mdm_config_reload_bool   (MDM_KEY_ENTRY_CIRCLES) ||
-	    mdm_config_reload_bool   (MDM_KEY_ENTRY_INVISIBLE) ||
-	    mdm_config_reload_bool   (MDM_KEY_INCLUDE_ALL) ||
-	    mdm_config_reload_bool   (MDM_KEY_SYSTEM_MENU) ||
-	    mdm_config_reload_bool   (MDM_KEY_CONFIG_AVAILABLE) ||
-	    mdm_config_reload_bool   (MDM_KEY_TIMED_LOGIN_ENABLE) ||
-	    mdm_config_reload_bool   (MDM_KEY_ALLOW_ROOT) ||
-	    mdm_config_reload_bool   (MDM_KEY_ADD_GTK_MODULES)) {
-
-		/* Set busy cursor */
-		mdm_common_setup_cursor (GDK_WATCH);
-
-		mdm_wm_save_wm_order ();
-		mdmcomm_close_connection_to_daemon ();
-
-		_exit (DISPLAY_RESTARTGREETER);
-	}	
-
-	mdm_config_reload_string (MDM_KEY_SOUND_PROGRAM);
-	mdm_config_reload_bool   (MDM_KEY_SOUND_ON_LOGIN);
-	mdm_config_reload_string (MDM_KEY_SOUND_ON_LOGIN_FILE);
-	mdm_config_reload_string (MDM_KEY_USE_24_CLOCK);
-
-	if (mdm_config_reload_string (MDM_KEY_WELCOME) ||
-	    mdm_config_reload_bool   (MDM_KEY_DEFAULT_WELCOME)) {
-
-		mdm_set_welcomemsg ();
-
-		/* Set busy cursor */
-		mdm_common_setup_cursor (GDK_WATCH);
-
-		mdm_wm_save_wm_order ();
-		mdmcomm_close_connection_to_daemon ();
-
-		_exit (DISPLAY_RESTARTGREETER);
-	}
+	if ( ! changed)
+		return;
 
-	mdmcomm_close_connection_to_daemon ();
+	/* Set busy cursor */
+	mdm_common_setup_cursor (GDK_WATCH);
+
+	mdm_wm_save_wm_order ();
+
+	_exit (DISPLAY_RESTARTGREETER);
+}
+
+static void
+welcome_keys_reloaded (gboolean changed, gpointer data)
+{
+	if ( ! changed)
+		return;
+
+	mdm_set_welcomemsg ();
+
+	/* Set busy cursor */
+	mdm_common_setup_cursor (GDK_WATCH);
+
+	mdm_wm_save_wm_order ();
+
+	_exit (DISPLAY_RESTARTGREETER);
+}
+
+/* The keys are read again without waiting for the daemon, each group
+ * is acted on once its answers are in */
+static gboolean
+greeter_reread_config (int sig, gpointer data)
+{
+	mdm_config_reload_async (restart_keys, G_N_ELEMENTS (restart_keys),
+				 restart_keys_reloaded, NULL);
+	mdm_config_reload_async (sound_keys, G_N_ELEMENTS (sound_keys),
+				 NULL, NULL);
+	mdm_config_reload_async (welcome_keys, G_N_ELEMENTS (welcome_keys),
+				 welcome_keys_reloaded, NULL);
 
 	return TRUE;
 }
@@ -882,6 +893,8 @@ main (int argc, char *argv[])
   gint i;
   gchar *key_string = NULL;
 
+  mdm_common_trace_init ("mdmgreeter");
+
   if (g_getenv ("DOING_MDM_DEVELOPMENT") != NULL)
     DOING_MDM_DEVELOPMENT = TRUE;
 
@@ -1191,6 +1204,7 @@ main (int argc, char *argv[])
 
   mdm_common_setup_blinking ();
 
+  mdm_common_trace_first_frame (window);
   gtk_widget_show_all (window);
   gtk_window_move (GTK_WINDOW (window), mdm_wm_screen.x, mdm_wm_screen.y);
   gtk_widget_show_now (window);
@@ -49,13 +49,14 @@
 #include "greeter_configuration.h"
 #include "greeter_item.h"
 
-static GList      *users = NULL;
-static GList      *users_string = NULL;
+static MdmUsersLoader *users_loader = NULL;
+static gboolean    users_loaded = FALSE;
 static GdkPixbuf  *defface;
 static GHashTable *displays_hash = NULL;
 
 static GtkWidget  *pam_entry = NULL;
 static GtkWidget  *user_list = NULL;
+static GreeterItemInfo *user_list_info = NULL;
 static gboolean    selecting_user = FALSE;
 static gchar      *selected_user = NULL;
 static int         num_users = 0;
@@ -77,8 +78,9 @@ greeter_item_ulist_check_show_userlist (void)
 	 * then hide the rectangle used to contain the userlist.  The
 	 * userlist-rect id allows a rectangle to be defined with alpha
 	 * behind the userlist that also goes away when the list is empty.
+	 * Not before all users are in though.
 	 */
-	if (num_users == 0) {
+	if (num_users == 0 && users_loaded) {
 
 		GreeterItemInfo *urinfo = greeter_lookup_id ("userlist-rect");
 
@@ -159,30 +161,34 @@ check_for_displays (void)
 	g_strfreev (vec);
 }
 
-static void 
-mdm_greeter_users_init (void)
+/* Reset size of the widget canvas item so it is the same size as the
+ * userlist.  This avoids the ugly white background displayed below the
+ * Face Browser when the list isn't as large as the rectangle defined in
+ * the MDM theme file. */
+static void
+fit_userlist_item (void)
 {
-	gint   size_of_users = 0;
+	GtkRequisition req;
+	gdouble        height;
 
-	defface = mdm_common_get_face (NULL,
-				       mdm_config_get_string (MDM_KEY_DEFAULT_FACE),
-				       mdm_config_get_int (MDM_KEY_MAX_ICON_WIDTH),
-				       mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT));
-	if (! defface) {
-		mdm_common_warning ("Can't open DefaultFace: %s!", mdm_config_get_string (MDM_KEY_DEFAULT_FACE));
-	}
+	if (user_list == NULL || user_list_info == NULL)
+		return;
+
+	gtk_widget_size_request (user_list, &req);
+	g_object_get (user_list_info->item, "height", &height, NULL);
 
-	mdm_users_init (&users, &users_string, NULL, defface, &size_of_users, MDM_IS_LOCAL, !DOING_MDM_DEVELOPMENT);
+	if (req.height < height)
+		g_object_set (user_list_info->item, "height", (double)req.height, NULL);
 }
 
 static void
-greeter_populate_user_list (GtkTreeModel *tm)
+greeter_add_users (GPtrArray *users, gboolean done, gpointer data)
 {
-	GList *li;
+	GtkTreeModel *tm = data;
+	guint         i;
 
-	for (li = users; li != NULL; li = li->next) {
-		MdmUser    *usr = li->data;
-		GtkTreeIter iter = {0};
+	for (i = 0; i < users->len; i++) {
+		MdmUser    *usr = g_ptr_array_index (users, i);
 		char       *label;
 		char       *name;
 		gboolean    active;
@@ -193,7 +199,8 @@ greeter_populate_user_list (GtkTreeModel *tm)
 			name = mdm_common_text_to_escaped_utf8 (usr->login);
 		}
 
-		if (g_hash_table_lookup (displays_hash, usr->login))
+		if (displays_hash != NULL &&
+		    g_hash_table_lookup (displays_hash, usr->login))
 			active = TRUE;
 		else
 			active = FALSE;
@@ -209,16 +216,29 @@ greeter_populate_user_list (GtkTreeModel *tm)
 
 		g_free (name);
 
-		gtk_list_store_append (GTK_LIST_STORE (tm), &iter);
-		gtk_list_store_set (GTK_LIST_STORE (tm), &iter,
-				    GREETER_ULIST_ICON_COLUMN, usr->picture,
-				    GREETER_ULIST_LOGIN_COLUMN, usr->login,
-				    GREETER_ULIST_LABEL_COLUMN, label,
-				    GREETER_ULIST_ACTIVE_COLUMN, active,
-				    -1);
+		/* in place, the model is sorted by login */
+		gtk_list_store_insert_with_values (GTK_LIST_STORE (tm), NULL, -1,
+						   GREETER_ULIST_ICON_COLUMN, usr->picture,
+						   GREETER_ULIST_LOGIN_COLUMN, usr->login,
+						   GREETER_ULIST_LABEL_COLUMN, label,
+						   GREETER_ULIST_ACTIVE_COLUMN, active,
+						   -1);
 		g_free (label);
 		num_users++;
 	}
+
+	if (done) {
+		users_loaded = TRUE;
+
+		/* we are done with the hash */
+		if (displays_hash != NULL) {
+			g_hash_table_destroy (displays_hash);
+			displays_hash = NULL;
+		}
+
+		fit_userlist_item ();
+		greeter_item_ulist_check_show_userlist ();
+	}
 }
 
 void
@@ -273,7 +293,13 @@ greeter_generate_userlist (GtkWidget *tv, GreeterItemInfo *info)
 	GtkTreeSelection *selection;
 	GList *list, *li;
 
-	mdm_greeter_users_init ();
+	defface = mdm_common_get_face (NULL,
+				       mdm_config_get_string (MDM_KEY_DEFAULT_FACE),
+				       mdm_config_get_int (MDM_KEY_MAX_ICON_WIDTH),
+				       mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT));
+	if (! defface) {
+		mdm_common_warning ("Can't open DefaultFace: %s!", mdm_config_get_string (MDM_KEY_DEFAULT_FACE));
+	}
 
 	check_for_displays ();
 
@@ -284,57 +310,64 @@ greeter_generate_userlist (GtkWidget *tv, GreeterItemInfo *info)
 
 	selection = gtk_tree_view_get_selection (GTK_TREE_VIEW (tv));
 	gtk_tree_selection_set_mode (selection, GTK_SELECTION_SINGLE);
-	if (users != NULL) {
-		g_signal_connect (selection, "changed",
-				  G_CALLBACK (user_selected),
-				  NULL);
-
-		g_signal_connect (GTK_TREE_VIEW (tv), "button_release_event",
-				  G_CALLBACK (browser_change_focus),
-				  NULL);
-
-		tm = (GtkTreeModel *)gtk_list_store_new (4,
-							 GDK_TYPE_PIXBUF,
-							 G_TYPE_STRING,
-							 G_TYPE_STRING,
-							 G_TYPE_BOOLEAN);
-		gtk_tree_view_set_model (GTK_TREE_VIEW (tv), tm);
-		column_one = gtk_tree_view_column_new_with_attributes (_("Icon"),
-								       gtk_cell_renderer_pixbuf_new (),
-								       "pixbuf", GREETER_ULIST_ICON_COLUMN,
-								       NULL);
-		gtk_tree_view_append_column (GTK_TREE_VIEW (tv), column_one);
-
-		column_two = gtk_tree_view_column_new_with_attributes (_("Username"),
-								       gtk_cell_renderer_text_new (),
-								       "markup", GREETER_ULIST_LABEL_COLUMN,
-								       NULL);
-		gtk_tree_view_append_column (GTK_TREE_VIEW (tv), column_two);
-
-		greeter_populate_user_list (tm);
-
-		list = gtk_tree_view_column_get_cell_renderers (column_one);
-		for (li = list; li != NULL; li = li->next) {
-			GtkObject *cell = li->data;
-
-			if (info->data.list.icon_color != NULL)
-				g_object_set (cell, "cell-background",
-					      info->data.list.icon_color, NULL);
-		}
+	g_signal_connect (selection, "changed",
+			  G_CALLBACK (user_selected),
+			  NULL);
+
+	g_signal_connect (GTK_TREE_VIEW (tv), "button_release_event",
+			  G_CALLBACK (browser_change_focus),
+			  NULL);
+
+	tm = (GtkTreeModel *)gtk_list_store_new (4,
+						 GDK_TYPE_PIXBUF,
+						 G_TYPE_STRING,
+						 G_TYPE_STRING,
+						 G_TYPE_BOOLEAN);
+	gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (tm),
+					 GREETER_ULIST_LOGIN_COLUMN,
+					 mdm_users_compare_logins,
+					 GINT_TO_POINTER (GREETER_ULIST_LOGIN_COLUMN),
+					 NULL);
+	gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (tm),
+					      GREETER_ULIST_LOGIN_COLUMN,
+					      GTK_SORT_ASCENDING);
+	gtk_tree_view_set_model (GTK_TREE_VIEW (tv), tm);
+	column_one = gtk_tree_view_column_new_with_attributes (_("Icon"),
+							       gtk_cell_renderer_pixbuf_new (),
+							       "pixbuf", GREETER_ULIST_ICON_COLUMN,
+							       NULL);
+	gtk_tree_view_append_column (GTK_TREE_VIEW (tv), column_one);
+
+	column_two = gtk_tree_view_column_new_with_attributes (_("Username"),
+							       gtk_cell_renderer_text_new (),
+							       "markup", GREETER_ULIST_LABEL_COLUMN,
+							       NULL);
+	gtk_tree_view_append_column (GTK_TREE_VIEW (tv), column_two);
+
+	/* The list fills in the background, the faces of the
+	 * rows on screen are asked for as they show up */
+	users_loader = mdm_users_loader_new (defface, greeter_add_users, tm);
+	mdm_users_loader_track_view (users_loader, GTK_TREE_VIEW (tv),
+				     GREETER_ULIST_ICON_COLUMN,
+				     GREETER_ULIST_LOGIN_COLUMN);
+
+	list = gtk_tree_view_column_get_cell_renderers (column_one);
+	for (li = list; li != NULL; li = li->next) {
+		GtkObject *cell = li->data;
+
+		if (info->data.list.icon_color != NULL)
+			g_object_set (cell, "cell-background",
+				      info->data.list.icon_color, NULL);
+	}
 
-		list = gtk_tree_view_column_get_cell_renderers (column_two);
-		for (li = list; li != NULL; li = li->next) {
-			GtkObject *cell = li->data;
+	list = gtk_tree_view_column_get_cell_renderers (column_two);
+	for (li = list; li != NULL; li = li->next) {
+		GtkObject *cell = li->data;
 
-			if (info->data.list.label_color != NULL) 
-				g_object_set (cell, "background",
-					      info->data.list.label_color, NULL);
-		}
+		if (info->data.list.label_color != NULL) 
+			g_object_set (cell, "background",
+				      info->data.list.label_color, NULL);
 	}
-
-	/* we are done with the hash */
-	g_hash_table_destroy (displays_hash);
-	displays_hash = NULL;
 }
 
 static inline void
@@ -378,28 +411,12 @@ greeter_item_ulist_setup (void)
 
 		if (GTK_IS_SCROLLED_WINDOW (sw) && 
 		    GTK_IS_TREE_VIEW (GTK_BIN (sw)->child)) {
-			GtkRequisition req;
-			gdouble        height;
-
 			user_list = GTK_BIN (sw)->child;
+			user_list_info = info;
 
 			force_no_tree_separators (user_list);
 
 			greeter_generate_userlist (user_list, info);
-
-			/* Reset size of the widget canvas item so it
-			 * is the same size as the userlist.  This
-			 * avoids the ugly white background displayed
-			 * below the Face Browser when the list isn't
-			 * as large as the rectangle defined in the
-			 * MDM theme file.
-			 */
-
-			gtk_widget_size_request (user_list, &req);
-			g_object_get (info->item, "height", &height, NULL);
-
-			if (req.height < height)
-				g_object_set (info->item, "height", (double)req.height, NULL);
 		}
 	}
 
@@ -28,7 +28,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <sys/socket.h>
@@ -45,9 +46,33 @@
 #include "mdm-socket-protocol.h"
 #include "mdm-daemon-config-keys.h"
 
-static gboolean bulk_acs = FALSE;
 static gboolean quiet    = FALSE;
-static int      num_cmds = 0;
+
+/*
+ * The connection to the daemon.  It is opened on the first command and
+ * kept for the life of the process, or until the daemon drops it, in
+ * which case the next command opens another one.  The daemon drops the
+ * connection that sat idle the longest when it needs the room, so
+ * keeping it costs nobody a slot.  AUTH_LOCAL is only sent when a
+ * command comes with a cookie the connection has not been
+ * authenticated with yet.
+ */
+static int      comm_fd     = -1;
+static pid_t    comm_pid    = 0;	/* who opened it, not inherited */
+static int      num_cmds    = 0;
+static char    *comm_cookie = NULL;	/* authenticated with this */
+
+/* Replies are read a buffer at a time, there is never more than the
+ * one line we are waiting for */
+static char     comm_buf[1024];
+static gsize    comm_buf_start = 0;
+static gsize    comm_buf_end   = 0;
+
+/* Retries back off exponentially from BACKOFF_START_MS up to
+ * BACKOFF_MAX_MS, each delay picked at random from its upper half so
+ * clients that failed together don't retry together */
+#define BACKOFF_START_MS 2
+#define BACKOFF_MAX_MS   500
 
 /*
  * Normally errors are printed.  Setting quiet to TRUE turns off
@@ -60,27 +85,74 @@ mdmcomm_set_quiet_errors (gboolean enable)
 }
 
 static char *
-do_command (int fd, const char *command, gboolean get_response)
+read_reply (int fd)
 {
-	GString *str;
-	char buf[1];
-	char *cstr;
-	int ret;
+	GString *str = NULL;
+
+	for (;;) {
+		char  *nl;
+		gsize  len;
+
+		if (comm_buf_start == comm_buf_end) {
+			ssize_t n;
+
+			VE_IGNORE_EINTR (n = read (fd, comm_buf, sizeof (comm_buf)));
+			if (n <= 0)
+				break;
+			comm_buf_start = 0;
+			comm_buf_end = n;
+		}
+
+		len = comm_buf_end - comm_buf_start;
+		nl = memchr (comm_buf + comm_buf_start, '\n', len);
+		if (nl != NULL)
+			len = nl - (comm_buf + comm_buf_start);
+
+		if (str == NULL)
+			str = g_string_sized_new (len);
+		g_string_append_len (str, comm_buf + comm_buf_start, len);
+		comm_buf_start += len;
+
+		if (nl != NULL) {
+			comm_buf_start++;
+			break;
+		}
+	}
+
+	return str != NULL ? g_string_free (str, FALSE) : g_strdup ("");
+}
+
+/* A daemon that hung up must not kill us with SIGPIPE */
+static ssize_t
+send_nosignal (int fd, const char *buf, gsize len)
+{
+	ssize_t ret;
 #ifndef MSG_NOSIGNAL
 	void (*old_handler)(int);
 #endif
 
-        mdm_common_debug ("Sending command: '%s'", command);
-
-	cstr = g_strdup_printf ("%s\n", command);
-
 #ifdef MSG_NOSIGNAL
-	ret = send (fd, cstr, strlen (cstr), MSG_NOSIGNAL);
+	ret = send (fd, buf, len, MSG_NOSIGNAL);
 #else
 	old_handler = signal (SIGPIPE, SIG_IGN);
-	ret = send (fd, cstr, strlen (cstr), 0);
+	ret = send (fd, buf, len, 0);
 	signal (SIGPIPE, old_handler);
 #endif
+
+	return ret;
+}
+
+static char *
+do_command (int fd, const char *command, gboolean get_response)
+{
+	char *cstr;
+	int ret;
+
+        mdm_common_debug ("Sending command: '%s'", command);
+
+	cstr = g_strdup_printf ("%s\n", command);
+
+	ret = send_nosignal (fd, cstr, strlen (cstr));
 	g_free (cstr);
 
 	num_cmds++;
@@ -95,24 +167,18 @@ do_command (int fd, const char *command, gboolean get_response)
 	if ( ! get_response)
 		return NULL;
 
-	str = g_string_new (NULL);
-	while (read (fd, buf, 1) == 1 &&
-	       buf[0] != '\n') {
-		g_string_append_c (str, buf[0]);
-	}
-
-        mdm_common_debug ("  Got response: '%s'", str->str);
+	cstr = read_reply (fd);
 
-	cstr = str->str;
-	g_string_free (str, FALSE);
+        mdm_common_debug ("  Got response: '%s'", cstr);
 
 	/*
-	 * If string is empty, then the daemon likely closed the connection 
-	 * because of too many subconnections.  At any rate the daemon should
+	 * If string is empty, then the daemon likely closed the connection,
+	 * because it was idle when the daemon needed room for others or
+	 * because of too many messages.  At any rate the daemon should
 	 * not return an empty string.  All return values should start with
-	 * "OK" or "ERROR".  Daemon should never complain about too many
-	 * messages since the slave keeps track of the number of commands sent
-	 * and should not send too many, but it does not hurt to check and
+	 * "OK" or "ERROR".  The daemon should never complain about too many
+	 * messages since we keep track of the number of commands sent
+	 * and reconnect before then, but it does not hurt to check and
 	 * manage it if it somehow happens.  In either case return NULL
 	 * instead so the caller can try again.
 	 */
@@ -129,147 +195,160 @@ do_command (int fd, const char *command, gboolean get_response)
 
 static gboolean allow_sleep          = TRUE;
 static gboolean did_sleep_on_failure = FALSE;
-static int comm_fd                   = 0;
 
-static char *
-mdmcomm_call_mdm_real (const char *command,
-		       const char *auth_cookie,
-		       int tries,
-		       int try_start)
+static void
+drop_connection (gboolean say_goodbye)
 {
-	char *ret;
+	/* a child shares the socket with its parent, it just forgets it */
+	if (comm_fd >= 0 && comm_pid == getpid ()) {
+		if (say_goodbye)
+			do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
+		VE_IGNORE_EINTR (close (comm_fd));
+	}
+	comm_fd = -1;
+	num_cmds = 0;
+	comm_buf_start = comm_buf_end = 0;
+	g_free (comm_cookie);
+	comm_cookie = NULL;
+}
+
+static gboolean
+open_connection (void)
+{
+	struct sockaddr_un addr;
+
+	if (comm_fd >= 0 && comm_pid != getpid ())
+		drop_connection (FALSE);
 
 	/*
-         * If already sent the max number of commands, close the connection
-         * and reopen.  Subtract 1 to allow the "CLOSE" to get through.
-         */
-	if (num_cmds == (MDM_SUP_MAX_MESSAGES - 1)) {
+	 * Authenticated connections may send many more messages.  Reconnect
+	 * before the daemon would cut us off, subtract 1 to allow the
+	 * "CLOSE" to get through.
+	 */
+	if (comm_fd >= 0 &&
+	    num_cmds >= (comm_cookie != NULL ? MDM_SUP_MAX_MESSAGES_AUTHENTICATED
+					     : MDM_SUP_MAX_MESSAGES) - 1) {
 		mdm_common_debug ("  Closing and reopening connection.");
-		do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
-		VE_IGNORE_EINTR (close (comm_fd));
-		comm_fd  = 0;
-		num_cmds = 0;
+		drop_connection (TRUE);
 	}
 
-	if (tries <= 0) {
+	if (comm_fd >= 0)
+		return TRUE;
+
+	comm_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (comm_fd < 0) {
 		if ( !quiet)
-			mdm_common_debug ("  Command failed %d times, aborting.", try_start);
-		return NULL;
+			mdm_common_debug ("  Failed to open socket");
+		return FALSE;
 	}
+	comm_pid = getpid ();
+	/* nothing we run gets to talk to the daemon as us */
+	fcntl (comm_fd, F_SETFD, FD_CLOEXEC);
 
-	if (!quiet && tries != try_start) {
-		mdm_common_debug ("  Trying failed command again.  Try %d of %d.",
-				  (try_start - tries + 1), try_start);
+	strcpy (addr.sun_path, MDM_SUP_SOCKET);
+	addr.sun_family = AF_UNIX;
+	if (connect (comm_fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+		/*
+		 * If there is a failure on connect, there are probably
+		 * other clients fighting for the connection, so the retry
+		 * backs off.  Only if allow_sleep is true, it will get set
+		 * to FALSE if the first call fails all retries.
+		 */
+		if (allow_sleep)
+			did_sleep_on_failure = TRUE;
+		if ( !quiet)
+			mdm_common_debug ("  Failed to connect to socket");
+		VE_IGNORE_EINTR (close (comm_fd));
+		comm_fd = -1;
+		return FALSE;
 	}
 
-	if (comm_fd <= 0) {
-		struct sockaddr_un addr;
-		strcpy (addr.sun_path, MDM_SUP_SOCKET);
-		addr.sun_family = AF_UNIX;
-		comm_fd = socket (AF_UNIX, SOCK_STREAM, 0);
-		if (comm_fd < 0) {
-			if ( !quiet)
-				mdm_common_debug ("  Failed to open socket");
+	/*
+	 * If we get this far, then even if we did sleep in the past,
+	 * we did get a connection, so no need to prevent future
+	 * sleeps if required.
+	 */
+	allow_sleep          = TRUE;
+	did_sleep_on_failure = FALSE;
+
+	return TRUE;
+}
+
+/* In microseconds */
+static gulong
+backoff_delay (int retry)
+{
+	int max_ms;
+
+	max_ms = BACKOFF_START_MS << MIN (retry, 16);
+	max_ms = MIN (max_ms, BACKOFF_MAX_MS);
+
+	return g_random_int_range (max_ms * 500, max_ms * 1000 + 1);
+}
+
+static void
+backoff (int retry)
+{
+	if ( ! allow_sleep)
+		return;
+
+	g_usleep (backoff_delay (retry));
+}
+
+static char *
+mdmcomm_call_mdm_real (const char *command,
+		       const char *auth_cookie,
+		       int tries)
+{
+	char *ret;
+	int try;
 
-			return mdmcomm_call_mdm_real (command, auth_cookie, tries - 1, try_start);
+	for (try = 0; try < tries; try++) {
+		if (try > 0) {
+			if ( !quiet)
+				mdm_common_debug ("  Trying failed command again.  Try %d of %d.",
+						  try + 1, tries);
+			backoff (try - 1);
 		}
 
-		if (connect (comm_fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
-
-
-			/*
-			 * If there is a failure on connect, there are probably
-                         * other clients fighting for the connection, so sleep
-                         * for 1 second before retry to avoid failing over and
-                         * over in a tight loop.
-                         *
-                         * Only do this if allow_sleep is true.  allow_sleep
-                         * will get set to FALSE if the first call to this 
-                         * function fails all retries.
-			 */
-			if (allow_sleep == TRUE) {
-
-				did_sleep_on_failure = TRUE;
-
-				/*
-				 * Only actualy sleep if we are going to try
-				 * again.
-				 */
-				if (tries > 1) {
-					if ( !quiet)
-						mdm_common_debug ("  Failed to connect to socket, sleep 1 second and retry");
-					sleep (1);
-				}
-			} else {
+		if ( ! open_connection ())
+			continue;
+
+		/* require authentication, once per connection and cookie */
+		if (auth_cookie != NULL &&
+		    (comm_cookie == NULL || strcmp (comm_cookie, auth_cookie) != 0)) {
+			char *auth_cmd = g_strdup_printf
+				(MDM_SUP_AUTH_LOCAL " %s", auth_cookie);
+			ret = do_command (comm_fd, auth_cmd, TRUE);
+			g_free (auth_cmd);
+			if (ret == NULL) {
+				drop_connection (FALSE);
+				continue;
+			}
+			/* not auth'ed, the daemon closes on us */
+			if (strcmp (ve_sure_string (ret), "OK") != 0) {
 				if ( !quiet)
-					mdm_common_debug ("  Failed to connect to socket, not sleeping");
+					mdm_common_debug ("  Error, auth check failed");
+				drop_connection (TRUE);
+				/* returns the error */
+				return ret;
 			}
-			VE_IGNORE_EINTR (close (comm_fd));
-			comm_fd = 0;
-			return mdmcomm_call_mdm_real (command, auth_cookie,
-						      tries - 1, try_start);
+			g_free (ret);
+			g_free (comm_cookie);
+			comm_cookie = g_strdup (auth_cookie);
 		}
 
-		/*
-         * If we get this far, then even if we did sleep in the past,
-		 * we did get a connection, so no need to prevent future
-		 * sleeps if required.
-                 */
-		allow_sleep          = TRUE;
-        did_sleep_on_failure = FALSE;	
-	}
-
-	/* require authentication */
-	if (auth_cookie != NULL)  {
-		char *auth_cmd = g_strdup_printf
-			(MDM_SUP_AUTH_LOCAL " %s", auth_cookie);
-		ret = do_command (comm_fd, auth_cmd, TRUE);
-		g_free (auth_cmd);
-		if (ret == NULL) {
-			VE_IGNORE_EINTR (close (comm_fd));
-			comm_fd = 0;
-			return mdmcomm_call_mdm_real (command, auth_cookie,
-						      tries - 1, try_start);
-		}
-		/* not auth'ed */
-		if (strcmp (ve_sure_string (ret), "OK") != 0) {
-			if ( !quiet)
-				mdm_common_debug ("  Error, auth check failed");
-			do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
-			VE_IGNORE_EINTR (close (comm_fd));
-			comm_fd = 0;
-			/* returns the error */
+		ret = do_command (comm_fd, command, TRUE);
+		if (ret != NULL)
 			return ret;
-		}
-		g_free (ret);
-	}
 
-	ret = do_command (comm_fd, command, TRUE);
-	if (ret == NULL) {
-		VE_IGNORE_EINTR (close (comm_fd));
-		comm_fd = 0;
-		return mdmcomm_call_mdm_real (command, auth_cookie,
-					      tries - 1, try_start);
+		drop_connection (FALSE);
 	}
 
-	/*
-	 * We want to leave the connection open if bulk_acs is set to
-	 * true, so clients can read as much config data in one 
-	 * sockets connection when it is set.  This requires that
-	 * MDM client programs ensure that they call the bulk_start
-	 * and bulk_stop functions around blocks of code that
-	 * need to read data in bulk.  If a client reads config data
-	 * outside of the bulk_start/stop functions, then this
-	 * will just negatively affect performance since an additional
-	 * socket will be opened to read that config data.
-	 */
-	if (bulk_acs == FALSE) {
-		do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
-		VE_IGNORE_EINTR (close (comm_fd));
-		comm_fd = 0;
-	}
+	if ( !quiet)
+		mdm_common_debug ("  Command failed %d times, aborting.", tries);
 
-	return ret;
+	return NULL;
 }
 
 char *
@@ -278,7 +357,7 @@ mdmcomm_send_cmd_to_daemon_with_args (const char *command, const char * auth_coo
 
 	char *retstr;
 
-	retstr = mdmcomm_call_mdm_real (command, auth_cookie, tries, tries);
+	retstr = mdmcomm_call_mdm_real (command, auth_cookie, tries);
 
 	/*
 	 * Disallow sleeping on future calls if it failed to connect.
@@ -303,23 +382,483 @@ mdmcomm_set_allow_sleep (gboolean val)
 	allow_sleep = val;
 }
 
+/*
+ * The connection stays open between commands anyway, these only mark
+ * blocks of commands for callers written when it did not.
+ */
 void
 mdmcomm_open_connection_to_daemon (void)
 {
-	bulk_acs = TRUE;
 }
 
 void
 mdmcomm_close_connection_to_daemon (void)
 {
-	/* Close the connection */
-	if (comm_fd > 0) {
-		do_command (comm_fd, MDM_SUP_CLOSE, FALSE);
-		VE_IGNORE_EINTR (close (comm_fd));
+}
+
+void
+mdmcomm_disconnect_from_daemon (void)
+{
+	drop_connection (TRUE);
+}
+
+/*
+ * The asynchronous commands have a connection of their own, watched
+ * from the main loop.  A command is written as soon as it is queued,
+ * without waiting for the answers to the ones before it; the daemon
+ * answers in order.  FLEXI_XSERVER is only answered once the new
+ * server is up, so nothing is written after it until then.  When the
+ * daemon drops the connection every command it did not answer costs a
+ * try and goes out again on a new connection after a back off.  One
+ * the daemon closed while nothing was going is not missed, the next
+ * command opens another one.
+ */
+typedef struct {
+	char             *command;
+	char             *auth_cookie;
+	int               tries;
+	MdmcommReplyFunc  func;
+	gpointer          data;
+	gboolean          is_auth;	/* our own AUTH_LOCAL */
+} AsyncCmd;
+
+static int         async_fd        = -1;
+static GIOChannel *async_channel   = NULL;
+static guint       async_in_watch  = 0;
+static guint       async_out_watch = 0;
+static guint       async_kick_id   = 0;	/* idle or back off timeout */
+static int         async_retry     = 0;
+static int         async_num_cmds  = 0;
+static char       *async_cookie    = NULL;	/* last AUTH_LOCAL sent */
+static GQueue      async_queued    = G_QUEUE_INIT;	/* not written yet */
+static GQueue      async_sent      = G_QUEUE_INIT;	/* waiting for answers */
+static GString    *async_out       = NULL;
+static GString    *async_in        = NULL;
+
+static gboolean async_kick (gpointer data);
+
+static void
+async_cmd_free (AsyncCmd *cmd)
+{
+	g_free (cmd->command);
+	g_free (cmd->auth_cookie);
+	g_free (cmd);
+}
+
+static void
+async_cmd_done (AsyncCmd *cmd, const char *ret)
+{
+	if (cmd->func != NULL)
+		(* cmd->func) (ret, cmd->data);
+	async_cmd_free (cmd);
+}
+
+static gboolean
+async_is_barrier (AsyncCmd *cmd)
+{
+	gsize len = strlen (MDM_SUP_FLEXI_XSERVER);
+
+	return strncmp (cmd->command, MDM_SUP_FLEXI_XSERVER, len) == 0 &&
+		(cmd->command[len] == '\0' || cmd->command[len] == ' ');
+}
+
+static void
+async_schedule (guint delay_ms)
+{
+	if (async_kick_id != 0)
+		g_source_remove (async_kick_id);
+
+	if (delay_ms == 0)
+		async_kick_id = g_idle_add (async_kick, NULL);
+	else
+		async_kick_id = g_timeout_add (delay_ms, async_kick, NULL);
+}
+
+static void
+async_close (gboolean say_goodbye)
+{
+	if (async_in_watch != 0)
+		g_source_remove (async_in_watch);
+	if (async_out_watch != 0)
+		g_source_remove (async_out_watch);
+	async_in_watch = async_out_watch = 0;
+
+	if (async_channel != NULL)
+		g_io_channel_unref (async_channel);
+	async_channel = NULL;
+
+	if (async_fd >= 0) {
+		/* best effort, the socket never blocks */
+		if (say_goodbye)
+			send_nosignal (async_fd, MDM_SUP_CLOSE "\n",
+				       strlen (MDM_SUP_CLOSE "\n"));
+		VE_IGNORE_EINTR (close (async_fd));
 	}
-	comm_fd  = 0;
-	num_cmds = 0;
-	bulk_acs = FALSE;
+	async_fd = -1;
+	async_num_cmds = 0;
+	g_free (async_cookie);
+	async_cookie = NULL;
+
+	if (async_out != NULL)
+		g_string_truncate (async_out, 0);
+	if (async_in != NULL)
+		g_string_truncate (async_in, 0);
+}
+
+/*
+ * Takes a try off each of the commands in the queue and puts the ones
+ * that have tries left back in front of the queued ones, in order.
+ */
+static void
+async_charge_tries (GQueue *cmds)
+{
+	GQueue    again = G_QUEUE_INIT;
+	AsyncCmd *cmd;
+
+	while ((cmd = g_queue_pop_head (cmds)) != NULL) {
+		if (cmd->is_auth) {
+			async_cmd_free (cmd);
+		} else if (--cmd->tries > 0) {
+			g_queue_push_tail (&again, cmd);
+		} else {
+			if ( !quiet)
+				mdm_common_debug ("  Command failed, aborting: '%s'",
+						  cmd->command);
+			async_cmd_done (cmd, NULL);
+		}
+	}
+
+	while ((cmd = g_queue_pop_tail (&again)) != NULL)
+		g_queue_push_head (&async_queued, cmd);
+
+	if ( ! g_queue_is_empty (&async_queued))
+		async_schedule ((backoff_delay (async_retry++) + 999) / 1000);
+}
+
+/* The daemon hung up on us or cannot be talked to */
+static void
+async_lost (void)
+{
+	GQueue unanswered = G_QUEUE_INIT;
+
+	if ( !quiet)
+		mdm_common_debug ("  Lost the connection, %u commands unanswered",
+				  g_queue_get_length (&async_sent));
+
+	async_close (FALSE);
+
+	unanswered = async_sent;
+	g_queue_init (&async_sent);
+	async_charge_tries (&unanswered);
+}
+
+/*
+ * Hands one line from the daemon to the command it answers.  Returns
+ * FALSE if the connection is no good any more.
+ */
+static gboolean
+async_answer (const char *line)
+{
+	AsyncCmd *cmd;
+	GSList   *failed = NULL, *li;
+	GList    *link, *next;
+
+	cmd = g_queue_pop_head (&async_sent);
+	if (cmd == NULL) {
+		mdm_common_debug ("  Unexpected response: '%s'", line);
+		return TRUE;
+	}
+
+	mdm_common_debug ("  Got response: '%s'", line);
+
+	/* the same as for the blocking calls, see do_command */
+	if (ve_string_empty (line) ||
+	    strcmp (line, "ERROR 200 Too many messages") == 0) {
+		g_queue_push_head (&async_sent, cmd);
+		return FALSE;
+	}
+
+	async_retry = 0;
+
+	if ( ! cmd->is_auth) {
+		async_cmd_done (cmd, line);
+		return TRUE;
+	}
+
+	if (strcmp (line, "OK") == 0) {
+		async_cmd_free (cmd);
+		return TRUE;
+	}
+
+	/* not auth'ed, the daemon closes on us and whatever needed the
+	 * cookie gets the error */
+	if ( !quiet)
+		mdm_common_debug ("  Error, auth check failed");
+
+	for (link = async_sent.head; link != NULL; link = next) {
+		AsyncCmd *other = link->data;
+
+		next = link->next;
+		if ( ! other->is_auth &&
+		    g_strcmp0 (other->auth_cookie, cmd->auth_cookie) == 0) {
+			g_queue_delete_link (&async_sent, link);
+			failed = g_slist_prepend (failed, other);
+		}
+	}
+	failed = g_slist_reverse (failed);
+	for (li = failed; li != NULL; li = li->next)
+		async_cmd_done (li->data, line);
+	g_slist_free (failed);
+	async_cmd_free (cmd);
+
+	return FALSE;
+}
+
+static gboolean
+async_can_read (GIOChannel   *source,
+		GIOCondition  cond,
+		gpointer      data)
+{
+	char    buf[1024];
+	char   *nl;
+	ssize_t n;
+
+	VE_IGNORE_EINTR (n = read (async_fd, buf, sizeof (buf)));
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return TRUE;
+
+	if (n > 0)
+		g_string_append_len (async_in, buf, n);
+
+	while (n > 0 &&
+	       (nl = memchr (async_in->str, '\n', async_in->len)) != NULL) {
+		char *line = g_strndup (async_in->str, nl - async_in->str);
+
+		g_string_erase (async_in, 0, nl - async_in->str + 1);
+		if ( ! async_answer (line))
+			n = 0;
+		g_free (line);
+	}
+
+	if (n <= 0) {
+		async_in_watch = 0;
+		async_lost ();
+		return FALSE;
+	}
+
+	/* room again after a barrier or for reconnecting */
+	if ( ! g_queue_is_empty (&async_queued) && async_kick_id == 0)
+		async_schedule (0);
+
+	return TRUE;
+}
+
+static gboolean async_can_write (GIOChannel   *source,
+				 GIOCondition  cond,
+				 gpointer      data);
+
+static void
+async_flush (void)
+{
+	while (async_out->len > 0) {
+		ssize_t n;
+
+		VE_IGNORE_EINTR (n = send_nosignal (async_fd, async_out->str,
+						    async_out->len));
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			if (async_out_watch == 0)
+				async_out_watch = g_io_add_watch (async_channel,
+								  G_IO_OUT | G_IO_HUP | G_IO_ERR,
+								  async_can_write, NULL);
+			return;
+		}
+		if (n <= 0) {
+			async_lost ();
+			return;
+		}
+		g_string_erase (async_out, 0, n);
+	}
+}
+
+static gboolean
+async_can_write (GIOChannel   *source,
+		 GIOCondition  cond,
+		 gpointer      data)
+{
+	async_out_watch = 0;
+	async_flush ();
+
+	return FALSE;
+}
+
+static gboolean
+async_connect (void)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		if ( !quiet)
+			mdm_common_debug ("  Failed to open socket");
+		return FALSE;
+	}
+	fcntl (fd, F_SETFD, FD_CLOEXEC);
+	fcntl (fd, F_SETFL, O_NONBLOCK);
+
+	/* a full backlog fails right away instead of blocking, it is
+	 * retried like any other failure */
+	strcpy (addr.sun_path, MDM_SUP_SOCKET);
+	addr.sun_family = AF_UNIX;
+	if (connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+		if ( !quiet)
+			mdm_common_debug ("  Failed to connect to socket");
+		VE_IGNORE_EINTR (close (fd));
+		return FALSE;
+	}
+
+	if (async_out == NULL) {
+		async_out = g_string_new (NULL);
+		async_in = g_string_new (NULL);
+	}
+
+	async_fd = fd;
+	async_channel = g_io_channel_unix_new (fd);
+	async_in_watch = g_io_add_watch (async_channel,
+					 G_IO_IN | G_IO_HUP | G_IO_ERR,
+					 async_can_read, NULL);
+
+	return TRUE;
+}
+
+static int
+async_max_messages (const char *cookie)
+{
+	/* leave room for the "CLOSE" as the blocking calls do */
+	return (cookie != NULL ? MDM_SUP_MAX_MESSAGES_AUTHENTICATED
+			       : MDM_SUP_MAX_MESSAGES) - 1;
+}
+
+static void
+async_write_cmd (AsyncCmd *cmd)
+{
+	mdm_common_debug ("Sending command: '%s'", cmd->command);
+
+	g_string_append (async_out, cmd->command);
+	g_string_append_c (async_out, '\n');
+	g_queue_push_tail (&async_sent, cmd);
+	async_num_cmds++;
+}
+
+/* Whether the command still fits on the connection, with the
+ * AUTH_LOCAL it needs first if it does */
+static gboolean
+async_fits (AsyncCmd *cmd, gboolean *need_auth)
+{
+	*need_auth = cmd->auth_cookie != NULL &&
+		g_strcmp0 (cmd->auth_cookie, async_cookie) != 0;
+
+	return async_num_cmds + (*need_auth ? 2 : 1) <=
+		async_max_messages (*need_auth ? cmd->auth_cookie : async_cookie);
+}
+
+/* Writes out as many of the queued commands as may go now */
+static void
+async_send_queued (void)
+{
+	while ( ! g_queue_is_empty (&async_queued)) {
+		AsyncCmd *cmd = g_queue_peek_head (&async_queued);
+		AsyncCmd *last = g_queue_peek_tail (&async_sent);
+		gboolean  need_auth;
+
+		if (last != NULL && async_is_barrier (last))
+			break;
+
+		if ( ! async_fits (cmd, &need_auth))
+			break;
+
+		g_queue_pop_head (&async_queued);
+
+		/* require authentication, once per connection and cookie */
+		if (need_auth) {
+			AsyncCmd *auth = g_new0 (AsyncCmd, 1);
+
+			auth->command = g_strdup_printf (MDM_SUP_AUTH_LOCAL " %s",
+							 cmd->auth_cookie);
+			auth->auth_cookie = g_strdup (cmd->auth_cookie);
+			auth->is_auth = TRUE;
+			async_write_cmd (auth);
+
+			g_free (async_cookie);
+			async_cookie = g_strdup (cmd->auth_cookie);
+		}
+
+		async_write_cmd (cmd);
+	}
+
+	async_flush ();
+}
+
+static gboolean
+async_kick (gpointer data)
+{
+	GQueue   attempted = G_QUEUE_INIT;
+	gboolean need_auth;
+
+	async_kick_id = 0;
+
+	if (g_queue_is_empty (&async_queued))
+		return FALSE;
+
+	/* reconnect before the daemon would cut us off, once the answers
+	 * still due are in */
+	if (async_fd >= 0 &&
+	    ! async_fits (g_queue_peek_head (&async_queued), &need_auth)) {
+		if ( ! g_queue_is_empty (&async_sent))
+			return FALSE;
+		mdm_common_debug ("  Closing and reopening connection.");
+		async_close (TRUE);
+	}
+
+	if (async_fd < 0 && ! async_connect ()) {
+		/* every queued command was waiting for this connection */
+		attempted = async_queued;
+		g_queue_init (&async_queued);
+		async_charge_tries (&attempted);
+		return FALSE;
+	}
+
+	async_send_queued ();
+
+	return FALSE;
+}
+
+/**
+ * mdmcomm_send_cmd_to_daemon_async
+ *
+ * Queues the command and returns right away, func gets the answer
+ * from the main loop.  Commands sent one after the other go out
+ * together and are answered in the order they were queued.
+ */
+void
+mdmcomm_send_cmd_to_daemon_async (const char *command,
+				  const char *auth_cookie,
+				  int tries,
+				  MdmcommReplyFunc func,
+				  gpointer data)
+{
+	AsyncCmd *cmd = g_new0 (AsyncCmd, 1);
+
+	cmd->command = g_strdup (command);
+	cmd->auth_cookie = g_strdup (auth_cookie);
+	cmd->tries = MAX (tries, 1);
+	cmd->func = func;
+	cmd->data = data;
+	g_queue_push_tail (&async_queued, cmd);
+
+	/* a back off that is under way is not cut short */
+	if (async_kick_id == 0)
+		async_schedule (0);
 }
 
 const char *
@@ -30,6 +30,20 @@ char *		mdmcomm_send_cmd_to_daemon (const char *command);
 void		mdmcomm_set_allow_sleep (gboolean val);
 void		mdmcomm_open_connection_to_daemon (void);
 void		mdmcomm_close_connection_to_daemon (void);
+/* Closes the connection kept between commands, the next one opens a new one */
+void		mdmcomm_disconnect_from_daemon (void);
+
+/*
+ * Called from the main loop with the answer to an asynchronous
+ * command, or with NULL if it failed all tries.  ret is freed
+ * afterwards.
+ */
+typedef void	(*MdmcommReplyFunc) (const char *ret, gpointer data);
+void		mdmcomm_send_cmd_to_daemon_async (const char *command,
+						  const char *auth_cookie,
+						  int tries,
+						  MdmcommReplyFunc func,
+						  gpointer data);
 const char *	mdmcomm_get_display (void);
 
 /* This just gets a cookie of MIT-MAGIC-COOKIE-1 type */
@@ -24,6 +24,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <locale.h>
 #include <string.h>
@@ -43,6 +44,7 @@
 
 #include "mdm-common.h"
 #include "mdm-log.h"
+#include "mdm-trace.h"
 #include "mdm-socket-protocol.h"
 #include "mdm-daemon-config-keys.h"
 
@@ -984,3 +986,75 @@ mdm_common_locale_is_displayable (const gchar *locale)
   return is_displayable;
 }
 
+static gboolean greeter_batch_quiet = FALSE;
+
+/*
+ * Answers a command that gets nothing but a bare STX back.  Inside an
+ * MDM_BATCH only the last command is answered, that answer is the one
+ * the slave waits for.
+ */
+void
+mdm_common_greeter_ack (void)
+{
+	if (greeter_batch_quiet)
+		return;
+
+	printf ("%c\n", STX);
+	fflush (stdout);
+}
+
+void
+mdm_common_greeter_batch (const gchar *args, MdmGreeterOpFunc process)
+{
+	/* some commands keep pointing into their arguments, just as they
+	 * do into the read buffer otherwise, so keep them until the next
+	 * batch */
+	static gchar **ops = NULL;
+	int i;
+
+	g_strfreev (ops);
+	ops = g_strsplit (ve_sure_string (args), MDM_BATCH_SEP, -1);
+
+	for (i = 0; ops[i] != NULL; i++) {
+		if (ops[i][0] == '\0')
+			continue;
+
+		greeter_batch_quiet = (ops[i + 1] != NULL);
+		process ((guchar) ops[i][0], ops[i] + 1);
+	}
+	greeter_batch_quiet = FALSE;
+}
+
+/*
+ * The greeters record from main to their first frame and append it to
+ * the trace file the slave passed on, tracing is off without one.
+ */
+void
+mdm_common_trace_init (const char *process)
+{
+	mdm_trace_init (g_getenv (MDM_TRACE_FILE_ENV), process, g_getenv ("DISPLAY"));
+	mdm_trace_begin ("greeter startup");
+}
+
+static gboolean
+first_frame_drawn (GtkWidget *window, GdkEventExpose *event, gpointer data)
+{
+	g_signal_handlers_disconnect_by_func (window, first_frame_drawn, data);
+
+	mdm_trace_end ("greeter startup");
+	mdm_trace_mark ("first frame");
+	mdm_trace_dump ();
+
+	return FALSE;
+}
+
+void
+mdm_common_trace_first_frame (GtkWidget *window)
+{
+	if ( ! mdm_trace_enabled ())
+		return;
+
+	/* after the window has drawn itself */
+	g_signal_connect_after (window, "expose-event",
+				G_CALLBACK (first_frame_drawn), NULL);
+}
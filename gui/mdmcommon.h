@@ -74,4 +74,15 @@ gchar*    mdm_common_expand_text            (const gchar *text);
 gchar*    mdm_common_get_clock              (struct tm **the_tm);
 gboolean  mdm_common_locale_is_displayable  (const gchar *locale);
 gboolean  mdm_common_is_action_available    (gchar *action);
+
+/* Greeter protocol */
+typedef void (* MdmGreeterOpFunc) (guchar op_code, const gchar *args);
+
+void      mdm_common_greeter_ack            (void);
+void      mdm_common_greeter_batch          (const gchar      *args,
+                                             MdmGreeterOpFunc  process);
+
+/* Boot timeline, see mdm-trace.h */
+void      mdm_common_trace_init             (const char *process);
+void      mdm_common_trace_first_frame      (GtkWidget  *window);
 #endif /* MDM_COMMON_H */
@@ -35,6 +35,7 @@
 #include "mdmconfig.h"
 
 #include "mdm-common.h"
+#include "mdm-config-snapshot.h"
 #include "mdm-log.h"
 #include "mdm-socket-protocol.h"
 
@@ -45,6 +46,7 @@ static GHashTable *bool_hash      = NULL;
 static GHashTable *string_hash    = NULL;
 static gboolean mdm_never_cache   = FALSE;
 static int comm_tries             = 5;
+static MdmConfigSnapshot *snapshot = NULL;
 
 /**
  * mdm_config_never_cache
@@ -123,67 +125,120 @@ mdm_config_add_hash (GHashTable *hash,
 	g_hash_table_insert (hash, newkey, value);
 }
 
-/**
- * mdm_config_get_result
- *
- * Calls daemon to get config result, stripping the key so it
- * doesn't contain a default value.
+/*
+ * Returns the value of an already stripped key from the configuration
+ * snapshot the daemon publishes, or NULL if the daemon has to be asked.
+ * Translated keys are always asked for, and so is everything when this
+ * display has its own configuration file, since the snapshot only
+ * holds the global values.  A snapshot the daemon has replaced is
+ * dropped and the new one mapped instead.
  */
+static const gchar *
+mdm_config_snapshot_value (const gchar *key)
+{
+	static gboolean tried = FALSE;
+
+	if (snapshot != NULL && ! mdm_config_snapshot_is_current (snapshot)) {
+		mdm_config_snapshot_close (snapshot);
+		snapshot = NULL;
+		tried = FALSE;
+	}
+
+	if (snapshot == NULL && ! tried) {
+		const gchar *display = g_getenv ("DISPLAY");
+
+		tried = TRUE;
+		snapshot = mdm_config_snapshot_open (MDM_SUP_CONFIG_SNAPSHOT);
+
+		if (snapshot != NULL && ! ve_string_empty (display)) {
+			gchar *file;
+
+			file = g_strconcat (mdm_config_snapshot_get_custom_file (snapshot),
+					    display, NULL);
+			if (g_file_test (file, G_FILE_TEST_EXISTS)) {
+				mdm_config_snapshot_close (snapshot);
+				snapshot = NULL;
+			}
+			g_free (file);
+		}
+	}
+
+	if (snapshot == NULL ||
+	    ! mdm_config_snapshot_is_current (snapshot) ||
+	    strchr (key, '[') != NULL)
+		return NULL;
+
+	return mdm_config_snapshot_lookup (snapshot, key);
+}
+
+/* The key without the compiled in default, as the daemon knows it */
 static gchar *
-mdm_config_get_result (const gchar *key)
+mdm_config_key_name (const gchar *key)
 {
 	gchar *p;
-	gchar *newkey  = g_strdup (key);
-	gchar *command = NULL;
-	gchar *result  = NULL;
-	static char *display = NULL;
+	gchar *newkey = g_strdup (key);
 
 	g_strstrip (newkey);
 	p = strchr (newkey, '=');
 	if (p != NULL)
 		*p = '\0';
 
-	display = g_strdup (g_getenv ("DISPLAY"));
+	return newkey;
+}
+
+static gchar *
+mdm_config_get_command (const gchar *newkey)
+{
+	const gchar *display = g_getenv ("DISPLAY");
+
 	if (display == NULL)
-		command = g_strdup_printf ("%s %s", MDM_SUP_GET_CONFIG, newkey);
+		return g_strdup_printf ("%s %s", MDM_SUP_GET_CONFIG, newkey);
 	else
-		command = g_strdup_printf ("%s %s %s", MDM_SUP_GET_CONFIG, newkey, display);
+		return g_strdup_printf ("%s %s %s", MDM_SUP_GET_CONFIG, newkey, display);
+}
+
+/**
+ * mdm_config_get_result
+ *
+ * Calls daemon to get config result, stripping the key so it
+ * doesn't contain a default value.
+ */
+static gchar *
+mdm_config_get_result (const gchar *key)
+{
+	gchar *newkey  = mdm_config_key_name (key);
+	gchar *command = NULL;
+	gchar *result  = NULL;
+	const gchar *value;
 
+	value = mdm_config_snapshot_value (newkey);
+	if (value != NULL) {
+		g_free (newkey);
+		return g_strconcat ("OK ", value, NULL);
+	}
+
+	command = mdm_config_get_command (newkey);
 	result  = mdmcomm_send_cmd_to_daemon_with_args (command, NULL, comm_tries);
 
-	g_free (display);
 	g_free (command);
 	g_free (newkey);
 	return result;
 }
 
-/**
- * mdm_config_get_string
- *
- * Gets string configuration value from daemon via GET_CONFIG
- * socket command.  It stores the value in a hash so subsequent
- * access is faster.
+/*
+ * Stores the answer to a GET_CONFIG request for a string key in the
+ * cache.  result is the raw "OK <value>" answer (or NULL) and gets
+ * freed.
  */
 static gchar *
-_mdm_config_get_string (const gchar *key,
-			gboolean reload,
-			gboolean *changed,
-			gboolean doing_translated)
+mdm_config_store_string (const gchar *key,
+			 gchar *result,
+			 gchar *hashretval,
+			 gboolean *changed,
+			 gboolean doing_translated)
 {
-	gchar *hashretval = NULL;
-	gchar *result = NULL;
 	gchar *temp;
 
-        if (string_hash == NULL)
-		string_hash = g_hash_table_new (g_str_hash, g_str_equal);
-
-	hashretval = mdm_config_hash_lookup (string_hash, key);
-
-	if (reload == FALSE && hashretval != NULL)
-		return hashretval;
-
-	result = mdm_config_get_result (key);
-
 	if ( ! result || ve_string_empty (result) ||
 	    strncmp (result, "OK ", 3) != 0) {
 
@@ -236,6 +291,33 @@ _mdm_config_get_string (const gchar *key,
 	return temp;
 }
 
+/**
+ * mdm_config_get_string
+ *
+ * Gets string configuration value from daemon via GET_CONFIG
+ * socket command.  It stores the value in a hash so subsequent
+ * access is faster.
+ */
+static gchar *
+_mdm_config_get_string (const gchar *key,
+			gboolean reload,
+			gboolean *changed,
+			gboolean doing_translated)
+{
+	gchar *hashretval = NULL;
+
+        if (string_hash == NULL)
+		string_hash = g_hash_table_new (g_str_hash, g_str_equal);
+
+	hashretval = mdm_config_hash_lookup (string_hash, key);
+
+	if (reload == FALSE && hashretval != NULL)
+		return hashretval;
+
+	return mdm_config_store_string (key, mdm_config_get_result (key),
+					hashretval, changed, doing_translated);
+}
+
 gchar *
 mdm_config_get_string (const gchar *key)
 {
@@ -307,31 +389,15 @@ mdm_config_get_translated_string (const gchar *key)
       return _mdm_config_get_translated_string (key, FALSE, NULL);
 }
 
-/**
- * mdm_config_get_int
- *
- * Gets int configuration value from daemon via GET_CONFIG
- * socket command.  It stores the value in a hash so subsequent
- * access is faster.
- */
+/* Same as mdm_config_store_string for an int key */
 static gint
-_mdm_config_get_int (const gchar *key,
-		     gboolean reload,
-		     gboolean *changed)
+mdm_config_store_int (const gchar *key,
+		      gchar *result,
+		      gint *hashretval,
+		      gboolean *changed)
 {
-	gint  *hashretval = NULL;
-	gchar *result = NULL;
 	gint  temp;
 
-        if (int_hash == NULL)
-		int_hash = g_hash_table_new (g_str_hash, g_str_equal);
-
-	hashretval = mdm_config_hash_lookup (int_hash, key);
-	if (reload == FALSE && hashretval != NULL)
-		return *hashretval;
-
-	result = mdm_config_get_result (key);
-
 	if ( ! result || ve_string_empty (result) ||
 	    strncmp (result, "OK ", 3) != 0) {
 
@@ -379,39 +445,48 @@ _mdm_config_get_int (const gchar *key,
 	}
 }
 
-gint
-mdm_config_get_int (const gchar *key)
-{
-   if (mdm_never_cache == TRUE)
-      return _mdm_config_get_int (key, TRUE, NULL);
-   else
-      return _mdm_config_get_int (key, FALSE, NULL);
-}
-
 /**
- * mdm_config_get_bool
+ * mdm_config_get_int
  *
  * Gets int configuration value from daemon via GET_CONFIG
  * socket command.  It stores the value in a hash so subsequent
  * access is faster.
  */
-static gboolean
-_mdm_config_get_bool (const gchar *key,
-		      gboolean reload,
-		      gboolean *changed)
+static gint
+_mdm_config_get_int (const gchar *key,
+		     gboolean reload,
+		     gboolean *changed)
 {
-	gboolean *hashretval = NULL;
-	gchar    *result;
-	gboolean temp;
+	gint  *hashretval = NULL;
 
-        if (bool_hash == NULL)
-           bool_hash = g_hash_table_new (g_str_hash, g_str_equal);
+        if (int_hash == NULL)
+		int_hash = g_hash_table_new (g_str_hash, g_str_equal);
 
-	hashretval = mdm_config_hash_lookup (bool_hash, key);
+	hashretval = mdm_config_hash_lookup (int_hash, key);
 	if (reload == FALSE && hashretval != NULL)
 		return *hashretval;
 
-	result = mdm_config_get_result (key);
+	return mdm_config_store_int (key, mdm_config_get_result (key),
+				     hashretval, changed);
+}
+
+gint
+mdm_config_get_int (const gchar *key)
+{
+   if (mdm_never_cache == TRUE)
+      return _mdm_config_get_int (key, TRUE, NULL);
+   else
+      return _mdm_config_get_int (key, FALSE, NULL);
+}
+
+/* Same as mdm_config_store_string for a bool key */
+static gboolean
+mdm_config_store_bool (const gchar *key,
+		       gchar *result,
+		       gboolean *hashretval,
+		       gboolean *changed)
+{
+	gboolean temp;
 
 	if ( ! result || ve_string_empty (result) ||
 	    strncmp (result, "OK ", 3) != 0) {
@@ -472,6 +547,31 @@ _mdm_config_get_bool (const gchar *key,
 	}
 }
 
+/**
+ * mdm_config_get_bool
+ *
+ * Gets int configuration value from daemon via GET_CONFIG
+ * socket command.  It stores the value in a hash so subsequent
+ * access is faster.
+ */
+static gboolean
+_mdm_config_get_bool (const gchar *key,
+		      gboolean reload,
+		      gboolean *changed)
+{
+	gboolean *hashretval = NULL;
+
+        if (bool_hash == NULL)
+           bool_hash = g_hash_table_new (g_str_hash, g_str_equal);
+
+	hashretval = mdm_config_hash_lookup (bool_hash, key);
+	if (reload == FALSE && hashretval != NULL)
+		return *hashretval;
+
+	return mdm_config_store_bool (key, mdm_config_get_result (key),
+				      hashretval, changed);
+}
+
 gboolean
 mdm_config_get_bool (const gchar *key)
 {
@@ -481,6 +581,368 @@ mdm_config_get_bool (const gchar *key)
       return _mdm_config_get_bool (key, FALSE, NULL);
 }
 
+/* GET_CONFIG_MULTI requests are kept well below the 4096 byte line
+ * limit of the daemon */
+#define PREFETCH_MAX_COMMAND 4000
+
+/* Set once the daemon turned down a GET_CONFIG_MULTI */
+static gboolean multi_unsupported = FALSE;
+
+/* changed, if not NULL, is set when the value changed and left alone
+ * otherwise */
+static void
+mdm_config_store_result (const MdmConfigKey *entry,
+			 gchar *result,
+			 gboolean *changed)
+{
+	gboolean entry_changed = FALSE;
+
+	switch (entry->type) {
+	case MDM_CONFIG_KEY_STRING:
+		if (string_hash == NULL)
+			string_hash = g_hash_table_new (g_str_hash, g_str_equal);
+		mdm_config_store_string (entry->key, result,
+					 mdm_config_hash_lookup (string_hash, entry->key),
+					 &entry_changed, FALSE);
+		break;
+	case MDM_CONFIG_KEY_INT:
+		if (int_hash == NULL)
+			int_hash = g_hash_table_new (g_str_hash, g_str_equal);
+		mdm_config_store_int (entry->key, result,
+				      mdm_config_hash_lookup (int_hash, entry->key),
+				      &entry_changed);
+		break;
+	case MDM_CONFIG_KEY_BOOL:
+		if (bool_hash == NULL)
+			bool_hash = g_hash_table_new (g_str_hash, g_str_equal);
+		mdm_config_store_bool (entry->key, result,
+				       mdm_config_hash_lookup (bool_hash, entry->key),
+				       &entry_changed);
+		break;
+	}
+
+	if (changed != NULL && entry_changed)
+		*changed = TRUE;
+}
+
+static void
+mdm_config_fetch_one (const MdmConfigKey *entry)
+{
+	switch (entry->type) {
+	case MDM_CONFIG_KEY_STRING:
+		_mdm_config_get_string (entry->key, TRUE, NULL, FALSE);
+		break;
+	case MDM_CONFIG_KEY_INT:
+		_mdm_config_get_int (entry->key, TRUE, NULL);
+		break;
+	case MDM_CONFIG_KEY_BOOL:
+		_mdm_config_get_bool (entry->key, TRUE, NULL);
+		break;
+	}
+}
+
+/*
+ * Stores whatever the snapshot has for the keys and returns the
+ * entries and the key names of those that have to be asked for.
+ */
+static void
+mdm_config_split_keys (const MdmConfigKey *keys,
+		       gint n_keys,
+		       gboolean *changed,
+		       GPtrArray **pending,
+		       GPtrArray **names)
+{
+	guint i;
+
+	*pending = g_ptr_array_new ();
+	*names = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < (guint) n_keys; i++) {
+		const gchar *value;
+		gchar *newkey = mdm_config_key_name (keys[i].key);
+
+		value = mdm_config_snapshot_value (newkey);
+		if (value != NULL) {
+			mdm_config_store_result (&keys[i],
+						 g_strconcat ("OK ", value, NULL),
+						 changed);
+			g_free (newkey);
+		} else {
+			g_ptr_array_add (*pending, (gpointer) &keys[i]);
+			g_ptr_array_add (*names, newkey);
+		}
+	}
+}
+
+/* A GET_CONFIG_MULTI for the names from start on, *end is set past the
+ * last one that fit */
+static gchar *
+mdm_config_multi_command (GPtrArray *names,
+			  guint start,
+			  guint *end)
+{
+	const gchar *display = g_getenv ("DISPLAY");
+	GString *command;
+
+	command = g_string_new (MDM_SUP_GET_CONFIG_MULTI " ");
+	g_string_append (command, ve_string_empty (display) ? "-" : display);
+
+	for (*end = start; *end < names->len; (*end)++) {
+		const gchar *newkey = g_ptr_array_index (names, *end);
+
+		if (*end > start &&
+		    command->len + 1 + strlen (newkey) > PREFETCH_MAX_COMMAND)
+			break;
+
+		g_string_append_c (command, ' ');
+		g_string_append (command, newkey);
+	}
+
+	return g_string_free (command, FALSE);
+}
+
+/*
+ * Stores the answer to a GET_CONFIG_MULTI for the given entries.
+ * Returns FALSE without storing anything if the answer is no good, the
+ * keys have to be read one by one then.
+ */
+static gboolean
+mdm_config_store_multi (GPtrArray *entries,
+			guint start,
+			guint end,
+			const gchar *result,
+			gboolean *changed)
+{
+	gchar **values;
+	guint i;
+
+	if (result == NULL)
+		return FALSE;
+
+	if (strncmp (result, "OK ", 3) != 0) {
+		/* "ERROR 0 Not implemented" from an older daemon */
+		multi_unsupported = TRUE;
+		return FALSE;
+	}
+
+	values = g_strsplit (result + 3, "\t", -1);
+	if (g_strv_length (values) != end - start) {
+		mdm_common_error ("Bad answer to %s", MDM_SUP_GET_CONFIG_MULTI);
+		g_strfreev (values);
+		return FALSE;
+	}
+
+	for (i = start; i < end; i++) {
+		const MdmConfigKey *entry = g_ptr_array_index (entries, i);
+		const gchar *value = values[i - start];
+
+		if (value[0] == '=') {
+			gchar *unescaped = g_strcompress (value + 1);
+			mdm_config_store_result (entry,
+						 g_strconcat ("OK ", unescaped, NULL),
+						 changed);
+			g_free (unescaped);
+		} else {
+			/* unsupported key, the compiled in default is used */
+			mdm_config_store_result (entry, NULL, changed);
+		}
+	}
+
+	g_strfreev (values);
+	return TRUE;
+}
+
+/**
+ * mdm_config_prefetch
+ *
+ * Reads all the given keys into the cache, from the configuration
+ * snapshot where possible and otherwise with as few GET_CONFIG_MULTI
+ * requests as possible, so that a program can get all the
+ * configuration it needs at startup in a single round trip.
+ * Afterwards the mdm_config_get_* functions answer from the cache.
+ * If the daemon is too old to know GET_CONFIG_MULTI the keys are read
+ * one by one instead.
+ */
+void
+mdm_config_prefetch (const MdmConfigKey *keys,
+		     gint n_keys)
+{
+	GPtrArray *pending;
+	GPtrArray *names;
+	guint start, end, i;
+
+	/* Whatever the snapshot answers does not need to go over the wire */
+	mdm_config_split_keys (keys, n_keys, NULL, &pending, &names);
+
+	for (start = 0; start < pending->len; start = end) {
+		gchar *command;
+		gchar *result = NULL;
+
+		command = mdm_config_multi_command (names, start, &end);
+
+		if ( ! multi_unsupported)
+			result = mdmcomm_send_cmd_to_daemon_with_args (command, NULL, comm_tries);
+
+		if ( ! mdm_config_store_multi (pending, start, end, result, NULL)) {
+			for (i = start; i < end; i++)
+				mdm_config_fetch_one (g_ptr_array_index (pending, i));
+		}
+
+		g_free (result);
+		g_free (command);
+	}
+
+	g_ptr_array_free (names, TRUE);
+	g_ptr_array_free (pending, TRUE);
+}
+
+/* One mdm_config_reload_async call */
+typedef struct {
+	MdmConfigReloadFunc  func;
+	gpointer             data;
+	gboolean             changed;
+	gint                 outstanding;	/* requests not answered yet */
+} MdmConfigReload;
+
+/* One request of it, for a single key or a GET_CONFIG_MULTI */
+typedef struct {
+	MdmConfigReload     *reload;
+	GPtrArray           *entries;
+} MdmConfigReloadRequest;
+
+static gboolean
+mdm_config_reload_finish (gpointer data)
+{
+	MdmConfigReload *reload = data;
+
+	if (reload->func != NULL)
+		(* reload->func) (reload->changed, reload->data);
+	g_free (reload);
+
+	return FALSE;
+}
+
+static void
+mdm_config_reload_request_done (MdmConfigReloadRequest *request)
+{
+	MdmConfigReload *reload = request->reload;
+
+	g_ptr_array_free (request->entries, TRUE);
+	g_free (request);
+
+	if (--reload->outstanding == 0)
+		mdm_config_reload_finish (reload);
+}
+
+static void
+mdm_config_reload_one_done (const char *ret,
+			    gpointer data)
+{
+	MdmConfigReloadRequest *request = data;
+
+	mdm_config_store_result (g_ptr_array_index (request->entries, 0),
+				 g_strdup (ret), &request->reload->changed);
+	mdm_config_reload_request_done (request);
+}
+
+static void
+mdm_config_reload_one (MdmConfigReload *reload,
+		       const MdmConfigKey *entry)
+{
+	MdmConfigReloadRequest *request;
+	gchar *newkey;
+	gchar *command;
+
+	request = g_new0 (MdmConfigReloadRequest, 1);
+	request->reload = reload;
+	request->entries = g_ptr_array_new ();
+	g_ptr_array_add (request->entries, (gpointer) entry);
+	reload->outstanding++;
+
+	newkey = mdm_config_key_name (entry->key);
+	command = mdm_config_get_command (newkey);
+	mdmcomm_send_cmd_to_daemon_async (command, NULL, comm_tries,
+					  mdm_config_reload_one_done, request);
+	g_free (command);
+	g_free (newkey);
+}
+
+static void
+mdm_config_reload_multi_done (const char *ret,
+			      gpointer data)
+{
+	MdmConfigReloadRequest *request = data;
+	guint i;
+
+	if ( ! mdm_config_store_multi (request->entries, 0, request->entries->len,
+				       ret, &request->reload->changed)) {
+		for (i = 0; i < request->entries->len; i++)
+			mdm_config_reload_one (request->reload,
+					       g_ptr_array_index (request->entries, i));
+	}
+
+	mdm_config_reload_request_done (request);
+}
+
+/**
+ * mdm_config_reload_async
+ *
+ * Like calling the mdm_config_reload_* function for each of the keys,
+ * but without waiting for the daemon.  The requests go out the same
+ * way mdm_config_prefetch sends them, and func is called from the main
+ * loop once every key is in, with changed TRUE if any of the values
+ * changed.  func may be NULL if only the cache needs to be up to date.
+ * The keys must stay around until the answers are in.
+ */
+void
+mdm_config_reload_async (const MdmConfigKey *keys,
+			 gint n_keys,
+			 MdmConfigReloadFunc func,
+			 gpointer data)
+{
+	MdmConfigReload *reload;
+	GPtrArray *pending;
+	GPtrArray *names;
+	guint start, end, i;
+
+	reload = g_new0 (MdmConfigReload, 1);
+	reload->func = func;
+	reload->data = data;
+
+	mdm_config_split_keys (keys, n_keys, &reload->changed, &pending, &names);
+
+	for (start = 0; start < pending->len; start = end) {
+		MdmConfigReloadRequest *request;
+		gchar *command;
+
+		command = mdm_config_multi_command (names, start, &end);
+
+		if (multi_unsupported) {
+			for (i = start; i < end; i++)
+				mdm_config_reload_one (reload, g_ptr_array_index (pending, i));
+			g_free (command);
+			continue;
+		}
+
+		request = g_new0 (MdmConfigReloadRequest, 1);
+		request->reload = reload;
+		request->entries = g_ptr_array_new ();
+		for (i = start; i < end; i++)
+			g_ptr_array_add (request->entries, g_ptr_array_index (pending, i));
+		reload->outstanding++;
+
+		mdmcomm_send_cmd_to_daemon_async (command, NULL, comm_tries,
+						  mdm_config_reload_multi_done, request);
+		g_free (command);
+	}
+
+	/* all of it came from the snapshot, still answer from the main loop */
+	if (reload->outstanding == 0)
+		g_idle_add (mdm_config_reload_finish, reload);
+
+	g_ptr_array_free (names, TRUE);
+	g_ptr_array_free (pending, TRUE);
+}
+
 /**
  * mdm_config_reload_string
  * mdm_config_reload_int
@@ -25,6 +25,21 @@
 
 #include "glib.h"
 
+typedef enum {
+	MDM_CONFIG_KEY_STRING,
+	MDM_CONFIG_KEY_INT,
+	MDM_CONFIG_KEY_BOOL
+} MdmConfigKeyType;
+
+/* A key to read with mdm_config_prefetch */
+typedef struct {
+	const gchar      *key;
+	MdmConfigKeyType  type;
+} MdmConfigKey;
+
+/* changed is TRUE if any of the reloaded values changed */
+typedef void (*MdmConfigReloadFunc) (gboolean changed, gpointer data);
+
 void		mdm_config_never_cache			(gboolean never_cache);
 void		mdm_config_set_comm_retries		(int tries);
 gchar *		mdm_config_get_string			(const gchar *key);
@@ -35,6 +50,12 @@ gboolean	mdm_config_reload_string		(const gchar *key);
 gboolean	mdm_config_reload_int			(const gchar *key);
 gboolean	mdm_config_reload_bool			(const gchar *key);
 GSList *	mdm_config_get_xservers			(gboolean flexible);
+void		mdm_config_prefetch			(const MdmConfigKey *keys,
+							 gint n_keys);
+void		mdm_config_reload_async			(const MdmConfigKey *keys,
+							 gint n_keys,
+							 MdmConfigReloadFunc func,
+							 gpointer data);
 
 void		mdm_save_customlist_data		(const gchar *file,
 							 const gchar *key,
@@ -3,7 +3,9 @@
 // The MDM daemon process is launched as root by daemon/mdm.c.
 // It sets up a UNIX socket in /var/run/gdm_socket (MDM_SUP_SOCKET) and writes its pid in /var/run/mdm.pid (MDM_PID_FILE).
 // MDMFlexiServer is like a remote control... it can be used to send commands with the --command option, or to ask for a new greeter.
-// It uses mdmcomm.c to talk with MDM via the socket:
+// It uses mdmcomm.c to talk with MDM via the socket, without blocking the main loop:
+// Commands that need authentication are sent right away, with PeerCredentialAuth the daemon knows a user logged in on the console from the socket.
+// Only if it does not is the Xauthority cookie looked up and sent with AUTH_LOCAL.
 // If --command is used, it sends that command to MDM.
 // Otherwise, it asks MDM for a list of already running greeters, with the command "MDM_SUP_ATTACHED_SERVERS".
 // If some greeters are already running, it picks the first one, locks the screen and switches the screen to its VT.
@@ -47,6 +49,12 @@ static gboolean debug_in         = FALSE;
 static gboolean authenticate     = FALSE;
 static gboolean no_lock          = FALSE;
 static gchar **args_remaining    = NULL; 
+static GMainLoop *loop           = NULL;
+static int exit_status           = 0;
+static int cur_vt                = -1;
+static gboolean not_authenticated = FALSE;
+static char *attached_servers    = NULL;
+static int answers_due           = 0;
 
 GOptionEntry options [] = {
 	{ "command", 'c', 0, G_OPTION_ARG_STRING, &send_command, N_("Send the specified protocol command to MDM"), N_("COMMAND") },
@@ -57,35 +65,80 @@ GOptionEntry options [] = {
 	{ NULL }
 };
 
-static int
-get_cur_vt (void)
+static gboolean
+is_not_authenticated (const char *ret)
 {
-	char           *result;
-	static int      cur_vt;
-	static gboolean checked = FALSE;
-	char           *ret = NULL;
+	return ret != NULL && strncmp (ret, "ERROR 100 ", strlen ("ERROR 100 ")) == 0;
+}
 
-	result = NULL;
+typedef struct {
+	char             *command;
+	MdmcommReplyFunc  func;
+	gpointer          data;
+} AuthCommand;
 
-	if (checked) {
-		return cur_vt;
+static void
+authenticated_reply (const char *ret, gpointer data)
+{
+	AuthCommand *cmd = data;
+	static gboolean tried_cookie = FALSE;
+
+	/* The daemon did not know us from the connection, so prove we
+	 * are on the console with the cookie, if there is one */
+	if (is_not_authenticated (ret) && auth_cookie == NULL) {
+		if ( ! tried_cookie) {
+			tried_cookie = TRUE;
+			auth_cookie = mdmcomm_get_auth_cookie ();
+		}
+		if (auth_cookie != NULL) {
+			mdmcomm_send_cmd_to_daemon_async (cmd->command, auth_cookie, 5,
+							  authenticated_reply, cmd);
+			return;
+		}
 	}
 
-	ret = mdmcomm_send_cmd_to_daemon_with_args (MDM_SUP_QUERY_VT, auth_cookie, 5);
-	if (ve_string_empty (ret) || strncmp (ret, "OK ", 3) != 0) {
-		goto out;
-	}
+	(* cmd->func) (ret, cmd->data);
+	g_free (cmd->command);
+	g_free (cmd);
+}
+
+/* Sends a command that needs authentication */
+static void
+send_authenticated (const char *command, MdmcommReplyFunc func, gpointer data)
+{
+	AuthCommand *cmd = g_new0 (AuthCommand, 1);
+
+	cmd->command = g_strdup (command);
+	cmd->func = func;
+	cmd->data = data;
+	mdmcomm_send_cmd_to_daemon_async (command, auth_cookie, 5,
+					  authenticated_reply, cmd);
+}
+
+static void check_for_users (void);
+
+static void
+got_cur_vt (const char *ret, gpointer data)
+{
+	if (is_not_authenticated (ret))
+		not_authenticated = TRUE;
 
-	if (sscanf (ret, "OK %d", &cur_vt) != 1) {
+	if (ve_string_empty (ret) || strncmp (ret, "OK ", 3) != 0 ||
+	    sscanf (ret, "OK %d", &cur_vt) != 1) {
 		cur_vt = -1;
 	}
 
-	checked = TRUE;
+	if (--answers_due == 0)
+		check_for_users ();
+}
 
- out:
-	g_free (ret);
+static void
+got_attached_servers (const char *ret, gpointer data)
+{
+	attached_servers = g_strdup (ret);
 
-	return cur_vt;
+	if (--answers_due == 0)
+		check_for_users ();
 }
 
 static GtkWidget *
@@ -114,16 +167,10 @@ hig_dialog_new (GtkWindow      *parent,
   	return dialog;
 }
 
-/* change to an existing vt */
 static void
-change_vt (int vt)
+vt_changed (const char *ret, gpointer data)
 {
-	char *cmd;
-	char *ret;
-
-	cmd = g_strdup_printf (MDM_SUP_SET_VT " %d", vt);
-	ret = mdmcomm_send_cmd_to_daemon_with_args (cmd, auth_cookie, 5);
-	g_free (cmd);
+	int vt = GPOINTER_TO_INT (data);
 
 	if (ve_string_empty (ret) ||
 	    strcmp (ret, "OK") != 0) {
@@ -140,7 +187,21 @@ change_vt (int vt)
 		gtk_dialog_run (GTK_DIALOG (dialog));
 		gtk_widget_destroy (dialog);
 	}
-	g_free (ret);
+
+	printf ("Switching to MDM server on VT #%d\n", vt);
+	exit_status = 0;
+	g_main_loop_quit (loop);
+}
+
+/* change to an existing vt */
+static void
+change_vt (int vt)
+{
+	char *cmd;
+
+	cmd = g_strdup_printf (MDM_SUP_SET_VT " %d", vt);
+	send_authenticated (cmd, vt_changed, GINT_TO_POINTER (vt));
+	g_free (cmd);
 }
 
 static int
@@ -231,34 +292,95 @@ maybe_lock_screen (void)
 	g_free (command);
 }
 
+static void
+flexi_server_started (const char *ret, gpointer data)
+{
+	GtkWidget *dialog;
+	const char *message;
+
+	if (ret != NULL &&
+	    strncmp (ret, "OK ", 3) == 0) {
+
+		/* if we switched to a different screen as a result of this,
+		 * lock the current screen */
+		if ( ! no_lock ) {
+			maybe_lock_screen ();
+		}
+
+		/* all fine and dandy */
+		exit_status = 0;
+		g_main_loop_quit (loop);
+		return;
+	}
+
+	message = mdmcomm_get_error_message (ret);
+
+	dialog = hig_dialog_new (NULL /* parent */,
+				 GTK_DIALOG_MODAL /* flags */,
+				 GTK_MESSAGE_ERROR,
+				 GTK_BUTTONS_OK,
+				 _("Cannot start new display"),
+				 message);
+
+	gtk_widget_show_all (dialog);
+	gtk_dialog_run (GTK_DIALOG (dialog));
+	gtk_widget_destroy (dialog);
+
+	exit_status = 1;
+	g_main_loop_quit (loop);
+}
+
+static void
+start_flexi_server (void)
+{
+	send_authenticated (MDM_SUP_FLEXI_XSERVER, flexi_server_started, NULL);
+}
+
+static void
+not_on_console (void)
+{
+	GtkWidget *dialog;
+
+	dialog = hig_dialog_new (NULL /* parent */,
+				 GTK_DIALOG_MODAL /* flags */,
+				 GTK_MESSAGE_ERROR,
+				 GTK_BUTTONS_OK,
+				 _("You do not seem to be logged in on the "
+				   "console"),
+				 _("Starting a new login only "
+				   "works correctly on the console."));
+	gtk_dialog_set_has_separator (GTK_DIALOG (dialog),
+				      FALSE);
+	gtk_widget_show_all (dialog);
+	gtk_dialog_run (GTK_DIALOG (dialog));
+	gtk_widget_destroy (dialog);
+
+	exit_status = 1;
+	g_main_loop_quit (loop);
+}
+
+/* Switches to a running greeter if there is one, otherwise starts one */
 static void
 check_for_users (void)
 {
-	char *result_string;
+	const char *result_string = attached_servers;
 	char **servers;
 	int i;
 
-	// Return if we're not on a VT
-	if (auth_cookie == NULL || get_cur_vt () < 0) {
+	if (not_authenticated) {
+		not_on_console ();
 		return;
 	}
-		
-    // Get the list of running servers from the daemon
-	result_string = mdmcomm_send_cmd_to_daemon_with_args (MDM_SUP_ATTACHED_SERVERS, auth_cookie, 5);
 
-	// Return if the daemon didn't send us the list
-	if (ve_string_empty (result_string) || strncmp (result_string, "OK ", 3) != 0) {
-		g_free (result_string);
+	// Start a new one if we're not on a VT or the daemon didn't send us the list
+	if (cur_vt < 0 ||
+	    ve_string_empty (result_string) || strncmp (result_string, "OK ", 3) != 0) {
+		start_flexi_server ();
 		return;
 	}
 
 	// Place the servers into the servers variable	
 	servers = g_strsplit (&result_string[3], ";", -1);
-	g_free (result_string);
-
-	// Return if there are no servers running
-	if (servers == NULL)
-		return;
 
 	// Each server is composed of 3 parts: [display, user, tty]
 	for (i = 0; servers[i] != NULL; i++) {
@@ -276,13 +398,14 @@ check_for_users (void)
 		// If the server's username is empty, this is a greeter and we want to switch to it
 		if (strcmp (server[1], "") == 0 && vt >= 0) {			
 			// lock the screen
-			if ( ! no_lock && vt != get_cur_vt () && vt >= 0) {
+			if ( ! no_lock && vt != cur_vt && vt >= 0) {
 				maybe_lock_screen ();
 			}
 			// Switch VT
 			change_vt (vt);	
-			printf ("Switching to MDM server on VT #%d\n", vt);
-			exit (0);
+			g_strfreev (server);
+			g_strfreev (servers);
+			return;
 		}
 
 		g_strfreev (server);
@@ -290,6 +413,15 @@ check_for_users (void)
 	
 	printf ("Found no MDM server, ordering a new one\n");
 	g_strfreev (servers);
+
+	start_flexi_server ();
+}
+
+static void
+got_command_reply (const char *ret, gpointer data)
+{
+	*(char **) data = g_strdup (ret);
+	g_main_loop_quit (loop);
 }
 
 /**
@@ -333,7 +465,6 @@ main (int argc, char *argv[])
 {
 	GtkWidget *dialog;
 	char *ret;
-	const char *message;
 	GOptionContext *ctx;
 
 	bindtextdomain (GETTEXT_PACKAGE, GNOMELOCALEDIR);
@@ -372,20 +503,21 @@ main (int argc, char *argv[])
 	
 	mdmcomm_open_connection_to_daemon ();
 
+	loop = g_main_loop_new (NULL, FALSE);
+
 	/* Process --command option */
 
 	if (send_command != NULL) {
 
 		/* gdk_init is needed for cookie code to get display */
 		gdk_init (&argc, &argv);
-		if (authenticate)
-			auth_cookie = mdmcomm_get_auth_cookie ();
 
 		/*
 		 * If asking for a translatable config value, then try to get
 		 * the translated value first.  If this fails, then go ahead
 		 * and call the normal sockets command.
 		 */
+		ret = NULL;
 		if (strncmp (send_command, MDM_SUP_GET_CONFIG " ",
 		    strlen (MDM_SUP_GET_CONFIG " ")) == 0) {
 			gchar *value = NULL;
@@ -397,15 +529,19 @@ main (int argc, char *argv[])
 					ret = g_strdup_printf ("OK %s", value);
 				}
 			}
+		}
 
-			/*
-			 * If the above didn't return a value, then must be a
-			 * different key, so call the daemon.
-			 */
-			if (value == NULL)
-				ret = mdmcomm_send_cmd_to_daemon_with_args (send_command, auth_cookie, 5);
-		} else {
-			ret = mdmcomm_send_cmd_to_daemon_with_args (send_command, auth_cookie, 5);
+		/*
+		 * If the above didn't return a value, then must be a
+		 * different key or command, so call the daemon.
+		 */
+		if (ret == NULL) {
+			if (authenticate)
+				send_authenticated (send_command, got_command_reply, &ret);
+			else
+				mdmcomm_send_cmd_to_daemon_async (send_command, NULL, 5,
+								  got_command_reply, &ret);
+			g_main_loop_run (loop);
 		}
 
 		/* At this point we are done using the socket, so close it */
@@ -431,72 +567,20 @@ main (int argc, char *argv[])
 	}
 
 	/*
-	 * Always attempt to get cookie and authenticate.  On remote
-	 * servers
+	 * Check for other displays/logged in users.  Both questions go out
+	 * at once, the servers are looked at once both answers are in.
 	 */
-	auth_cookie = mdmcomm_get_auth_cookie ();
-	
-	/* check for other displays/logged in users */
-	check_for_users ();
-
-	if (auth_cookie == NULL) {
-
-		/* At this point we are done using the socket, so close it */
-		mdmcomm_close_connection_to_daemon ();
+	answers_due = 2;
+	send_authenticated (MDM_SUP_QUERY_VT, got_cur_vt, NULL);
+	mdmcomm_send_cmd_to_daemon_async (MDM_SUP_ATTACHED_SERVERS, NULL, 5,
+					  got_attached_servers, NULL);
+	g_main_loop_run (loop);
 
-		dialog = hig_dialog_new (NULL /* parent */,
-					 GTK_DIALOG_MODAL /* flags */,
-					 GTK_MESSAGE_ERROR,
-					 GTK_BUTTONS_OK,
-					 _("You do not seem to be logged in on the "
-					   "console"),
-					 _("Starting a new login only "
-					   "works correctly on the console."));
-		gtk_dialog_set_has_separator (GTK_DIALOG (dialog),
-					      FALSE);
-		gtk_widget_show_all (dialog);
-		gtk_dialog_run (GTK_DIALOG (dialog));
-		gtk_widget_destroy (dialog);
-		return 1;
-	}
-	
-	ret = mdmcomm_send_cmd_to_daemon_with_args (MDM_SUP_FLEXI_XSERVER, auth_cookie, 5);
-
-	g_free (auth_cookie);
+	g_free (attached_servers);
 	g_strfreev (args_remaining);
 
 	/* At this point we are done using the socket, so close it */
 	mdmcomm_close_connection_to_daemon ();
 
-	if (ret != NULL &&
-	    strncmp (ret, "OK ", 3) == 0) {
-
-		/* if we switched to a different screen as a result of this,
-		 * lock the current screen */
-		if ( ! no_lock ) {
-			maybe_lock_screen ();
-		}
-
-		/* all fine and dandy */
-		g_free (ret);
-		return 0;
-	}
-
-	message = mdmcomm_get_error_message (ret);
-
-	dialog = hig_dialog_new (NULL /* parent */,
-				 GTK_DIALOG_MODAL /* flags */,
-				 GTK_MESSAGE_ERROR,
-				 GTK_BUTTONS_OK,
-				 _("Cannot start new display"),
-				 message);
-
-	gtk_widget_show_all (dialog);
-	gtk_dialog_run (GTK_DIALOG (dialog));
-	gtk_widget_destroy (dialog);
-	g_free (ret);
-
-	return 1;
+	return exit_status;
 }
-
-
@@ -1106,8 +1106,7 @@ mdm_lang_op_setlang (const gchar *args)
   if (args)
     mdm_lang_set ((char*)args);
 
-  printf ("%c\n", STX);
-  fflush (stdout);
+  mdm_common_greeter_ack ();
 }
 
 void
@@ -1121,7 +1120,6 @@ mdm_lang_op_always_restart (const gchar *args)
         mdm_lang_set_restart_state (FALSE);
     }
 
-  printf ("%c\n", STX);
-  fflush (stdout);
+  mdm_common_greeter_ack ();
 }
 
@@ -115,8 +115,7 @@ static GtkTreeModel *browser_model;
 static GdkPixbuf *defface;
 
 /* Eew. Loads of global vars. It's hard to be event controlled while maintaining state */
-static GList *users = NULL;
-static GList *users_string = NULL;
+static MdmUsersLoader *users_loader = NULL;
 static gint size_of_users = 0;
 
 static gchar *curuser = NULL;
@@ -1010,8 +1009,7 @@ process_operation (guchar       op_code,
 	if (mdm_config_get_bool (MDM_KEY_BROWSER)) {
     	browser_set_user (curuser);
     }
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_PROMPT:
@@ -1113,8 +1111,7 @@ process_operation (guchar       op_code,
 	replace_msg = FALSE;
 
 	gtk_widget_show (GTK_WIDGET (msg));
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 
 	login_window_resize (FALSE /* force */);
 
@@ -1132,8 +1129,7 @@ process_operation (guchar       op_code,
 		err_box_clear_handler = g_timeout_add (30000,
 						       err_box_clear,
 						       NULL);
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 
 	login_window_resize (FALSE /* force */);
 	break;
@@ -1177,8 +1173,7 @@ process_operation (guchar       op_code,
 
     case MDM_SETSESS:
     	current_session = args;
-    	printf ("%c\n", STX);
-    	fflush (stdout);
+    	mdm_common_greeter_ack ();
     	break;
 
     case MDM_SETLANG:
@@ -1230,8 +1225,7 @@ process_operation (guchar       op_code,
 	g_free (tmp);
 	gtk_widget_show (GTK_WIDGET (msg));
 
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 
 	login_window_resize (FALSE /* force */);
 	break;
@@ -1293,8 +1287,7 @@ process_operation (guchar       op_code,
 		mdm_timed_delay = mdm_config_get_int (MDM_KEY_TIMED_LOGIN_DELAY);
 		timed_handler_id  = g_timeout_add (1000, mdm_timer, NULL);
 	}
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_STOPTIMER:
@@ -1306,24 +1299,21 @@ process_operation (guchar       op_code,
 		g_source_remove (timed_handler_id);
 		timed_handler_id = 0;
 	}
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_DISABLE:
 	if (clock_label != NULL)
 		GTK_WIDGET_SET_FLAGS (clock_label->parent, GTK_SENSITIVE);
 	gtk_widget_set_sensitive (login, FALSE);
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_ENABLE:
 	gtk_widget_set_sensitive (login, TRUE);
 	if (clock_label != NULL)
 		GTK_WIDGET_UNSET_FLAGS (clock_label->parent, GTK_SENSITIVE);
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     /* These are handled separately so ignore them here and send
@@ -1337,15 +1327,13 @@ process_operation (guchar       op_code,
     case MDM_NOFOCUS:
 	mdm_wm_no_login_focus_push ();
 	
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_FOCUS:
 	mdm_wm_no_login_focus_pop ();
 	
-	printf ("%c\n", STX);
-	fflush (stdout);
+	mdm_common_greeter_ack ();
 	break;
 
     case MDM_SAVEDIE:
@@ -1371,6 +1359,10 @@ process_operation (guchar       op_code,
 
 	break;
 	
+    case MDM_BATCH:
+	mdm_common_greeter_batch (args, process_operation);
+	break;
+
     default:
 	mdm_kill_thingies ();
 	mdm_common_fail_greeter ("Unexpected greeter command received: '%c'", op_code);
@@ -1379,14 +1371,18 @@ process_operation (guchar       op_code,
 }
 
 
+/* Users come in batches while the greeter is up, the list grows to
+ * a quarter of the screen as they do */
 static void
-mdm_login_browser_populate (void)
+mdm_login_browser_add_users (GPtrArray *users, gboolean done, gpointer data)
 {
-    GList *li;
+    GtkWidget *bbox;
+    guint i;
+    int height;
+    int icon_height = mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT);
 
-    for (li = users; li != NULL; li = li->next) {
-	    MdmUser *usr = li->data;
-	    GtkTreeIter iter = {0};
+    for (i = 0; i < users->len; i++) {
+	    MdmUser *usr = g_ptr_array_index (users, i);
 	    char *label;
 	    char *login, *gecos;
 
@@ -1399,15 +1395,26 @@ mdm_login_browser_populate (void)
 
 	    g_free (login);
 	    g_free (gecos);
-	    gtk_list_store_append (GTK_LIST_STORE (browser_model), &iter);
-	    gtk_list_store_set (GTK_LIST_STORE (browser_model), &iter,
+	    /* in place, the model is sorted by login */
+	    gtk_list_store_insert_with_values (GTK_LIST_STORE (browser_model), NULL, -1,
 				GREETER_ULIST_ICON_COLUMN, usr->picture,
 				GREETER_ULIST_LOGIN_COLUMN, usr->login,
 				GREETER_ULIST_LABEL_COLUMN, label,
 				-1);
 	    g_free (label);
+
+	    if (usr->picture != NULL)
+		    size_of_users += gdk_pixbuf_get_height (usr->picture) + 2;
+	    else
+		    size_of_users += icon_height;
     }
-    return;
+
+    bbox = gtk_widget_get_parent (browser);
+    height = size_of_users + 4 /* some padding */;
+    if (height > mdm_wm_screen.height * 0.25)
+	height = mdm_wm_screen.height * 0.25;
+
+    gtk_widget_set_size_request (GTK_WIDGET (bbox), -1, height);
 }
 
 static void
@@ -1827,6 +1834,11 @@ mdm_login_gui_init (void)
 
 	    browser_model = (GtkTreeModel *)gtk_list_store_new (3,
 	             GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING);
+	    gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (browser_model),
+	             GREETER_ULIST_LOGIN_COLUMN, mdm_users_compare_logins,
+	             GINT_TO_POINTER (GREETER_ULIST_LOGIN_COLUMN), NULL);
+	    gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (browser_model),
+	             GREETER_ULIST_LOGIN_COLUMN, GTK_SORT_ASCENDING);
 
 	    gtk_tree_view_set_model (GTK_TREE_VIEW (browser), browser_model);
 	    column = gtk_tree_view_column_new_with_attributes
@@ -1851,10 +1863,8 @@ mdm_login_gui_init (void)
 	                    GTK_POLICY_AUTOMATIC);
 	    gtk_container_add (GTK_CONTAINER (bbox), browser);
 
-	    height = size_of_users + 4 /* some padding */;
-	    if (height > mdm_wm_screen.height * 0.25)
-	        height = mdm_wm_screen.height * 0.25;
-
+	    /* grows as the users come in */
+	    height = 4 /* some padding */;
 	    gtk_widget_set_size_request (GTK_WIDGET (bbox), -1, height);   
 	} 
                
@@ -2180,14 +2190,63 @@ enum {
 	RESPONSE_CLOSE
 };
 
-/* 
+/*
  * If new configuration keys are added to this program, make sure to add the
- * key to the mdm_read_config and mdm_reread_config functions.  Note if the
- * number of configuration values used by mdmlogin is greater than 
- * MDM_SUP_MAX_MESSAGES defined in daemon/mdm.h (currently defined to be 80),
- * consider bumping that number so that all the config can be read in one
- * socket connection.
+ * key to config_keys and to one of the key groups mdm_reread_config reads
+ * again.  The keys in config_keys are all read with a single
+ * GET_CONFIG_MULTI request.
  */
+static const MdmConfigKey config_keys[] = {
+	{ MDM_KEY_BACKGROUND_COLOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_BACKGROUND_IMAGE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_BACKGROUND_PROGRAM, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_CONFIGURATOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_FACE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_SESSION, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_EXCLUDE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTK_THEME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTK_THEMES_TO_ALLOW, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTKRC, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_HALT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INCLUDE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INFO_MSG_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INFO_MSG_FONT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_LOCALE_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_REBOOT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SESSION_DESKTOP_DIR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SOUND_PROGRAM, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SOUND_ON_LOGIN_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SUSPEND, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_TIMED_LOGIN, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_USE_24_CLOCK, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_WELCOME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SYSTEM_COMMANDS_IN_MENU, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_BACKGROUND_TYPE, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_BACKGROUND_PROGRAM_INITIAL_DELAY, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_BACKGROUND_PROGRAM_RESTART_DELAY, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_FLEXI_REAP_DELAY_MINUTES, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MAX_ICON_HEIGHT, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MAX_ICON_WIDTH, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MINIMAL_UID, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_TIMED_LOGIN_DELAY, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_PRIMARY_MONITOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_ALLOW_GTK_THEME_CHANGE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ALLOW_ROOT, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_BROWSER, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_CONFIG_AVAILABLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_DEFAULT_WELCOME, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ENTRY_CIRCLES, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ENTRY_INVISIBLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_INCLUDE_ALL, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_RUN_BACKGROUND_PROGRAM_ALWAYS, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_RESTART_BACKGROUND_PROGRAM, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_SOUND_ON_LOGIN, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_SYSTEM_MENU, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_TIMED_LOGIN_ENABLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ADD_GTK_MODULES, MDM_CONFIG_KEY_BOOL },
+};
+
 static void
 mdm_read_config (void)
 {
@@ -2200,56 +2259,7 @@ mdm_read_config (void)
 	 * Read all the keys at once and close sockets connection so we do
 	 * not have to keep the socket open. 
 	 */
-	mdm_config_get_string (MDM_KEY_BACKGROUND_COLOR);
-	mdm_config_get_string (MDM_KEY_BACKGROUND_IMAGE);
-	mdm_config_get_string (MDM_KEY_BACKGROUND_PROGRAM);
-	mdm_config_get_string (MDM_KEY_CONFIGURATOR);
-	mdm_config_get_string (MDM_KEY_DEFAULT_FACE);
-	mdm_config_get_string (MDM_KEY_DEFAULT_SESSION);
-	mdm_config_get_string (MDM_KEY_EXCLUDE);
-	mdm_config_get_string (MDM_KEY_GTK_THEME);
-	mdm_config_get_string (MDM_KEY_GTK_THEMES_TO_ALLOW);
-	mdm_config_get_string (MDM_KEY_GTKRC);
-	mdm_config_get_string (MDM_KEY_HALT);
-	mdm_config_get_string (MDM_KEY_INCLUDE);
-	mdm_config_get_string (MDM_KEY_INFO_MSG_FILE);
-	mdm_config_get_string (MDM_KEY_INFO_MSG_FONT);
-	mdm_config_get_string (MDM_KEY_LOCALE_FILE);	
-	mdm_config_get_string (MDM_KEY_REBOOT);	
-	mdm_config_get_string (MDM_KEY_SESSION_DESKTOP_DIR);
-	mdm_config_get_string (MDM_KEY_SOUND_PROGRAM);
-	mdm_config_get_string (MDM_KEY_SOUND_ON_LOGIN_FILE);
-	mdm_config_get_string (MDM_KEY_SUSPEND);
-	mdm_config_get_string (MDM_KEY_TIMED_LOGIN);
-	mdm_config_get_string (MDM_KEY_USE_24_CLOCK);
-	mdm_config_get_string (MDM_KEY_WELCOME);
-	mdm_config_get_string (MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS);
-	mdm_config_get_string (MDM_KEY_SYSTEM_COMMANDS_IN_MENU);	
-
-	mdm_config_get_int    (MDM_KEY_BACKGROUND_TYPE);
-	mdm_config_get_int    (MDM_KEY_BACKGROUND_PROGRAM_INITIAL_DELAY);
-	mdm_config_get_int    (MDM_KEY_BACKGROUND_PROGRAM_RESTART_DELAY);
-	mdm_config_get_int    (MDM_KEY_FLEXI_REAP_DELAY_MINUTES);
-	mdm_config_get_int    (MDM_KEY_MAX_ICON_HEIGHT);
-	mdm_config_get_int    (MDM_KEY_MAX_ICON_WIDTH);
-	mdm_config_get_int    (MDM_KEY_MINIMAL_UID);
-	mdm_config_get_int    (MDM_KEY_TIMED_LOGIN_DELAY);
-	mdm_config_get_string    (MDM_KEY_PRIMARY_MONITOR);
-
-	mdm_config_get_bool   (MDM_KEY_ALLOW_GTK_THEME_CHANGE);
-	mdm_config_get_bool   (MDM_KEY_ALLOW_ROOT);	
-	mdm_config_get_bool   (MDM_KEY_BROWSER);
-	mdm_config_get_bool   (MDM_KEY_CONFIG_AVAILABLE);
-	mdm_config_get_bool   (MDM_KEY_DEFAULT_WELCOME);
-	mdm_config_get_bool   (MDM_KEY_ENTRY_CIRCLES);
-	mdm_config_get_bool   (MDM_KEY_ENTRY_INVISIBLE);
-	mdm_config_get_bool   (MDM_KEY_INCLUDE_ALL);	
-	mdm_config_get_bool   (MDM_KEY_RUN_BACKGROUND_PROGRAM_ALWAYS);
-	mdm_config_get_bool   (MDM_KEY_RESTART_BACKGROUND_PROGRAM);
-	mdm_config_get_bool   (MDM_KEY_SOUND_ON_LOGIN);
-	mdm_config_get_bool   (MDM_KEY_SYSTEM_MENU);
-	mdm_config_get_bool   (MDM_KEY_TIMED_LOGIN_ENABLE);	
-	mdm_config_get_bool   (MDM_KEY_ADD_GTK_MODULES);
+	mdm_config_prefetch (config_keys, G_N_ELEMENTS (config_keys));
 
 	/* Keys not to include in reread_config */	
 	mdm_config_get_string (MDM_KEY_PRE_FETCH_PROGRAM);	
@@ -2257,97 +2267,123 @@ mdm_read_config (void)
 	mdmcomm_close_connection_to_daemon ();
 }
 
-static gboolean
-mdm_reread_config (int sig, gpointer data)
-{
-	gboolean resize = FALSE;
-	gint i;
-	gchar *key_string = NULL;
-	
-	mdmcomm_open_connection_to_daemon ();
+/* A change to any of these restarts the greeter */
+static const MdmConfigKey restart_keys[] = {
+	{ MDM_KEY_BACKGROUND_PROGRAM, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_CONFIGURATOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_FACE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_SESSION, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_EXCLUDE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTKRC, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTK_THEME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_GTK_THEMES_TO_ALLOW, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_HALT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INCLUDE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INFO_MSG_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_INFO_MSG_FONT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_LOCALE_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_REBOOT, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SESSION_DESKTOP_DIR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SUSPEND, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_TIMED_LOGIN, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SYSTEM_COMMANDS_IN_MENU, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_BACKGROUND_PROGRAM_INITIAL_DELAY, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_BACKGROUND_PROGRAM_RESTART_DELAY, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MAX_ICON_WIDTH, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MAX_ICON_HEIGHT, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_MINIMAL_UID, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_TIMED_LOGIN_DELAY, MDM_CONFIG_KEY_INT },
+	{ MDM_KEY_PRIMARY_MONITOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_ALLOW_GTK_THEME_CHANGE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ALLOW_ROOT, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_BROWSER, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_CONFIG_AVAILABLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ENTRY_CIRCLES, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ENTRY_INVISIBLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_INCLUDE_ALL, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_RESTART_BACKGROUND_PROGRAM, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_RUN_BACKGROUND_PROGRAM_ALWAYS, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_SYSTEM_MENU, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_TIMED_LOGIN_ENABLE, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_ADD_GTK_MODULES, MDM_CONFIG_KEY_BOOL },
+};
 
-	/* reparse config stuff here.  At least the ones we care about */
+static const MdmConfigKey background_keys[] = {
+	{ MDM_KEY_BACKGROUND_IMAGE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_BACKGROUND_COLOR, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_BACKGROUND_TYPE, MDM_CONFIG_KEY_INT },
+};
+
+static const MdmConfigKey clock_keys[] = {
+	{ MDM_KEY_SOUND_PROGRAM, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_SOUND_ON_LOGIN, MDM_CONFIG_KEY_BOOL },
+	{ MDM_KEY_SOUND_ON_LOGIN_FILE, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_USE_24_CLOCK, MDM_CONFIG_KEY_STRING },
+};
+
+static const MdmConfigKey welcome_keys[] = {
+	{ MDM_KEY_WELCOME, MDM_CONFIG_KEY_STRING },
+	{ MDM_KEY_DEFAULT_WELCOME, MDM_CONFIG_KEY_BOOL },
+};
+
+static void
+restart_keys_reloaded (gboolean changed, gpointer data)
+{
 	/* FIXME: We should update these on the fly rather than just
          * restarting */
-	/* Also we may not need to check ALL those keys but just a few */
-
-	if (mdm_config_reload_string (MDM_KEY_BACKGROUND_PROGRAM) ||
-	    mdm_config_reload_string (MDM_KEY_CONFIGURATOR) ||
-	    mdm_config_reload_string (MDM_KEY_DEFAULT_FACE) ||
-	    mdm_config_reload_string (MDM_KEY_DEFAULT_SESSION) ||
-	    mdm_config_reload_string (MDM_KEY_EXCLUDE) ||
-	    mdm_config_reload_string (MDM_KEY_GTKRC) ||
-	    mdm_config_reload_string (MDM_KEY_GTK_THEME) ||
-	    mdm_config_reload_string (MDM_KEY_GTK_THEMES_TO_ALLOW) ||
-	    mdm_config_reload_string (MDM_KEY_HALT) ||
-	    mdm_config_reload_string (MDM_KEY_INCLUDE) ||
-	    mdm_config_reload_string (MDM_KEY_INFO_MSG_FILE) ||
-	    mdm_config_reload_string (MDM_KEY_INFO_MSG_FONT) ||
-	    mdm_config_reload_string (MDM_KEY_LOCALE_FILE) ||
-	    mdm_config_reload_string (MDM_KEY_REBOOT) ||
-	    mdm_config_reload_string (MDM_KEY_SESSION_DESKTOP_DIR) ||
-	    mdm_config_reload_string (MDM_KEY_SUSPEND) ||
-	    mdm_config_reload_string (MDM_KEY_TIMED_LOGIN) ||
-	    mdm_config_reload_string (MDM_KEY_RBAC_SYSTEM_COMMAND_KEYS) ||
-	    mdm_config_reload_string (MDM_KEY_SYSTEM_COMMANDS_IN_MENU) ||
-
-	    mdm_config_reload_int    (MDM_KEY_BACKGROUND_PROGRAM_INITIAL_DELAY) ||
-	    mdm_config_reload_int    (MDM_KEY_BACKGROUND_PROGRAM_RESTART_DELAY) ||
-	    mdm_config_reload_int    (MDM_KEY_MAX_ICON_WIDTH) ||
-	    mdm_config_reload_int    (MDM_KEY_MAX_ICON_HEIGHT) ||
-	    mdm_config_reload_int    (MDM_KEY_MINIMAL_UID) ||
-	    mdm_config_reload_int    (MDM_KEY_TIMED_LOGIN_DELAY) ||
-	    mdm_config_reload_string    (MDM_KEY_PRIMARY_MONITOR) ||
-
-	    mdm_config_reload_bool   (MDM_KEY_ALLOW_GTK_THEME_CHANGE) ||
-	    mdm_config_reload_bool   (MDM_KEY_ALLOW_ROOT) ||
-	    mdm_config_reload_bool   (MDM_KEY_BROWSER) ||	    
-	    mdm_config_reload_bool   (MDM_KEY_CONFIG_AVAILABLE) ||
-	    mdm_config_reload_bool   (MDM_KEY_ENTRY_CIRCLES) ||
-	    mdm_config_reload_bool   (MDM_KEY_ENTRY_INVISIBLE) ||
-	    mdm_config_reload_bool   (MDM_KEY_INCLUDE_ALL) ||	    
-	    mdm_config_reload_bool   (MDM_KEY_RESTART_BACKGROUND_PROGRAM) ||
-	    mdm_config_reload_bool   (MDM_KEY_RUN_BACKGROUND_PROGRAM_ALWAYS) ||
-	    mdm_config_reload_bool   (MDM_KEY_SYSTEM_MENU) ||
-	    mdm_config_reload_bool   (MDM_KEY_TIMED_LOGIN_ENABLE) ||	    
-	    mdm_config_reload_bool   (MDM_KEY_ADD_GTK_MODULES)) {
-
-		/* Set busy cursor */
-		mdm_common_setup_cursor (GDK_WATCH);
-
-		mdm_wm_save_wm_order ();
-		mdm_kill_thingies ();
-		mdmcomm_close_connection_to_daemon ();
+	if ( ! changed)
+		return;
 
-		_exit (DISPLAY_RESTARTGREETER);
-		return TRUE;
-	}
+	/* Set busy cursor */
+	mdm_common_setup_cursor (GDK_WATCH);
+
+	mdm_wm_save_wm_order ();
+	mdm_kill_thingies ();
 
-	if (mdm_config_reload_string (MDM_KEY_BACKGROUND_IMAGE) ||
-	    mdm_config_reload_string (MDM_KEY_BACKGROUND_COLOR) ||
-	    mdm_config_reload_int    (MDM_KEY_BACKGROUND_TYPE)) {
+	_exit (DISPLAY_RESTARTGREETER);
+}
 
-		mdm_kill_thingies ();
-		setup_background ();
-		back_prog_launch_after_timeout ();
-	}	
+static void
+background_keys_reloaded (gboolean changed, gpointer data)
+{
+	if ( ! changed)
+		return;
+
+	mdm_kill_thingies ();
+	setup_background ();
+	back_prog_launch_after_timeout ();
+}
 
-	mdm_config_reload_string (MDM_KEY_SOUND_PROGRAM);
-	mdm_config_reload_bool   (MDM_KEY_SOUND_ON_LOGIN);
-	mdm_config_reload_string (MDM_KEY_SOUND_ON_LOGIN_FILE);
-	mdm_config_reload_string (MDM_KEY_USE_24_CLOCK);
+static void
+clock_keys_reloaded (gboolean changed, gpointer data)
+{
 	update_clock ();
-	
-	if (mdm_config_reload_string (MDM_KEY_WELCOME) ||
-            mdm_config_reload_bool   (MDM_KEY_DEFAULT_WELCOME)) {
+}
 
+static void
+welcome_keys_reloaded (gboolean changed, gpointer data)
+{
+	if (changed)
 		mdm_set_welcomemsg ();
-	}
-
-	if (resize)
-		login_window_resize (TRUE /* force */);
+}
 
-	mdmcomm_close_connection_to_daemon ();
+/*
+ * Reparse config stuff here.  At least the ones we care about.  The
+ * keys are read again without waiting for the daemon, each group is
+ * acted on once its answers are in.
+ */
+static gboolean
+mdm_reread_config (int sig, gpointer data)
+{
+	mdm_config_reload_async (restart_keys, G_N_ELEMENTS (restart_keys),
+				 restart_keys_reloaded, NULL);
+	mdm_config_reload_async (background_keys, G_N_ELEMENTS (background_keys),
+				 background_keys_reloaded, NULL);
+	mdm_config_reload_async (clock_keys, G_N_ELEMENTS (clock_keys),
+				 clock_keys_reloaded, NULL);
+	mdm_config_reload_async (welcome_keys, G_N_ELEMENTS (welcome_keys),
+				 welcome_keys_reloaded, NULL);
 
 	return TRUE;
 }
@@ -2370,6 +2406,8 @@ main (int argc, char *argv[])
     GIOChannel *ctrlch;
     guint sid;
 
+    mdm_common_trace_init ("mdmlogin");
+
     if (g_getenv ("DOING_MDM_DEVELOPMENT") != NULL)
 	    DOING_MDM_DEVELOPMENT = TRUE;
 
@@ -2419,15 +2457,16 @@ main (int argc, char *argv[])
         mdm_common_warning ("Could not open DefaultFace: %s!", mdm_config_get_string (MDM_KEY_DEFAULT_FACE));
     }
 
-    if (mdm_config_get_bool (MDM_KEY_BROWSER)) {
-    	mdm_users_init (&users, &users_string, NULL, defface, &size_of_users, login_is_local, !DOING_MDM_DEVELOPMENT);
-    }
-
     mdm_login_gui_init ();
 
+    /* The list fills in the background, the faces of the rows on
+     * screen are asked for as they show up */
     if (mdm_config_get_bool (MDM_KEY_BROWSER)) {
-		mdm_login_browser_populate ();
-	}
+	users_loader = mdm_users_loader_new (defface, mdm_login_browser_add_users, NULL);
+	mdm_users_loader_track_view (users_loader, GTK_TREE_VIEW (browser),
+				     GREETER_ULIST_ICON_COLUMN,
+				     GREETER_ULIST_LOGIN_COLUMN);
+    }
 
     ve_signal_add (SIGHUP, mdm_reread_config, NULL);
 
@@ -2557,6 +2596,7 @@ main (int argc, char *argv[])
 				NULL /* destroy_notify */);
 
     gtk_widget_queue_resize (login);
+    mdm_common_trace_first_frame (login);
     gtk_widget_show_now (login);
 
     mdm_wm_center_window (GTK_WINDOW (login));    
@@ -319,7 +319,10 @@ update_key (const char *key)
 	/* recheck for mdm */
 	mdm_running = mdmcomm_is_daemon_running (FALSE);
 
-	if (mdm_running) {
+	/* a daemon that watches its configuration files has already
+	 * seen the change, and tells the login screens about all keys
+	 * changed in the same write at once */
+	if (mdm_running && ! mdm_config_get_bool (MDM_KEY_WATCH_CONFIG_FILES)) {
 		char *ret;
 		char *s = g_strdup_printf ("%s %s", MDM_SUP_UPDATE_CONFIG,
 					   key);
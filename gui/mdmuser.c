@@ -25,7 +25,12 @@
 #include <locale.h>
 #include <glib/gi18n.h>
 #include <string.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 #include <pwd.h>
 
@@ -37,9 +42,160 @@
 
 #include "mdm-socket-protocol.h"
 #include "mdm-daemon-config-keys.h"
+#include "mdm-face-cache.h"
+#include "mdm-user-filter.h"
 
 static time_t time_started;
 
+/* Socket the slave passes the open picture files over, from
+ * MDM_FACE_SOCKET; -2 until looked up */
+static int face_socket = -2;
+
+static int
+get_face_socket (void)
+{
+	const char *str;
+
+	if (face_socket != -2)
+		return face_socket;
+
+	face_socket = -1;
+	str = g_getenv ("MDM_FACE_SOCKET");
+	if ( ! ve_string_empty (str)) {
+		face_socket = atoi (str);
+		/* nothing we run needs it */
+		if (face_socket > 2)
+			fcntl (face_socket, F_SETFD, FD_CLOEXEC);
+		else
+			face_socket = -1;
+	}
+
+	return face_socket;
+}
+
+static int
+receive_face_fd (void)
+{
+	struct msghdr   msg;
+	struct iovec    iov;
+	struct cmsghdr *cmsg;
+	char            control[CMSG_SPACE (sizeof (int))];
+	char            byte;
+	int             fd = -1;
+	ssize_t         n;
+
+	if (get_face_socket () < 0)
+		return -1;
+
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof (control);
+
+	do {
+		n = recvmsg (face_socket, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n != 1)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN (sizeof (int)))
+			memcpy (&fd, CMSG_DATA (cmsg), sizeof (int));
+	}
+
+	if (fd >= 0)
+		fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+	return fd;
+}
+
+/* The scaled pictures the slaves keep for us, opened on first use */
+static MdmFaceCache *face_cache = NULL;
+static gboolean face_cache_opened = FALSE;
+
+static GdkPixbuf *
+load_face_cache (uid_t uid, gint64 mtime, guint64 size)
+{
+	const guchar *pixels;
+	GdkPixbuf    *img;
+	int           rowstride, row;
+
+	if ( ! face_cache_opened ||
+	    (face_cache != NULL && ! mdm_face_cache_is_current (face_cache))) {
+		mdm_face_cache_close (face_cache);
+		face_cache = mdm_face_cache_open (mdm_config_get_string (MDM_KEY_FACE_CACHE));
+		face_cache_opened = TRUE;
+	}
+	if (face_cache == NULL)
+		return NULL;
+
+	/* the slave has checked the path */
+	pixels = mdm_face_cache_lookup (face_cache, uid, NULL, mtime, size);
+	if (pixels == NULL)
+		return NULL;
+
+	img = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+			      MDM_FACE_CACHE_THUMB_SIZE,
+			      MDM_FACE_CACHE_THUMB_SIZE);
+	if (img == NULL)
+		return NULL;
+
+	rowstride = gdk_pixbuf_get_rowstride (img);
+	for (row = 0; row < MDM_FACE_CACHE_THUMB_SIZE; row++)
+		memcpy (gdk_pixbuf_get_pixels (img) + row * rowstride,
+			pixels + row * MDM_FACE_CACHE_THUMB_SIZE * 4,
+			MDM_FACE_CACHE_THUMB_SIZE * 4);
+
+	return img;
+}
+
+/* Loads the picture straight out of the file the slave opened for us.
+ * The file is the user's, who can truncate it at any time, so it is
+ * read and not mapped: a mapping would SIGBUS once the pages are gone. */
+static GdkPixbuf *
+load_face_fd (int fd, gsize size)
+{
+	GdkPixbufLoader *loader;
+	GdkPixbuf       *img;
+	guchar          *buf;
+	gsize            len;
+
+	/* size is what the slave checked against UserMaxFile */
+	buf = g_try_malloc (MAX (size, 1));
+	if (buf == NULL)
+		return NULL;
+
+	len = 0;
+	while (len < size) {
+		ssize_t n;
+
+		do {
+			n = pread (fd, buf + len, size - len, len);
+		} while (n < 0 && errno == EINTR);
+		if (n <= 0)
+			break;	/* changed since the slave checked it */
+		len += n;
+	}
+
+	loader = gdk_pixbuf_loader_new ();
+	gdk_pixbuf_loader_write (loader, buf, len, NULL);
+	gdk_pixbuf_loader_close (loader, NULL);
+	g_free (buf);
+
+	img = gdk_pixbuf_loader_get_pixbuf (loader);
+	if (img != NULL)
+		img = gdk_pixbuf_scale_simple (img, 48, 48, GDK_INTERP_BILINEAR);
+
+	g_object_unref (G_OBJECT (loader));
+
+	return img;
+}
+
 static MdmUser * 
 mdm_user_alloc (const gchar *logname,
 		uid_t uid,
@@ -99,20 +255,49 @@ mdm_user_alloc (const gchar *logname,
 	printf ("%c%s\n", STX, logname);
 	fflush (stdout);
 
-	do {
-		while (read (STDIN_FILENO, buf, 1) == 1)
-			if (buf[0] == STX)
-				break;
-		size = read (STDIN_FILENO, buf, sizeof (buf));
-		if (size <= 0)
-			return user;
-	} while (buf[0] != MDM_READPIC);
+	for (;;) {
+		gint64 mtime;
+		guint64 cached_size;
+
+		do {
+			while (read (STDIN_FILENO, buf, 1) == 1)
+				if (buf[0] == STX)
+					break;
+			size = read (STDIN_FILENO, buf, sizeof (buf));
+			if (size <= 0)
+				return user;
+		} while (buf[0] != MDM_READPIC);
+
+		/* both nul terminate and wipe the trailing \n */
+		buf[size-1] = '\0';
+
+		if (size < 2 ||
+		    sscanf (&buf[1], "cache:%" G_GINT64_FORMAT ":%" G_GUINT64_FORMAT,
+			    &mtime, &cached_size) != 2)
+			break;
 
-	/* both nul terminate and wipe the trailing \n */
-	buf[size-1] = '\0';
+		img = load_face_cache (uid, mtime, cached_size);
+		if (img != NULL)
+			break;
+
+		/* the slave sends the picture itself then */
+		printf ("%cmiss\n", STX);
+		fflush (stdout);
+	}
+
+	if (img != NULL) {
+		/* from the face cache */
+	} else if (size < 2) {
+		img = NULL;
+	} else if (sscanf (&buf[1], "fd:%d", &bufsize) == 1) {
+		int fd = receive_face_fd ();
 
-	if (size < 2) {
 		img = NULL;
+		if (fd >= 0) {
+			if (bufsize > 0)
+				img = load_face_fd (fd, bufsize);
+			close (fd);
+		}
 	} else if (sscanf (&buf[1], "buffer:%d", &bufsize) == 1) {
 		unsigned char buffer[2048];
 		int pos = 0;
@@ -176,59 +361,6 @@ mdm_user_alloc (const gchar *logname,
 	return user;
 }
 
-static gboolean
-mdm_check_exclude (struct passwd *pwent, char **excludes, gboolean is_local)
-{
-	const char * const lockout_passes[] = { "!!", NULL };
-	gint i;
-
-        if ( ! mdm_config_get_bool (MDM_KEY_ALLOW_ROOT) && pwent->pw_uid == 0)
-                return TRUE;       
-
-	if (pwent->pw_uid < mdm_config_get_int (MDM_KEY_MINIMAL_UID))
-		return TRUE;
-
-	for (i=0 ; lockout_passes[i] != NULL ; i++)  {
-		if (strcmp (lockout_passes[i], pwent->pw_passwd) == 0) {
-			return TRUE;
-		}
-	}
-
-	if (excludes != NULL) {
-		for (i=0 ; excludes[i] != NULL ; i++)  {
-			if (g_ascii_strcasecmp (excludes[i],
-						pwent->pw_name) == 0) {
-				return TRUE;
-			}
-		}
-	}
-
-	return FALSE;
-}
-
-static gboolean
-mdm_check_shell (const gchar *usersh)
-{
-    gint found = 0;
-    gchar *csh;
-
-    if (strcmp (usersh, NOLOGIN) == 0 ||
-	strcmp (usersh, "/bin/true") == 0 ||
-	strcmp (usersh, "/bin/false") == 0) {
-      return 0;
-    }
-
-    setusershell ();
-
-    while ((csh = getusershell ()) != NULL)
-        if (! strcmp (csh, usersh))
-            found = 1;
-
-    endusershell ();
-
-    return (found);
-}
-
 static gint
 mdm_sort_func (gpointer d1, gpointer d2)
 {
@@ -246,21 +378,21 @@ static gboolean
 setup_user (struct passwd *pwent,
 	    GList **users,
 	    GList **users_string,
-	    char **excludes,
+	    MdmUserFilter *filter,
+	    GHashTable *seen,
 	    char *exclude_user,
 	    GdkPixbuf *defface,
+	    int icon_height,
 	    int *size_of_users,
-	    gboolean is_local,
 	    gboolean read_faces)
 {
     MdmUser *user;
     int cnt = 0;
 
-    if (pwent->pw_shell && 
-	mdm_check_shell (pwent->pw_shell) &&
-	!mdm_check_exclude (pwent, excludes, is_local) &&
+    if (mdm_user_filter_accepts (filter, pwent) &&
 	(exclude_user == NULL ||
-	strcmp (ve_sure_string (exclude_user), pwent->pw_name)) != 0) {
+	strcmp (ve_sure_string (exclude_user), pwent->pw_name)) != 0 &&
+	! g_hash_table_contains (seen, pwent->pw_name)) {
 
 	    user = mdm_user_alloc (pwent->pw_name,
 				   pwent->pw_uid,
@@ -268,29 +400,23 @@ setup_user (struct passwd *pwent,
 				   ve_sure_string (pwent->pw_gecos),
 				   defface, read_faces);
 
-	    if ((user) &&
-		(! g_list_find_custom (*users, user, (GCompareFunc) mdm_sort_func))) {
+	    if (user) {
 		cnt++;
-		*users = g_list_insert_sorted (*users, user,
-		     (GCompareFunc) mdm_sort_func);
+		/* sorted once the list is complete */
+		*users = g_list_prepend (*users, user);
 		*users_string = g_list_prepend (*users_string, g_strdup (pwent->pw_name));
+		g_hash_table_add (seen, user->login);
 
 		if (user->picture != NULL) {
 			*size_of_users +=
 				gdk_pixbuf_get_height (user->picture) + 2;
 		} else {
-			*size_of_users += mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT);
+			*size_of_users += icon_height;
 		}
 	    }
 
-	    if (cnt > 1000 || time_started + 5 <= time (NULL)) {
-		*users = g_list_append (*users,
-			g_strdup (_("Too many users to list here...")));
-		*users_string = g_list_append (*users_string,
-			g_strdup (_("Too many users to list here...")));
-
+	    if (cnt > 1000 || time_started + 5 <= time (NULL))
 		return (FALSE);
-	    }
     }
     return (TRUE);
 }
@@ -340,8 +466,11 @@ mdm_users_init (GList **users,
 {
     struct passwd *pwent;
     char **includes;
-    char **excludes;
+    MdmUserFilter *filter;
+    GHashTable *seen;
     gboolean found_include = FALSE;
+    gboolean complete = TRUE;
+    int icon_height;
     int i;
 
     time_started = time (NULL);
@@ -353,19 +482,25 @@ mdm_users_init (GList **users,
            found_include = TRUE;
     }
 
-    excludes = g_strsplit (mdm_config_get_string (MDM_KEY_EXCLUDE), ",", 0);
-    for (i=0 ; excludes != NULL && excludes[i] != NULL ; i++)
-	g_strstrip (excludes[i]);
+    /* everything the entries are checked against is looked up once
+     * here rather than once per entry */
+    filter = mdm_user_filter_new (mdm_config_get_bool (MDM_KEY_ALLOW_ROOT),
+				  mdm_config_get_int (MDM_KEY_MINIMAL_UID),
+				  mdm_config_get_string (MDM_KEY_EXCLUDE));
+    icon_height = mdm_config_get_int (MDM_KEY_MAX_ICON_HEIGHT);
+    seen = g_hash_table_new (g_str_hash, g_str_equal);
 
     if (mdm_config_get_bool (MDM_KEY_INCLUDE_ALL) == TRUE) {
 	    setpwent ();
 	    pwent = getpwent ();
 	    while (pwent != NULL) {
 
-		if (! setup_user (pwent, users, users_string, excludes,
-			exclude_user, defface, size_of_users, is_local,
-			read_faces))
+		if (! setup_user (pwent, users, users_string, filter, seen,
+			exclude_user, defface, icon_height, size_of_users,
+			read_faces)) {
+			complete = FALSE;
 			break;
+		}
 
 		pwent = getpwent ();
 	}
@@ -376,16 +511,604 @@ mdm_users_init (GList **users,
 		pwent = getpwnam (includes[i]);
 
 		if (pwent != NULL) {
-			if (!setup_user (pwent, users, users_string, excludes,
-			    exclude_user, defface, size_of_users, is_local,
-			    read_faces))
-			break;
+			if (!setup_user (pwent, users, users_string, filter, seen,
+			    exclude_user, defface, icon_height, size_of_users,
+			    read_faces)) {
+				complete = FALSE;
+				break;
+			}
 
 		}
 	}
     }
 
+    *users = g_list_sort (*users, (GCompareFunc) mdm_sort_func);
+
+    if (! complete) {
+	*users = g_list_append (*users,
+		g_strdup (_("Too many users to list here...")));
+	*users_string = g_list_append (*users_string,
+		g_strdup (_("Too many users to list here...")));
+    }
+
+    g_hash_table_destroy (seen);
+    mdm_user_filter_free (filter);
     g_strfreev (includes);
-    g_strfreev (excludes);
 }
 
+
+/*
+ * The user list for directories too large to enumerate before the
+ * greeter shows up.  A thread walks the passwd database and passes
+ * what the filter accepts to the main loop in batches, the views put
+ * them in a sorted model as they come, and only the faces of the rows
+ * on screen are ever asked for.
+ */
+
+/* a batch goes out when it has this many users or is this old */
+#define USERS_BATCH_SIZE	256
+#define USERS_BATCH_USEC	(50 * 1000)
+
+/* faces asked for and not answered yet */
+#define FACE_REQUESTS_MAX	16
+
+typedef struct {
+	char  *login;
+	uid_t  uid;
+	char  *homedir;
+	char  *gecos;
+} UserRecord;
+
+typedef struct {
+	MdmUsersLoader *loader;
+	GPtrArray      *records;
+	gboolean        done;
+} UsersBatch;
+
+struct _MdmUsersLoader {
+	gint               ref_count;
+	gint               cancelled;
+
+	GdkPixbuf         *defface;
+	MdmUsersBatchFunc  func;
+	gpointer           data;
+
+	/* only read by the thread */
+	MdmUserFilter     *filter;
+	gboolean           include_all;
+	char             **includes;
+
+	GHashTable        *users;	/* login -> MdmUser */
+
+	GtkTreeView       *view;
+	int                icon_column;
+	int                login_column;
+	gulong             value_changed_id;
+	gulong             size_allocate_id;
+	GtkAdjustment     *vadjustment;
+	guint              update_id;
+
+	guint              face_watch;
+	int                n_face_requests;
+};
+
+static void queue_update_faces (MdmUsersLoader *loader);
+
+static void
+user_free (MdmUser *user)
+{
+	if (user->picture != NULL)
+		g_object_unref (G_OBJECT (user->picture));
+	g_free (user->login);
+	g_free (user->homedir);
+	g_free (user->gecos);
+	g_free (user);
+}
+
+static void
+user_record_free (UserRecord *record)
+{
+	g_free (record->login);
+	g_free (record->homedir);
+	g_free (record->gecos);
+	g_free (record);
+}
+
+static MdmUsersLoader *
+loader_ref (MdmUsersLoader *loader)
+{
+	g_atomic_int_inc (&loader->ref_count);
+	return loader;
+}
+
+static void
+loader_unref (MdmUsersLoader *loader)
+{
+	if ( ! g_atomic_int_dec_and_test (&loader->ref_count))
+		return;
+
+	g_hash_table_destroy (loader->users);
+	mdm_user_filter_free (loader->filter);
+	g_strfreev (loader->includes);
+	if (loader->defface != NULL)
+		g_object_unref (G_OBJECT (loader->defface));
+	g_free (loader);
+}
+
+static gboolean
+deliver_batch (gpointer data)
+{
+	UsersBatch     *batch = data;
+	MdmUsersLoader *loader = batch->loader;
+	guint           i;
+
+	if ( ! g_atomic_int_get (&loader->cancelled)) {
+		GPtrArray *users = g_ptr_array_sized_new (batch->records->len);
+
+		for (i = 0; i < batch->records->len; i++) {
+			UserRecord *record = g_ptr_array_index (batch->records, i);
+			MdmUser    *user;
+
+			user = mdm_user_alloc (record->login, record->uid,
+					       record->homedir, record->gecos,
+					       loader->defface, FALSE);
+			g_hash_table_insert (loader->users, user->login, user);
+			g_ptr_array_add (users, user);
+		}
+
+		loader->func (users, batch->done, loader->data);
+		g_ptr_array_free (users, TRUE);
+
+		/* the new rows may be on screen */
+		queue_update_faces (loader);
+	}
+
+	g_ptr_array_free (batch->records, TRUE);
+	loader_unref (loader);
+	g_free (batch);
+
+	return FALSE;
+}
+
+static void
+send_batch (MdmUsersLoader *loader, GPtrArray **records, gboolean done)
+{
+	UsersBatch *batch;
+
+	if (*records == NULL && ! done)
+		return;
+
+	batch = g_new0 (UsersBatch, 1);
+	batch->loader = loader_ref (loader);
+	batch->records = *records != NULL ? *records :
+		g_ptr_array_new_with_free_func ((GDestroyNotify) user_record_free);
+	batch->done = done;
+	*records = NULL;
+
+	/* below redrawing and input, the list fills in while the
+	 * greeter is already usable */
+	g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, deliver_batch, batch, NULL);
+}
+
+static void
+add_record (MdmUsersLoader *loader,
+	    struct passwd  *pwent,
+	    GHashTable     *seen,
+	    GPtrArray     **records,
+	    gint64         *batch_started)
+{
+	UserRecord *record;
+
+	if ( ! mdm_user_filter_accepts (loader->filter, pwent) ||
+	    g_hash_table_contains (seen, pwent->pw_name))
+		return;
+
+	record = g_new0 (UserRecord, 1);
+	record->login = g_strdup (pwent->pw_name);
+	record->uid = pwent->pw_uid;
+	record->homedir = g_strdup (pwent->pw_dir);
+	record->gecos = g_strdup (ve_sure_string (pwent->pw_gecos));
+	g_hash_table_add (seen, g_strdup (record->login));
+
+	if (*records == NULL) {
+		*records = g_ptr_array_new_with_free_func ((GDestroyNotify) user_record_free);
+		*batch_started = g_get_monotonic_time ();
+	}
+	g_ptr_array_add (*records, record);
+
+	if ((*records)->len >= USERS_BATCH_SIZE ||
+	    g_get_monotonic_time () - *batch_started >= USERS_BATCH_USEC)
+		send_batch (loader, records, FALSE);
+}
+
+static gpointer
+load_users (gpointer data)
+{
+	MdmUsersLoader *loader = data;
+	GHashTable     *seen;
+	GPtrArray      *records = NULL;
+	gint64          batch_started = 0;
+	struct passwd  *pwent;
+
+	seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	if (loader->include_all) {
+		/* nobody else in the greeter walks the database */
+		setpwent ();
+		while ( ! g_atomic_int_get (&loader->cancelled) &&
+		       (pwent = getpwent ()) != NULL)
+			add_record (loader, pwent, seen, &records, &batch_started);
+		endpwent ();
+	} else if (loader->includes != NULL) {
+		struct passwd pwbuf;
+		char         *buf;
+		long          bufsize;
+		int           i;
+
+		/* getpwnam is not ours alone, the main loop uses it too */
+		bufsize = sysconf (_SC_GETPW_R_SIZE_MAX);
+		if (bufsize <= 0)
+			bufsize = 16384;
+		buf = g_malloc (bufsize);
+
+		for (i = 0; loader->includes[i] != NULL; i++) {
+			if (g_atomic_int_get (&loader->cancelled))
+				break;
+			if (loader->includes[i][0] != '\0' &&
+			    getpwnam_r (loader->includes[i], &pwbuf, buf, bufsize, &pwent) == 0 &&
+			    pwent != NULL)
+				add_record (loader, pwent, seen, &records, &batch_started);
+		}
+
+		g_free (buf);
+	}
+
+	send_batch (loader, &records, TRUE);
+
+	g_hash_table_destroy (seen);
+	loader_unref (loader);
+
+	return NULL;
+}
+
+MdmUsersLoader *
+mdm_users_loader_new (GdkPixbuf         *defface,
+		      MdmUsersBatchFunc  func,
+		      gpointer           data)
+{
+	MdmUsersLoader *loader;
+	GThread        *thread;
+	GError         *error = NULL;
+	int             i;
+
+	loader = g_new0 (MdmUsersLoader, 1);
+	loader->ref_count = 1;
+	loader->func = func;
+	loader->data = data;
+	if (defface != NULL)
+		loader->defface = g_object_ref (G_OBJECT (defface));
+	loader->users = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					       (GDestroyNotify) user_free);
+
+	/* the configuration comes from the daemon, so it is read here
+	 * and not in the thread */
+	loader->filter = mdm_user_filter_new (mdm_config_get_bool (MDM_KEY_ALLOW_ROOT),
+					      mdm_config_get_int (MDM_KEY_MINIMAL_UID),
+					      mdm_config_get_string (MDM_KEY_EXCLUDE));
+	loader->include_all = mdm_config_get_bool (MDM_KEY_INCLUDE_ALL);
+	if ( ! loader->include_all) {
+		loader->includes = g_strsplit (mdm_config_get_string (MDM_KEY_INCLUDE), ",", 0);
+		for (i = 0; loader->includes != NULL && loader->includes[i] != NULL; i++)
+			g_strstrip (loader->includes[i]);
+	}
+
+	thread = g_thread_try_new ("mdm-users", load_users, loader_ref (loader), &error);
+	if (thread == NULL) {
+		GPtrArray *none = NULL;
+
+		mdm_common_warning ("Cannot start loading the user list: %s",
+				    error->message);
+		g_error_free (error);
+		loader_unref (loader);
+		/* an empty list then */
+		send_batch (loader, &none, TRUE);
+	} else {
+		g_thread_unref (thread);
+	}
+
+	return loader;
+}
+
+static void
+loader_untrack_view (MdmUsersLoader *loader)
+{
+	if (loader->update_id != 0) {
+		g_source_remove (loader->update_id);
+		loader->update_id = 0;
+	}
+
+	if (loader->vadjustment != NULL) {
+		g_signal_handler_disconnect (loader->vadjustment, loader->value_changed_id);
+		g_object_unref (G_OBJECT (loader->vadjustment));
+		loader->vadjustment = NULL;
+	}
+
+	if (loader->view != NULL) {
+		g_signal_handler_disconnect (loader->view, loader->size_allocate_id);
+		g_object_remove_weak_pointer (G_OBJECT (loader->view),
+					      (gpointer *) &loader->view);
+		loader->view = NULL;
+	}
+}
+
+void
+mdm_users_loader_free (MdmUsersLoader *loader)
+{
+	if (loader == NULL)
+		return;
+
+	/* the thread and the batches on their way hold on to it until
+	 * they notice */
+	g_atomic_int_set (&loader->cancelled, 1);
+
+	loader_untrack_view (loader);
+	if (loader->face_watch != 0) {
+		g_source_remove (loader->face_watch);
+		loader->face_watch = 0;
+	}
+
+	loader_unref (loader);
+}
+
+MdmUser *
+mdm_users_loader_lookup (MdmUsersLoader *loader,
+			 const char     *login)
+{
+	return g_hash_table_lookup (loader->users, login);
+}
+
+gint
+mdm_users_compare_logins (GtkTreeModel *model,
+			  GtkTreeIter  *a,
+			  GtkTreeIter  *b,
+			  gpointer      data)
+{
+	int   column = GPOINTER_TO_INT (data);
+	char *login_a = NULL, *login_b = NULL;
+	gint  ret;
+
+	gtk_tree_model_get (model, a, column, &login_a, -1);
+	gtk_tree_model_get (model, b, column, &login_b, -1);
+
+	/* the same order mdm_users_init gives */
+	ret = strcmp (ve_sure_string (login_a), ve_sure_string (login_b));
+
+	g_free (login_a);
+	g_free (login_b);
+
+	return ret;
+}
+
+/* A picture the slave sent in answer to request_face */
+static void
+apply_face_reply (MdmUsersLoader *loader, char *msg, int fd)
+{
+	MdmUser   *user;
+	GdkPixbuf *img = NULL;
+	char      *answer;
+	gint64     mtime;
+	guint64    size;
+	int        bufsize;
+
+	answer = strchr (msg, '\t');
+	if (answer == NULL)
+		return;
+	*answer++ = '\0';
+
+	user = g_hash_table_lookup (loader->users, msg);
+	if (user == NULL || user->face_state != MDM_USER_FACE_PENDING)
+		return;
+
+	loader->n_face_requests--;
+	user->face_state = MDM_USER_FACE_LOADED;
+
+	if (sscanf (answer, "cache:%" G_GINT64_FORMAT ":%" G_GUINT64_FORMAT,
+		    &mtime, &size) == 2) {
+		img = load_face_cache (user->uid, mtime, size);
+		/* our copy of the cache is older than the slave's */
+		if (img == NULL && fd >= 0)
+			img = load_face_fd (fd, size);
+	} else if (sscanf (answer, "fd:%d", &bufsize) == 1 &&
+		   fd >= 0 && bufsize > 0) {
+		img = load_face_fd (fd, bufsize);
+	}
+
+	if (img != NULL) {
+		if (user->picture != NULL)
+			g_object_unref (G_OBJECT (user->picture));
+		user->picture = img;
+	}
+}
+
+static gboolean
+face_reply_ready (GIOChannel   *source,
+		  GIOCondition  cond,
+		  gpointer      data)
+{
+	MdmUsersLoader *loader = data;
+	struct msghdr   msg;
+	struct iovec    iov;
+	struct cmsghdr *cmsg;
+	char            control[CMSG_SPACE (sizeof (int))];
+	char            buf[512];
+	int             fd = -1;
+	ssize_t         n;
+
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = buf;
+	iov.iov_len = sizeof (buf) - 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof (control);
+
+	do {
+		n = recvmsg (face_socket, &msg, MSG_DONTWAIT);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return TRUE;
+
+	if (n <= 0) {
+		/* no more pictures from this slave, the rest keep the
+		 * default face */
+		loader->face_watch = 0;
+		face_socket = -1;
+		return FALSE;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS &&
+		    cmsg->cmsg_len == CMSG_LEN (sizeof (int)))
+			memcpy (&fd, CMSG_DATA (cmsg), sizeof (int));
+	}
+
+	buf[n] = '\0';
+	apply_face_reply (loader, buf, fd);
+
+	if (fd >= 0)
+		close (fd);
+
+	queue_update_faces (loader);
+
+	return TRUE;
+}
+
+/* Asks the slave for the user's face, it answers once it is waiting
+ * on us anyway */
+static void
+request_face (MdmUsersLoader *loader, MdmUser *user)
+{
+	ssize_t n;
+
+	if (get_face_socket () < 0) {
+		user->face_state = MDM_USER_FACE_LOADED;
+		return;
+	}
+
+	if (loader->n_face_requests >= FACE_REQUESTS_MAX)
+		return;
+
+	if (loader->face_watch == 0) {
+		GIOChannel *channel = g_io_channel_unix_new (face_socket);
+
+		loader->face_watch = g_io_add_watch (channel,
+						     G_IO_IN | G_IO_HUP | G_IO_ERR,
+						     face_reply_ready, loader);
+		g_io_channel_unref (channel);
+	}
+
+	do {
+		n = send (face_socket, user->login, strlen (user->login), MSG_DONTWAIT);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0) {
+		/* tried again on the next update if the socket is only full */
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			user->face_state = MDM_USER_FACE_LOADED;
+		return;
+	}
+
+	user->face_state = MDM_USER_FACE_PENDING;
+	loader->n_face_requests++;
+}
+
+static gboolean
+update_faces (gpointer data)
+{
+	MdmUsersLoader *loader = data;
+	GtkTreeModel   *model;
+	GtkTreePath    *start, *end;
+	GtkTreeIter     iter;
+	int             i, last;
+	gboolean        valid;
+
+	loader->update_id = 0;
+
+	if (loader->view == NULL ||
+	    ! gtk_tree_view_get_visible_range (loader->view, &start, &end))
+		return FALSE;
+
+	model = gtk_tree_view_get_model (loader->view);
+	i = gtk_tree_path_get_indices (start)[0];
+	last = gtk_tree_path_get_indices (end)[0];
+
+	for (valid = gtk_tree_model_get_iter (model, &iter, start);
+	     valid && i <= last;
+	     valid = gtk_tree_model_iter_next (model, &iter), i++) {
+		MdmUser   *user;
+		GdkPixbuf *icon = NULL;
+		char      *login = NULL;
+
+		gtk_tree_model_get (model, &iter,
+				    loader->login_column, &login,
+				    loader->icon_column, &icon,
+				    -1);
+
+		user = login != NULL ? g_hash_table_lookup (loader->users, login) : NULL;
+		if (user != NULL) {
+			if (user->face_state == MDM_USER_FACE_NONE)
+				request_face (loader, user);
+			if (user->picture != icon)
+				gtk_list_store_set (GTK_LIST_STORE (model), &iter,
+						    loader->icon_column, user->picture,
+						    -1);
+		}
+
+		if (icon != NULL)
+			g_object_unref (G_OBJECT (icon));
+		g_free (login);
+	}
+
+	gtk_tree_path_free (start);
+	gtk_tree_path_free (end);
+
+	return FALSE;
+}
+
+static void
+queue_update_faces (MdmUsersLoader *loader)
+{
+	if (loader->view != NULL && loader->update_id == 0)
+		loader->update_id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+						     update_faces, loader, NULL);
+}
+
+void
+mdm_users_loader_track_view (MdmUsersLoader *loader,
+			     GtkTreeView    *view,
+			     int             icon_column,
+			     int             login_column)
+{
+	loader_untrack_view (loader);
+
+	loader->view = view;
+	loader->icon_column = icon_column;
+	loader->login_column = login_column;
+	g_object_add_weak_pointer (G_OBJECT (view), (gpointer *) &loader->view);
+
+	/* rows come into view by scrolling and by the view growing, and
+	 * with every batch */
+	loader->size_allocate_id =
+		g_signal_connect_swapped (view, "size_allocate",
+					  G_CALLBACK (queue_update_faces), loader);
+	loader->vadjustment = gtk_tree_view_get_vadjustment (view);
+	if (loader->vadjustment != NULL) {
+		g_object_ref (G_OBJECT (loader->vadjustment));
+		loader->value_changed_id =
+			g_signal_connect_swapped (loader->vadjustment, "value_changed",
+						  G_CALLBACK (queue_update_faces), loader);
+	}
+	queue_update_faces (loader);
+}
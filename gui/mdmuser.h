@@ -19,11 +19,19 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <gtk/gtk.h>
+
 #include "misc.h"
 
 #ifndef MDM_USER_H
 #define MDM_USER_H
 
+typedef enum {
+    MDM_USER_FACE_NONE = 0,	/* not asked for yet */
+    MDM_USER_FACE_PENDING,	/* asked the slave for it */
+    MDM_USER_FACE_LOADED	/* picture is as good as it gets */
+} MdmUserFaceState;
+
 typedef struct _MdmUser MdmUser;
 struct _MdmUser {
     uid_t uid;
@@ -31,6 +39,7 @@ struct _MdmUser {
     char *homedir;
     char *gecos;
     GdkPixbuf *picture;
+    MdmUserFaceState face_state;
 };
 
 gboolean    mdm_is_user_valid		(const char *username);
@@ -41,4 +50,36 @@ void        mdm_users_init              (GList **users, GList **users_string,
 					int *size_of_users, gboolean is_local,
 					gboolean read_faces);
 
+/*
+ * The user list loaded in the background: the passwd database is
+ * enumerated in a thread and the users are handed to func on the main
+ * loop a batch at a time, with done TRUE on the last one.  Everybody
+ * starts out with the default face.  The batch array and the users
+ * belong to the loader.
+ */
+typedef struct _MdmUsersLoader MdmUsersLoader;
+typedef void (* MdmUsersBatchFunc) (GPtrArray *users, gboolean done, gpointer data);
+
+MdmUsersLoader *mdm_users_loader_new   (GdkPixbuf *defface,
+					MdmUsersBatchFunc func,
+					gpointer data);
+void        mdm_users_loader_free      (MdmUsersLoader *loader);
+MdmUser *   mdm_users_loader_lookup    (MdmUsersLoader *loader,
+					const char *login);
+
+/* Asks the slave for the faces of the rows of view that are on screen
+ * and puts them in icon_column once they come in.  The model must be a
+ * GtkListStore with the login in login_column. */
+void        mdm_users_loader_track_view (MdmUsersLoader *loader,
+					 GtkTreeView *view,
+					 int icon_column,
+					 int login_column);
+
+/* Sort function for the login column of such a model, with the column
+ * number as data */
+gint        mdm_users_compare_logins   (GtkTreeModel *model,
+					GtkTreeIter *a,
+					GtkTreeIter *b,
+					gpointer data);
+
 #endif /* MDM_USER_H */
@@ -303,6 +303,7 @@ void webkit_on_loaded(WebKitWebView *view, WebKitWebFrame *frame, gpointer user_
         g_io_channel_unref (ctrlch);
     }
 
+    mdm_common_trace_first_frame (GTK_WIDGET (login));
     gtk_widget_show_all (GTK_WIDGET (login));
 }
 
@@ -510,8 +511,7 @@ void process_operation (guchar op_code, const gchar *args) {
 
         case MDM_SETLOGIN:
             webkit_execute_script("mdm_set_current_user", html_encode(args));
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
 
@@ -585,8 +585,7 @@ void process_operation (guchar op_code, const gchar *args) {
 
             webkit_execute_script("mdm_msg", mdm_msg);
 
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
 
             break;
 
@@ -604,8 +603,7 @@ void process_operation (guchar op_code, const gchar *args) {
             else {
                 err_box_clear_handler = g_timeout_add (30000, err_box_clear, NULL);
             }
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_ERRDLG:
@@ -647,8 +645,7 @@ void process_operation (guchar op_code, const gchar *args) {
             webkit_execute_script("mdm_set_current_session", wargs);
             g_free (wargs);
             mdm_debug("mdm_verify_set_user_settings: mdm_set_current_session '%s'.", args);
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_SETLANG:
@@ -676,8 +673,7 @@ void process_operation (guchar op_code, const gchar *args) {
                 g_free (untranslated);
             }
 
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_ALWAYS_RESTART:
@@ -690,8 +686,7 @@ void process_operation (guchar op_code, const gchar *args) {
             mdm_msg = g_strdup (tmp);
             webkit_execute_script("mdm_msg", mdm_msg);
             g_free (tmp);
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_QUIT:
@@ -732,8 +727,7 @@ void process_operation (guchar op_code, const gchar *args) {
                 mdm_timed_delay = mdm_config_get_int (MDM_KEY_TIMED_LOGIN_DELAY);
                 timed_handler_id  = g_timeout_add (1000, mdm_timer, NULL);
             }
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_STOPTIMER:
@@ -741,22 +735,19 @@ void process_operation (guchar op_code, const gchar *args) {
                 g_source_remove (timed_handler_id);
                 timed_handler_id = 0;
             }
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_DISABLE:
             gtk_widget_set_sensitive (login, FALSE);
             webkit_execute_script("mdm_disable", NULL);
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_ENABLE:
             gtk_widget_set_sensitive (login, TRUE);
             webkit_execute_script("mdm_enable", NULL);
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         // These are handled separately so ignore them here and send back a NULL response so that the daemon quits sending them
@@ -768,14 +759,12 @@ void process_operation (guchar op_code, const gchar *args) {
 
         case MDM_NOFOCUS:
             mdm_wm_no_login_focus_push ();
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_FOCUS:
             mdm_wm_no_login_focus_pop ();
-            printf ("%c\n", STX);
-            fflush (stdout);
+            mdm_common_greeter_ack ();
             break;
 
         case MDM_SAVEDIE:
@@ -798,6 +787,10 @@ void process_operation (guchar op_code, const gchar *args) {
             fflush (stdout);
             break;
 
+        case MDM_BATCH:
+            mdm_common_greeter_batch (args, process_operation);
+            break;
+
         default:
             mdm_common_fail_greeter ("Unexpected greeter command received: '%c'", op_code);
             break;
@@ -1165,12 +1158,49 @@ static void mdm_login_gui_init (void) {
 void lang_set_custom_callback (gchar *language) {
 }
 
+/* Everything mdmwebkit and mdmuser read from the daemon, fetched at once
+ * in main() so that startup does not pay one round trip per key */
+static const MdmConfigKey config_keys[] = {
+    { MDM_KEY_DEBUG, MDM_CONFIG_KEY_BOOL },
+    { MDM_KEY_SOUND_ON_LOGIN, MDM_CONFIG_KEY_BOOL },
+    { MDM_KEY_SYSTEM_MENU, MDM_CONFIG_KEY_BOOL },
+    { MDM_KEY_TIMED_LOGIN_ENABLE, MDM_CONFIG_KEY_BOOL },
+    { MDM_KEY_INCLUDE_ALL, MDM_CONFIG_KEY_BOOL },
+    { MDM_KEY_ALLOW_ROOT, MDM_CONFIG_KEY_BOOL },
+    { MDM_KEY_BACKGROUND_TYPE, MDM_CONFIG_KEY_INT },
+    { MDM_KEY_FLEXI_REAP_DELAY_MINUTES, MDM_CONFIG_KEY_INT },
+    { MDM_KEY_MAX_ICON_HEIGHT, MDM_CONFIG_KEY_INT },
+    { MDM_KEY_MAX_ICON_WIDTH, MDM_CONFIG_KEY_INT },
+    { MDM_KEY_TIMED_LOGIN_DELAY, MDM_CONFIG_KEY_INT },
+    { MDM_KEY_MINIMAL_UID, MDM_CONFIG_KEY_INT },
+    { MDM_KEY_BACKGROUND_COLOR, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_BACKGROUND_IMAGE, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_DEFAULT_FACE, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_GTKRC, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_GTK_THEME, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_HALT, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_HTML_THEME, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_LOCALE_FILE, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_PRIMARY_MONITOR, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_REBOOT, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_SOUND_ON_LOGIN_FILE, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_SOUND_PROGRAM, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_SUSPEND, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_TIMED_LOGIN, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_INCLUDE, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_EXCLUDE, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_DEFAULT_SESSION, MDM_CONFIG_KEY_STRING },
+    { MDM_KEY_SESSION_DESKTOP_DIR, MDM_CONFIG_KEY_STRING },
+};
+
 int main (int argc, char *argv[]) {
     struct sigaction hup;
     struct sigaction term;
     sigset_t mask;
     guint sid;
 
+    mdm_common_trace_init ("mdmwebkit");
+
     if (g_getenv ("DOING_MDM_DEVELOPMENT") != NULL) {
         DOING_MDM_DEVELOPMENT = TRUE;
     }
@@ -1181,6 +1211,10 @@ int main (int argc, char *argv[]) {
 
     gtk_init (&argc, &argv);
 
+    mdmcomm_open_connection_to_daemon ();
+    mdm_config_prefetch (config_keys, G_N_ELEMENTS (config_keys));
+    mdmcomm_close_connection_to_daemon ();
+
     mdm_common_log_init ();
     mdm_common_log_set_debug (mdm_config_get_bool (MDM_KEY_DEBUG));
 
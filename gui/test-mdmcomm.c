@@ -0,0 +1,264 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Benchmark of the daemon connection: sends a number of GET_CONFIG
+ * commands to the running daemon one after the other, once with a new
+ * connection for every command as mdmcomm used to make them outside of
+ * bulk blocks, once over the connection mdmcomm now keeps, and once
+ * all queued at the same time with the asynchronous calls, which write
+ * them without waiting for the answers.  With --auth every command
+ * carries the display's cookie, so the first run also authenticates
+ * every time.  Checks all of them get the same answers.
+ *
+ * With --greeters N that many processes ask the daemon something every
+ * second through mdmcomm all the while, as greeters do.  Their
+ * connections must not take up the daemon's slots between their
+ * commands, which shows in the slowest command of the runs.
+ *
+ * usage: test-mdmcomm [--auth] [--greeters N] [commands]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <glib.h>
+
+#include "mdmcomm.h"
+
+#include "mdm-bench.h"
+
+#include "mdm-socket-protocol.h"
+
+static const char *keys[] = {
+        "greeter/Browser", "greeter/Include", "greeter/Exclude",
+        "greeter/MinimalUID", "security/AllowRoot", "daemon/DefaultSession",
+        NULL
+};
+
+static double slowest = 0.0;
+
+/* Runs the commands, keeping the answers or comparing with them */
+static double
+run (int n_commands, const char *cookie, gboolean reconnect,
+     GPtrArray *answers, int *mismatches, int *failures)
+{
+        double start;
+        int    i;
+
+        start = mdm_bench_now ();
+        for (i = 0; i < n_commands; i++) {
+                char  *command, *ret;
+                double sent;
+
+                command = g_strdup_printf ("%s %s", MDM_SUP_GET_CONFIG,
+                                           keys[i % (G_N_ELEMENTS (keys) - 1)]);
+                sent = mdm_bench_now ();
+                ret = mdmcomm_send_cmd_to_daemon_with_args (command, cookie, 5);
+                slowest = MAX (slowest, mdm_bench_now () - sent);
+                g_free (command);
+
+                if (ret == NULL)
+                        (*failures)++;
+
+                if ((guint) i >= answers->len)
+                        g_ptr_array_add (answers, ret);
+                else {
+                        if (g_strcmp0 (g_ptr_array_index (answers, i), ret) != 0)
+                                (*mismatches)++;
+                        g_free (ret);
+                }
+
+                if (reconnect)
+                        mdmcomm_disconnect_from_daemon ();
+        }
+
+        return mdm_bench_now () - start;
+}
+
+static GMainLoop *loop;
+static int        outstanding;
+
+typedef struct {
+        GPtrArray *answers;
+        int        index;
+        int       *mismatches;
+        int       *failures;
+} Answer;
+
+static void
+got_answer (const char *ret, gpointer data)
+{
+        Answer *answer = data;
+
+        if (ret == NULL)
+                (*answer->failures)++;
+        if (g_strcmp0 (g_ptr_array_index (answer->answers, answer->index), ret) != 0)
+                (*answer->mismatches)++;
+        g_free (answer);
+
+        if (--outstanding == 0)
+                g_main_loop_quit (loop);
+}
+
+/* Queues all the commands at once and waits for the answers */
+static double
+run_async (int n_commands, const char *cookie,
+           GPtrArray *answers, int *mismatches, int *failures)
+{
+        double start;
+        int    i;
+
+        loop = g_main_loop_new (NULL, FALSE);
+
+        start = mdm_bench_now ();
+        for (i = 0; i < n_commands; i++) {
+                Answer *answer = g_new0 (Answer, 1);
+                char   *command;
+
+                answer->answers = answers;
+                answer->index = i;
+                answer->mismatches = mismatches;
+                answer->failures = failures;
+
+                command = g_strdup_printf ("%s %s", MDM_SUP_GET_CONFIG,
+                                           keys[i % (G_N_ELEMENTS (keys) - 1)]);
+                mdmcomm_send_cmd_to_daemon_async (command, cookie, 5,
+                                                  got_answer, answer);
+                g_free (command);
+                outstanding++;
+        }
+        g_main_loop_run (loop);
+
+        g_main_loop_unref (loop);
+
+        return mdm_bench_now () - start;
+}
+
+static gboolean
+greeter_poll (gpointer data)
+{
+        g_free (mdmcomm_send_cmd_to_daemon (MDM_SUP_GET_CONFIG " greeter/Browser"));
+        mdmcomm_send_cmd_to_daemon_async (MDM_SUP_GET_CONFIG " greeter/Include",
+                                          NULL, 5, NULL, NULL);
+
+        return TRUE;
+}
+
+/* A process that talks to the daemon now and then until it is killed */
+static pid_t
+start_greeter (void)
+{
+        pid_t pid;
+
+        pid = fork ();
+        if (pid != 0)
+                return pid;
+
+        mdmcomm_disconnect_from_daemon ();
+        greeter_poll (NULL);
+        g_timeout_add (1000, greeter_poll, NULL);
+        g_main_loop_run (g_main_loop_new (NULL, FALSE));
+        _exit (0);
+}
+
+int
+main (int argc, char **argv)
+{
+        int         n_commands = 1000;
+        int         n_greeters = 0;
+        pid_t      *greeters;
+        char       *cookie = NULL;
+        char       *ret;
+        GPtrArray  *answers;
+        double      per_command, persistent, pipelined;
+        int         i, mismatches = 0, failures = 0;
+
+        for (i = 1; i < argc; i++) {
+                if (strcmp (argv[i], "--greeters") == 0 && i + 1 < argc) {
+                        n_greeters = MAX (0, atoi (argv[++i]));
+                } else if (strcmp (argv[i], "--auth") == 0) {
+                        cookie = mdmcomm_get_auth_cookie ();
+                        if (cookie == NULL) {
+                                g_printerr ("no cookie for this display\n");
+                                return 1;
+                        }
+                } else {
+                        n_commands = MAX (1, atoi (argv[i]));
+                }
+        }
+
+        mdmcomm_set_quiet_errors (TRUE);
+
+        ret = mdmcomm_send_cmd_to_daemon_with_args (MDM_SUP_VERSION, NULL, 1);
+        if (ret == NULL) {
+                g_printerr ("the daemon is not running on %s\n", MDM_SUP_SOCKET);
+                /* skipped */
+                return 77;
+        }
+        g_free (ret);
+        mdmcomm_disconnect_from_daemon ();
+
+        greeters = g_new0 (pid_t, n_greeters + 1);
+        for (i = 0; i < n_greeters; i++)
+                greeters[i] = start_greeter ();
+        /* let them all have their first go */
+        if (n_greeters > 0)
+                g_usleep (G_USEC_PER_SEC / 2);
+
+        answers = g_ptr_array_new_with_free_func (g_free);
+
+        per_command = run (n_commands, cookie, TRUE, answers, &mismatches, &failures);
+        persistent = run (n_commands, cookie, FALSE, answers, &mismatches, &failures);
+        mdmcomm_disconnect_from_daemon ();
+        pipelined = run_async (n_commands, cookie, answers, &mismatches, &failures);
+
+        for (i = 0; i < n_greeters; i++) {
+                if (greeters[i] > 0) {
+                        kill (greeters[i], SIGTERM);
+                        waitpid (greeters[i], NULL, 0);
+                }
+        }
+        g_free (greeters);
+
+        g_print ("%d %s commands%s, %d greeters\n", n_commands, MDM_SUP_GET_CONFIG,
+                 cookie != NULL ? ", authenticated" : "", n_greeters);
+        g_print ("connection per command: %.3f s  (%.1f us per command)\n",
+                 per_command, per_command * 1000000.0 / n_commands);
+        g_print ("kept connection:        %.3f s  (%.1f us per command)\n",
+                 persistent, persistent * 1000000.0 / n_commands);
+        g_print ("pipelined:              %.3f s  (%.1f us per command)\n",
+                 pipelined, pipelined * 1000000.0 / n_commands);
+        g_print ("speedup:                %.1fx kept, %.1fx pipelined\n",
+                 persistent > 0 ? per_command / persistent : 0.0,
+                 pipelined > 0 ? per_command / pipelined : 0.0);
+        g_print ("slowest blocking call:  %.1f ms\n", slowest * 1000.0);
+        g_print ("failures:               %d\n", failures);
+        g_print ("mismatches:             %d\n", mismatches);
+
+        g_ptr_array_free (answers, TRUE);
+        g_free (cookie);
+
+        return (failures == 0 && mismatches == 0) ? 0 : 1;
+}